@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP build configuration, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_CONFIG_h
+#define __COAP_CONFIG_h
+
+/*	What gets built, and the limits everything is sized by. Change the
+	defaults here, or set any of them on the compiler command line
+	(-DCOAP_WITH_OBSERVE=0). Queue depth, timeouts and the port can also be
+	set per CoapProtocol with the coap_config given to begin(); the values
+	here are then only its defaults	*/
+
+//Features. Set to 0 to leave one out of the build: no code, no RAM
+#ifndef COAP_WITH_DEDUP
+#define		COAP_WITH_DEDUP			1		//Duplicate detection, CoapDedupCache
+#endif
+#ifndef COAP_WITH_OBSERVE
+#define		COAP_WITH_OBSERVE		1		//CoapObserve
+#endif
+#ifndef COAP_WITH_BLOCKWISE
+#define		COAP_WITH_BLOCKWISE		1		//CoapBlockwise
+#endif
+#ifndef COAP_WITH_METRICS
+#define		COAP_WITH_METRICS		1		//Counters and histograms, CoapMetrics
+#endif
+
+//Largest packet sent or received, in bytes
+#ifndef MAX_SIZE
+#define 	MAX_SIZE				1250
+#endif
+
+//Slots in each of the rx and tx queues
+#ifndef MAX_QUEUE_SIZE
+#define		MAX_QUEUE_SIZE			4
+#endif
+
+//Retransmission, RFC 7252 section 4.8. MAX_RETRANSMIT is also the most
+//any CoapProtocol can be given in its coap_config
+#ifndef ACK_TIMEOUT
+#define		ACK_TIMEOUT				2		//Seconds
+#endif
+#ifndef MAX_RETRANSMIT
+#define		MAX_RETRANSMIT			4
+#endif
+#ifndef MAX_LATENCY
+#define		MAX_LATENCY				100		//Seconds
+#endif
+
+//How long a CON waits for its ACK. COAP_RTO_COCOA estimates it per peer
+//from measured round trip times (draft-ietf-core-cocoa), COAP_RTO_RFC7252
+//always starts from ACK_TIMEOUT and doubles it. Either way the first wait
+//is made up to ACK_RANDOM_FACTOR longer at random
+#define		COAP_RTO_RFC7252		0
+#define		COAP_RTO_COCOA			1
+#ifndef COAP_RTO_MODE
+#define		COAP_RTO_MODE			COAP_RTO_COCOA
+#endif
+//Limits on a CoCoA estimate and on each wait backed off from it, ms
+#ifndef COAP_MIN_RTO
+#define		COAP_MIN_RTO			50
+#endif
+#ifndef COAP_MAX_RTO
+#define		COAP_MAX_RTO			60000
+#endif
+
+#endif
@@ -1,13 +1,15 @@
 #include "coap-packet.h"
+#include "coap-pool.h"
 
 /*		Helper functions	*/
-inline uns8 invalid_option_num(uns8 optNum) {
+inline uns8 valid_option_num(uns16 optNum) {
 	switch(optNum) {
 		case OPTION_REPEAT:
 		case OPT_IF_MATCH:
 		case OPT_URI_HOST:
 		case OPT_ETAG:
 		case OPT_IF_NMATCH:
+		case OPT_OBSERVE:
 		case OPT_URI_PORT:
 		case OPT_LOC_PATH:
 		case OPT_URI_PATH:
@@ -16,6 +18,9 @@ inline uns8 invalid_option_num(uns8 optNum) {
 		case OPT_URI_QUERY:
 		case OPT_ACCEPT:
 		case OPT_LOC_QUERY:
+		case OPT_BLOCK2:
+		case OPT_BLOCK1:
+		case OPT_SIZE2:
 		case OPT_PROXY_URI:
 		case OPT_PROXY_SCH:
 		case OPT_SIZE1:
@@ -25,9 +30,130 @@ inline uns8 invalid_option_num(uns8 optNum) {
 	}
 }
 
-void CoapPacket::CoapPacket() {}
+/*	Returns the 4 bit nibble used for an option delta or length of VALUE	*/
+inline uns8 option_nibble(uns16 value) {
+	if (value < 13)
+		return value;
+	else if (value < 269)
+		return 13;
+	else
+		return 14;
+}
+
+/*	Writes the extended delta/length bytes for VALUE at BUF, returns how many	*/
+inline uns8 option_extension(uns8 *buf, uns16 value) {
+	if (value < 13)
+		return 0;
+	else if (value < 269) {
+		buf[0] = value - 13;
+		return 1;
+	}
+	value -= 269;
+	buf[0] = value >> 8;
+	buf[1] = value & 0xFF;
+	return 2;
+}
 
-void CoapPacket::~CoapPacket() {delete[] packet_buffer;}
+CoapPacket::CoapPacket() {
+	pkt_buffer = NULL;
+	pkt_capacity = 0;
+	pkt_tag = COAP_POOL_NO_TAG;
+	begin();
+}
+
+CoapPacket::~CoapPacket() {
+	release();
+}
+
+/*		Buffer Functions	*/
+
+/*	Moves the packet, and the pointers into it, to BUFFER and gives the old
+	buffer back to the pool	*/
+void CoapPacket::moveTo(uns8 *buffer, uns16 capacity) {
+	if (pkt_buffer != NULL) {
+		//Options being encoded are ahead of PKT_LENGTH, up to PKT_CURSOR
+		sgn16 used = (pkt_cursor > pkt_length) ? pkt_cursor : pkt_length;
+		if (used > 0)
+			memcpy(buffer, pkt_buffer, used);
+		if (tkn_ptr != NULL)
+			tkn_ptr = buffer + (tkn_ptr - pkt_buffer);
+		if (option_ptr != NULL)
+			option_ptr = buffer + (option_ptr - pkt_buffer);
+		if (payload_ptr != NULL)
+			payload_ptr = buffer + (payload_ptr - pkt_buffer);
+		coapBufferPool.release(pkt_buffer, pkt_capacity);
+	}
+	pkt_buffer = buffer;
+	pkt_capacity = capacity;
+	CoapBufferPool::setTag(pkt_buffer, pkt_tag);
+}
+
+/*	Makes sure the buffer holds at least LEN bytes, moving the packet to a
+	bigger block if it doesn't. Returns 0 if LEN is more than MAX_SIZE or
+	the pool has nothing that big left	*/
+uns8 CoapPacket::reserve(uns16 len) {
+	if (len <= pkt_capacity)
+		return 1;
+	if (len > MAX_SIZE)
+		return 0;
+	uns16 capacity;
+	uns8 *buffer = coapBufferPool.allocate(len, &capacity);
+	if (buffer == NULL)
+		return 0;
+	moveTo(buffer, capacity);
+	return 1;
+}
+
+/*	Makes room for a packet of PKTLEN bytes to be written straight into the
+	returned pointer (then setIndex() and parsePacket()). Returns NULL if
+	there isn't room	*/
+uns8* CoapPacket::reservePacket(uns16 pktLen) {
+	return reserve(pktLen) ? pkt_buffer : NULL;
+}
+
+/*	Moves the packet into the smallest block it fits in, or gives the buffer
+	back if the packet is empty. For packets that were given more room than
+	they turned out to need and are kept a while	*/
+void CoapPacket::shrink() {
+	if (pkt_length <= 0) {
+		release();
+		return;
+	}
+	uns16 capacity;
+	uns8 *buffer = coapBufferPool.allocate(pkt_length, &capacity);
+	if (buffer == NULL)
+		return;
+	if (capacity < pkt_capacity)
+		moveTo(buffer, capacity);
+	else
+		coapBufferPool.release(buffer, capacity);
+}
+
+/*	Gives the buffer back to the pool and empties the packet	*/
+void CoapPacket::release() {
+	if (pkt_buffer != NULL)
+		coapBufferPool.release(pkt_buffer, pkt_capacity);
+	pkt_buffer = NULL;
+	pkt_capacity = 0;
+	begin();
+}
+
+/*	Bytes the packet's buffer can hold before it has to move	*/
+uns16 CoapPacket::capacity() {
+	return pkt_capacity;
+}
+
+void CoapPacket::setTag(uns32 tag) {
+	pkt_tag = tag;
+	if (pkt_buffer != NULL)
+		CoapBufferPool::setTag(pkt_buffer, tag);
+}
+
+/*	The tag of the packet whose buffer starts at PKT. PKT must have come
+	from packetPtr()	*/
+uns32 CoapPacket::tagOf(const uns8 *pkt) {
+	return CoapBufferPool::getTag(pkt);
+}
 
 /*		Packet Creation Functions	*/
 void CoapPacket::begin() {
@@ -42,6 +168,8 @@ void CoapPacket::begin() {
 	tkn_ptr = NULL;
 	option_ptr = NULL;
 	payload_ptr = NULL;
+	payload_length = 0;
+	scan_number = 0;
 }
 
 uns8 CoapPacket::addHeader(uns8 type, uns8 code, uns16 msg_id) {
@@ -50,6 +178,14 @@ uns8 CoapPacket::addHeader(uns8 type, uns8 code, uns16 msg_id) {
 	coap_code = code;
 	coap_msg_id = msg_id;
 	token_length = 0;
+	num_options = 0;
+	tkn_ptr = NULL;
+	option_ptr = NULL;
+	payload_ptr = NULL;
+	payload_length = 0;
+	scan_number = 0;
+	if (!reserve(4))
+		return 0;
 	pkt_buffer[pkt_cursor++] = ((COAP_VERSION << 6)  | (coap_type << 4)) & 0xF0;
 	pkt_buffer[pkt_cursor++] = coap_code;
 	pkt_buffer[pkt_cursor++] = coap_msg_id >> 8;
@@ -60,65 +196,495 @@ uns8 CoapPacket::addHeader(uns8 type, uns8 code, uns16 msg_id) {
 	return 1;
 }
 
+/*	Adds the token. Anything already after the header (options, payload) is
+	moved up to make room for it	*/
 uns8 CoapPacket::addTokens(uns8 tknLen, uns8* tknValue) {
-	if (tknLen > 8)
+	if ((tknLen > 8) || (pkt_length < 4))
 		return 0;
 	if (tknLen == 0)
 		return 1;
+	uns16 tail = 4 + token_length;
+	uns16 length = 4 + tknLen + (pkt_length - tail);
+	if (!reserve(length))
+		return 0;
+	memmove(&pkt_buffer[4 + tknLen], &pkt_buffer[tail], pkt_length - tail);
 	
 	//Get token length, add to header
+	sgn16 shift = tknLen - token_length;
 	token_length = tknLen;
-	pkt_buffer[0] |= (token_length & 0x0F);
+	pkt_buffer[0] = (pkt_buffer[0] & 0xF0) | (token_length & 0x0F);
 	
 	//Add tokens
 	tkn_ptr = &pkt_buffer[4];
-	for (uns8 i = 0; i < token_length; i++) {
-		pkt_buffer[pkt_cursor++] = *tknValue++;
-	}
-	pkt_length = pkt_cursor;
+	memcpy(tkn_ptr, tknValue, token_length);
+	setIndex(length);
+	
+	//Whatever followed the old token is SHIFT bytes further on
+	if (option_ptr != NULL)
+		option_ptr += shift;
+	if (payload_ptr != NULL)
+		payload_ptr += shift;
+	int indexed = (num_options < MAX_PARSED_OPTIONS) ? num_options : MAX_PARSED_OPTIONS;
+	for (int i = 0; i < indexed; i++)
+		option_index[i].offset += shift;
+	scan_number = 0;
 	return 1;
 }
 
-uns8 CoapPacket::addOption(uns8 optNum, uns16 optLen, const char *optParam) {
+/*	Adds an option. Options can be added in any order; each one is written
+	straight into the packet, delta encoded, after any options with the same
+	number (so repeated options keep the order they were added in).
+	Returns 0 if the option number is unknown or it doesn't fit	*/
+uns8 CoapPacket::addOption(uns16 optNum, uns16 optLen, const char *optParam) {
 	//First check to make sure it's an actual option number
-	if (invalid_option_num(optNum))
+	if (!valid_option_num(optNum))
 		return 0;
+	return insertOption(optNum, optLen, (const uns8*)optParam);
+}
+
+/*	Adds an option whose value is an unsigned integer, using the fewest bytes	*/
+uns8 CoapPacket::addUintOption(uns16 optNum, uns32 value) {
+	uns8 bytes[4];
+	uns8 len = 0;
 	
+	if (!valid_option_num(optNum))
+		return 0;
+	while ((len < 4) && (value >> (8 * len)))
+		len++;
+	for (uns8 i = 0; i < len; i++) {
+		bytes[i] = value >> (8 * (len - 1 - i));
+	}
+	return insertOption(optNum, len, bytes);
+}
+
+/*	Adds one Uri-Path option per segment of PATH ("a/b/c")	*/
+uns8 CoapPacket::addUriPath(const char *path) {
+	while (*path) {
+		uns16 len = 0;
+		while ((path[len] != 0) && (path[len] != '/'))
+			len++;
+		if ((len > 0) && !addOption(OPT_URI_PATH, len, path))
+			return 0;
+		path += len;
+		if (*path == '/')
+			path++;
+	}
+	return 1;
+}
+
+/*	Writes an option into the packet after any options with the same number.
+	Only the option that follows it has its delta rewritten; the rest of the
+	packet is moved up in one go, and the option index is shifted rather
+	than rebuilt. Returns 0 if it doesn't fit	*/
+uns8 CoapPacket::insertOption(uns16 optNum, uns16 optLen, const uns8 *optValue) {
+	if (pkt_length < 4)
+		return 0;
+	
+	//The option it goes in front of, if any. Options are mostly added in
+	//order, so the last one is looked at first
+	coap_option_index next;
+	uns16 previous = 0;
+	int i = num_options;
+	if (num_options > 0) {
+		optionAt(num_options - 1, &next);
+		previous = next.number;
+		if (next.number > optNum) {
+			previous = 0;
+			for (i = 0; i < num_options; i++) {
+				optionAt(i, &next);
+				if (next.number > optNum)
+					break;
+				previous = next.number;
+			}
+		}
+	}
 	
+	uns16 start, tail;		//Where the new option goes, and what is kept after it
+	uns8 nextHead[5];
+	uns8 nextHeadLength = 0;
+	if (i < num_options) {
+		uns16 oldDelta = next.number - previous;
+		uns16 newDelta = next.number - optNum;
+		start = next.offset - 1 - option_extension(nextHead, oldDelta) - option_extension(nextHead, next.length);
+		tail = next.offset;
+		nextHead[0] = (option_nibble(newDelta) << 4) | option_nibble(next.length);
+		nextHeadLength = 1;
+		nextHeadLength += option_extension(&nextHead[nextHeadLength], newDelta);
+		nextHeadLength += option_extension(&nextHead[nextHeadLength], next.length);
+	}
+	else {
+		start = (payload_ptr != NULL) ? (payload_ptr - pkt_buffer) - 1 : pkt_length;
+		tail = start;
+	}
+	
+	uns8 head[5];
+	uns8 headLength = 1;
+	head[0] = (option_nibble(optNum - previous) << 4) | option_nibble(optLen);
+	headLength += option_extension(&head[headLength], optNum - previous);
+	headLength += option_extension(&head[headLength], optLen);
+	
+	uns16 insert = headLength + optLen + nextHeadLength;
+	uns16 length = start + insert + (pkt_length - tail);
+	if ((length > MAX_SIZE) || !reserve(length))
+		return 0;
+	memmove(&pkt_buffer[start + insert], &pkt_buffer[tail], pkt_length - tail);
+	memcpy(&pkt_buffer[start], head, headLength);
+	if (optLen > 0)
+		memcpy(&pkt_buffer[start + headLength], optValue, optLen);
+	memcpy(&pkt_buffer[start + headLength + optLen], nextHead, nextHeadLength);
+	
+	//Everything after the new option is SHIFT bytes further on
+	sgn16 shift = insert - (tail - start);
+	int last = (num_options < MAX_PARSED_OPTIONS) ? num_options : MAX_PARSED_OPTIONS - 1;
+	for (int k = last; k > i; k--) {
+		option_index[k] = option_index[k - 1];
+		option_index[k].offset += shift;
+	}
+	coap_option_index &opt = (i < MAX_PARSED_OPTIONS) ? option_index[i] : scan_option;
+	opt.number = optNum;
+	opt.offset = start + headLength;
+	opt.length = optLen;
+	scan_number = (i < MAX_PARSED_OPTIONS) ? 0 : i;
+	num_options++;
+	
+	option_ptr = &pkt_buffer[4 + token_length];
+	if (payload_ptr != NULL)
+		payload_ptr += shift;
+	setIndex(length);
+	return 1;
+}
+
+/*	Adds PAYLOADLEN bytes of binary payload. Returns 0 if they don't fit	*/
+uns8 CoapPacket::addPayload(uns16 payloadLen, const uns8 *payloadValue) {
+	uns8 *space = reservePayload(payloadLen);
+	if ((space == NULL) && (payloadLen > 0))
+		return 0;
+	if (payloadLen > 0)
+		memcpy(space, payloadValue, payloadLen);
+	return 1;
+}
+
+/*	Adds a text payload: up to PAYLOADLEN characters, stopping at the NUL	*/
+uns8 CoapPacket::addPayload(uns16 payloadLen, const char *payloadValue) {
+	uns16 len = 0;
+	while ((len < payloadLen) && payloadValue[len])
+		len++;
+	return addPayload(len, (const uns8*)payloadValue);
 }
 
-uns8 CoapPacket::addPayload(uns16 payloadLen, uns8 *payloadValue) {
+/*	Makes room for PAYLOADLEN bytes of payload after the options, to be
+	written straight into the returned pointer. setPayloadLength() can shrink
+	it afterwards. Returns NULL if it doesn't fit (or PAYLOADLEN is 0)	*/
+uns8* CoapPacket::reservePayload(uns16 payloadLen) {
 	if (payloadLen == 0)
-		return 1;
+		return NULL;
+	if (payload_ptr != NULL)
+		pkt_cursor = (payload_ptr - pkt_buffer) - 1;	//Replace the previous one
+	if (!reserve(pkt_cursor + 1 + payloadLen))
+		return NULL;
 	
 	pkt_buffer[pkt_cursor++] = PAYLOAD_MARK;
 	payload_ptr = &pkt_buffer[pkt_cursor];	//Pointer will point to first byte of payload, NOT marker
-	
-	while ((*payloadValue) && (pkt_cursor < MAX_SIZE)) {
-		pkt_buffer[pkt_cursor++] = *payloadValue++;
-	}
-	if (pkt_cursor >= MAX_SIZE)
+	payload_length = payloadLen;
+	pkt_cursor += payloadLen;
+	pkt_length = pkt_cursor;
+	return payload_ptr;
+}
+
+/*	Shrinks the payload made by reservePayload() to PAYLOADLEN bytes.
+	A length of 0 removes the payload marker too	*/
+uns8 CoapPacket::setPayloadLength(uns16 payloadLen) {
+	if ((payload_ptr == NULL) || (payloadLen > payload_length))
 		return 0;
-	
+	if (payloadLen == 0) {
+		pkt_cursor = (payload_ptr - pkt_buffer) - 1;
+		payload_ptr = NULL;
+	}
+	else {
+		pkt_cursor = (payload_ptr - pkt_buffer) + payloadLen;
+	}
+	payload_length = payloadLen;
 	pkt_length = pkt_cursor;
 	return 1;
 }
 
+/*	Inserts an option into a packet that is already encoded (copied in and
+	parsed, or finished). Unlike addOption() the number isn't checked, so
+	unknown options can be passed on. Returns 0 if it doesn't fit	*/
+uns8 CoapPacket::spliceOption(uns16 optNum, uns16 optLen, const uns8 *optValue) {
+	return insertOption(optNum, optLen, optValue);
+}
+
 uns16 CoapPacket::copy(uns8 *pktPtr, uns16 pktLen) {
+	return copyPacket(pktPtr, pktLen);
+}
+
+/*	Copies a raw packet in and decodes it. Returns the number of bytes copied	*/
+uns16 CoapPacket::copyPacket(uns8 *pktPtr, uns16 pktLen) {
+	if (pktLen > MAX_SIZE)
+		pktLen = MAX_SIZE;
+	begin();
+	if (!reserve(pktLen))
+		return 0;
+	memcpy(pkt_buffer, pktPtr, pktLen);
+	setIndex(pktLen);
+	parsePacket();
+	return pktLen;
+}
+
+/*	Sets the packet length after a packet was written straight into packetPtr()	*/
+void CoapPacket::setIndex(uns16 pktLen) {
 	pkt_length = pktLen;
-	pkt_cursor = 0;
+	pkt_cursor = pktLen;
+}
+
+
+/*		Decoding Functions	*/
+
+/*	Reads the extended delta/length that follows an option header byte.
+	VALUE is 32 bits wide, as a 2 byte extension goes up to 65804.
+	Returns 0 if the packet ends first	*/
+inline uns8 read_extension(const uns8 *buf, uns16 len, uns16 &pos, uns32 &value) {
+	if (value == 13) {
+		if (pos + 1 > len)
+			return 0;
+		value = buf[pos++] + 13;
+	}
+	else if (value == 14) {
+		if (pos + 2 > len)
+			return 0;
+		value = (((uns32)buf[pos] << 8) | buf[pos + 1]) + 269;
+		pos += 2;
+	}
+	return 1;
+}
+
+/*	Decodes the PKT_LENGTH bytes in pkt_buffer in a single pass. Header fields,
+	token, payload and an index of every option are filled in; nothing is
+	copied. Returns PARSE_OK, or the PARSE_ code of the first problem found	*/
+uns8 CoapPacket::parsePacket() {
+	const uns8 *buf = pkt_buffer;
+	uns16 len = pkt_length;
+	uns16 pos = 4;
+	uns32 number = 0;
+	
 	token_length = 0;
-	coap_code = 0;
-	coap_type = 0;
-	coap_msg_id = 0;
+	num_options = 0;
+	tkn_ptr = NULL;
+	option_ptr = NULL;
+	payload_ptr = NULL;
+	payload_length = 0;
+	scan_number = 0;
+	
+	//Header
+	if (len < 4)
+		return PARSE_TOO_SHORT;
+	if ((buf[0] >> 6) != COAP_VERSION)
+		return PARSE_BAD_VERSION;
+	coap_type = (buf[0] >> 4) & 0x03;
+	coap_code = buf[1];
+	coap_msg_id = (buf[2] << 8) | buf[3];
+	if ((buf[0] & 0x0F) > MAX_TOKENSIZE)
+		return PARSE_BAD_TOKEN_LENGTH;
+	if ((coap_code == COAP_PING) && (len > 4))
+		return PARSE_BAD_EMPTY;
+	
+	//Token
+	token_length = buf[0] & 0x0F;
+	if (pos + token_length > len)
+		return PARSE_TOKEN_TRUNCATED;
+	if (token_length > 0)
+		tkn_ptr = &pkt_buffer[pos];
+	pos += token_length;
+	
+	//Options, then payload
+	if ((pos < len) && (buf[pos] != PAYLOAD_MARK))
+		option_ptr = &pkt_buffer[pos];
 	
+	while (pos < len) {
+		uns8 head = buf[pos++];
+		if (head == PAYLOAD_MARK) {
+			if (pos == len)
+				return PARSE_EMPTY_PAYLOAD;
+			payload_ptr = &pkt_buffer[pos];
+			payload_length = len - pos;
+			break;
+		}
+		
+		uns32 delta = head >> 4;
+		uns32 optLen = head & 0x0F;
+		if (delta == 15)
+			return PARSE_BAD_OPTION_DELTA;
+		if (optLen == 15)
+			return PARSE_BAD_OPTION_LENGTH;
+		if (!read_extension(buf, len, pos, delta) || !read_extension(buf, len, pos, optLen))
+			return PARSE_OPTION_TRUNCATED;
+		
+		number += delta;
+		if ((number > 0xFFFF) || (optLen > 0xFFFF))
+			return PARSE_OPTION_OVERFLOW;
+		if (pos + optLen > len)
+			return PARSE_OPTION_TRUNCATED;
+		
+		//Past the index the option is still checked, but only counted
+		if (num_options < MAX_PARSED_OPTIONS) {
+			option_index[num_options].number = number;
+			option_index[num_options].offset = pos;
+			option_index[num_options].length = optLen;
+		}
+		num_options++;
+		pos += optLen;
+	}
+	return PARSE_OK;
+}
+
+/*	Decodes only the header and token of a packet written straight into
+	packetPtr() - enough to queue it for sending without indexing its options.
+	Returns PARSE_OK, or the PARSE_ code of the first problem found	*/
+uns8 CoapPacket::parseHeader() {
+	token_length = 0;
+	num_options = 0;
 	tkn_ptr = NULL;
 	option_ptr = NULL;
 	payload_ptr = NULL;
+	payload_length = 0;
+	scan_number = 0;
+	
+	if (pkt_length < 4)
+		return PARSE_TOO_SHORT;
+	coap_type = (pkt_buffer[0] >> 4) & 0x03;
+	coap_code = pkt_buffer[1];
+	coap_msg_id = (pkt_buffer[2] << 8) | pkt_buffer[3];
+	if ((pkt_buffer[0] & 0x0F) > MAX_TOKENSIZE)
+		return PARSE_BAD_TOKEN_LENGTH;
+	token_length = pkt_buffer[0] & 0x0F;
+	if (4 + token_length > pkt_length)
+		return PARSE_TOKEN_TRUNCATED;
+	if (token_length > 0)
+		tkn_ptr = &pkt_buffer[4];
+	return PARSE_OK;
+}
+
+/*	Fills OPT with entry OPTINDEX (below num_options) of the option index.
+	Options after the first MAX_PARSED_OPTIONS are decoded on from the last
+	indexed one, or from the last one decoded if that is nearer. They were
+	checked by parsePacket(), so they are only read here	*/
+void CoapPacket::optionAt(int optIndex, coap_option_index *opt) {
+	if (optIndex < MAX_PARSED_OPTIONS) {
+		*opt = option_index[optIndex];
+		return;
+	}
+	
+	int i = MAX_PARSED_OPTIONS - 1;
+	coap_option_index at = option_index[i];
+	if ((scan_number > 0) && (scan_number <= optIndex)) {
+		i = scan_number;
+		at = scan_option;
+	}
+	while (i < optIndex) {
+		uns16 pos = at.offset + at.length;
+		uns8 head = pkt_buffer[pos++];
+		uns32 delta = head >> 4;
+		uns32 optLen = head & 0x0F;
+		read_extension(pkt_buffer, pkt_length, pos, delta);
+		read_extension(pkt_buffer, pkt_length, pos, optLen);
+		at.number += delta;
+		at.offset = pos;
+		at.length = optLen;
+		i++;
+	}
+	scan_option = at;
+	scan_number = optIndex;
+	*opt = at;
+}
+
+/*	Returns the option index entry of the first OPTNUM option, or -1	*/
+int CoapPacket::findOption(uns16 optNum) {
+	coap_option_index opt;
+	for (int i = 0; i < num_options; i++) {
+		optionAt(i, &opt);
+		if (opt.number == optNum)
+			return i;
+		if (opt.number > optNum)
+			break;
+	}
+	return -1;
+}
+
+/*	Returns the next entry with the same option number as OPTINDEX, or -1.
+	Repeated options are next to each other, so this is a single compare	*/
+int CoapPacket::nextOption(int optIndex) {
+	coap_option_index opt, next;
+	if (optIndex + 1 >= num_options)
+		return -1;
+	optionAt(optIndex, &opt);
+	optionAt(optIndex + 1, &next);
+	return (next.number == opt.number) ? optIndex + 1 : -1;
+}
+
+uns16 CoapPacket::getOptionNumber(int optIndex) {
+	coap_option_index opt;
+	if (optIndex < MAX_PARSED_OPTIONS)
+		return option_index[optIndex].number;
+	optionAt(optIndex, &opt);
+	return opt.number;
+}
+
+uns16 CoapPacket::getOptionLength(int optIndex) {
+	coap_option_index opt;
+	if (optIndex < MAX_PARSED_OPTIONS)
+		return option_index[optIndex].length;
+	optionAt(optIndex, &opt);
+	return opt.length;
+}
+
+uns8* CoapPacket::getOptionValue(int optIndex) {
+	coap_option_index opt;
+	if (optIndex < MAX_PARSED_OPTIONS)
+		return &pkt_buffer[option_index[optIndex].offset];
+	optionAt(optIndex, &opt);
+	return &pkt_buffer[opt.offset];
+}
+
+/*	Returns 1 if the Uri-Path options spell out PATH ("a/b/c"), 0 if not	*/
+uns8 CoapPacket::matchUriPath(const char *path) {
+	int opt = findOption(OPT_URI_PATH);
+	coap_option_index segment;
+	
+	while (1) {
+		while (*path == '/')
+			path++;
+		if (*path == 0)
+			return opt < 0;
+		if (opt < 0)
+			return 0;
+		
+		uns16 len = 0;
+		while ((path[len] != 0) && (path[len] != '/'))
+			len++;
+		optionAt(opt, &segment);
+		if ((len != segment.length) || (memcmp(path, &pkt_buffer[segment.offset], len) != 0))
+			return 0;
+		path += len;
+		opt = nextOption(opt);
+	}
+}
+
+/*	Reads option OPTNUM as an unsigned integer. Returns 0 if it isn't there	*/
+uns8 CoapPacket::getUintOption(uns16 optNum, uns32 *value) {
+	int i = findOption(optNum);
+	coap_option_index opt;
+	if (i < 0)
+		return 0;
+	optionAt(i, &opt);
+	if (opt.length > 4)
+		return 0;
 	
-	while (*pktPtr) {
-		pkt_buffer[pkt_cursor++] = *pktPtr++;
-	}	
+	*value = 0;
+	for (uns16 n = 0; n < opt.length; n++) {
+		*value = (*value << 8) | pkt_buffer[opt.offset + n];
+	}
+	return 1;
 }
 
 /*		Packet Information Functions	*/
@@ -138,21 +704,87 @@ uns16 CoapPacket::messageId() {
 	return coap_msg_id;
 }
 
+uns16 CoapPacket::numOptions() {
+	return num_options;
+}
+
+uns8 CoapPacket::getTokenLength() {
+	return token_length;
+}
+
+uns16 CoapPacket::getPayloadLength() {
+	return payload_length;
+}
+
+int CoapPacket::getPacketLength() {
+	return size();
+}
+
+uns8 CoapPacket::getMessageType() {
+	return coap_type;
+}
+
+uns8 CoapPacket::getResponseCode() {
+	return coap_code;
+}
+
+uns16 CoapPacket::getID() {
+	return coap_msg_id;
+}
+
+uns8* CoapPacket::getPacket() {
+	return packetPtr();
+}
+
 /*		Packet Pointer Functions	*/
 uns8* CoapPacket::packetPtr() {
-	return &(this->pkt_buffer[0]);
+	return pkt_buffer;
 }
 
 uns8* CoapPacket::getTokenPtr() {
 	return tkn_ptr;
 }
 
+uns8* CoapPacket::getOptionPtr() {
+	return option_ptr;
+}
+
 uns8* CoapPacket::getPayloadPtr() {
 	return payload_ptr;
 }
 
 
+/*		Debugging Functions	*/
 
+/*	Prints the raw packet in HEX	*/
+void CoapPacket::printPacket() {
+	uns8 *buf = packetPtr();
+	for (sgn16 i = 0; i < pkt_length; i++) {
+		coap_printf("%02X ", buf[i]);
+	}
+	coap_printf("\n");
+}
 
-
-
+/*	Prints the packet contents in a readable form	*/
+void CoapPacket::readPacket() {
+	static const char *types[] = {"CON", "NON", "ACK", "RST"};
+	
+	coap_printf("%s %d.%02d id=%u", types[coap_type & 0x03], coap_code >> 5, coap_code & 0x1F, coap_msg_id);
+	coap_printf(" token=");
+	for (uns8 i = 0; i < token_length; i++) {
+		coap_printf("%02X", tkn_ptr[i]);
+	}
+	coap_printf("\n");
+	
+	for (int i = 0; i < num_options; i++) {
+		coap_option_index opt;
+		optionAt(i, &opt);
+		coap_printf("  option %u (%u bytes): ", opt.number, opt.length);
+		for (uns16 n = 0; n < opt.length; n++) {
+			coap_printf("%02X ", pkt_buffer[opt.offset + n]);
+		}
+		coap_printf("\n");
+	}
+	if (payload_ptr != NULL)
+		coap_printf("  payload (%u bytes): %.*s\n", payload_length, payload_length, (const char*)payload_ptr);
+}
@@ -31,20 +31,36 @@ THE POSSIBILITY OF SUCH DAMAGE.
 // Written originally by Embedded Adventures
 
 
-#ifndef __COAP-PACKET_h
-#define __COAP-PACKET_h
+#ifndef __COAP_PACKET_h
+#define __COAP_PACKET_h
+
+#include "coap-platform.h"
+#include "coap-config.h"
 
 #define		uns8			uint8_t
 #define		uns16			uint16_t
 #define		sgn16			int16_t
-#define		uns32			int32_t
+#define		uns32			uint32_t
 
-#define 	MAX_SIZE		1250
 #define		MAX_TOKENSIZE	8
 
 #define		COAP_VERSION	0x01
 #define 	PAYLOAD_MARK	0xFF
 #define		MAX_OPTIONS		100
+#define		MAX_PARSED_OPTIONS	16		//Options parsePacket() indexes. Later ones are found by decoding on from the last
+
+//parsePacket() results
+#define PARSE_OK				0
+#define PARSE_TOO_SHORT			1		//Shorter than the 4 byte header
+#define PARSE_BAD_VERSION		2
+#define PARSE_BAD_TOKEN_LENGTH	3		//TKL 9-15
+#define PARSE_TOKEN_TRUNCATED	4
+#define PARSE_BAD_EMPTY			5		//Code 0.00 with bytes after the header
+#define PARSE_BAD_OPTION_DELTA	6		//Delta nibble 15 that isn't the payload marker
+#define PARSE_BAD_OPTION_LENGTH	7		//Length nibble 15
+#define PARSE_OPTION_TRUNCATED	8
+#define PARSE_OPTION_OVERFLOW	9		//Option number or length past 65535
+#define PARSE_EMPTY_PAYLOAD		11		//Payload marker with no payload after it
 
 //Transaction types
 #define TYPE_CON			0x00
@@ -65,6 +81,7 @@ THE POSSIBILITY OF SUCH DAMAGE.
 #define CODE_VALID			0x43
 #define CODE_CHANGED		0x44
 #define CODE_CONTENT		0x45
+#define CODE_CONTINUE		0x5F
 //Response codes - errors
 #define CODE_BAD_REQUEST	0x80
 #define CODE_UNAUTHORIZED	0x81
@@ -73,6 +90,7 @@ THE POSSIBILITY OF SUCH DAMAGE.
 #define CODE_NOT_FOUND		0x84
 #define CODE_NOT_ALLOWED	0x85
 #define CODE_NOT_ACCEPTABLE	0x86
+#define CODE_INCOMPLETE		0x88
 #define CODE_PRECOND_FAIL	0x8C
 #define CODE_REQ_TOO_LARGE	0x8D
 #define CODE_FORMAT_UNSUPP	0x8F
@@ -90,6 +108,7 @@ THE POSSIBILITY OF SUCH DAMAGE.
 #define OPT_URI_HOST		3
 #define OPT_ETAG			4
 #define OPT_IF_NMATCH		5
+#define OPT_OBSERVE			6		//RFC 7641
 #define OPT_URI_PORT		7
 #define OPT_LOC_PATH		8
 #define OPT_URI_PATH		11
@@ -98,6 +117,9 @@ THE POSSIBILITY OF SUCH DAMAGE.
 #define OPT_URI_QUERY		15
 #define OPT_ACCEPT			17
 #define OPT_LOC_QUERY		20
+#define OPT_BLOCK2			23		//RFC 7959
+#define OPT_BLOCK1			27
+#define OPT_SIZE2			28
 #define OPT_PROXY_URI		35
 #define OPT_PROXY_SCH		39
 #define OPT_SIZE1			60
@@ -118,10 +140,22 @@ typedef struct {
 	uns8	*option_value_ptr;
 }	coap_option_struct;
 
+//Where one received option sits in pkt_buffer
+typedef struct {
+	uns16	number;
+	uns16	offset;			//Offset of the option value from the start of the packet
+	uns16	length;
+}	coap_option_index;
 
+/*	A packet, and the buffer it is built or decoded in. The buffer comes from
+	coapBufferPool, starts out as small as the packet, and is moved to a
+	bigger block as the packet grows, so a packet only holds on to the
+	bytes it needs. release() hands the buffer back	*/
 class CoapPacket {
 private:
-	uns8	pkt_buffer[MAX_SIZE];
+	uns8	*pkt_buffer;
+	uns16	pkt_capacity;
+	uns32	pkt_tag;			//Kept in front of every buffer the packet has
 	sgn16	pkt_length;
 	sgn16	pkt_cursor;
 
@@ -129,11 +163,31 @@ private:
 	uns8	coap_code;
 	uns8	coap_type;
 	uns16	coap_msg_id;
-	uns8	num_options;
+	uns16	num_options;
 	
 	uns8	*tkn_ptr;
 	uns8	*option_ptr;
 	uns8	*payload_ptr;
+	uns16	payload_length;
+	
+	//Filled by parsePacket(), sorted by option number. Options after the
+	//first MAX_PARSED_OPTIONS are decoded when asked for; the last one
+	//decoded is kept, so walking them in order costs one step each
+	coap_option_index	option_index[MAX_PARSED_OPTIONS];
+	coap_option_index	scan_option;
+	uns16				scan_number;		//Entry SCAN_OPTION is, 0 if none
+	
+	uns8	insertOption(uns16 optNum, uns16 optLen, const uns8 *optValue);
+	void	optionAt(int optIndex, coap_option_index *opt);
+	void	moveTo(uns8 *buffer, uns16 capacity);
+	uns8	reserve(uns16 len);
+	
+	//Packets own their buffer, so they can't be copied
+	CoapPacket(const CoapPacket&);
+	CoapPacket& operator=(const CoapPacket&);
+	
+	//Stamps packets with their pointers and option index already worked out
+	friend class CoapPacketTemplate;
 	
 public:
 	CoapPacket();
@@ -142,20 +196,63 @@ public:
 	void	begin();
 	uns8	addHeader(uns8 type, uns8 code, uns16 msg_id);
 	uns8	addTokens(uns8 tknLen, uns8 *tknValue);
-	uns8	addOption(uns8 optNum, uns16 optLen, const char *optParam);
-	uns8	addPayload(uns16 payloadLen, uns8 *payloadValue);
+	uns8	addOption(uns16 optNum, uns16 optLen, const char *optParam);
+	uns8	addUintOption(uns16 optNum, uns32 value);
+	uns8	addUriPath(const char *path);
+	uns8	addPayload(uns16 payloadLen, const uns8 *payloadValue);
+	uns8	addPayload(uns16 payloadLen, const char *payloadValue);
+	uns8*	reservePayload(uns16 payloadLen);
+	uns8	setPayloadLength(uns16 payloadLen);
+	uns8	spliceOption(uns16 optNum, uns16 optLen, const uns8 *optValue);
+	
+	uns8*	reservePacket(uns16 pktLen);
+	void	shrink();
+	void	release();
+	uns16	capacity();
+	//TAG goes with the packet from buffer to buffer, so whoever set it can
+	//tell which packet of theirs a buffer is from tagOf(packetPtr()) alone
+	void	setTag(uns32 tag);
+	static uns32	tagOf(const uns8 *pkt);
 	
 	uns16	copy(uns8 *pktPtr, uns16 pktLen);
+	uns16	copyPacket(uns8 *pktPtr, uns16 pktLen);
+	void	setIndex(uns16 pktLen);
+	
+	//Decoding
+	uns8	parsePacket();
+	uns8	parseHeader();
+	int		findOption(uns16 optNum);
+	int		nextOption(int optIndex);
+	uns16	getOptionNumber(int optIndex);
+	uns16	getOptionLength(int optIndex);
+	uns8*	getOptionValue(int optIndex);
+	uns8	getUintOption(uns16 optNum, uns32 *value);
+	uns8	matchUriPath(const char *path);
 	
 	uns16	size();
 	uns8	code();
 	uns8	type();
 	uns16	messageId();
+	uns16	numOptions();
+	uns8	getTokenLength();
+	uns16	getPayloadLength();
+	
+	//Same as size(), type(), code(), messageId() and packetPtr()
+	int		getPacketLength();
+	uns8	getMessageType();
+	uns8	getResponseCode();
+	uns16	getID();
+	uns8*	getPacket();
 	
 	uns8*	packetPtr();
 	uns8*	getTokenPtr();
+	uns8*	getOptionPtr();
 	uns8*	getPayloadPtr();
 	
+	//Debugging
+	void	printPacket();
+	void	readPacket();
+	
 	
 	
 	
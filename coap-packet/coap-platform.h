@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP platform glue, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_PLATFORM_h
+#define __COAP_PLATFORM_h
+
+/*	On Arduino everything comes from the core. On a host build (Linux gateway)
+	we provide the handful of Arduino helpers the libraries rely on. */
+#ifdef ARDUINO
+#include "Arduino.h"
+
+#define		coap_printf(...)		Serial.printf(__VA_ARGS__)
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define		coap_printf(...)		printf(__VA_ARGS__)
+
+//32 bits, wrapping like they do on Arduino, so a difference between two
+//readings kept in a uint32_t is right across the wrap
+uint32_t	millis();
+uint32_t	micros();
+
+#define		bitRead(value, bit)		(((value) >> (bit)) & 0x01)
+#define		bitSet(value, bit)		((value) |= (1UL << (bit)))
+#define		bitClear(value, bit)	((value) &= ~(1UL << (bit)))
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP packet buffer pool, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-pool.h"
+
+COAP_POOL_STORAGE CoapBufferPool coapBufferPool;
+
+//Room at the start of a slab for the link to the next one
+#define		SLAB_HEADER		sizeof(uns8*)
+//Room in front of each block for its tag
+#define		BLOCK_HEADER	sizeof(uns32)
+
+CoapBufferPool::CoapBufferPool() {
+	static const uns16 sizes[COAP_POOL_CLASSES] = COAP_POOL_SIZES;
+	for (int c = 0; c < COAP_POOL_CLASSES; c++) {
+		classes[c].freeList = NULL;
+		classes[c].blockSize = sizes[c];
+		classes[c].inUse = 0;
+		classes[c].available = 0;
+		classes[c].peak = 0;
+	}
+	slabs = NULL;
+	budget = COAP_POOL_BUDGET;
+	heapBytes = 0;
+	failures = 0;
+}
+
+/*	Gives the slabs back, unless a packet still holds a block from one	*/
+CoapBufferPool::~CoapBufferPool() {
+	if (bytesInUse() > 0)
+		return;
+	while (slabs != NULL) {
+		uns8 *next;
+		memcpy(&next, slabs, sizeof(next));
+		delete[] slabs;
+		slabs = next;
+	}
+	for (int c = 0; c < COAP_POOL_CLASSES; c++) {
+		classes[c].freeList = NULL;
+		classes[c].available = 0;
+	}
+	heapBytes = 0;
+}
+
+/*	Limits what the pool takes from the heap from now on. 0 for no limit	*/
+void CoapBufferPool::setBudget(uns32 bytes) {
+	budget = bytes;
+}
+
+int CoapBufferPool::classOf(uns16 size) {
+	for (int c = 0; c < COAP_POOL_CLASSES; c++) {
+		if (size <= classes[c].blockSize)
+			return c;
+	}
+	return -1;
+}
+
+/*	Takes a slab from the heap and cuts it into blocks of class C.
+	Returns 0 if the budget or the heap has run out	*/
+int CoapBufferPool::grow(int c) {
+	coap_pool_class &cls = classes[c];
+	uns32 stride = BLOCK_HEADER + cls.blockSize;
+	uns32 blocks = COAP_POOL_SLAB / stride;
+	if (blocks == 0)
+		blocks = 1;
+	uns32 bytes = SLAB_HEADER + (blocks * stride);
+	if ((budget > 0) && (heapBytes + bytes > budget))
+		return 0;
+	
+	uns8 *slab = new (std::nothrow) uns8[bytes];
+	if (slab == NULL)
+		return 0;
+	memcpy(slab, &slabs, sizeof(slabs));
+	slabs = slab;
+	heapBytes += bytes;
+	
+	for (uns32 b = 0; b < blocks; b++) {
+		uns8 *block = slab + SLAB_HEADER + (b * stride) + BLOCK_HEADER;
+		memcpy(block, &cls.freeList, sizeof(cls.freeList));
+		cls.freeList = block;
+	}
+	cls.available += blocks;
+	return 1;
+}
+
+uns8* CoapBufferPool::allocate(uns16 size, uns16 *capacity) {
+	int first = classOf(size);
+	if (first < 0)
+		return NULL;
+	
+	//The right size, else a new slab of it, else a bigger block
+	int c = first;
+	if ((classes[c].freeList == NULL) && !grow(c)) {
+		for (c = first + 1; c < COAP_POOL_CLASSES; c++) {
+			if (classes[c].freeList != NULL)
+				break;
+		}
+		if (c == COAP_POOL_CLASSES) {
+			failures++;
+			return NULL;
+		}
+	}
+	
+	coap_pool_class &cls = classes[c];
+	uns8 *block = cls.freeList;
+	memcpy(&cls.freeList, block, sizeof(cls.freeList));
+	cls.available--;
+	cls.inUse++;
+	if (cls.inUse > cls.peak)
+		cls.peak = cls.inUse;
+	*capacity = cls.blockSize;
+	setTag(block, COAP_POOL_NO_TAG);
+	return block;
+}
+
+/*	Gives back a block from allocate(), with the CAPACITY it came with	*/
+void CoapBufferPool::release(uns8 *block, uns16 capacity) {
+	if (block == NULL)
+		return;
+	coap_pool_class &cls = classes[classOf(capacity)];
+	memcpy(block, &cls.freeList, sizeof(cls.freeList));
+	cls.freeList = block;
+	cls.available++;
+	cls.inUse--;
+}
+
+/*	Keeps TAG with BLOCK, a block from allocate(), until it is released. It
+	lets whoever tagged it tell which of theirs a block belongs to	*/
+void CoapBufferPool::setTag(uns8 *block, uns32 tag) {
+	memcpy(block - BLOCK_HEADER, &tag, sizeof(tag));
+}
+
+uns32 CoapBufferPool::getTag(const uns8 *block) {
+	uns32 tag;
+	memcpy(&tag, block - BLOCK_HEADER, sizeof(tag));
+	return tag;
+}
+
+uns32 CoapBufferPool::getMemoryUsage() {
+	return heapBytes;
+}
+
+uns32 CoapBufferPool::bytesInUse() {
+	uns32 bytes = 0;
+	for (int c = 0; c < COAP_POOL_CLASSES; c++) {
+		bytes += (uns32)classes[c].inUse * classes[c].blockSize;
+	}
+	return bytes;
+}
+
+uns32 CoapBufferPool::allocationFailures() {
+	return failures;
+}
+
+/*	Blocks in use, free and at peak for each size	*/
+void CoapBufferPool::printReport() {
+	coap_printf("packet pool: %lu bytes from the heap, %lu in use, %lu failed allocations\n",
+		(unsigned long)heapBytes, (unsigned long)bytesInUse(), (unsigned long)failures);
+	for (int c = 0; c < COAP_POOL_CLASSES; c++) {
+		coap_pool_class &cls = classes[c];
+		coap_printf("  %4u byte blocks: %lu in use, %lu free, %lu at peak\n",
+			cls.blockSize, (unsigned long)cls.inUse, (unsigned long)cls.available, (unsigned long)cls.peak);
+	}
+}
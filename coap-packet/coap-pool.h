@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP packet buffer pool, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_POOL_h
+#define __COAP_POOL_h
+
+#include "coap-packet.h"
+
+//Block sizes. A packet gets the smallest block it fits in
+#define		COAP_POOL_CLASSES		5
+#define		COAP_POOL_SIZES			{64, 128, 256, 512, MAX_SIZE}
+
+//Tag of a block nobody has tagged
+#define		COAP_POOL_NO_TAG		0xFFFFFFFFUL
+
+//Bytes taken from the heap at a time, cut into blocks of one size
+#ifndef COAP_POOL_SLAB
+#ifdef ARDUINO
+#define		COAP_POOL_SLAB			512
+#else
+#define		COAP_POOL_SLAB			65536
+#endif
+#endif
+//Most bytes the pool takes from the heap in all, 0 for no limit
+#ifndef COAP_POOL_BUDGET
+#ifdef ARDUINO
+#define		COAP_POOL_BUDGET		8192
+#else
+#define		COAP_POOL_BUDGET		0
+#endif
+#endif
+
+//Blocks of one size
+typedef struct {
+	uns8	*freeList;		//Each free block starts with a pointer to the next
+	uns16	blockSize;
+	uns32	inUse;
+	uns32	available;
+	uns32	peak;			//Most in use at once
+}	coap_pool_class;
+
+/*	Packet storage for CoapPacket. Blocks come in a few sizes, each size
+	carved out of slabs of COAP_POOL_SLAB bytes and kept on its own free
+	list, so a packet costs the block it needs rather than MAX_SIZE bytes,
+	and nothing is given back to the heap to fragment it (slabs last as long
+	as the pool). A size that runs out, with the budget used up, borrows
+	a bigger block	*/
+class CoapBufferPool {
+private:
+	coap_pool_class	classes[COAP_POOL_CLASSES];
+	uns8			*slabs;			//Each slab starts with a pointer to the next
+	uns32			budget;
+	uns32			heapBytes;
+	uns32			failures;
+	
+	int		classOf(uns16 size);
+	int		grow(int c);
+	
+public:
+	CoapBufferPool();
+	~CoapBufferPool();
+	
+	void	setBudget(uns32 bytes);
+	//A block of at least SIZE bytes, or NULL. CAPACITY is set to its size
+	uns8*	allocate(uns16 size, uns16 *capacity);
+	void	release(uns8 *block, uns16 capacity);
+	//A number kept in front of a block that is handed out
+	static void		setTag(uns8 *block, uns32 tag);
+	static uns32	getTag(const uns8 *block);
+	
+	uns32	getMemoryUsage();		//Bytes taken from the heap
+	uns32	bytesInUse();			//Bytes in blocks handed out
+	uns32	allocationFailures();
+	void	printReport();
+};
+
+//On Linux each thread has a pool of its own, so threads running their own
+//CoapProtocol never share one. A packet must be released on the thread
+//that gave it its buffer
+#ifdef ARDUINO
+#define		COAP_POOL_STORAGE
+#else
+#define		COAP_POOL_STORAGE		thread_local
+#endif
+
+//The pool every CoapPacket takes its buffer from
+extern COAP_POOL_STORAGE CoapBufferPool coapBufferPool;
+
+#endif
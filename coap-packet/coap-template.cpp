@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP packet templates, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-template.h"
+
+CoapPacketTemplate::CoapPacketTemplate() {
+	typeBits = 0;
+	code = 0;
+	options = NULL;
+	optionsLength = 0;
+	index = NULL;
+	numIndexed = 0;
+	numOptions = 0;
+}
+
+CoapPacketTemplate::~CoapPacketTemplate() {
+	end();
+}
+
+uns8 CoapPacketTemplate::begin(CoapPacket &pkt) {
+	end();
+	uns8 *start = pkt.packetPtr();
+	if (start == NULL)
+		return 0;
+	
+	//Options run from after the token to the payload marker, or the end
+	uns8 *first = pkt.getOptionPtr();
+	uns8 *last = (pkt.getPayloadPtr() != NULL) ? pkt.getPayloadPtr() - 1 : start + pkt.getPacketLength();
+	optionsLength = (first != NULL) ? last - first : 0;
+	numOptions = pkt.numOptions();
+	numIndexed = (numOptions < MAX_PARSED_OPTIONS) ? numOptions : MAX_PARSED_OPTIONS;
+	
+	if (optionsLength > 0) {
+		options = new (std::nothrow) uns8[optionsLength];
+		index = new (std::nothrow) coap_option_index[numIndexed];
+		if ((options == NULL) || (index == NULL)) {
+			end();
+			return 0;
+		}
+		memcpy(options, first, optionsLength);
+		for (uns8 i = 0; i < numIndexed; i++) {
+			index[i].number = pkt.getOptionNumber(i);
+			index[i].offset = pkt.getOptionValue(i) - first;
+			index[i].length = pkt.getOptionLength(i);
+		}
+	}
+	typeBits = (COAP_VERSION << 6) | (pkt.getMessageType() << 4);
+	code = pkt.getResponseCode();
+	return 1;
+}
+
+void CoapPacketTemplate::end() {
+	delete[] options;
+	delete[] index;
+	options = NULL;
+	index = NULL;
+	optionsLength = 0;
+	numIndexed = 0;
+	numOptions = 0;
+}
+
+uns16 CoapPacketTemplate::packetLength(uns8 tokenLength, uns16 payloadLength) {
+	return 4 + tokenLength + optionsLength + ((payloadLength > 0) ? 1 + payloadLength : 0);
+}
+
+uns16 CoapPacketTemplate::stamp(uns8 *buf, uns16 bufLen, uns16 id, const uns8 *token, uns8 tokenLength,
+								const uns8 *payload, uns16 payloadLength) {
+	uns16 len = packetLength(tokenLength, payloadLength);
+	if ((tokenLength > MAX_TOKENSIZE) || (len > bufLen))
+		return 0;
+	
+	buf[0] = typeBits | tokenLength;
+	buf[1] = code;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	uns8 *pos = buf + 4;
+	if (tokenLength > 0)
+		memcpy(pos, token, tokenLength);
+	pos += tokenLength;
+	if (optionsLength > 0)
+		memcpy(pos, options, optionsLength);
+	pos += optionsLength;
+	if (payloadLength > 0) {
+		*pos++ = PAYLOAD_MARK;
+		memcpy(pos, payload, payloadLength);
+	}
+	return len;
+}
+
+/*	Same as stamp() into a buffer, with PKT's pointers and option index set
+	from what the template already knows rather than by parsePacket()	*/
+uns8 CoapPacketTemplate::stamp(CoapPacket &pkt, uns16 id, const uns8 *token, uns8 tokenLength,
+							   const uns8 *payload, uns16 payloadLength) {
+	uns16 len = packetLength(tokenLength, payloadLength);
+	pkt.begin();
+	uns8 *buf = pkt.reservePacket(len);
+	if ((buf == NULL) || (stamp(buf, len, id, token, tokenLength, payload, payloadLength) == 0))
+		return 0;
+	
+	uns16 optionStart = 4 + tokenLength;
+	pkt.pkt_length = len;
+	pkt.pkt_cursor = len;
+	pkt.coap_type = (typeBits >> 4) & 0x03;
+	pkt.coap_code = code;
+	pkt.coap_msg_id = id;
+	pkt.token_length = tokenLength;
+	pkt.tkn_ptr = (tokenLength > 0) ? buf + 4 : NULL;
+	pkt.option_ptr = (optionsLength > 0) ? buf + optionStart : NULL;
+	pkt.payload_ptr = (payloadLength > 0) ? buf + optionStart + optionsLength + 1 : NULL;
+	pkt.payload_length = payloadLength;
+	pkt.num_options = numOptions;
+	for (uns8 i = 0; i < numIndexed; i++) {
+		pkt.option_index[i] = index[i];
+		pkt.option_index[i].offset += optionStart;
+	}
+	return 1;
+}
+
+uns8 CoapPacketTemplate::type() {
+	return (typeBits >> 4) & 0x03;
+}
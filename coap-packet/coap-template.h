@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP packet templates, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_TEMPLATE_h
+#define __COAP_TEMPLATE_h
+
+#include "coap-packet.h"
+
+/*	The part of a packet that is the same every time it is sent: type, code
+	and options, encoded once. Build it with the usual CoapPacket calls and
+	hand the packet to begin(); after that stamp() writes a packet from it
+	with only the message ID, token and payload filled in, a few memcpy()s
+	instead of the option sorting and delta encoding	*/
+class CoapPacketTemplate {
+private:
+	uns8				typeBits;		//Version and type, for the first header byte
+	uns8				code;
+	uns8				*options;		//Encoded, delta from option 0
+	uns16				optionsLength;
+	coap_option_index	*index;			//Offsets from the start of OPTIONS
+	uns8				numIndexed;
+	uns16				numOptions;		//Indexed or not
+	
+public:
+	CoapPacketTemplate();
+	~CoapPacketTemplate();
+	
+	//Keeps the type, code and options of PKT. Returns 0 if out of memory
+	uns8	begin(CoapPacket &pkt);
+	void	end();
+	
+	//Writes a packet into BUF, returns its length or 0 if it doesn't fit in BUFLEN
+	uns16	stamp(uns8 *buf, uns16 bufLen, uns16 id, const uns8 *token, uns8 tokenLength,
+				  const uns8 *payload, uns16 payloadLength);
+	//Writes a packet into PKT, which comes out as if parsed. Returns 0 if it doesn't fit
+	uns8	stamp(CoapPacket &pkt, uns16 id, const uns8 *token, uns8 tokenLength,
+				  const uns8 *payload, uns16 payloadLength);
+	//Bytes stamp() writes for a token and payload of these lengths
+	uns16	packetLength(uns8 tokenLength, uns16 payloadLength);
+	
+	uns8	type();
+};
+
+#endif
@@ -0,0 +1,556 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP block-wise transfers, Arduino library
+// Written originally by Embedded Adventures
+
+#include "coap-blockwise.h"
+
+#if COAP_WITH_BLOCKWISE
+
+#define		BLOCK_TOKEN_LENGTH		5		//Transfer, generation, 24 bit block number
+
+/*	Block1/Block2 option value: NUM, more flag and size exponent	*/
+inline uns32 block_option(uns32 num, bool more, uns8 szx) {
+	return (num << 4) | ((more ? 1 : 0) << 3) | szx;
+}
+
+CoapBlockwise::CoapBlockwise() {
+	coap = NULL;
+	defaultSzx = COAP_BLOCK_SZX;
+	defaultWindow = COAP_BLOCK_WINDOW;
+	for (int t = 0; t < COAP_BLOCK_TRANSFERS; t++) {
+		transfers[t].state = BLOCK_FREE;
+		transfers[t].generation = 0;
+	}
+}
+
+/*	Hooks into PROTOCOL. Call once, after PROTOCOL's begin()	*/
+int CoapBlockwise::begin(CoapProtocol *protocol) {
+	coap = protocol;
+	coap->addExtension(this);
+	return 1;
+}
+
+/*	Block size asked for by new transfers: 16 to 1024, rounded down to a power of 2	*/
+void CoapBlockwise::setBlockSize(uns16 bytes) {
+	uns8 szx = 0;
+	while ((szx < 6) && ((16U << (szx + 1)) <= bytes))
+		szx++;
+	defaultSzx = szx;
+}
+
+/*	Blocks new transfers keep in flight at once, 1 to COAP_BLOCK_MAX_WINDOW.
+	Only worth raising on links with a long round trip time	*/
+void CoapBlockwise::setWindow(uns8 blocks) {
+	if (blocks < 1)
+		blocks = 1;
+	if (blocks > COAP_BLOCK_MAX_WINDOW)
+		blocks = COAP_BLOCK_MAX_WINDOW;
+	defaultWindow = blocks;
+}
+
+
+////////////////////////////////////////////////////
+////				Client Side					////
+////////////////////////////////////////////////////
+
+int CoapBlockwise::newTransfer(uns8 state, const coap_endpoint &peer, const char *path, void *ctx) {
+	for (int t = 0; t < COAP_BLOCK_TRANSFERS; t++) {
+		coap_block_transfer &tr = transfers[t];
+		if (tr.state != BLOCK_FREE)
+			continue;
+		tr.state = state;
+		tr.szx = defaultSzx;
+		tr.window = defaultWindow;
+		tr.inFlight = 0;
+		tr.peer = peer;
+		tr.path = path;
+		tr.size = 0;
+		tr.nextNum = 0;
+		tr.lastNum = BLOCK_UNKNOWN;
+		tr.completed = 0;
+		tr.lastActivity = millis();
+		tr.reader = NULL;
+		tr.sink = NULL;
+		tr.done = NULL;
+		tr.ctx = ctx;
+		for (int p = 0; p < COAP_BLOCK_MAX_WINDOW; p++) {
+			tr.pending[p].used = false;
+		}
+		return t;
+	}
+	return -1;
+}
+
+/*	Sends SIZE bytes, read through READER, to PATH on TO with METHOD (usually
+	COAP_PUT or COAP_POST). DONE gets the final response code	*/
+int CoapBlockwise::upload(const coap_endpoint &to, uns8 method, const char *path, uns32 size,
+							coap_block_reader reader, coap_block_done done, void *ctx) {
+	int t = newTransfer(BLOCK_UPLOAD, to, path, ctx);
+	if (t < 0)
+		return -1;
+	coap_block_transfer &tr = transfers[t];
+	tr.method = method;
+	tr.size = size;
+	tr.lastNum = (size > 0) ? ((size - 1) >> (tr.szx + 4)) : 0;
+	tr.reader = reader;
+	tr.done = done;
+	pump(t);
+	return t;
+}
+
+/*	GETs PATH from FROM, handing the body to SINK as it arrives	*/
+int CoapBlockwise::download(const coap_endpoint &from, const char *path,
+							coap_block_sink sink, coap_block_done done, void *ctx) {
+	int t = newTransfer(BLOCK_DOWNLOAD, from, path, ctx);
+	if (t < 0)
+		return -1;
+	coap_block_transfer &tr = transfers[t];
+	tr.method = COAP_GET;
+	tr.sink = sink;
+	tr.done = done;
+	pump(t);
+	return t;
+}
+
+/*	Stops TRANSFER without calling its done callback	*/
+void CoapBlockwise::cancel(int transfer) {
+	if ((transfer >= 0) && (transfer < COAP_BLOCK_TRANSFERS) && (transfers[transfer].state != BLOCK_FREE))
+		finish(transfer, 0, false);
+}
+
+/*	Returns the number of transfers running	*/
+int CoapBlockwise::active() {
+	int n = 0;
+	for (int t = 0; t < COAP_BLOCK_TRANSFERS; t++) {
+		if (transfers[t].state != BLOCK_FREE)
+			n++;
+	}
+	return n;
+}
+
+/*	Can transfer T send its next block yet?
+	The first block goes alone, so the peer can ask for a smaller block size
+	(and tell a downloader the body size) before the window opens. The last
+	block of an upload waits for all the others, so the server knows the body
+	is complete when it arrives	*/
+bool CoapBlockwise::canSend(int t) {
+	coap_block_transfer &tr = transfers[t];
+	
+	if (tr.inFlight >= tr.window)
+		return false;
+	if (tr.nextNum == 0)
+		return true;
+	if (tr.completed == 0)
+		return false;
+	if (tr.lastNum == BLOCK_UNKNOWN)
+		return tr.inFlight == 0;
+	if (tr.nextNum > tr.lastNum)
+		return false;
+	if ((tr.state == BLOCK_UPLOAD) && (tr.nextNum == tr.lastNum))
+		return (tr.inFlight == 0) && (tr.completed == tr.lastNum);
+	return true;
+}
+
+/*	Sends as many blocks of transfer T as it may. Anything that doesn't fit in
+	the tx queue now is sent from poll()	*/
+void CoapBlockwise::pump(int t) {
+	while ((transfers[t].state != BLOCK_FREE) && canSend(t)) {
+		if (sendBlock(t, transfers[t].nextNum) <= 0)
+			return;
+		transfers[t].nextNum++;
+	}
+}
+
+/*	Queues the CON for block NUM of transfer T. Upload blocks are read from
+	the reader straight into the tx packet. Returns 1 if queued, 0 if the tx
+	queue is full and -1 if the transfer had to be aborted	*/
+int CoapBlockwise::sendBlock(int t, uns32 num) {
+	coap_block_transfer &tr = transfers[t];
+	uns8 token[BLOCK_TOKEN_LENGTH] = { (uns8)t, tr.generation, (uns8)(num >> 16), (uns8)(num >> 8), (uns8)num };
+	
+	int p = 0;
+	while ((p < COAP_BLOCK_MAX_WINDOW) && tr.pending[p].used)
+		p++;
+	if (p == COAP_BLOCK_MAX_WINDOW)
+		return 0;
+	
+	int x = coap->reserveTX(tr.peer);
+	if (x < 0)
+		return 0;
+	CoapPacket &pkt = coap->getCoapPacket(TX, x);
+	pkt.addHeader(TYPE_CON, tr.method, coap->nextMessageId(tr.peer));
+	pkt.addTokens(BLOCK_TOKEN_LENGTH, token);
+	pkt.addUriPath(tr.path);
+	
+	if (tr.state == BLOCK_UPLOAD) {
+		uns32 offset = num << (tr.szx + 4);
+		uns32 len = tr.size - offset;
+		if (len > (1UL << (tr.szx + 4)))
+			len = 1UL << (tr.szx + 4);
+		
+		pkt.addUintOption(OPT_BLOCK1, block_option(num, (offset + len) < tr.size, tr.szx));
+		if (num == 0)
+			pkt.addUintOption(OPT_SIZE1, tr.size);
+		if (len > 0) {
+			uns8 *buf = pkt.reservePayload(len);
+			if ((buf == NULL) || (tr.reader(tr.ctx, offset, buf, len) != (int)len)) {
+				coap->clearQueue(TX, x);
+				finish(t, 0, true);
+				return -1;
+			}
+		}
+	}
+	else {
+		pkt.addUintOption(OPT_BLOCK2, block_option(num, false, tr.szx));
+		//Size2 of 0 asks the server for the body size
+		if (num == 0)
+			pkt.addUintOption(OPT_SIZE2, 0);
+	}
+	coap->commitTX(x);
+	
+	tr.pending[p].num = num;
+	tr.pending[p].txIndex = x;
+	tr.pending[p].used = true;
+	tr.inFlight++;
+	tr.lastActivity = millis();
+	return 1;
+}
+
+/*	Returns the transfer PKT (a block request, or a response to one)
+	belongs to and sets NUM to its block number, or returns -1	*/
+int CoapBlockwise::findTransfer(CoapPacket &pkt, const coap_endpoint &peer, uns32 *num) {
+	const uns8 *token = pkt.getTokenPtr();
+	
+	if ((pkt.getTokenLength() != BLOCK_TOKEN_LENGTH) || (token[0] >= COAP_BLOCK_TRANSFERS))
+		return -1;
+	coap_block_transfer &tr = transfers[token[0]];
+	if ((tr.state == BLOCK_FREE) || (tr.generation != token[1]) || !coap_endpoint_equal(tr.peer, peer))
+		return -1;
+	*num = ((uns32)token[2] << 16) | ((uns32)token[3] << 8) | token[4];
+	return token[0];
+}
+
+int CoapBlockwise::findPending(int t, uns32 num) {
+	for (int p = 0; p < COAP_BLOCK_MAX_WINDOW; p++) {
+		if (transfers[t].pending[p].used && (transfers[t].pending[p].num == num))
+			return p;
+	}
+	return -1;
+}
+
+/*	Block NUM of download T has arrived	*/
+void CoapBlockwise::downloadBlock(int t, CoapPacket &rsp, uns32 num) {
+	coap_block_transfer &tr = transfers[t];
+	uns32 opt;
+	
+	//Server sent the whole body at once
+	if (!rsp.getUintOption(OPT_BLOCK2, &opt)) {
+		if ((num == 0) && (rsp.getPayloadLength() > 0) && (tr.sink(tr.ctx, 0, rsp.getPayloadPtr(), rsp.getPayloadLength()) < 0))
+			finish(t, 0, true);
+		else
+			finish(t, (num == 0) ? rsp.getResponseCode() : 0, true);
+		return;
+	}
+	
+	uns32 bnum = opt >> 4;
+	bool more = (opt >> 3) & 0x01;
+	uns8 szx = opt & 0x07;
+	if (szx == 7) {
+		finish(t, 0, true);		//BERT isn't supported
+		return;
+	}
+	//The server may want smaller blocks than asked for
+	if ((bnum == 0) && (szx < tr.szx))
+		tr.szx = szx;
+	
+	if ((rsp.getPayloadLength() > 0) &&
+		(tr.sink(tr.ctx, bnum << (szx + 4), rsp.getPayloadPtr(), rsp.getPayloadLength()) < 0)) {
+		finish(t, 0, true);
+		return;
+	}
+	
+	uns32 size2;
+	if (!more)
+		tr.lastNum = bnum;
+	else if ((bnum == 0) && rsp.getUintOption(OPT_SIZE2, &size2) && (size2 > 0)) {
+		tr.size = size2;
+		tr.lastNum = (size2 - 1) >> (tr.szx + 4);
+	}
+	tr.completed++;
+	
+	if ((tr.lastNum != BLOCK_UNKNOWN) && (tr.completed > tr.lastNum))
+		finish(t, rsp.getResponseCode(), true);
+	else
+		pump(t);
+}
+
+/*	The server has answered block NUM of upload T	*/
+void CoapBlockwise::uploadBlock(int t, CoapPacket &rsp, uns32 num) {
+	coap_block_transfer &tr = transfers[t];
+	uns32 opt;
+	
+	//Anything but 2.31 Continue is the final response
+	if ((rsp.getResponseCode() != CODE_CONTINUE) || !rsp.getUintOption(OPT_BLOCK1, &opt)) {
+		finish(t, rsp.getResponseCode(), true);
+		return;
+	}
+	
+	uns8 szx = opt & 0x07;
+	if ((num == 0) && (szx < tr.szx)) {
+		//Server took only the first SZX sized block of block 0. Carry on from there
+		tr.nextNum = 1UL << (tr.szx - szx);
+		tr.completed = tr.nextNum;
+		tr.szx = szx;
+		tr.lastNum = (tr.size > 0) ? ((tr.size - 1) >> (szx + 4)) : 0;
+	}
+	else {
+		tr.completed++;
+	}
+	pump(t);
+}
+
+/*	Ends transfer T. Block requests still in the tx queue are dropped	*/
+void CoapBlockwise::finish(int t, uns8 code, bool notify) {
+	coap_block_transfer &tr = transfers[t];
+	
+	for (int p = 0; p < COAP_BLOCK_MAX_WINDOW; p++) {
+		if (tr.pending[p].used && (tr.pending[p].txIndex >= 0))
+			coap->clearQueue(TX, tr.pending[p].txIndex);
+		tr.pending[p].used = false;
+	}
+	tr.state = BLOCK_FREE;
+	tr.generation++;
+	tr.inFlight = 0;
+	if (notify && (tr.done != NULL))
+		tr.done(tr.ctx, t, code);
+}
+
+
+////////////////////////////////////////////////////
+////				Server Side					////
+////////////////////////////////////////////////////
+
+/*	Takes a tx slot for the response to the request in rx slot RXINDEX:
+	piggybacked on the ACK if it is a CON, otherwise a NON	*/
+int CoapBlockwise::startReply(int rxIndex, uns8 code) {
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	
+	int x = coap->reserveTX(peer);
+	if (x < 0)
+		return -1;
+	CoapPacket &rsp = coap->getCoapPacket(TX, x);
+	if (req.getMessageType() == TYPE_CON)
+		rsp.addHeader(TYPE_ACK, code, req.getID());
+	else
+		rsp.addHeader(TYPE_NON, code, coap->nextMessageId(peer));
+	rsp.addTokens(req.getTokenLength(), req.getTokenPtr());
+	return x;
+}
+
+/*	Answers REQUEST with CODE and the block of a SIZE byte body it asks for
+	(block 0 if it doesn't say), read through READER. A body that fits in one
+	block is sent without a Block2 option. Marks REQUEST as processed.
+	Returns 1 if the response was queued, -1 otherwise	*/
+int CoapBlockwise::serveBlock2(const uns8 *request, uns8 code, uns32 size, coap_block_reader reader, void *ctx) {
+	int rxIndex = coap->getRxIndex(request);
+	if (rxIndex < 0)
+		return -1;
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	uns16 id = req.getID();
+	
+	uns32 opt;
+	bool asked = req.getUintOption(OPT_BLOCK2, &opt);
+	uns32 num = asked ? (opt >> 4) : 0;
+	uns8 szx = (asked && ((opt & 0x07) < defaultSzx)) ? (opt & 0x07) : defaultSzx;
+	uns32 offset = num << (szx + 4);
+	uns32 len = (size > offset) ? (size - offset) : 0;
+	if (len > (1UL << (szx + 4)))
+		len = 1UL << (szx + 4);
+	bool more = (offset + len) < size;
+	
+	//Asked for a block past the end
+	if ((offset >= size) && (num > 0)) {
+		int x = startReply(rxIndex, CODE_BAD_OPTION);
+		if (x < 0)
+			return -1;
+		coap->commitTX(x);
+		coap->packetProcessed(peer, id);
+		return -1;
+	}
+	
+	int x = startReply(rxIndex, code);
+	if (x < 0)
+		return -1;
+	CoapPacket &rsp = coap->getCoapPacket(TX, x);
+	if (asked || more) {
+		rsp.addUintOption(OPT_BLOCK2, block_option(num, more, szx));
+		if (num == 0)
+			rsp.addUintOption(OPT_SIZE2, size);
+	}
+	if (len > 0) {
+		uns8 *buf = rsp.reservePayload(len);
+		if ((buf == NULL) || (reader(ctx, offset, buf, len) != (int)len)) {
+			coap->clearQueue(TX, x);
+			return -1;
+		}
+	}
+	coap->commitTX(x);
+	coap->packetProcessed(peer, id);
+	return 1;
+}
+
+/*	Hands the block of a request body carried by REQUEST to SINK, and answers
+	2.31 Continue, or FINALCODE once the last block is in. A request without
+	a Block1 option is a body in one piece. Marks REQUEST as processed.
+	Returns 1 when the body is complete, 0 if more blocks are to come and -1
+	if the block was refused	*/
+int CoapBlockwise::acceptBlock1(const uns8 *request, coap_block_sink sink, void *ctx, uns8 finalCode) {
+	int rxIndex = coap->getRxIndex(request);
+	if (rxIndex < 0)
+		return -1;
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	uns16 id = req.getID();
+	
+	uns32 opt;
+	bool blocked = req.getUintOption(OPT_BLOCK1, &opt);
+	uns32 num = blocked ? (opt >> 4) : 0;
+	bool more = blocked && ((opt >> 3) & 0x01);
+	uns8 szx = blocked ? (opt & 0x07) : defaultSzx;
+	uns32 len = req.getPayloadLength();
+	uns32 offset = num << (szx + 4);
+	
+	//First block bigger than we like: take it, and ask for smaller ones after it
+	if (blocked && (num == 0) && (szx > defaultSzx) && (szx != 7))
+		szx = defaultSzx;
+	
+	uns8 code = more ? CODE_CONTINUE : finalCode;
+	int result = more ? 0 : 1;
+	if ((szx == 7) || ((len > 0) && (sink(ctx, offset, req.getPayloadPtr(), len) < 0))) {
+		code = (szx == 7) ? CODE_BAD_OPTION : CODE_REQ_TOO_LARGE;
+		result = -1;
+	}
+	
+	int x = startReply(rxIndex, code);
+	if (x < 0)
+		return -1;
+	if (blocked && (result >= 0))
+		coap->getCoapPacket(TX, x).addUintOption(OPT_BLOCK1, block_option(num, more, szx));
+	coap->commitTX(x);
+	coap->packetProcessed(peer, id);
+	return result;
+}
+
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+int CoapBlockwise::onResponse(int rxIndex, int txIndex) {
+	CoapPacket &rsp = coap->getCoapPacket(RX, rxIndex);
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	uns32 num;
+	
+	//An empty ACK has no token, so go by the request it ACKs
+	int t = findTransfer((txIndex >= 0) ? coap->getCoapPacket(TX, txIndex) : rsp, peer, &num);
+	if (t < 0)
+		return 0;
+	coap_block_transfer &tr = transfers[t];
+	int p = findPending(t, num);
+	if (p < 0)
+		return 1;		//Late duplicate
+	
+	//Response will follow separately
+	if (rsp.getResponseCode() == 0) {
+		tr.pending[p].txIndex = -1;
+		return 1;
+	}
+	
+	tr.pending[p].used = false;
+	tr.inFlight--;
+	tr.lastActivity = millis();
+	
+	if ((rsp.getResponseCode() >> 5) != 2)
+		finish(t, rsp.getResponseCode(), true);
+	else if (tr.state == BLOCK_DOWNLOAD)
+		downloadBlock(t, rsp, num);
+	else
+		uploadBlock(t, rsp, num);
+	return 1;
+}
+
+/*	A block request was never ACKed. The whole transfer has failed	*/
+int CoapBlockwise::onTxFailure(int txIndex) {
+	uns32 num;
+	int t = findTransfer(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &num);
+	if (t < 0)
+		return 0;
+	int p = findPending(t, num);
+	if (p >= 0)
+		transfers[t].pending[p].used = false;	//CoapProtocol releases it
+	finish(t, 0, true);
+	return 1;
+}
+
+/*	Sends blocks that didn't fit in the tx queue earlier, and gives up on
+	transfers whose separate responses never came	*/
+int CoapBlockwise::poll(uns32 now) {
+	for (int t = 0; t < COAP_BLOCK_TRANSFERS; t++) {
+		coap_block_transfer &tr = transfers[t];
+		if (tr.state == BLOCK_FREE)
+			continue;
+		if ((tr.inFlight > 0) && ((now - tr.lastActivity) > (EXCHANGE_LIFETIME * 1000UL)))
+			finish(t, 0, true);
+		else
+			pump(t);
+	}
+	return 0;
+}
+
+/*	When the quietest transfer with blocks in flight gives up	*/
+int CoapBlockwise::nextDeadline(uns32 *deadline) {
+	bool found = false;
+	for (int t = 0; t < COAP_BLOCK_TRANSFERS; t++) {
+		coap_block_transfer &tr = transfers[t];
+		if ((tr.state == BLOCK_FREE) || (tr.inFlight == 0))
+			continue;
+		uns32 giveUp = tr.lastActivity + (EXCHANGE_LIFETIME * 1000UL) + 1;
+		if (!found || ((int32_t)(giveUp - *deadline) < 0)) {
+			*deadline = giveUp;
+			found = true;
+		}
+	}
+	return found;
+}
+
+#endif	//COAP_WITH_BLOCKWISE
@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP block-wise transfers, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_BLOCKWISE_h
+#define __COAP_BLOCKWISE_h
+
+#include "coap-protocol.h"
+
+//Transfers that can run at once
+#ifndef COAP_BLOCK_TRANSFERS
+#ifdef ARDUINO
+#define		COAP_BLOCK_TRANSFERS	2
+#else
+#define		COAP_BLOCK_TRANSFERS	16
+#endif
+#endif
+//Default block size is 1 << (COAP_BLOCK_SZX + 4) bytes
+#ifndef COAP_BLOCK_SZX
+#ifdef ARDUINO
+#define		COAP_BLOCK_SZX			4		//256 bytes
+#else
+#define		COAP_BLOCK_SZX			6		//1024 bytes
+#endif
+#endif
+//Default number of blocks in flight per transfer, and the most allowed
+#ifndef COAP_BLOCK_WINDOW
+#ifdef ARDUINO
+#define		COAP_BLOCK_WINDOW		1
+#else
+#define		COAP_BLOCK_WINDOW		4
+#endif
+#endif
+#define		COAP_BLOCK_MAX_WINDOW	8
+
+#define		BLOCK_FREE				0
+#define		BLOCK_UPLOAD			1		//Block1: body goes to the peer
+#define		BLOCK_DOWNLOAD			2		//Block2: body comes from the peer
+#define		BLOCK_UNKNOWN			0xFFFFFFFFUL
+
+#if COAP_WITH_BLOCKWISE
+
+//Fills BUF with the LEN bytes of the body at OFFSET. Returns how many it read
+typedef int (*coap_block_reader)(void *ctx, uns32 offset, uns8 *buf, int len);
+//Takes the LEN bytes of the body at OFFSET. Returns < 0 to abort the transfer
+typedef int (*coap_block_sink)(void *ctx, uns32 offset, const uns8 *data, int len);
+//Transfer TRANSFER has ended with response CODE, or 0 if it failed
+typedef void (*coap_block_done)(void *ctx, int transfer, uns8 code);
+
+//A block request waiting for its response
+typedef struct {
+	uns32	num;
+	int		txIndex;		//-1 once the CON was ACKed empty
+	bool	used;
+}	coap_block_pending;
+
+typedef struct {
+	uns8			state;			//BLOCK_FREE, BLOCK_UPLOAD or BLOCK_DOWNLOAD
+	uns8			generation;		//Changes each time the slot is reused
+	uns8			method;
+	uns8			szx;
+	uns8			window;
+	uns8			inFlight;
+	coap_endpoint	peer;
+	const char		*path;
+	uns32			size;			//Body size, 0 if not known
+	uns32			nextNum;		//Next block to send or ask for
+	uns32			lastNum;		//BLOCK_UNKNOWN until known
+	uns32			completed;		//Blocks done
+	uns32			lastActivity;
+	coap_block_reader	reader;
+	coap_block_sink		sink;
+	coap_block_done		done;
+	void			*ctx;
+	coap_block_pending	pending[COAP_BLOCK_MAX_WINDOW];
+}	coap_block_transfer;
+
+/*	RFC 7959 block-wise transfers on top of CoapProtocol.
+	As a client, upload() streams a body from a reader callback with Block1
+	and download() hands a body to a sink callback with Block2, one block per
+	CON, with up to a window of blocks in flight. Blocks are read straight into
+	(and handed out straight from) the packets in the rx and tx queues, so a
+	transfer needs no buffer of its own.
+	As a server, serveBlock2() and acceptBlock1() answer one block request
+	from availablePacketHandler() and keep no state between blocks	*/
+class CoapBlockwise : public CoapExtension {
+private:
+	CoapProtocol		*coap;
+	coap_block_transfer	transfers[COAP_BLOCK_TRANSFERS];
+	uns8				defaultSzx;
+	uns8				defaultWindow;
+	
+	int		newTransfer(uns8 state, const coap_endpoint &peer, const char *path, void *ctx);
+	int		findTransfer(CoapPacket &pkt, const coap_endpoint &peer, uns32 *num);
+	int		findPending(int t, uns32 num);
+	bool	canSend(int t);
+	void	pump(int t);
+	int		sendBlock(int t, uns32 num);
+	void	downloadBlock(int t, CoapPacket &rsp, uns32 num);
+	void	uploadBlock(int t, CoapPacket &rsp, uns32 num);
+	void	finish(int t, uns8 code, bool notify);
+	int		startReply(int rxIndex, uns8 code);
+	
+public:
+	CoapBlockwise();
+	
+	int		begin(CoapProtocol *protocol);
+	void	setBlockSize(uns16 bytes);
+	void	setWindow(uns8 blocks);
+	
+	//Client side. Return a transfer number, or -1 if all are in use.
+	//PATH must stay valid until the transfer is done
+	int		upload(const coap_endpoint &to, uns8 method, const char *path, uns32 size,
+					coap_block_reader reader, coap_block_done done, void *ctx);
+	int		download(const coap_endpoint &from, const char *path,
+					coap_block_sink sink, coap_block_done done, void *ctx);
+	void	cancel(int transfer);
+	int		active();
+	
+	//Server side, for a REQUEST handed to availablePacketHandler()
+	int		serveBlock2(const uns8 *request, uns8 code, uns32 size, coap_block_reader reader, void *ctx);
+	int		acceptBlock1(const uns8 *request, coap_block_sink sink, void *ctx, uns8 finalCode);
+	
+	//CoapExtension hooks
+	int		onResponse(int rxIndex, int txIndex);
+	int		onTxFailure(int txIndex);
+	int		poll(uns32 now);
+	int		nextDeadline(uns32 *deadline);
+};
+
+#endif	//COAP_WITH_BLOCKWISE
+
+#endif
@@ -0,0 +1,554 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP client response cache, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-cache.h"
+
+//Bytes in front of a cached response for the header and token it is served with
+#define		HEAD_ROOM		(4 + MAX_TOKENSIZE)
+//Longest Max-Age that still fits a millis() deadline
+#define		MAX_AGE_LIMIT	2000000UL
+
+/*	NoCacheKey options (RFC 7252 5.4.6) are left out of the cache key	*/
+inline bool no_cache_key(uns16 optNum) {
+	return (optNum & 0x1E) == 0x1C;
+}
+
+CoapResponseCache::CoapResponseCache() {
+	coap = NULL;
+	entries = NULL;
+	buckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	freeHead = -1;
+	lruHead = -1;
+	lruTail = -1;
+	budget = 0;
+	used = 0;
+	hitCount = 0;
+	revalidationCount = 0;
+	missCount = 0;
+	evictionCount = 0;
+	savedBytes = 0;
+	for (int p = 0; p < COAP_CACHE_PENDING; p++) {
+		pending[p].used = false;
+	}
+}
+
+CoapResponseCache::~CoapResponseCache() {
+	end();
+}
+
+int CoapResponseCache::begin(CoapProtocol *protocol) {
+	return begin(protocol, COAP_CACHE_BUDGET, COAP_CACHE_ENTRIES);
+}
+
+/*	Hooks into PROTOCOL, keeping up to MAXENTRIES responses in BUDGETBYTES.
+	Call once, after PROTOCOL's begin(). Returns 0 if out of memory	*/
+int CoapResponseCache::begin(CoapProtocol *protocol, uns32 budgetBytes, int maxEntries) {
+	end();
+	
+	int bucketCount = 1;
+	while (bucketCount < maxEntries)
+		bucketCount <<= 1;
+	entries = new (std::nothrow) coap_cache_entry[maxEntries];
+	buckets = new (std::nothrow) int[bucketCount];
+	if ((entries == NULL) || (buckets == NULL)) {
+		end();
+		return 0;
+	}
+	capacity = maxEntries;
+	bucketMask = bucketCount - 1;
+	budget = budgetBytes;
+	for (int i = 0; i < capacity; i++) {
+		entries[i].data = NULL;
+	}
+	clear();
+	
+	coap = protocol;
+	coap->addExtension(this);
+	return 1;
+}
+
+void CoapResponseCache::end() {
+	clear();
+	delete[] entries;
+	delete[] buckets;
+	entries = NULL;
+	buckets = NULL;
+	capacity = 0;
+}
+
+/*	Forgets every response. Counters are kept	*/
+void CoapResponseCache::clear() {
+	for (int i = 0; i < capacity; i++) {
+		delete[] entries[i].data;
+		entries[i].data = NULL;
+		entries[i].lruNext = (i + 1 < capacity) ? i + 1 : -1;
+	}
+	for (int i = 0; i <= bucketMask; i++) {
+		if (buckets != NULL)
+			buckets[i] = -1;
+	}
+	for (int p = 0; p < COAP_CACHE_PENDING; p++) {
+		pending[p].used = false;
+	}
+	freeHead = (capacity > 0) ? 0 : -1;
+	lruHead = -1;
+	lruTail = -1;
+	used = 0;
+}
+
+
+////////////////////////////////////////////////////
+////				Entries						////
+////////////////////////////////////////////////////
+
+uns32 CoapResponseCache::hash(const uns8 *key, uns16 len) {
+	uns32 h = 2166136261UL;
+	for (uns16 i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 16777619UL;
+	}
+	h ^= h >> 15;
+	return h;
+}
+
+/*	Writes the cache key of REQ to PEER into KEY: METHOD, the peer, then the
+	number, length and value of each option that isn't NoCacheKey. Returns
+	its length, or 0 if it is longer than COAP_CACHE_KEY_SIZE	*/
+uns16 CoapResponseCache::buildKey(CoapPacket &req, const coap_endpoint &peer, uns8 method, uns8 *key) {
+	uns16 n = 0;
+	key[n++] = method;
+	key[n++] = peer.addr >> 24;
+	key[n++] = peer.addr >> 16;
+	key[n++] = peer.addr >> 8;
+	key[n++] = peer.addr;
+	key[n++] = peer.port >> 8;
+	key[n++] = peer.port;
+	
+	for (int i = 0; i < req.numOptions(); i++) {
+		uns16 num = req.getOptionNumber(i);
+		uns16 len = req.getOptionLength(i);
+		if (no_cache_key(num))
+			continue;
+		if (n + 4 + len > COAP_CACHE_KEY_SIZE)
+			return 0;
+		key[n++] = num >> 8;
+		key[n++] = num;
+		key[n++] = len >> 8;
+		key[n++] = len;
+		memcpy(&key[n], req.getOptionValue(i), len);
+		n += len;
+	}
+	return n;
+}
+
+int CoapResponseCache::find(const uns8 *key, uns16 len, uns32 h) {
+	if (capacity == 0)
+		return -1;
+	int i = buckets[h & bucketMask];
+	while (i >= 0) {
+		coap_cache_entry &e = entries[i];
+		if ((e.hash == h) && (e.keyLength == len) && (memcmp(e.data, key, len) == 0))
+			return i;
+		i = e.hashNext;
+	}
+	return -1;
+}
+
+void CoapResponseCache::unlinkLRU(int e) {
+	coap_cache_entry &c = entries[e];
+	if (c.lruPrev >= 0)
+		entries[c.lruPrev].lruNext = c.lruNext;
+	else
+		lruHead = c.lruNext;
+	if (c.lruNext >= 0)
+		entries[c.lruNext].lruPrev = c.lruPrev;
+	else
+		lruTail = c.lruPrev;
+}
+
+void CoapResponseCache::pushLRU(int e) {
+	coap_cache_entry &c = entries[e];
+	c.lruPrev = -1;
+	c.lruNext = lruHead;
+	if (lruHead >= 0)
+		entries[lruHead].lruPrev = e;
+	else
+		lruTail = e;
+	lruHead = e;
+}
+
+void CoapResponseCache::remove(int e) {
+	coap_cache_entry &c = entries[e];
+	unlinkLRU(e);
+	
+	int *link = &buckets[c.hash & bucketMask];
+	while (*link >= 0) {
+		if (*link == e) {
+			*link = c.hashNext;
+			break;
+		}
+		link = &entries[*link].hashNext;
+	}
+	
+	used -= c.keyLength + HEAD_ROOM + c.bodyLength;
+	delete[] c.data;
+	c.data = NULL;
+	c.lruNext = freeHead;
+	freeHead = e;
+}
+
+/*	Max-Age and ETag of RSP, from when it arrived at NOW	*/
+void CoapResponseCache::setFreshness(int e, CoapPacket &rsp, uns32 now) {
+	coap_cache_entry &c = entries[e];
+	uns32 maxAge;
+	if (!rsp.getUintOption(OPT_MAX_AGE, &maxAge))
+		maxAge = COAP_CACHE_DEFAULT_MAX_AGE;
+	if (maxAge > MAX_AGE_LIMIT)
+		maxAge = MAX_AGE_LIMIT;
+	c.expires = now + (maxAge * 1000UL);
+	
+	int etag = rsp.findOption(OPT_ETAG);
+	if ((etag >= 0) && (rsp.getOptionLength(etag) <= COAP_CACHE_ETAG_SIZE)) {
+		c.etagLength = rsp.getOptionLength(etag);
+		memcpy(c.etag, rsp.getOptionValue(etag), c.etagLength);
+	}
+	else if (rsp.getResponseCode() != CODE_VALID) {
+		c.etagLength = 0;
+	}
+}
+
+/*	Keeps RSP under KEY, evicting the least recently used responses to make
+	room. Returns the entry, or -1 if it can't be kept	*/
+int CoapResponseCache::store(const uns8 *key, uns16 keyLength, uns32 h, CoapPacket &rsp, uns32 now) {
+	uns16 tokenEnd = 4 + rsp.getTokenLength();
+	uns16 bodyLength = rsp.getPacketLength() - tokenEnd;
+	uns32 need = keyLength + HEAD_ROOM + bodyLength;
+	if ((capacity == 0) || (need > budget))
+		return -1;
+	
+	int old = find(key, keyLength, h);
+	if (old >= 0)
+		remove(old);
+	while ((freeHead < 0) || (used + need > budget)) {
+		remove(lruTail);
+		evictionCount++;
+	}
+	
+	uns8 *data = new (std::nothrow) uns8[need];
+	if (data == NULL)
+		return -1;
+	int e = freeHead;
+	coap_cache_entry &c = entries[e];
+	freeHead = c.lruNext;
+	
+	c.data = data;
+	c.hash = h;
+	c.keyLength = keyLength;
+	c.bodyLength = bodyLength;
+	c.code = rsp.getResponseCode();
+	memcpy(data, key, keyLength);
+	memcpy(data + keyLength + HEAD_ROOM, rsp.getPacket() + tokenEnd, bodyLength);
+	setFreshness(e, rsp, now);
+	used += need;
+	
+	int *bucket = &buckets[c.hash & bucketMask];
+	c.hashNext = *bucket;
+	*bucket = e;
+	pushLRU(e);
+	return e;
+}
+
+/*	Hands entry E to txSuccessHandler() as the piggybacked answer to REQ.
+	The header and token are written into the room kept in front of the
+	response, so it is handed over where it is	*/
+void CoapResponseCache::serve(int e, CoapPacket &req) {
+	coap_cache_entry &c = entries[e];
+	uns8 tkl = req.getTokenLength();
+	uns8 *pkt = c.data + c.keyLength + MAX_TOKENSIZE - tkl;
+	pkt[0] = (COAP_VERSION << 6) | (TYPE_ACK << 4) | tkl;
+	pkt[1] = c.code;
+	pkt[2] = req.getID() >> 8;
+	pkt[3] = req.getID() & 0xFF;
+	memcpy(&pkt[4], req.getTokenPtr(), tkl);
+	
+	int len = 4 + tkl + c.bodyLength;
+	savedBytes += req.getPacketLength() + len;
+	coap->txSuccessHandler(pkt, len);
+}
+
+/*	Turns RSP, a 2.03 Valid in the rx queue, into the response entry E holds,
+	keeping RSP's header and token	*/
+void CoapResponseCache::restore(int e, CoapPacket &rsp) {
+	coap_cache_entry &c = entries[e];
+	uns16 tokenEnd = 4 + rsp.getTokenLength();
+	uns8 *buf = rsp.reservePacket(tokenEnd + c.bodyLength);
+	if (buf == NULL)
+		return;		//Left as the 2.03 it was
+	
+	if (c.bodyLength > rsp.getPacketLength() - tokenEnd)
+		savedBytes += c.bodyLength - (rsp.getPacketLength() - tokenEnd);
+	buf[1] = c.code;
+	memcpy(&buf[tokenEnd], c.data + c.keyLength + HEAD_ROOM, c.bodyLength);
+	rsp.setIndex(tokenEnd + c.bodyLength);
+	rsp.parsePacket();
+}
+
+
+////////////////////////////////////////////////////
+////				Requests					////
+////////////////////////////////////////////////////
+
+/*	A free pending slot, or the one waiting longest	*/
+int CoapResponseCache::newPending(uns32 now) {
+	int oldest = 0;
+	for (int p = 0; p < COAP_CACHE_PENDING; p++) {
+		if (!pending[p].used)
+			return p;
+		if ((now - pending[p].sent) > (now - pending[oldest].sent))
+			oldest = p;
+	}
+	return oldest;
+}
+
+/*	A piggybacked response matches by the message ID of the request in
+	TXINDEX, a separate one by its token	*/
+int CoapResponseCache::findPending(const coap_endpoint &peer, CoapPacket &rsp, int txIndex) {
+	uns16 id = (txIndex >= 0) ? coap->getCoapPacket(TX, txIndex).getID() : 0;
+	uns8 tkl = rsp.getTokenLength();
+	
+	for (int p = 0; p < COAP_CACHE_PENDING; p++) {
+		coap_cache_pending &pend = pending[p];
+		if (!pend.used || !coap_endpoint_equal(pend.peer, peer))
+			continue;
+		if (txIndex >= 0) {
+			if (pend.id == id)
+				return p;
+		}
+		else if ((tkl > 0) && (pend.tokenLength == tkl) && (memcmp(pend.token, rsp.getTokenPtr(), tkl) == 0)) {
+			return p;
+		}
+	}
+	return -1;
+}
+
+/*	GETs are answered from the cache while fresh, and revalidated once stale
+	if the cached response has an ETag. Requests that already carry an ETag
+	are the application's own revalidation, and are sent as they are	*/
+int CoapResponseCache::request(const coap_endpoint &to, uns8 *packet, int len) {
+	if ((len < 4) || (len > MAX_SIZE))
+		return -1;
+	int x = coap->reserveTX(to);
+	if (x < 0)
+		return -1;
+	CoapPacket &req = coap->getCoapPacket(TX, x);
+	uns8 *buf = req.reservePacket(len);
+	if (buf == NULL) {
+		coap->clearQueue(TX, x);
+		return -1;
+	}
+	memcpy(buf, packet, len);
+	req.setIndex(len);
+	if ((req.parsePacket() != PARSE_OK) || (capacity == 0))
+		return coap->commitTX(x);
+	
+	uns8 method = req.getResponseCode();
+	
+	//Changing a resource makes its cached representation stale
+	if ((method == COAP_POST) || (method == COAP_PUT) || (method == COAP_DEL)) {
+		uns8 key[COAP_CACHE_KEY_SIZE];
+		uns16 keyLength = buildKey(req, to, COAP_GET, key);
+		int e = (keyLength > 0) ? find(key, keyLength, hash(key, keyLength)) : -1;
+		if (e >= 0)
+			remove(e);
+		return coap->commitTX(x);
+	}
+	if ((method != COAP_GET) || (req.findOption(OPT_ETAG) >= 0))
+		return coap->commitTX(x);
+	
+	//This may be the oldest request still waiting, which is given up on here
+	uns32 now = millis();
+	coap_cache_pending &pend = pending[newPending(now)];
+	pend.used = false;
+	pend.keyLength = buildKey(req, to, COAP_GET, pend.key);
+	if (pend.keyLength == 0)
+		return coap->commitTX(x);
+	pend.hash = hash(pend.key, pend.keyLength);
+	
+	int e = find(pend.key, pend.keyLength, pend.hash);
+	pend.revalidating = false;
+	if (e >= 0) {
+		unlinkLRU(e);
+		pushLRU(e);
+		if ((int32_t)(now - entries[e].expires) < 0) {
+			hitCount++;
+			serve(e, req);
+			coap->clearQueue(TX, x);
+			return CACHE_HIT;
+		}
+		if ((entries[e].etagLength > 0) &&
+			req.spliceOption(OPT_ETAG, entries[e].etagLength, entries[e].etag))
+			pend.revalidating = true;
+	}
+	missCount++;
+	
+	pend.used = true;
+	pend.peer = to;
+	pend.sent = now;
+	pend.id = req.getID();
+	pend.tokenLength = req.getTokenLength();
+	memcpy(pend.token, req.getTokenPtr(), pend.tokenLength);
+	if (coap->commitTX(x) < 0)
+		return -1;
+	return CACHE_SENT;
+}
+
+
+/*	Fresh response cached under KEY, or -1	*/
+int CoapResponseCache::lookup(const uns8 *key, uns16 keyLength) {
+	int e = find(key, keyLength, hash(key, keyLength));
+	if ((e < 0) || ((int32_t)(millis() - entries[e].expires) >= 0)) {
+		missCount++;
+		return -1;
+	}
+	unlinkLRU(e);
+	pushLRU(e);
+	hitCount++;
+	savedBytes += entries[e].bodyLength;
+	return e;
+}
+
+/*	Options and payload of the response in ENTRY, and its code	*/
+const uns8* CoapResponseCache::getBody(int entry, uns16 *len, uns8 *code) {
+	coap_cache_entry &c = entries[entry];
+	*len = c.bodyLength;
+	*code = c.code;
+	return c.data + c.keyLength + HEAD_ROOM;
+}
+
+/*	Caches RSP under KEY if it is a 2.05 Content. Returns the entry, or -1	*/
+int CoapResponseCache::keep(const uns8 *key, uns16 keyLength, CoapPacket &rsp) {
+	if (rsp.getResponseCode() != CODE_CONTENT)
+		return -1;
+	return store(key, keyLength, hash(key, keyLength), rsp, millis());
+}
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+/*	Keeps 2.05 responses to requests sent through request(), and answers
+	2.03 Valid with the cached response. The response always goes on to the
+	application	*/
+int CoapResponseCache::onResponse(int rxIndex, int txIndex) {
+	CoapPacket &rsp = coap->getCoapPacket(RX, rxIndex);
+	uns8 code = rsp.getResponseCode();
+	if (code == 0)
+		return 0;	//Empty ACK, the response comes separately
+	int p = findPending(coap->getPeer(RX, rxIndex), rsp, txIndex);
+	if (p < 0)
+		return 0;
+	coap_cache_pending &pend = pending[p];
+	pend.used = false;
+	
+	uns32 now = millis();
+	int e = find(pend.key, pend.keyLength, pend.hash);
+	if ((code == CODE_VALID) && pend.revalidating && (e >= 0)) {
+		revalidationCount++;
+		setFreshness(e, rsp, now);
+		restore(e, rsp);
+	}
+	else if (code == CODE_CONTENT) {
+		store(pend.key, pend.keyLength, pend.hash, rsp, now);
+	}
+	else if (e >= 0) {
+		remove(e);
+	}
+	return 0;
+}
+
+int CoapResponseCache::onTxFailure(int txIndex) {
+	CoapPacket &tx = coap->getCoapPacket(TX, txIndex);
+	coap_endpoint peer = coap->getPeer(TX, txIndex);
+	for (int p = 0; p < COAP_CACHE_PENDING; p++) {
+		if (pending[p].used && (pending[p].id == tx.getID()) && coap_endpoint_equal(pending[p].peer, peer))
+			pending[p].used = false;
+	}
+	return 0;
+}
+
+
+////////////////////////////////////////////////////
+////				Statistics					////
+////////////////////////////////////////////////////
+
+int CoapResponseCache::size() {
+	int n = 0;
+	for (int e = lruHead; e >= 0; e = entries[e].lruNext)
+		n++;
+	return n;
+}
+
+/*	Bytes in use: the tables, plus the keys and responses kept	*/
+uns32 CoapResponseCache::getMemoryUsage() {
+	return sizeof(CoapResponseCache) + (capacity * sizeof(coap_cache_entry)) +
+			((bucketMask + 1) * sizeof(int)) + used;
+}
+
+uns32 CoapResponseCache::hits() {
+	return hitCount;
+}
+
+uns32 CoapResponseCache::revalidations() {
+	return revalidationCount;
+}
+
+uns32 CoapResponseCache::misses() {
+	return missCount;
+}
+
+uns32 CoapResponseCache::evictions() {
+	return evictionCount;
+}
+
+/*	Share of GETs answered without a round trip	*/
+float CoapResponseCache::hitRatio() {
+	uns32 lookups = hitCount + missCount;
+	return (lookups > 0) ? (float)hitCount / lookups : 0;
+}
+
+/*	Bytes that didn't cross the network: requests and responses of fresh
+	hits, plus the part of each revalidated response a 2.03 didn't resend	*/
+uns32 CoapResponseCache::bytesSaved() {
+	return savedBytes;
+}
@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP client response cache, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_CACHE_h
+#define __COAP_CACHE_h
+
+#include "coap-protocol.h"
+
+//Bytes kept for cache keys and responses
+#ifndef COAP_CACHE_BUDGET
+#ifdef ARDUINO
+#define		COAP_CACHE_BUDGET			1024
+#else
+#define		COAP_CACHE_BUDGET			1048576
+#endif
+#endif
+//Most responses kept, whatever their size
+#ifndef COAP_CACHE_ENTRIES
+#ifdef ARDUINO
+#define		COAP_CACHE_ENTRIES			4
+#else
+#define		COAP_CACHE_ENTRIES			4096
+#endif
+#endif
+//Requests waiting for a response that may be cached
+#ifndef COAP_CACHE_PENDING
+#ifdef ARDUINO
+#define		COAP_CACHE_PENDING			2
+#else
+#define		COAP_CACHE_PENDING			64
+#endif
+#endif
+//Longest cache key. Requests with a longer one are sent uncached
+#ifndef COAP_CACHE_KEY_SIZE
+#ifdef ARDUINO
+#define		COAP_CACHE_KEY_SIZE			48
+#else
+#define		COAP_CACHE_KEY_SIZE			256
+#endif
+#endif
+//Max-Age of a response that doesn't say, in seconds (RFC 7252 5.10.5)
+#define		COAP_CACHE_DEFAULT_MAX_AGE	60
+#define		COAP_CACHE_ETAG_SIZE		8
+
+//request() results
+#define		CACHE_SENT					1		//Queued, possibly to revalidate a stale response
+#define		CACHE_HIT					2		//Answered from the cache
+
+//One cached response
+typedef struct {
+	uns8	*data;				//Key, then room for a header and token, then the response
+	uns32	hash;
+	uns32	expires;
+	uns16	keyLength;
+	uns16	bodyLength;			//Options and payload of the response
+	uns8	code;
+	uns8	etagLength;
+	uns8	etag[COAP_CACHE_ETAG_SIZE];
+	int		hashNext;
+	int		lruPrev;			//Towards the most recently used
+	int		lruNext;
+}	coap_cache_entry;
+
+//A request sent by request(), until its response arrives
+typedef struct {
+	coap_endpoint	peer;
+	uns32	hash;
+	uns32	sent;
+	uns16	id;
+	uns16	keyLength;
+	uns8	token[MAX_TOKENSIZE];
+	uns8	tokenLength;
+	bool	used;
+	bool	revalidating;		//Sent with the ETag of a stale entry
+	uns8	key[COAP_CACHE_KEY_SIZE];
+}	coap_cache_pending;
+
+/*	RFC 7252 5.6 response cache for the client side. GETs sent through
+	request() instead of addToTX() are looked up by their cache key: the
+	peer, the method and every option that isn't NoCacheKey. A fresh
+	response (younger than its Max-Age) is handed straight to
+	txSuccessHandler(), as if it had come back piggybacked, and nothing is
+	sent. A stale one with an ETag is revalidated: the request goes out with
+	that ETag, and a 2.03 Valid coming back is turned into the cached
+	response in the rx queue before the application sees it, so the payload
+	isn't sent twice. Keys and responses share a byte budget, and the least
+	recently used responses make room for new ones. PUT, POST and DELETE
+	sent through request() drop the cached GET response for their URI.
+	CoapProxy uses the cache through lookup() and keep() instead	*/
+class CoapResponseCache : public CoapExtension {
+private:
+	CoapProtocol		*coap;
+	coap_cache_entry	*entries;
+	int					*buckets;
+	int					capacity;
+	int					bucketMask;
+	int					freeHead;
+	int					lruHead;
+	int					lruTail;
+	uns32				budget;
+	uns32				used;
+	coap_cache_pending	pending[COAP_CACHE_PENDING];
+	
+	uns32				hitCount;
+	uns32				revalidationCount;
+	uns32				missCount;
+	uns32				evictionCount;
+	uns32				savedBytes;
+	
+	uns32	hash(const uns8 *key, uns16 len);
+	int		find(const uns8 *key, uns16 len, uns32 h);
+	void	unlinkLRU(int e);
+	void	pushLRU(int e);
+	void	remove(int e);
+	int		store(const uns8 *key, uns16 keyLength, uns32 h, CoapPacket &rsp, uns32 now);
+	void	setFreshness(int e, CoapPacket &rsp, uns32 now);
+	void	serve(int e, CoapPacket &req);
+	void	restore(int e, CoapPacket &rsp);
+	int		newPending(uns32 now);
+	int		findPending(const coap_endpoint &peer, CoapPacket &rsp, int txIndex);
+	
+public:
+	CoapResponseCache();
+	~CoapResponseCache();
+	
+	int		begin(CoapProtocol *protocol);
+	int		begin(CoapProtocol *protocol, uns32 budgetBytes, int maxEntries);
+	void	end();
+	void	clear();
+	
+	//Queues PACKET for TO like addToTX(), unless the cache can answer it.
+	//Returns CACHE_SENT, CACHE_HIT, or -1 if the tx queue is full
+	int		request(const coap_endpoint &to, uns8 *packet, int len);
+	
+	//For a proxy, which keeps its own requests: KEY is built by buildKey().
+	//lookup() counts a hit or a miss and returns a fresh response, or -1
+	static uns16	buildKey(CoapPacket &req, const coap_endpoint &peer, uns8 method, uns8 *key);
+	int		lookup(const uns8 *key, uns16 keyLength);
+	const uns8*	getBody(int entry, uns16 *len, uns8 *code);
+	int		keep(const uns8 *key, uns16 keyLength, CoapPacket &rsp);
+	
+	int		size();
+	uns32	getMemoryUsage();
+	uns32	hits();
+	uns32	revalidations();
+	uns32	misses();
+	uns32	evictions();
+	float	hitRatio();
+	uns32	bytesSaved();
+	
+	//CoapExtension hooks
+	int		onResponse(int rxIndex, int txIndex);
+	int		onTxFailure(int txIndex);
+};
+
+#endif
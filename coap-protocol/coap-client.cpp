@@ -0,0 +1,336 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP coroutine client (Linux host builds)
+// Written originally by Embedded Adventures
+
+#include "coap-client.h"
+
+#if defined(__cpp_impl_coroutine) && !defined(ARDUINO)
+
+#include <new>
+#include <exception>
+#include <stdint.h>
+#include "coap-pool.h"
+
+#define		SLOT_FREE			0
+#define		SLOT_SENT			1		//Waiting for the ACK or the response
+#define		SLOT_ACKED			2		//Empty ACK came, separate response to follow
+
+//What a coroutine frame from the pool starts with
+typedef struct {
+	uns8	*block;
+	uns16	capacity;
+}	coap_frame_header;
+
+#define		FRAME_ALIGN			16
+
+
+////////////////////////////////////////////////////
+////				Coroutines					////
+////////////////////////////////////////////////////
+
+/*	Frames are put FRAME_ALIGN aligned in a pool block, with the block they
+	came from just before them	*/
+void* CoapTask::promise_type::operator new(size_t size) noexcept {
+	size_t needed = size + sizeof(coap_frame_header) + FRAME_ALIGN - 1;
+	if (needed > MAX_SIZE)
+		return NULL;
+	uns16 capacity;
+	uns8 *block = coapBufferPool.allocate(needed, &capacity);
+	if (block == NULL)
+		return NULL;
+	
+	uintptr_t start = (uintptr_t)(block + sizeof(coap_frame_header));
+	uns8 *frame = (uns8*)((start + FRAME_ALIGN - 1) & ~(uintptr_t)(FRAME_ALIGN - 1));
+	coap_frame_header *header = (coap_frame_header*)(frame - sizeof(coap_frame_header));
+	header->block = block;
+	header->capacity = capacity;
+	return frame;
+}
+
+void CoapTask::promise_type::operator delete(void *frame, size_t size) {
+	coap_frame_header *header = (coap_frame_header*)((uns8*)frame - sizeof(coap_frame_header));
+	coapBufferPool.release(header->block, header->capacity);
+}
+
+void CoapTask::promise_type::unhandled_exception() {
+	std::terminate();
+}
+
+/*	Sends the request. If it can't be, the coroutine carries straight on with
+	COAP_REQUEST_NO_ROOM	*/
+bool CoapRequest::await_suspend(std::coroutine_handle<> handle) {
+	if (client->send(*this, handle))
+		return true;
+	result.status = client->ending ? COAP_REQUEST_CANCELLED : COAP_REQUEST_NO_ROOM;
+	result.code = 0;
+	result.packet = NULL;
+	return false;
+}
+
+
+////////////////////////////////////////////////////
+////				Setup						////
+////////////////////////////////////////////////////
+
+CoapClient::CoapClient() {
+	coap = NULL;
+	slots = NULL;
+	capacity = 0;
+	freeSlot = -1;
+	numPending = 0;
+	timeout = COAP_CLIENT_TIMEOUT;
+	ending = false;
+}
+
+CoapClient::~CoapClient() {
+	end();
+}
+
+int CoapClient::begin(CoapProtocol *protocol) {
+	return begin(protocol, COAP_CLIENT_REQUESTS);
+}
+
+/*	Hooks into PROTOCOL, after its begin(), with room for MAXREQUESTS (up to
+	65536) requests waited on at once. Returns 0 if out of memory	*/
+int CoapClient::begin(CoapProtocol *protocol, int maxRequests) {
+	end();
+	if ((maxRequests < 1) || (maxRequests > 0x10000))
+		return 0;
+	slots = new (std::nothrow) coap_client_slot[maxRequests];
+	if ((slots == NULL) || !timers.begin(maxRequests)) {
+		end();
+		return 0;
+	}
+	capacity = maxRequests;
+	for (int s = 0; s < capacity; s++) {
+		slots[s].state = SLOT_FREE;
+		slots[s].generation = 0;
+		slots[s].next = (s + 1 < capacity) ? s + 1 : -1;
+	}
+	freeSlot = 0;
+	numPending = 0;
+	ending = false;
+	
+	coap = protocol;
+	coap->addExtension(this);
+	return 1;
+}
+
+void CoapClient::end() {
+	if (slots != NULL) {
+		ending = true;
+		for (int s = 0; s < capacity; s++) {
+			if (slots[s].state != SLOT_FREE)
+				finish(s, COAP_REQUEST_CANCELLED, NULL);
+		}
+	}
+	delete[] slots;
+	slots = NULL;
+	timers.end();
+	capacity = 0;
+	freeSlot = -1;
+	numPending = 0;
+}
+
+void CoapClient::setTimeout(uns32 ms) {
+	timeout = ms;
+}
+
+int CoapClient::pending() {
+	return numPending;
+}
+
+
+////////////////////////////////////////////////////
+////				Requests					////
+////////////////////////////////////////////////////
+
+CoapRequest CoapClient::request(const coap_endpoint &to, uns8 method, const char *path,
+								const uns8 *payload, uns16 payloadLength, uns8 type) {
+	CoapRequest req;
+	req.client = this;
+	req.to = to;
+	req.tmpl = NULL;
+	req.type = type;
+	req.method = method;
+	req.path = path;
+	req.payload = payload;
+	req.payloadLength = payloadLength;
+	return req;
+}
+
+CoapRequest CoapClient::request(const coap_endpoint &to, CoapPacketTemplate &tmpl,
+								const uns8 *payload, uns16 payloadLength) {
+	CoapRequest req;
+	req.client = this;
+	req.to = to;
+	req.tmpl = &tmpl;
+	req.type = tmpl.type();
+	req.method = 0;
+	req.path = NULL;
+	req.payload = payload;
+	req.payloadLength = payloadLength;
+	return req;
+}
+
+/*	Takes a slot for REQ and queues it with the slot in its token.
+	Returns 0 if there is no slot or no room in the tx queue	*/
+int CoapClient::send(CoapRequest &req, std::coroutine_handle<> handle) {
+	if (ending || (freeSlot < 0))
+		return 0;
+	int s = freeSlot;
+	coap_client_slot &sl = slots[s];
+	uns8 token[CLIENT_TOKEN_LENGTH] = { CLIENT_TOKEN_TAG, sl.generation, (uns8)(s >> 8), (uns8)s };
+	
+	if (req.tmpl != NULL) {
+		if (coap->addToTX(req.to, *req.tmpl, token, CLIENT_TOKEN_LENGTH, req.payload, req.payloadLength) < 0)
+			return 0;
+	}
+	else {
+		int x = coap->reserveTX(req.to);
+		if (x < 0)
+			return 0;
+		CoapPacket &pkt = coap->getCoapPacket(TX, x);
+		pkt.addHeader(req.type, req.method, coap->nextMessageId(req.to));
+		pkt.addTokens(CLIENT_TOKEN_LENGTH, token);
+		pkt.addUriPath(req.path);
+		if ((req.payloadLength > 0) && !pkt.addPayload(req.payloadLength, req.payload)) {
+			coap->clearQueue(TX, x);
+			return 0;
+		}
+		coap->commitTX(x);
+	}
+	
+	freeSlot = sl.next;
+	sl.awaiting = &req;
+	sl.handle = handle;
+	sl.peer = req.to;
+	sl.state = SLOT_SENT;
+	numPending++;
+	//A CON is given up on by the protocol if it isn't ACKed
+	if (req.type != TYPE_CON)
+		timers.schedule(s, millis() + timeout);
+	return 1;
+}
+
+/*	Returns the slot of the request PKT (sent to or answered by PEER) belongs
+	to, or -1. OURS is set if PKT carries one of our tokens, even one of a
+	request that is over	*/
+int CoapClient::slotOf(CoapPacket &pkt, const coap_endpoint &peer, bool *ours) {
+	const uns8 *token = pkt.getTokenPtr();
+	*ours = (pkt.getTokenLength() == CLIENT_TOKEN_LENGTH) && (token[0] == CLIENT_TOKEN_TAG) &&
+			((((int)token[2] << 8) | token[3]) < capacity);
+	if (!*ours)
+		return -1;
+	int s = ((int)token[2] << 8) | token[3];
+	coap_client_slot &sl = slots[s];
+	if ((sl.state == SLOT_FREE) || (sl.generation != token[1]) || !coap_endpoint_equal(sl.peer, peer))
+		return -1;
+	return s;
+}
+
+/*	Frees slot S and resumes its coroutine with STATUS. The slot is free
+	before the coroutine runs, so it can send its next request from it	*/
+void CoapClient::finish(int s, int status, CoapPacket *rsp) {
+	coap_client_slot &sl = slots[s];
+	CoapRequest *req = sl.awaiting;
+	std::coroutine_handle<> handle = sl.handle;
+	
+	req->result.status = status;
+	req->result.code = (rsp != NULL) ? rsp->getResponseCode() : 0;
+	req->result.packet = rsp;
+	
+	timers.cancel(s);
+	sl.state = SLOT_FREE;
+	sl.generation++;
+	sl.next = freeSlot;
+	freeSlot = s;
+	numPending--;
+	handle.resume();
+}
+
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+int CoapClient::onResponse(int rxIndex, int txIndex) {
+	CoapPacket &rsp = coap->getCoapPacket(RX, rxIndex);
+	bool ours;
+	//An empty ACK has no token, so go by the request it ACKs
+	int s = (txIndex >= 0) ? slotOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours)
+						   : slotOf(rsp, coap->getPeer(RX, rxIndex), &ours);
+	if (s < 0)
+		return ours;	//Late answer to a request that is over
+	if (rsp.getResponseCode() == 0) {
+		slots[s].state = SLOT_ACKED;
+		timers.schedule(s, millis() + timeout);
+		return 1;
+	}
+	finish(s, COAP_REQUEST_OK, &rsp);
+	return 1;
+}
+
+int CoapClient::onTxFailure(int txIndex) {
+	bool ours;
+	int s = slotOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours);
+	if (s >= 0)
+		finish(s, COAP_REQUEST_FAILED, NULL);
+	return ours;
+}
+
+int CoapClient::onReset(int rxIndex, int txIndex) {
+	if (txIndex < 0)
+		return 0;
+	bool ours;
+	int s = slotOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours);
+	if (s >= 0)
+		finish(s, COAP_REQUEST_RESET, NULL);
+	return ours;
+}
+
+/*	Gives up on requests whose response never came	*/
+int CoapClient::poll(uns32 now) {
+	int due[COAP_BATCH_SIZE];
+	int count;
+	while ((count = timers.expire(now, due, COAP_BATCH_SIZE)) > 0) {
+		for (int n = 0; n < count; n++) {
+			finish(due[n], COAP_REQUEST_TIMEOUT, NULL);
+		}
+	}
+	return 0;
+}
+
+int CoapClient::nextDeadline(uns32 *deadline) {
+	return timers.next(deadline);
+}
+
+#endif
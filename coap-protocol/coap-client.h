@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP coroutine client (Linux host builds)
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_CLIENT_h
+#define __COAP_CLIENT_h
+
+#include "coap-protocol.h"
+
+//Needs C++20 coroutines, so it is only there when the compiler has them
+//(g++ -std=c++20 on Linux) and never on Arduino
+#if defined(__cpp_impl_coroutine) && !defined(ARDUINO)
+
+#include <coroutine>
+#include "coap-timer.h"
+
+//Requests that can be waited on at once
+#ifndef COAP_CLIENT_REQUESTS
+#define		COAP_CLIENT_REQUESTS	1024
+#endif
+//How long a request waits for its response once it is sent, or once its CON
+//is ACKed without one
+#ifndef COAP_CLIENT_TIMEOUT
+#define		COAP_CLIENT_TIMEOUT		(MAJOR_TIMEOUT * 1000UL + MAX_LATENCY * 1000UL)
+#endif
+
+#define		CLIENT_TOKEN_LENGTH		4		//CLIENT_TOKEN_TAG, generation, 16 bit slot
+#define		CLIENT_TOKEN_TAG		0xC1
+
+//How a request ended
+#define		COAP_REQUEST_OK			0		//Answered, see code and packet
+#define		COAP_REQUEST_TIMEOUT	1		//Sent, or ACKed, and never answered
+#define		COAP_REQUEST_FAILED		2		//The CON was never ACKed
+#define		COAP_REQUEST_RESET		3		//The peer sent RST
+#define		COAP_REQUEST_NO_ROOM	4		//No request or tx slot free, nothing was sent
+#define		COAP_REQUEST_CANCELLED	5		//end() was called first
+
+typedef struct {
+	int			status;			//COAP_REQUEST_xxx
+	uns8		code;			//Response code, 0 unless COAP_REQUEST_OK
+	CoapPacket	*packet;		//The response in the rx queue, until the coroutine next
+								//suspends or returns. NULL unless COAP_REQUEST_OK
+}	coap_response;
+
+class CoapClient;
+
+/*	What co_await CoapClient::request() waits on. The request is sent when the
+	coroutine suspends, and it is resumed from process_rx_queue() or
+	process_tx_queue() with the outcome	*/
+class CoapRequest {
+private:
+	friend class CoapClient;
+	CoapClient			*client;
+	coap_endpoint		to;
+	CoapPacketTemplate	*tmpl;
+	uns8				type;
+	uns8				method;
+	const char			*path;
+	const uns8			*payload;
+	uns16				payloadLength;
+	coap_response		result;
+	
+public:
+	bool	await_ready() { return false; }
+	bool	await_suspend(std::coroutine_handle<> handle);
+	coap_response	await_resume() { return result; }
+};
+
+/*	Return type of a coroutine that awaits requests. It runs as soon as it is
+	called, up to its first co_await, and frees itself when it returns. Its
+	frame comes from coapBufferPool rather than the heap; if the pool has no
+	room for it the coroutine never runs and started is false	*/
+class CoapTask {
+public:
+	struct promise_type {
+		CoapTask			get_return_object() { return CoapTask(true); }
+		static CoapTask		get_return_object_on_allocation_failure() { return CoapTask(false); }
+		std::suspend_never	initial_suspend() noexcept { return {}; }
+		std::suspend_never	final_suspend() noexcept { return {}; }
+		void				return_void() {}
+		void				unhandled_exception();
+		
+		static void*	operator new(size_t size) noexcept;
+		static void		operator delete(void *frame, size_t size);
+	};
+	
+	bool	started;
+	
+	explicit CoapTask(bool running) : started(running) {}
+};
+
+//A request being waited on
+typedef struct {
+	CoapRequest				*awaiting;		//In the waiting coroutine's frame
+	std::coroutine_handle<>	handle;
+	coap_endpoint			peer;
+	int						next;			//Free list
+	uns8					generation;
+	uns8					state;
+}	coap_client_slot;
+
+/*	Requests a coroutine can co_await instead of matching responses up in the
+	global callbacks:
+	
+		CoapTask readTemp(CoapClient &client, coap_endpoint sensor) {
+			coap_response rsp = co_await client.request(sensor, COAP_GET, "sensors/temp");
+			if (rsp.status == COAP_REQUEST_OK)
+				...
+		}
+	
+	Responses are matched by token, which holds the request's slot, so finding
+	the waiting coroutine takes no search. Each slot has a generation, so a
+	late answer to a request that timed out is never taken for the next one
+	in the same slot. All calls must come from the thread running the
+	protocol, as coroutines are resumed from its process calls	*/
+class CoapClient : public CoapExtension {
+private:
+	friend class CoapRequest;
+	CoapProtocol		*coap;
+	coap_client_slot	*slots;
+	int					capacity;
+	int					freeSlot;
+	int					numPending;
+	CoapTimerWheel		timers;
+	uns32				timeout;
+	bool				ending;
+	
+	int		slotOf(CoapPacket &pkt, const coap_endpoint &peer, bool *ours);
+	int		send(CoapRequest &req, std::coroutine_handle<> handle);
+	void	finish(int s, int status, CoapPacket *rsp);
+	
+public:
+	CoapClient();
+	~CoapClient();
+	
+	int		begin(CoapProtocol *protocol);
+	int		begin(CoapProtocol *protocol, int maxRequests);
+	//Resumes every coroutine still waiting with COAP_REQUEST_CANCELLED
+	void	end();
+	void	setTimeout(uns32 ms);
+	
+	//METHOD request for PATH ("a/b/c"), with PAYLOAD if LEN > 0. PATH and
+	//PAYLOAD must stay valid until the coroutine suspends
+	CoapRequest	request(const coap_endpoint &to, uns8 method, const char *path,
+						const uns8 *payload = NULL, uns16 payloadLength = 0, uns8 type = TYPE_CON);
+	//Request stamped from TMPL, with this request's token and PAYLOAD
+	CoapRequest	request(const coap_endpoint &to, CoapPacketTemplate &tmpl,
+						const uns8 *payload = NULL, uns16 payloadLength = 0);
+	int		pending();
+	
+	//CoapExtension hooks
+	int		onResponse(int rxIndex, int txIndex);
+	int		onTxFailure(int txIndex);
+	int		onReset(int rxIndex, int txIndex);
+	int		poll(uns32 now);
+	int		nextDeadline(uns32 *deadline);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP duplicate detection, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-dedup.h"
+
+#if COAP_WITH_DEDUP
+
+CoapDedupCache::CoapDedupCache() {
+	entries = NULL;
+	responses = NULL;
+	capacity = 0;
+	lifetime = 0;
+	hitCount = 0;
+	missCount = 0;
+	evictionCount = 0;
+}
+
+CoapDedupCache::~CoapDedupCache() {
+	end();
+}
+
+/*	Takes as many entries as fit in BUDGETBYTES (rounded down to a power of 2),
+	each remembered for LIFETIMEMS. A budget too small for one entry turns
+	duplicate detection off. Returns 0 if out of memory	*/
+int CoapDedupCache::begin(uns32 budgetBytes, uns32 lifetimeMs) {
+	end();
+	
+	uns32 fit = budgetBytes / (sizeof(coap_dedup_entry) + COAP_DEDUP_RESPONSE_SIZE);
+	int count = 1;
+	if (fit == 0)
+		return 1;
+	while ((uns32)(count << 1) <= fit)
+		count <<= 1;
+	
+	entries = new (std::nothrow) coap_dedup_entry[count];
+	responses = new (std::nothrow) uns8[count * COAP_DEDUP_RESPONSE_SIZE];
+	if ((entries == NULL) || (responses == NULL)) {
+		end();
+		return 0;
+	}
+	capacity = count;
+	lifetime = lifetimeMs;
+	clear();
+	return 1;
+}
+
+void CoapDedupCache::end() {
+	delete[] entries;
+	delete[] responses;
+	entries = NULL;
+	responses = NULL;
+	capacity = 0;
+}
+
+/*	Forgets everything and zeroes the counters	*/
+void CoapDedupCache::clear() {
+	for (int i = 0; i < capacity; i++) {
+		entries[i].state = DEDUP_EMPTY;
+	}
+	hitCount = 0;
+	missCount = 0;
+	evictionCount = 0;
+}
+
+uns32 CoapDedupCache::hash(const coap_endpoint &peer, uns16 id) {
+	uns32 h = (peer.addr * 2654435761UL) ^ (((uns32)peer.port << 16) | id);
+	h ^= h >> 15;
+	h *= 2246822519UL;
+	h ^= h >> 13;
+	return h;
+}
+
+/*	Returns the live entry for (PEER, ID), or -1	*/
+int CoapDedupCache::find(const coap_endpoint &peer, uns16 id, uns32 now) {
+	int mask = capacity - 1;
+	int slot = hash(peer, id) & mask;
+	int probes = (capacity < COAP_DEDUP_PROBES) ? capacity : COAP_DEDUP_PROBES;
+	
+	for (int p = 0; p < probes; p++, slot = (slot + 1) & mask) {
+		coap_dedup_entry &e = entries[slot];
+		if ((e.state != DEDUP_EMPTY) && (e.id == id) && (e.addr == peer.addr) && (e.port == peer.port)
+				&& ((int32_t)(now - e.expires) < 0))
+			return slot;
+	}
+	return -1;
+}
+
+int CoapDedupCache::check(const coap_endpoint &peer, uns16 id, uns32 now) {
+	if (capacity == 0)
+		return -1;
+	
+	int slot = find(peer, id, now);
+	if (slot >= 0) {
+		hitCount++;
+		return slot;
+	}
+	missCount++;
+	
+	//Take the first free or expired slot in the run, otherwise the oldest
+	int mask = capacity - 1;
+	int probes = (capacity < COAP_DEDUP_PROBES) ? capacity : COAP_DEDUP_PROBES;
+	int home = hash(peer, id) & mask;
+	int victim = home;
+	bool evict = true;
+	for (int p = 0; p < probes; p++) {
+		int s = (home + p) & mask;
+		coap_dedup_entry &e = entries[s];
+		if ((e.state == DEDUP_EMPTY) || ((int32_t)(now - e.expires) >= 0)) {
+			victim = s;
+			evict = false;
+			break;
+		}
+		if ((int32_t)(e.expires - entries[victim].expires) < 0)
+			victim = s;
+	}
+	if (evict)
+		evictionCount++;
+	
+	coap_dedup_entry &e = entries[victim];
+	e.addr = peer.addr;
+	e.port = peer.port;
+	e.id = id;
+	e.expires = now + lifetime;
+	e.length = 0;
+	e.state = DEDUP_SEEN;
+	return -1;
+}
+
+/*	A response too big to keep makes the cache forget the message, so a
+	duplicate of it goes to the application like a new one	*/
+void CoapDedupCache::storeResponse(const coap_endpoint &peer, uns16 id, const uns8 *data, int len, uns32 now) {
+	if (capacity == 0)
+		return;
+	int slot = find(peer, id, now);
+	if (slot < 0)
+		return;
+	
+	coap_dedup_entry &e = entries[slot];
+	if (len > COAP_DEDUP_RESPONSE_SIZE) {
+		e.state = DEDUP_EMPTY;
+		return;
+	}
+	memcpy(responses + (slot * COAP_DEDUP_RESPONSE_SIZE), data, len);
+	e.length = len;
+	e.state = DEDUP_ANSWERED;
+}
+
+const uns8* CoapDedupCache::getResponse(int entry, int *len) {
+	if (entries[entry].state != DEDUP_ANSWERED)
+		return NULL;
+	*len = entries[entry].length;
+	return responses + (entry * COAP_DEDUP_RESPONSE_SIZE);
+}
+
+int CoapDedupCache::getCapacity() {
+	return capacity;
+}
+
+/*	Bytes taken by the entries and stored responses	*/
+uns32 CoapDedupCache::getMemoryUsage() {
+	return capacity * (sizeof(coap_dedup_entry) + COAP_DEDUP_RESPONSE_SIZE);
+}
+
+uns32 CoapDedupCache::hits() {
+	return hitCount;
+}
+
+uns32 CoapDedupCache::misses() {
+	return missCount;
+}
+
+uns32 CoapDedupCache::evictions() {
+	return evictionCount;
+}
+
+#endif	//COAP_WITH_DEDUP
@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP duplicate detection, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_DEDUP_h
+#define __COAP_DEDUP_h
+
+#include "coap-packet.h"
+#include "coap-transport.h"
+
+//Bytes given to the cache by CoapProtocol::begin()
+#ifndef COAP_DEDUP_BUDGET
+#ifdef ARDUINO
+#define		COAP_DEDUP_BUDGET			2048
+#else
+#define		COAP_DEDUP_BUDGET			32768
+#endif
+#endif
+//Largest response that can be replayed. Bigger ones are not remembered
+#ifndef COAP_DEDUP_RESPONSE_SIZE
+#ifdef ARDUINO
+#define		COAP_DEDUP_RESPONSE_SIZE	32
+#else
+#define		COAP_DEDUP_RESPONSE_SIZE	256
+#endif
+#endif
+//How many slots from its home slot an entry may be placed
+#define		COAP_DEDUP_PROBES			8
+
+#define		DEDUP_EMPTY					0
+#define		DEDUP_SEEN					1		//Received, not answered yet
+#define		DEDUP_ANSWERED				2		//Response stored
+
+//Declared even when it isn't built, for CoapProtocol::getDedupCache()
+class CoapDedupCache;
+
+#if COAP_WITH_DEDUP
+
+//One remembered message
+typedef struct {
+	uns32	addr;
+	uns32	expires;
+	uns16	port;
+	uns16	id;
+	uns16	length;		//Of the stored response
+	uns8	state;
+}	coap_dedup_entry;
+
+/*	Remembers the (peer, message ID) of recent CON and NON messages for
+	EXCHANGE_LIFETIME, along with the ACK or RST sent back, so that a
+	retransmission can be answered again without the application seeing it
+	twice (RFC 7252 4.5). Open addressing with linear probing, limited to
+	COAP_DEDUP_PROBES slots so a lookup never touches more than one short
+	run. When the run is full the entry closest to expiring is evicted.
+	All memory is taken once in begin()	*/
+class CoapDedupCache {
+private:
+	coap_dedup_entry	*entries;
+	uns8				*responses;		//COAP_DEDUP_RESPONSE_SIZE bytes per entry
+	int					capacity;
+	uns32				lifetime;
+	uns32				hitCount;
+	uns32				missCount;
+	uns32				evictionCount;
+	
+	uns32	hash(const coap_endpoint &peer, uns16 id);
+	int		find(const coap_endpoint &peer, uns16 id, uns32 now);
+	
+public:
+	CoapDedupCache();
+	~CoapDedupCache();
+	
+	int		begin(uns32 budgetBytes, uns32 lifetimeMs);
+	void	end();
+	void	clear();
+	
+	//Returns the entry for a message already seen (a duplicate), or -1 after
+	//remembering it as new. Counts a hit or a miss
+	int		check(const coap_endpoint &peer, uns16 id, uns32 now);
+	//Keeps the response sent to PEER for message ID, so duplicates can be answered
+	void	storeResponse(const coap_endpoint &peer, uns16 id, const uns8 *data, int len, uns32 now);
+	//Stored response of ENTRY, or NULL if it hasn't been answered yet
+	const uns8*	getResponse(int entry, int *len);
+	
+	int		getCapacity();
+	uns32	getMemoryUsage();
+	uns32	hits();
+	uns32	misses();
+	uns32	evictions();
+};
+
+#endif	//COAP_WITH_DEDUP
+
+#endif
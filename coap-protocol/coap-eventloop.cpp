@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP event loop driver (Linux host builds)
+// Written originally by Embedded Adventures
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include "coap-eventloop.h"
+
+//epoll data of the eventfd; protocols use their index
+#define		WAKE_EVENT		COAP_LOOP_PROTOCOLS
+
+CoapEventLoop::CoapEventLoop() {
+	epfd = -1;
+	wakeFd = -1;
+	numProtocols = 0;
+	stopping = 0;
+	wakeups = 0;
+}
+
+CoapEventLoop::~CoapEventLoop() {
+	end();
+}
+
+int CoapEventLoop::begin() {
+	end();
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((epfd < 0) || (wakeFd < 0)) {
+		end();
+		return 0;
+	}
+	
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = WAKE_EVENT;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev) < 0) {
+		end();
+		return 0;
+	}
+	__atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+	return 1;
+}
+
+void CoapEventLoop::end() {
+	if (epfd >= 0)
+		close(epfd);
+	if (wakeFd >= 0)
+		close(wakeFd);
+	epfd = -1;
+	wakeFd = -1;
+	numProtocols = 0;
+}
+
+int CoapEventLoop::add(CoapProtocol *protocol) {
+	int fd = protocol->getFd();
+	if ((epfd < 0) || (fd < 0) || (numProtocols == COAP_LOOP_PROTOCOLS))
+		return 0;
+	
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = numProtocols;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return 0;
+	protocols[numProtocols] = protocol;
+	reading[numProtocols] = true;
+	numProtocols++;
+	return 1;
+}
+
+/*	Waits on protocol P's socket only while it has room in its rx queue.
+	Otherwise a full queue would wake the loop for as long as datagrams are
+	left in the socket	*/
+int CoapEventLoop::watch(int p, bool read) {
+	if (reading[p] == read)
+		return 1;
+	
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = read ? (uns32)EPOLLIN : 0u;
+	ev.data.u32 = p;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, protocols[p]->getFd(), &ev) < 0)
+		return 0;
+	reading[p] = read;
+	return 1;
+}
+
+int CoapEventLoop::runOnce(int maxWait) {
+	int					timeouts[COAP_LOOP_PROTOCOLS];
+	bool				ready[COAP_LOOP_PROTOCOLS];
+	struct epoll_event	events[COAP_LOOP_PROTOCOLS + 1];
+	
+	if ((epfd < 0) || __atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+		return 0;
+	
+	int wait = maxWait;
+	for (int p = 0; p < numProtocols; p++) {
+		watch(p, protocols[p]->canReceive());
+		timeouts[p] = protocols[p]->nextTimeout();
+		ready[p] = false;
+		if ((timeouts[p] >= 0) && ((wait < 0) || (timeouts[p] < wait)))
+			wait = timeouts[p];
+	}
+	
+	uns32 start = millis();
+	int n = epoll_wait(epfd, events, COAP_LOOP_PROTOCOLS + 1, wait);
+	if ((n < 0) && (errno != EINTR))
+		return 0;
+	wakeups++;
+	
+	for (int e = 0; e < n; e++) {
+		if (events[e].data.u32 == WAKE_EVENT) {
+			uint64_t count;
+			while (read(wakeFd, &count, sizeof(count)) > 0) {}
+		}
+		else {
+			ready[events[e].data.u32] = true;
+		}
+	}
+	
+	//Sockets that are readable and deadlines that have come up
+	int waited = (int)(millis() - start);
+	for (int p = 0; p < numProtocols; p++) {
+		if (ready[p] || ((timeouts[p] >= 0) && (timeouts[p] <= waited))) {
+			protocols[p]->process_rx_queue();
+			protocols[p]->process_tx_queue();
+		}
+	}
+	return !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+}
+
+void CoapEventLoop::run() {
+	while (runOnce(-1)) {}
+}
+
+/*	Makes run() return. Safe to call from another thread or a signal handler	*/
+void CoapEventLoop::stop() {
+	uint64_t one = 1;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	ssize_t written = write(wakeFd, &one, sizeof(one));
+	(void)written;
+}
+
+int CoapEventLoop::getFd() {
+	return epfd;
+}
+
+/*	Earliest nextTimeout() of the protocols, -1 if none has a deadline	*/
+int CoapEventLoop::nextTimeout() {
+	int wait = -1;
+	for (int p = 0; p < numProtocols; p++) {
+		int t = protocols[p]->nextTimeout();
+		if ((t >= 0) && ((wait < 0) || (t < wait)))
+			wait = t;
+	}
+	return wait;
+}
+
+uns32 CoapEventLoop::wakeupCount() {
+	return wakeups;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP event loop driver (Linux host builds)
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_EVENTLOOP_h
+#define __COAP_EVENTLOOP_h
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include "coap-protocol.h"
+
+//CoapProtocol instances one loop can drive
+#ifndef COAP_LOOP_PROTOCOLS
+#define		COAP_LOOP_PROTOCOLS		8
+#endif
+
+/*	Runs CoapProtocol instances only when they have work, instead of calling
+	process_rx_queue() and process_tx_queue() in a tight loop. It sleeps in
+	epoll_wait() until a transport's socket is readable or the next
+	retransmission, response or extension deadline (nextTimeout()) comes up.
+	
+	run() is the whole loop. To fit into a loop a program already has, wait
+	on getFd() (readable when any transport is) for at most nextTimeout() ms
+	alongside everything else, then call runOnce(0). Packets queued from
+	outside the loop's callbacks are picked up on its next wake up, so call
+	runOnce(0) after queueing them too	*/
+class CoapEventLoop {
+private:
+	int				epfd;
+	int				wakeFd;			//eventfd, so stop() works from any thread
+	CoapProtocol	*protocols[COAP_LOOP_PROTOCOLS];
+	bool			reading[COAP_LOOP_PROTOCOLS];
+	int				numProtocols;
+	int				stopping;
+	uns32			wakeups;
+	
+	int		watch(int p, bool read);
+	
+public:
+	CoapEventLoop();
+	~CoapEventLoop();
+	
+	//Returns 0 if epoll or the eventfd can't be had
+	int		begin();
+	void	end();
+	//Drives PROTOCOL, which must have begun. Returns 0 if its transport has no
+	//fd or the loop is full
+	int		add(CoapProtocol *protocol);
+	
+	//Waits up to MAXWAIT ms (-1 for as long as it takes) for a socket or a
+	//deadline, then processes whatever is due. Returns 0 once stop() is called
+	int		runOnce(int maxWait);
+	//runOnce() until stop()
+	void	run();
+	void	stop();
+	
+	int		getFd();
+	int		nextTimeout();
+	uns32	wakeupCount();
+};
+
+#endif
+
+#endif
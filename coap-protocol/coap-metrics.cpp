@@ -0,0 +1,117 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP runtime metrics, Arduino library
+// Written originally by Embedded Adventures
+
+#include "coap-metrics.h"
+
+#if COAP_WITH_METRICS
+
+#include <stdio.h>
+
+static const char *counterNames[COAP_METRIC_COUNTERS] = {
+	"rx_packets", "rx_bytes", "tx_packets", "tx_bytes", "retransmits", "dedup_hits",
+	"tx_failures", "late_responses", "resets", "send_errors", "rx_queue_full",
+	"drop_malformed", "drop_unmatched", "drop_expired", "drop_tx_full", "drop_no_memory",
+	"drop_truncated"
+};
+
+static const char *histogramNames[COAP_HISTOGRAMS] = {"rtt_ms", "rx_queue_ms", "tx_queue_ms"};
+
+CoapMetrics::CoapMetrics() {
+	sequence = 0;
+	clear();
+}
+
+void CoapMetrics::clear() {
+	writeBegin();
+	memset(&m, 0, sizeof(m));
+	writeEnd();
+}
+
+/*	Copies the metrics into COPY as they were between two updates	*/
+void CoapMetrics::snapshot(coap_metrics *copy) {
+#ifdef ARDUINO
+	*copy = m;
+#else
+	uns32 before, after;
+	do {
+		before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+		memcpy(copy, &m, sizeof(m));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) || (before != after));
+#endif
+}
+
+/*	Writes line LINE of the text form of M into BUF, which COAP_METRICS_LINE
+	bytes are enough for. Returns its length, or 0 past the last line	*/
+int CoapMetrics::formatLine(const coap_metrics &m, int line, char *buf, int size) {
+	static const char *gauges[4] = {"rx_in_use", "tx_in_use", "rx_high_water", "tx_high_water"};
+	uns16 gaugeValues[4] = {m.inUse[1], m.inUse[0], m.highWater[1], m.highWater[0]};
+	
+	if (line < COAP_METRIC_COUNTERS)
+		return snprintf(buf, size, "%s %lu\n", counterNames[line], (unsigned long)m.counters[line]);
+	line -= COAP_METRIC_COUNTERS;
+	if (line < 4)
+		return snprintf(buf, size, "%s %u\n", gauges[line], (unsigned)gaugeValues[line]);
+	line -= 4;
+	if (line >= COAP_HISTOGRAMS)
+		return 0;
+	int n = snprintf(buf, size, "%s", histogramNames[line]);
+	for (int b = 0; b < COAP_HISTOGRAM_BUCKETS; b++) {
+		n += snprintf(buf + n, size - n, " %lu", (unsigned long)m.histograms[line][b]);
+	}
+	n += snprintf(buf + n, size - n, "\n");
+	return n;
+}
+
+int CoapMetrics::format(const coap_metrics &m, char *buf, int size) {
+	char text[COAP_METRICS_LINE];
+	int len = 0;
+	int n;
+	
+	for (int line = 0; (n = formatLine(m, line, text, sizeof(text))) > 0; line++) {
+		if (len + n > size)
+			break;
+		memcpy(buf + len, text, n);
+		len += n;
+	}
+	return len;
+}
+
+void CoapMetrics::print(const coap_metrics &m) {
+	char text[COAP_METRICS_LINE];
+	for (int line = 0; formatLine(m, line, text, sizeof(text)) > 0; line++) {
+		coap_printf("%s", text);
+	}
+}
+
+#endif	//COAP_WITH_METRICS
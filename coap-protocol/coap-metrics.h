@@ -0,0 +1,179 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP runtime metrics, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_METRICS_h
+#define __COAP_METRICS_h
+
+#include "coap-packet.h"
+
+//Counters
+#define		COAP_METRIC_RX_PACKETS			0
+#define		COAP_METRIC_RX_BYTES			1
+#define		COAP_METRIC_TX_PACKETS			2		//Retransmissions included
+#define		COAP_METRIC_TX_BYTES			3
+#define		COAP_METRIC_RETRANSMITS			4
+#define		COAP_METRIC_DEDUP_HITS			5		//Duplicates answered from the dedup cache
+#define		COAP_METRIC_TX_FAILURES			6		//CONs never ACKed
+#define		COAP_METRIC_LATE_RESPONSES		7		//CONs not answered before their ACK was due
+#define		COAP_METRIC_RESETS				8		//RSTs received
+#define		COAP_METRIC_SEND_ERRORS			9		//Datagrams the transport didn't take, sent again later
+#define		COAP_METRIC_RX_QUEUE_FULL		10		//Times the rx queue filled up. Until a slot is
+													//free datagrams wait in the socket, which may drop them
+//Drops, by reason
+#define		COAP_METRIC_DROP_MALFORMED		11		//Didn't parse
+#define		COAP_METRIC_DROP_UNMATCHED		12		//ACK for no CON in the tx queue
+#define		COAP_METRIC_DROP_EXPIRED		13		//NON never processed
+#define		COAP_METRIC_DROP_TX_FULL		14		//No free tx slot for addToTX() or reserveTX()
+#define		COAP_METRIC_DROP_NO_MEMORY		15		//No pool buffer for a packet being queued
+#define		COAP_METRIC_DROP_TRUNCATED		16		//Datagram bigger than MAX_SIZE, cut short by the transport
+#define		COAP_METRIC_COUNTERS			17
+
+//Histograms, in ms. Bucket 0 counts times under 1 ms, bucket B times from
+//2^(B-1) to 2^B - 1 ms, and the last bucket everything longer
+#define		COAP_HISTOGRAM_RTT				0		//CON sent once to its ACK
+#define		COAP_HISTOGRAM_RX_QUEUE			1		//Received to packetProcessed(), or to being
+													//answered by an extension
+#define		COAP_HISTOGRAM_TX_QUEUE			2		//Queued to first sent
+#define		COAP_HISTOGRAMS					3
+#define		COAP_HISTOGRAM_BUCKETS			16
+
+//Longest line of format()
+#define		COAP_METRICS_LINE				(16 + COAP_HISTOGRAM_BUCKETS * 11)
+
+/*	Everything CoapMetrics keeps. inUse and highWater are indexed by RX and
+	TX; inUse is as of the last process_rx_queue() or process_tx_queue()	*/
+typedef struct {
+	uns32	counters[COAP_METRIC_COUNTERS];
+	uns32	histograms[COAP_HISTOGRAMS][COAP_HISTOGRAM_BUCKETS];
+	uns16	inUse[2];
+	uns16	highWater[2];
+}	coap_metrics;
+
+#if COAP_WITH_METRICS
+
+/*	Counters, histograms and queue gauges for one CoapProtocol. Only its own
+	thread updates them, each update between two increments of a sequence
+	number, so snapshot() can copy them from any other thread without
+	locking or slowing it down: it copies again if the sequence was odd, or
+	changed while it copied. On Arduino there is only the one thread	*/
+class CoapMetrics {
+private:
+	coap_metrics	m;
+	uns32			sequence;
+	
+	inline void	writeBegin() {
+#ifndef ARDUINO
+		__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+	}
+	inline void	writeEnd() {
+#ifndef ARDUINO
+		__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+#endif
+	}
+	static int	formatLine(const coap_metrics &m, int line, char *buf, int size);
+	
+public:
+	CoapMetrics();
+	
+	//Protocol's thread only
+	void	clear();
+	inline void	count(int counter, uns32 n = 1) {
+		writeBegin();
+		m.counters[counter] += n;
+		writeEnd();
+	}
+	inline void	record(int histogram, uns32 ms) {
+		int bucket = 0;
+		while ((ms > 0) && (bucket < COAP_HISTOGRAM_BUCKETS - 1)) {
+			ms >>= 1;
+			bucket++;
+		}
+		writeBegin();
+		m.histograms[histogram][bucket]++;
+		writeEnd();
+	}
+	//A packet of BYTES received into a queue now holding INUSE
+	inline void	received(int bytes, int inUse) {
+		writeBegin();
+		m.counters[COAP_METRIC_RX_PACKETS]++;
+		m.counters[COAP_METRIC_RX_BYTES] += bytes;
+		m.inUse[1] = inUse;
+		if (inUse > m.highWater[1])
+			m.highWater[1] = inUse;
+		writeEnd();
+	}
+	//A packet of BYTES sent for the TRANSMISSION'th time
+	inline void	sent(int bytes, int transmission) {
+		writeBegin();
+		m.counters[COAP_METRIC_TX_PACKETS]++;
+		m.counters[COAP_METRIC_TX_BYTES] += bytes;
+		if (transmission > 1)
+			m.counters[COAP_METRIC_RETRANSMITS]++;
+		writeEnd();
+	}
+	//Slots in use in queue RX or TX
+	inline void	occupancy(int queue, int inUse) {
+		writeBegin();
+		m.inUse[queue] = inUse;
+		if (inUse > m.highWater[queue])
+			m.highWater[queue] = inUse;
+		writeEnd();
+	}
+	
+	//Any thread
+	void	snapshot(coap_metrics *copy);
+	
+	//Writes M as text, one "name value" line per counter and gauge and one
+	//"name count count ..." line per histogram, into BUF. Returns the length,
+	//cut short at a line end if SIZE isn't enough
+	static int	format(const coap_metrics &m, char *buf, int size);
+	static void	print(const coap_metrics &m);
+};
+
+#else
+
+//Built out: every update is empty
+class CoapMetrics {
+public:
+	void	clear() {}
+	void	count(int counter, uns32 n = 1) {}
+	void	record(int histogram, uns32 ms) {}
+	void	received(int bytes, int inUse) {}
+	void	sent(int bytes, int transmission) {}
+	void	occupancy(int queue, int inUse) {}
+};
+
+#endif	//COAP_WITH_METRICS
+
+#endif
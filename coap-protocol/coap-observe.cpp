@@ -0,0 +1,463 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP observe server, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-observe.h"
+
+#if COAP_WITH_OBSERVE
+
+#if (COAP_OBSERVE_SIZE + 4 + MAX_TOKENSIZE) > MAX_SIZE
+#error COAP_OBSERVE_SIZE leaves no room for the header and token
+#endif
+
+#define		SEQ_OFFSET		1		//Observe value comes right after its option byte
+#define		SEQ_MASK		0xFFFFFFUL
+
+CoapObserve::CoapObserve() {
+	coap = NULL;
+	pool = NULL;
+	buckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	freeHead = -1;
+	numResources = 0;
+	conInterval = COAP_OBSERVE_CON_INTERVAL;
+}
+
+CoapObserve::~CoapObserve() {
+	end();
+}
+
+int CoapObserve::begin(CoapProtocol *protocol) {
+	return begin(protocol, COAP_MAX_OBSERVERS);
+}
+
+/*	Hooks into PROTOCOL with room for MAXOBSERVERS observers. Call once, after
+	PROTOCOL's begin(). Returns 0 if out of memory	*/
+int CoapObserve::begin(CoapProtocol *protocol, int maxObservers) {
+	end();
+	
+	int bucketCount = 1;
+	while (bucketCount < maxObservers)
+		bucketCount <<= 1;
+	pool = new (std::nothrow) coap_observer[maxObservers];
+	buckets = new (std::nothrow) int[bucketCount];
+	if ((pool == NULL) || (buckets == NULL)) {
+		end();
+		return 0;
+	}
+	capacity = maxObservers;
+	bucketMask = bucketCount - 1;
+	for (int i = 0; i < bucketCount; i++) {
+		buckets[i] = -1;
+	}
+	for (int i = 0; i < capacity; i++) {
+		pool[i].next = (i + 1 < capacity) ? i + 1 : -1;
+	}
+	freeHead = (capacity > 0) ? 0 : -1;
+	
+	coap = protocol;
+	coap->addExtension(this);
+	return 1;
+}
+
+void CoapObserve::end() {
+	delete[] pool;
+	delete[] buckets;
+	pool = NULL;
+	buckets = NULL;
+	capacity = 0;
+	freeHead = -1;
+	for (int r = 0; r < numResources; r++) {
+		delete[] resources[r].rep;
+	}
+	numResources = 0;
+}
+
+
+////////////////////////////////////////////////////
+////				Resources					////
+////////////////////////////////////////////////////
+
+int CoapObserve::addResource(const char *path) {
+	if (numResources == COAP_MAX_RESOURCES)
+		return -1;
+	coap_observe_resource &res = resources[numResources];
+	res.rep = new (std::nothrow) uns8[COAP_OBSERVE_SIZE];
+	if (res.rep == NULL)
+		return -1;
+	res.path = path;
+	res.repLength = 0;
+	res.code = 0;
+	res.seq = 0;
+	res.minInterval = COAP_OBSERVE_MIN_INTERVAL;
+	res.lastRound = millis() - COAP_OBSERVE_MIN_INTERVAL;
+	res.lastConRound = millis();
+	res.observers = -1;
+	res.count = 0;
+	res.cursor = -1;
+	res.dirty = false;
+	res.conRound = false;
+	return numResources++;
+}
+
+/*	Encodes the new representation of RESOURCE once, with the next sequence
+	number. Observers still waiting for the current round get it straight
+	away; everyone gets it in the next round	*/
+int CoapObserve::notify(int resource, uns8 code, int contentFormat, const uns8 *payload, int len) {
+	if ((resource < 0) || (resource >= numResources))
+		return -1;
+	coap_observe_resource &res = resources[resource];
+	uns8 cfLength = (contentFormat <= 0) ? 0 : ((contentFormat < 256) ? 1 : 2);
+	int size = 4 + ((contentFormat >= 0) ? 1 + cfLength : 0) + ((len > 0) ? 1 + len : 0);
+	if (size > COAP_OBSERVE_SIZE)
+		return -1;
+	
+	uns8 *rep = res.rep;
+	int pos = 0;
+	res.seq = (res.seq + 1) & SEQ_MASK;
+	
+	//Observe is always 3 bytes, so the sequence number can be patched in place
+	rep[pos++] = (OPT_OBSERVE << 4) | 3;
+	rep[pos++] = res.seq >> 16;
+	rep[pos++] = res.seq >> 8;
+	rep[pos++] = res.seq;
+	if (contentFormat >= 0) {
+		rep[pos++] = ((OPT_CONTENT_FORMAT - OPT_OBSERVE) << 4) | cfLength;
+		if (cfLength == 2)
+			rep[pos++] = contentFormat >> 8;
+		if (cfLength > 0)
+			rep[pos++] = contentFormat & 0xFF;
+	}
+	if (len > 0) {
+		rep[pos++] = PAYLOAD_MARK;
+		memcpy(&rep[pos], payload, len);
+		pos += len;
+	}
+	res.repLength = pos;
+	res.code = code;
+	res.dirty = true;
+	return 1;
+}
+
+/*	Notifications for RESOURCE go out at most once every MS	*/
+void CoapObserve::setMinInterval(int resource, uns32 ms) {
+	if ((resource >= 0) && (resource < numResources))
+		resources[resource].minInterval = ms;
+}
+
+/*	How often a round of notifications is sent as CONs, to find observers
+	that have gone away	*/
+void CoapObserve::setConInterval(uns32 ms) {
+	conInterval = ms;
+}
+
+int CoapObserve::observerCount(int resource) {
+	if ((resource < 0) || (resource >= numResources))
+		return 0;
+	return resources[resource].count;
+}
+
+/*	Returns the resource REQ's Uri-Path names, or -1	*/
+int CoapObserve::findResource(CoapPacket &req) {
+	for (int r = 0; r < numResources; r++) {
+		if (req.matchUriPath(resources[r].path))
+			return r;
+	}
+	return -1;
+}
+
+
+////////////////////////////////////////////////////
+////				Observers					////
+////////////////////////////////////////////////////
+
+uns32 CoapObserve::hash(const coap_endpoint &peer, const uns8 *token, uns8 len) {
+	uns32 h = 2166136261UL ^ peer.addr;
+	for (uns8 i = 0; i < len; i++) {
+		h = (h ^ token[i]) * 16777619UL;
+	}
+	h = (h ^ peer.port) * 16777619UL;
+	h ^= h >> 15;
+	return h;
+}
+
+int CoapObserve::findObserver(const coap_endpoint &peer, const uns8 *token, uns8 len) {
+	if (capacity == 0)
+		return -1;
+	int i = buckets[hash(peer, token, len) & bucketMask];
+	while (i >= 0) {
+		coap_observer &o = pool[i];
+		if ((o.tokenLength == len) && coap_endpoint_equal(o.peer, peer) &&
+			((len == 0) || (memcmp(o.token, token, len) == 0)))
+			return i;
+		i = o.hashNext;
+	}
+	return -1;
+}
+
+/*	Adds an observer at the head of RESOURCE's list, where a round that is
+	under way won't reach it. Returns its index, or -1 if the pool is full	*/
+int CoapObserve::addObserver(int resource, const coap_endpoint &peer, const uns8 *token, uns8 len) {
+	int i = freeHead;
+	if (i < 0)
+		return -1;
+	coap_observer &o = pool[i];
+	coap_observe_resource &res = resources[resource];
+	freeHead = o.next;
+	
+	o.peer = peer;
+	memcpy(o.token, token, len);
+	o.tokenLength = len;
+	o.resource = resource;
+	o.lastId = 0;
+	
+	o.prev = -1;
+	o.next = res.observers;
+	if (res.observers >= 0)
+		pool[res.observers].prev = i;
+	res.observers = i;
+	res.count++;
+	
+	int *bucket = &buckets[hash(peer, token, len) & bucketMask];
+	o.hashNext = *bucket;
+	*bucket = i;
+	return i;
+}
+
+void CoapObserve::removeObserver(int index) {
+	coap_observer &o = pool[index];
+	coap_observe_resource &res = resources[o.resource];
+	
+	if (res.cursor == index)
+		res.cursor = o.next;
+	if (o.prev >= 0)
+		pool[o.prev].next = o.next;
+	else
+		res.observers = o.next;
+	if (o.next >= 0)
+		pool[o.next].prev = o.prev;
+	res.count--;
+	
+	int *link = &buckets[hash(o.peer, o.token, o.tokenLength) & bucketMask];
+	while (*link >= 0) {
+		if (*link == index) {
+			*link = o.hashNext;
+			break;
+		}
+		link = &pool[*link].hashNext;
+	}
+	
+	o.next = freeHead;
+	freeHead = index;
+}
+
+
+////////////////////////////////////////////////////
+////				Notifications				////
+////////////////////////////////////////////////////
+
+/*	Copies RESOURCE's representation into a new tx packet behind a header
+	and token of its own. Returns the tx index, or -1 if the queue is full	*/
+int CoapObserve::queueRepresentation(int resource, const coap_endpoint &peer, const uns8 *token, uns8 len, uns8 type, uns16 id) {
+	coap_observe_resource &res = resources[resource];
+	int x = coap->reserveTX(peer);
+	if (x < 0)
+		return -1;
+	
+	CoapPacket &pkt = coap->getCoapPacket(TX, x);
+	uns8 *buf = pkt.reservePacket(4 + len + res.repLength);
+	if (buf == NULL) {
+		coap->clearQueue(TX, x);
+		return -1;
+	}
+	buf[0] = (COAP_VERSION << 6) | (type << 4) | len;
+	buf[1] = res.code;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	memcpy(&buf[4], token, len);
+	memcpy(&buf[4 + len], res.rep, res.repLength);
+	pkt.setIndex(4 + len + res.repLength);
+	pkt.parseHeader();
+	coap->commitTX(x);
+	return x;
+}
+
+void CoapObserve::startRound(int resource, uns32 now) {
+	coap_observe_resource &res = resources[resource];
+	res.cursor = res.observers;
+	res.dirty = false;
+	res.lastRound = now;
+	res.conRound = (now - res.lastConRound) >= conInterval;
+	if (res.conRound)
+		res.lastConRound = now;
+}
+
+/*	Starts the rounds that are due, and queues notifications for as many
+	observers as the tx queue has room for	*/
+int CoapObserve::poll(uns32 now) {
+	int queued = 0;
+	
+	for (int r = 0; r < numResources; r++) {
+		coap_observe_resource &res = resources[r];
+		if ((res.cursor < 0) && res.dirty && ((now - res.lastRound) >= res.minInterval))
+			startRound(r, now);
+		
+		while (res.cursor >= 0) {
+			int i = res.cursor;
+			coap_observer &o = pool[i];
+			uns16 id = coap->nextMessageId(o.peer);
+			if (queueRepresentation(r, o.peer, o.token, o.tokenLength, res.conRound ? TYPE_CON : TYPE_NON, id) < 0)
+				return queued;
+			o.lastId = id;
+			res.cursor = o.next;
+			queued++;
+			
+			//An error response ends the observation
+			if ((res.code >> 5) != 2)
+				removeObserver(i);
+		}
+	}
+	return queued;
+}
+
+/*	When the first changed resource held back by its minimum interval can
+	start its round	*/
+int CoapObserve::nextDeadline(uns32 *deadline) {
+	bool found = false;
+	for (int r = 0; r < numResources; r++) {
+		coap_observe_resource &res = resources[r];
+		if ((res.cursor >= 0) || !res.dirty)
+			continue;
+		uns32 start = res.lastRound + res.minInterval;
+		if (!found || ((int32_t)(start - *deadline) < 0)) {
+			*deadline = start;
+			found = true;
+		}
+	}
+	return found;
+}
+
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+/*	GET with Observe: 0 registers, and is answered here with the current
+	representation. Observe: 1, or a plain GET with an observer's token,
+	deregisters, and the GET goes on to the application	*/
+int CoapObserve::onRequest(int rxIndex) {
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	if (req.getResponseCode() != COAP_GET)
+		return 0;
+	int r = findResource(req);
+	if (r < 0)
+		return 0;
+	
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	uns8 *token = req.getTokenPtr();
+	uns8 len = req.getTokenLength();
+	int existing = findObserver(peer, token, len);
+	uns32 observe;
+	
+	if (!req.getUintOption(OPT_OBSERVE, &observe) || (observe != 0)) {
+		if (existing >= 0)
+			removeObserver(existing);
+		return 0;
+	}
+	//Nothing to send yet. The application answers, without registering
+	if (resources[r].repLength == 0)
+		return 0;
+	
+	int added = -1;
+	if (existing < 0) {
+		added = addObserver(r, peer, token, len);
+		if (added < 0)
+			return 0;
+	}
+	
+	bool con = req.getMessageType() == TYPE_CON;
+	if (queueRepresentation(r, peer, token, len, con ? TYPE_ACK : TYPE_NON,
+							con ? req.getID() : coap->nextMessageId(peer)) < 0) {
+		if (added >= 0)
+			removeObserver(added);
+		return 0;
+	}
+	return 1;
+}
+
+/*	ACKs to CON notifications are of no interest to the application	*/
+int CoapObserve::onResponse(int rxIndex, int txIndex) {
+	if (txIndex < 0)
+		return 0;
+	CoapPacket &tx = coap->getCoapPacket(TX, txIndex);
+	return findObserver(coap->getPeer(TX, txIndex), tx.getTokenPtr(), tx.getTokenLength()) >= 0;
+}
+
+/*	An observer that never ACKed a CON notification has gone away	*/
+int CoapObserve::onTxFailure(int txIndex) {
+	CoapPacket &tx = coap->getCoapPacket(TX, txIndex);
+	int i = findObserver(coap->getPeer(TX, txIndex), tx.getTokenPtr(), tx.getTokenLength());
+	if (i < 0)
+		return 0;
+	removeObserver(i);
+	return 1;
+}
+
+/*	RST to a notification cancels the observation. A NON notification is gone
+	from the tx queue by then, so it is found by its message ID	*/
+int CoapObserve::onReset(int rxIndex, int txIndex) {
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	int i = -1;
+	
+	if (txIndex >= 0) {
+		CoapPacket &tx = coap->getCoapPacket(TX, txIndex);
+		i = findObserver(peer, tx.getTokenPtr(), tx.getTokenLength());
+	}
+	else {
+		uns16 id = coap->getCoapPacket(RX, rxIndex).getID();
+		for (int r = 0; (r < numResources) && (i < 0); r++) {
+			for (int o = resources[r].observers; o >= 0; o = pool[o].next) {
+				if ((pool[o].lastId == id) && coap_endpoint_equal(pool[o].peer, peer)) {
+					i = o;
+					break;
+				}
+			}
+		}
+	}
+	if (i < 0)
+		return 0;
+	removeObserver(i);
+	return 1;
+}
+
+#endif	//COAP_WITH_OBSERVE
@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP observe server, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_OBSERVE_h
+#define __COAP_OBSERVE_h
+
+#include "coap-protocol.h"
+
+//Observers kept across all resources
+#ifndef COAP_MAX_OBSERVERS
+#ifdef ARDUINO
+#define		COAP_MAX_OBSERVERS			8
+#else
+#define		COAP_MAX_OBSERVERS			16384
+#endif
+#endif
+//Observable resources
+#ifndef COAP_MAX_RESOURCES
+#ifdef ARDUINO
+#define		COAP_MAX_RESOURCES			2
+#else
+#define		COAP_MAX_RESOURCES			32
+#endif
+#endif
+//Bytes kept per resource for its options and payload
+#ifndef COAP_OBSERVE_SIZE
+#ifdef ARDUINO
+#define		COAP_OBSERVE_SIZE			128
+#else
+#define		COAP_OBSERVE_SIZE			1024
+#endif
+#endif
+//Default shortest time between two rounds of notifications for a resource, ms
+#ifndef COAP_OBSERVE_MIN_INTERVAL
+#define		COAP_OBSERVE_MIN_INTERVAL	100
+#endif
+//A round of notifications goes out as CONs at least this often, ms
+#ifndef COAP_OBSERVE_CON_INTERVAL
+#define		COAP_OBSERVE_CON_INTERVAL	300000UL
+#endif
+
+#if COAP_WITH_OBSERVE
+
+//One client observing one resource
+typedef struct {
+	coap_endpoint	peer;
+	uns8			token[MAX_TOKENSIZE];
+	uns8			tokenLength;
+	uns8			resource;
+	uns16			lastId;			//Message ID of the last notification
+	int				next;			//Resource's observer list, or free list
+	int				prev;
+	int				hashNext;
+}	coap_observer;
+
+typedef struct {
+	const char	*path;
+	uns8		*rep;			//Encoded options and payload, Observe first
+	uns16		repLength;		//0 until notify() is first called
+	uns8		code;
+	uns32		seq;			//Observe sequence number, 24 bits
+	uns32		minInterval;
+	uns32		lastRound;		//When the last round of notifications started
+	uns32		lastConRound;
+	int			observers;		//List head
+	int			count;
+	int			cursor;			//Next observer of the round being sent, or -1
+	bool		dirty;			//Changed since the last round started
+	bool		conRound;
+}	coap_observe_resource;
+
+/*	RFC 7641 observe server. GETs with Observe: 0 on a resource added with
+	addResource() register the sender, and are answered with the current
+	representation. Each notify() encodes the representation once; every
+	observer's notification is that same block of bytes behind its own
+	header and token, copied straight into the tx queue, with the sequence
+	number patched in place. Notifications go out in rounds, no more often
+	than the resource's minimum interval, as many per process_tx_queue() as
+	the queue can take. Observers that RST a notification, or don't ACK a CON
+	one, are removed	*/
+class CoapObserve : public CoapExtension {
+private:
+	CoapProtocol			*coap;
+	coap_observer			*pool;
+	int						*buckets;
+	int						capacity;
+	int						bucketMask;
+	int						freeHead;
+	coap_observe_resource	resources[COAP_MAX_RESOURCES];
+	int						numResources;
+	uns32					conInterval;
+	
+	uns32	hash(const coap_endpoint &peer, const uns8 *token, uns8 len);
+	int		findObserver(const coap_endpoint &peer, const uns8 *token, uns8 len);
+	int		addObserver(int resource, const coap_endpoint &peer, const uns8 *token, uns8 len);
+	void	removeObserver(int index);
+	int		findResource(CoapPacket &req);
+	int		queueRepresentation(int resource, const coap_endpoint &peer, const uns8 *token, uns8 len, uns8 type, uns16 id);
+	void	startRound(int resource, uns32 now);
+	
+public:
+	CoapObserve();
+	~CoapObserve();
+	
+	int		begin(CoapProtocol *protocol);
+	int		begin(CoapProtocol *protocol, int maxObservers);
+	void	end();
+	
+	//Returns the resource number, or -1 if there's no room.
+	//PATH ("a/b/c") must stay valid
+	int		addResource(const char *path);
+	//Sets the representation of RESOURCE, and notifies its observers.
+	//CONTENTFORMAT < 0 leaves the option out. Returns -1 if it doesn't fit
+	int		notify(int resource, uns8 code, int contentFormat, const uns8 *payload, int len);
+	void	setMinInterval(int resource, uns32 ms);
+	void	setConInterval(uns32 ms);
+	int		observerCount(int resource);
+	
+	//CoapExtension hooks
+	int		onRequest(int rxIndex);
+	int		onResponse(int rxIndex, int txIndex);
+	int		onTxFailure(int txIndex);
+	int		onReset(int rxIndex, int txIndex);
+	int		poll(uns32 now);
+	int		nextDeadline(uns32 *deadline);
+};
+
+#endif	//COAP_WITH_OBSERVE
+
+#endif
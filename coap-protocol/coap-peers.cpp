@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP peer table, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-peers.h"
+
+CoapPeerTable::CoapPeerTable() {
+	peers = NULL;
+	buckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	used = 0;
+	lruHead = -1;
+	lruTail = -1;
+	freeHead = -1;
+	evictionCount = 0;
+}
+
+CoapPeerTable::~CoapPeerTable() {
+	end();
+}
+
+/*	Makes room for PEERCOUNT peers. Returns 0 if out of memory	*/
+int CoapPeerTable::begin(int peerCount) {
+	end();
+	
+	int bucketCount = 1;
+	while (bucketCount < peerCount)
+		bucketCount <<= 1;
+	
+	peers = new (std::nothrow) coap_peer[peerCount];
+	buckets = new (std::nothrow) int[bucketCount];
+	if ((peers == NULL) || (buckets == NULL)) {
+		end();
+		return 0;
+	}
+	capacity = peerCount;
+	bucketMask = bucketCount - 1;
+	clear();
+	return 1;
+}
+
+void CoapPeerTable::end() {
+	delete[] peers;
+	delete[] buckets;
+	peers = NULL;
+	buckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	used = 0;
+	lruHead = -1;
+	lruTail = -1;
+	freeHead = -1;
+}
+
+/*	Forgets every peer	*/
+void CoapPeerTable::clear() {
+	if (buckets == NULL)
+		return;
+	for (int i = 0; i <= bucketMask; i++) {
+		buckets[i] = -1;
+	}
+	for (int i = 0; i < capacity; i++) {
+		peers[i].lruNext = (i + 1 < capacity) ? i + 1 : -1;
+	}
+	freeHead = (capacity > 0) ? 0 : -1;
+	used = 0;
+	lruHead = -1;
+	lruTail = -1;
+	evictionCount = 0;
+}
+
+uns32 CoapPeerTable::hash(const coap_endpoint &ep) {
+	uns32 h = (ep.addr * 2654435761UL) ^ ep.port;
+	h ^= h >> 15;
+	h *= 2246822519UL;
+	h ^= h >> 13;
+	return h;
+}
+
+void CoapPeerTable::unlinkLRU(int index) {
+	coap_peer &p = peers[index];
+	if (p.lruPrev >= 0)
+		peers[p.lruPrev].lruNext = p.lruNext;
+	else
+		lruHead = p.lruNext;
+	if (p.lruNext >= 0)
+		peers[p.lruNext].lruPrev = p.lruPrev;
+	else
+		lruTail = p.lruPrev;
+}
+
+void CoapPeerTable::pushLRU(int index) {
+	coap_peer &p = peers[index];
+	p.lruPrev = -1;
+	p.lruNext = lruHead;
+	if (lruHead >= 0)
+		peers[lruHead].lruPrev = index;
+	else
+		lruTail = index;
+	lruHead = index;
+}
+
+void CoapPeerTable::unlinkHash(int index) {
+	int *link = &buckets[hash(peers[index].endpoint) & bucketMask];
+	while (*link >= 0) {
+		if (*link == index) {
+			*link = peers[index].hashNext;
+			return;
+		}
+		link = &peers[*link].hashNext;
+	}
+}
+
+int CoapPeerTable::find(const coap_endpoint &ep) {
+	if (capacity == 0)
+		return -1;
+	int i = buckets[hash(ep) & bucketMask];
+	while (i >= 0) {
+		if (coap_endpoint_equal(peers[i].endpoint, ep))
+			return i;
+		i = peers[i].hashNext;
+	}
+	return -1;
+}
+
+int CoapPeerTable::get(const coap_endpoint &ep) {
+	int index = find(ep);
+	if (index >= 0) {
+		if (index != lruHead) {
+			unlinkLRU(index);
+			pushLRU(index);
+		}
+		return index;
+	}
+	if (capacity == 0)
+		return -1;
+	
+	//Take a free entry, or forget the least recently used peer
+	if (freeHead >= 0) {
+		index = freeHead;
+		freeHead = peers[index].lruNext;
+		used++;
+	}
+	else {
+		index = lruTail;
+		unlinkLRU(index);
+		unlinkHash(index);
+		evictionCount++;
+	}
+	
+	coap_peer &p = peers[index];
+	p.endpoint = ep;
+	//Start somewhere unpredictable, as RFC 7252 4.4 recommends
+	p.nextId = (uns16)(hash(ep) ^ micros());
+	p.inFlight = 0;
+	p.srtt = 0;
+	p.rttvar = 0;
+	p.weakSrtt = 0;
+	p.weakRttvar = 0;
+	p.rto = 0;
+	p.rtoUpdated = 0;
+	
+	int *bucket = &buckets[hash(ep) & bucketMask];
+	p.hashNext = *bucket;
+	*bucket = index;
+	pushLRU(index);
+	return index;
+}
+
+/*	Returns the message ID to use for the next message to peer INDEX	*/
+uns16 CoapPeerTable::nextMessageId(int index) {
+	return peers[index].nextId++;
+}
+
+/*	Folds RTT into the smoothed round trip time and variation at SRTT and
+	RTTVAR the way RFC 6298 does for TCP, and returns the timeout they give,
+	SRTT + K * RTTVAR	*/
+static uns32 rtt_estimate(uns32 *srtt, uns32 *rttvar, uns32 rtt, uns32 k) {
+	if (*srtt == 0) {
+		*srtt = (rtt > 0) ? rtt : 1;
+		*rttvar = rtt / 2;
+	}
+	else {
+		uns32 diff = (*srtt > rtt) ? (*srtt - rtt) : (rtt - *srtt);
+		*rttvar = ((3 * *rttvar) + diff) / 4;
+		*srtt = ((7 * *srtt) + rtt) / 8;
+		if (*srtt == 0)
+			*srtt = 1;
+	}
+	return *srtt + (k * *rttvar);
+}
+
+/*	Folds a round trip time measurement into peer INDEX's estimates, as
+	CoCoA does: strong samples (K = 4) move the retransmission timeout half
+	way to their own estimate, weak ones (K = 1) only a quarter of the way.
+	The timeout starts out as INITIAL	*/
+void CoapPeerTable::rttSample(int index, uns32 rtt, bool weak, uns32 initial, uns32 now) {
+	coap_peer &p = peers[index];
+	uns32 current = (p.rto == 0) ? initial : p.rto;
+	
+	if (!weak)
+		p.rto = (rtt_estimate(&p.srtt, &p.rttvar, rtt, 4) + current) / 2;
+	else
+		p.rto = (rtt_estimate(&p.weakSrtt, &p.weakRttvar, rtt, 1) + (3 * current)) / 4;
+	if (p.rto < COAP_MIN_RTO)
+		p.rto = COAP_MIN_RTO;
+	if (p.rto > COAP_MAX_RTO)
+		p.rto = COAP_MAX_RTO;
+	p.rtoUpdated = now;
+}
+
+/*	An estimate that hasn't been updated for a while is aged towards
+	INITIAL: a short one doubles after 16 of itself, a long one halves its
+	distance from INITIAL after 4 of itself	*/
+uns32 CoapPeerTable::rto(int index, uns32 initial, uns32 now) {
+	coap_peer &p = peers[index];
+	if (p.rto == 0)
+		return initial;
+	
+	uns32 idle = now - p.rtoUpdated;
+	if ((p.rto < 1000) && (idle > 16 * p.rto)) {
+		p.rto *= 2;
+		p.rtoUpdated = now;
+	}
+	else if ((p.rto > 3000) && (idle > 4 * p.rto)) {
+		p.rto = (initial + p.rto) / 2;
+		p.rtoUpdated = now;
+	}
+	return p.rto;
+}
+
+int CoapPeerTable::size() {
+	return used;
+}
+
+int CoapPeerTable::getCapacity() {
+	return capacity;
+}
+
+uns32 CoapPeerTable::getMemoryUsage() {
+	if (capacity == 0)
+		return 0;
+	return capacity * sizeof(coap_peer) + (bucketMask + 1) * sizeof(int);
+}
+
+uns32 CoapPeerTable::evictions() {
+	return evictionCount;
+}
+
+coap_peer& CoapPeerTable::operator[](int index) {
+	return peers[index];
+}
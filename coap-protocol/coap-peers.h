@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP peer table, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_PEERS_h
+#define __COAP_PEERS_h
+
+#include "coap-packet.h"
+#include "coap-transport.h"
+
+//Peers CoapProtocol::begin() keeps state for
+#ifndef COAP_MAX_PEERS
+#ifdef ARDUINO
+#define		COAP_MAX_PEERS		8
+#else
+#define		COAP_MAX_PEERS		64
+#endif
+#endif
+
+//What is known about one remote endpoint
+typedef struct {
+	coap_endpoint	endpoint;
+	uns16			nextId;			//Next message ID to use towards this peer
+	uns16			inFlight;		//CONs sent and not yet ACKed or failed
+	uns32			srtt;			//Smoothed round trip time, ms. 0 = no sample yet
+	uns32			rttvar;			//Round trip time variation, ms
+	uns32			weakSrtt;		//The same for CONs ACKed after being sent again
+	uns32			weakRttvar;
+	uns32			rto;			//CoCoA retransmission timeout, ms. 0 = no estimate yet
+	uns32			rtoUpdated;		//When rto last changed
+	int				hashNext;
+	int				lruPrev;		//Most recently used first
+	int				lruNext;
+}	coap_peer;
+
+/*	Fixed capacity table of per-peer state. Peers are found through a chained
+	hash table on their endpoint, so lookups stay O(1) on average however many
+	there are, and are kept in least recently used order. When the table is
+	full the least recently used peer is forgotten to make room	*/
+class CoapPeerTable {
+private:
+	coap_peer	*peers;
+	int			*buckets;
+	int			capacity;
+	int			bucketMask;
+	int			used;
+	int			lruHead;
+	int			lruTail;
+	int			freeHead;
+	uns32		evictionCount;
+	
+	uns32	hash(const coap_endpoint &ep);
+	void	unlinkLRU(int index);
+	void	pushLRU(int index);
+	void	unlinkHash(int index);
+	
+public:
+	CoapPeerTable();
+	~CoapPeerTable();
+	
+	int		begin(int peerCount);
+	void	end();
+	void	clear();
+	
+	//Returns the peer with endpoint EP, or -1. Doesn't change the LRU order
+	int		find(const coap_endpoint &ep);
+	//Returns the peer with endpoint EP, adding it if needed, and marks it as
+	//most recently used. Returns -1 only if the table has no room at all
+	int		get(const coap_endpoint &ep);
+	
+	uns16	nextMessageId(int index);
+	//Round trip time of a CON, from when it was first sent. WEAK if it was
+	//sent more than once, so the ACK may be for any of the copies. INITIAL
+	//is the retransmission timeout used until there are samples
+	void	rttSample(int index, uns32 rtt, bool weak, uns32 initial, uns32 now);
+	//Peer INDEX's retransmission timeout, or INITIAL until it has one
+	uns32	rto(int index, uns32 initial, uns32 now);
+	
+	int		size();
+	int		getCapacity();
+	uns32	getMemoryUsage();
+	uns32	evictions();
+	coap_peer&	operator[](int index);
+};
+
+#endif
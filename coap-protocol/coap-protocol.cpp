@@ -30,28 +30,177 @@ THE POSSIBILITY OF SUCH DAMAGE.
 // CoAP packet protocol handler, Arduino library
 // Written originally by Embedded Adventures
 
-#include "Arduino.h"
-#include "WiFiUdp.h"
 #include "coap-protocol.h"
+#include "coap-pool.h"
 
-CoapProtocol::CoapProtocol() {}
+CoapProtocol::CoapProtocol() {
+	transport = &defaultTransport;
+	destination.addr = 0;
+	destination.port = 0;
+	
+	_txSuccess = NULL;
+	_txFailure = NULL;
+	_packetAvailable = NULL;
+	_responseTimeout = NULL;
+	for (int i = 0; i < COAP_EVENTS; i++) {
+		viewHandlers[i] = NULL;
+		viewContexts[i] = NULL;
+	}
+	extensions = NULL;
+	
+	coap_config defaults = COAP_CONFIG_DEFAULT;
+	config = defaults;
+}
 
 CoapProtocol::~CoapProtocol() {}
 
 int CoapProtocol::begin() {
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		rxPacketStatus[i] = 0;	//Clear status bytes
-		txPacketStatus[i] = 0;
-		rxTimeLog[i] = 0;		//Clear the time log
-		txTimeLog[i] = 0;
+	return begin(&defaultTransport);
+}
+
+/*	Same as begin(), but runs on top of BACKEND instead of the platform default	*/
+int CoapProtocol::begin(CoapTransport *backend) {
+	return begin(backend, MAX_QUEUE_SIZE);
+}
+
+/*	Same as begin(BACKEND), with room for QUEUESIZE packets in each of the
+	rx and tx queues. Returns 0 if the queues can't be allocated	*/
+int CoapProtocol::begin(CoapTransport *backend, int queueSize) {
+	coap_config settings = COAP_CONFIG_DEFAULT;
+	settings.queueSize = queueSize;
+	return begin(backend, settings);
+}
+
+/*	Same as begin(BACKEND), with the queue depth, timeouts, port and table
+	sizes in SETTINGS. Returns 0 if the tables can't be allocated	*/
+int CoapProtocol::begin(CoapTransport *backend, const coap_config &settings) {
+	config = settings;
+	if (config.maxRetransmit > MAX_RETRANSMIT)
+		config.maxRetransmit = MAX_RETRANSMIT;
+	
+	//The lifetimes that follow from RFC 7252's exponential back-off
+	uns32 majorTimeout = config.ackTimeout * ((1UL << config.maxRetransmit) - 1) * 3 / 2;
+	nonLifetime = majorTimeout + (MAX_LATENCY * 1000UL);
+	randomState = micros() | 1;
+	
+	if (!rxTable.begin(config.queueSize) || !txTable.begin(config.queueSize))
+		return 0;
+#if COAP_WITH_DEDUP
+	if (!dedup.begin(config.dedupBudget, nonLifetime + (MAX_LATENCY * 1000UL) + config.ackTimeout))
+		return 0;
+#endif
+	if (!peerTable.begin(config.maxPeers))
+		return 0;
+	
+	transport = backend;
+	return transport->begin(config.localPort);
+}
+
+const coap_config& CoapProtocol::getConfig() {
+	return config;
+}
+
+CoapTransport* CoapProtocol::getTransport() {
+	return transport;
+}
+
+/*	Adds EXT to the end of the extension chain. It stays in use until the
+	CoapProtocol object is destroyed	*/
+void CoapProtocol::addExtension(CoapExtension *ext) {
+	CoapExtension **link = &extensions;
+	while (*link != NULL) {
+		if (*link == ext)
+			return;		//Already added, by an earlier begin()
+		link = &(*link)->nextExtension;
 	}
-	WiFiUDP::begin(thisPort);
+	ext->nextExtension = NULL;
+	*link = ext;
+}
+
+/*	Per-peer state, for round trip times and CONs in flight	*/
+CoapPeerTable* CoapProtocol::getPeers() {
+	return &peerTable;
+}
+
+/*	Duplicate detection, for its hit/miss/eviction counts	*/
+CoapDedupCache* CoapProtocol::getDedupCache() {
+#if COAP_WITH_DEDUP
+	return &dedup;
+#else
+	return NULL;
+#endif
+}
+
+/*	Heap bytes taken by the queues, the dedup cache, the peer table and the
+	packet pool (which extensions' packets share)	*/
+uns32 CoapProtocol::getMemoryUsage() {
+	uns32 bytes = rxTable.getMemoryUsage() + txTable.getMemoryUsage() + peerTable.getMemoryUsage() +
+					coapBufferPool.getMemoryUsage();
+#if COAP_WITH_DEDUP
+	bytes += dedup.getMemoryUsage();
+#endif
+	return bytes;
+}
+
+/*	Prints where getMemoryUsage() goes	*/
+void CoapProtocol::printMemoryReport() {
+	coap_printf("rx queue: %d slots of %u bytes, %lu bytes\n", rxTable.getCapacity(),
+				(unsigned)sizeof(coap_transaction), (unsigned long)rxTable.getMemoryUsage());
+	coap_printf("tx queue: %d slots of %u bytes, %lu bytes\n", txTable.getCapacity(),
+				(unsigned)sizeof(coap_transaction), (unsigned long)txTable.getMemoryUsage());
+#if COAP_WITH_DEDUP
+	coap_printf("dedup cache: %d entries, %lu bytes\n", dedup.getCapacity(), (unsigned long)dedup.getMemoryUsage());
+#endif
+	coap_printf("peer table: %d peers, %lu bytes\n", peerTable.getCapacity(), (unsigned long)peerTable.getMemoryUsage());
+	coapBufferPool.printReport();
+	coap_printf("total: %lu bytes\n", (unsigned long)getMemoryUsage());
+}
+
+/*	Copies the counters, histograms and queue gauges into SNAPSHOT without
+	holding up process_rx_queue() or process_tx_queue(), so another thread
+	can call it while they run. Returns 0, with SNAPSHOT zeroed, if
+	COAP_WITH_METRICS is 0	*/
+int CoapProtocol::getMetrics(coap_metrics *snapshot) {
+#if COAP_WITH_METRICS
+	metrics.snapshot(snapshot);
 	return 1;
+#else
+	memset(snapshot, 0, sizeof(coap_metrics));
+	return 0;
+#endif
 }
 
+/*	Zeroes the metrics. Only from the thread running the protocol	*/
+void CoapProtocol::clearMetrics() {
+	metrics.clear();
+}
+
+void CoapProtocol::printMetrics() {
+#if COAP_WITH_METRICS
+	coap_metrics snapshot;
+	metrics.snapshot(&snapshot);
+	CoapMetrics::print(snapshot);
+#endif
+}
+
+#ifdef ARDUINO
+void CoapProtocol::setDestination(IPAddress ip, int portNum) {
+	destination.addr = ((uns32)ip[0] << 24) | ((uns32)ip[1] << 16) | ((uns32)ip[2] << 8) | ip[3];
+	destination.port = portNum;
+}
+#endif
+
 void CoapProtocol::setDestination(const char* ip, int portNum) {
-	ipAddr = ip;
-	portRemote = portNum;
+	transport->resolve(ip, portNum, &destination);
+}
+
+/*	Returns a message ID for the next message to PEER. Each peer has its own
+	sequence, starting from a random point	*/
+uns16 CoapProtocol::nextMessageId(const coap_endpoint &peer) {
+	int p = peerTable.get(peer);
+	if (p < 0)
+		return (uns16)micros();
+	return peerTable.nextMessageId(p);
 }
 
 /*	Returns number of times the packet was transmitted */
@@ -64,119 +213,66 @@ int CoapProtocol::numTimesTransmitted(uns8& stat) {
 ////		Status & Overhead Functions			////
 ////////////////////////////////////////////////////
 
-/*	Returns number of empty spaces in the buffer QUEUE	*/
-int CoapProtocol::numEmptySpaces(int queue) {
-	uns8 empty = 0;
+/*	Returns the rx or tx table	*/
+CoapTransactionTable& CoapProtocol::queueTable(int queue) {
 	if (queue)
-		ptr_packetStatus = &rxPacketStatus[0];
+		return rxTable;
 	else
-		ptr_packetStatus = &txPacketStatus[0];
-	
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		empty += bitRead(*ptr_packetStatus, FLAG_FILLED);
-	}
-	return empty;
+		return txTable;
 }
 
-/*	Returns number of filled spaces in the buffer QUEUE */
-int CoapProtocol::numFilledSpaces(int queue) {
-	uns8 filled = MAX_QUEUE_SIZE;
-	if (queue)
-		ptr_packetStatus = &rxPacketStatus[0];
-	else
-		ptr_packetStatus = &txPacketStatus[0];
-	
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		if (!bitRead(*ptr_packetStatus, FLAG_FILLED))
-			filled--;
-	}
-	return filled;
+/*	Returns number of empty spaces in the buffer QUEUE	*/
+int CoapProtocol::numEmptySpaces(int queue) {
+	return queueTable(queue).available();
 }
 
-/*	Returns index of first empty space tx/rx buffer. Returns 4 if full	*/
-int CoapProtocol::findSpace(int queue) {
-	if (queue)
-		ptr_packetStatus = &rxPacketStatus[0];
-	else
-		ptr_packetStatus = &txPacketStatus[0];
-	
-	int cursor = 0;
-	while ((bitRead(ptr_packetStatus[cursor], FLAG_FILLED)) && (cursor < MAX_QUEUE_SIZE)) {
-		cursor++;
-	}
-	return cursor;
+/*	Returns number of filled spaces in the buffer QUEUE */
+int CoapProtocol::numFilledSpaces(int queue) {
+	return queueTable(queue).size();
 }
 
 /*	Returns the time packet at index INDEX was sent	*/
 uns32 CoapProtocol::timeSent(int index) {
-	return txTimeLog[index];
+	return txTable[index].time;
 }
 
 /*	Returns the time packet at index INDEX was received	*/
 uns32 CoapProtocol::timeReceived(int index) {
-	return rxTimeLog[index];
+	return rxTable[index].time;
 }
 
-/*	Checks if TIMEOUT has elapsed since the packet was logged in
-	-1 if empty
-	0 if TIMEOUT hasn't passed
-	1 if TIMEOUT has passed
-*/
-int CoapProtocol::timeExpired(int queue, int index) {
-	//Change pointers to point to either RX vars or TX vars
-	if (queue) {
-		ptr_packetStatus = &rxPacketStatus[0];
-		timePtr = &rxTimeLog[0];
-	} else {
-		ptr_packetStatus = &txPacketStatus[0];
-		timePtr = &txTimeLog[0];
-	}
-
-	if (!bitRead(ptr_packetStatus[index], 7))
-		return -1;
-	//If TIMEOUT has passed since packet sent/rcvd
-	else if ((millis() - timePtr[index]) > (MAJOR_TIMEOUT * 1000)) 
-		return 1;
-	//If TIMEOUT not passed yet, return 0
-	else 
-		return 0;							
+/*	Returns packet status byte of packet INDEX in buffer QUEUE	*/
+uns8 CoapProtocol::getPacketStatus(int queue, int index) {
+	return queueTable(queue)[index].status;
 }
 
-int CoapProtocol::responseTimeExpired(int queue, int index) {
-	//Change pointers to point to either RX vars or TX vars
-	if (queue) {
-		ptr_packetStatus = &rxPacketStatus[index];
-		timePtr = &rxTimeLog[index];
-	} else {
-		ptr_packetStatus = &txPacketStatus[index];
-		timePtr = &txTimeLog[index];
+/*	Marks as processed the packet in rxQueue with same id.
+	Message IDs are only unique per peer, so this walks the whole queue;
+	packetProcessed(peer, id) is a direct lookup	*/
+void CoapProtocol::packetProcessed(uns16 id) {
+	for (int i = rxTable.first(); i >= 0; i = rxTable.next(i)) {
+		if (rxTable[i].packet.getID() == id)
+			markProcessed(i);
 	}
-	
-	uns8 transmitted = *ptr_packetStatus & COUNT_TRANSMISSIONS;	//We need to know how many times it's been transmitted
-	long timeout = pow(ACK_TIMEOUT, transmitted) * 1000;
-	
-	if (!bitRead(ptr_packetStatus[index], FLAG_FILLED))	//If empty, return -1
-		return -1;
-	else if ((millis() - timePtr[index]) > timeout) 	//If LATE_RESPONSE has passed since packet sent/rcvd
-		return 1;
-	else 
-		return 0;							//If LATE_RESPONSE not passed yet, return 0
 }
 
-/*	Returns packet status byte of packet INDEX in buffer QUEUE	*/
-uns8 CoapProtocol::getPacketStatus(int queue, int index) {
-	if (queue)
-		return rxPacketStatus[index];
-	else
-		return txPacketStatus[index];
+//Marks as processed the packet in rxQueue from PEER with same id
+void CoapProtocol::packetProcessed(const coap_endpoint &peer, uns16 id) {
+	int i = rxTable.findById(peer, id);
+	if (i >= 0)
+		markProcessed(i);
 }
 
-//Marks as processed the packet in rxQueue with same id
-void CoapProtocol::packetProcessed(uns16 id) {
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		if ((bitRead(rxPacketStatus[i], FLAG_FILLED)) && (rxBuffer[i].getID() == id))
-			bitSet(rxPacketStatus[i], FLAG_PROCESSED);
-	}
+/*	Rx slot INDEX has been answered. It is removed on the next
+	process_rx_queue()	*/
+void CoapProtocol::markProcessed(int index) {
+	coap_transaction &rx = rxTable[index];
+	if (bitRead(rx.status, FLAG_PROCESSED))
+		return;
+	uns32 now = millis();
+	metrics.record(COAP_HISTOGRAM_RX_QUEUE, now - rx.time);
+	bitSet(rx.status, FLAG_PROCESSED);
+	rxTable.schedule(index, now);
 }
 
 
@@ -186,32 +282,46 @@ void CoapProtocol::packetProcessed(uns16 id) {
 
 /*	Returns address of first byte of packet in INDEX in buffer QUEUE	*/
 uns8* CoapProtocol::getPacket(int queue, int index) {
-	if (queue)
-		return rxBuffer[index].getPacket();
-	else
-		return txBuffer[index].getPacket();
+	return queueTable(queue)[index].packet.getPacket();
 }
 
 /*	Returns length of packet in index INDEX at buffer QUEUE	*/
 int CoapProtocol::getPacketLength(int queue, int index) {
-	if (queue)
-		return rxBuffer[index].getPacketLength();
-	else
-		return txBuffer[index].getPacketLength();
+	return queueTable(queue)[index].packet.getPacketLength();
+}
+
+/*	Returns the endpoint packet INDEX in buffer QUEUE came from or goes to	*/
+coap_endpoint CoapProtocol::getPeer(int queue, int index) {
+	return queueTable(queue)[index].peer;
+}
+
+/*	Returns the decoded packet INDEX in buffer QUEUE	*/
+CoapPacket& CoapProtocol::getCoapPacket(int queue, int index) {
+	return queueTable(queue)[index].packet;
+}
+
+/*	Sets FROM to the sender of PKT, a packet handed to availablePacketHandler()
+	that is still in the rx queue. Returns -1 if it isn't	*/
+int CoapProtocol::getSender(const uns8 *pkt, coap_endpoint *from) {
+	int index = rxTable.indexOf(pkt);
+	if (index < 0)
+		return -1;
+	*from = rxTable[index].peer;
+	return 1;
+}
+
+/*	Returns the rx queue index of PKT, a packet handed to availablePacketHandler(),
+	or -1 if it is no longer in the queue	*/
+int CoapProtocol::getRxIndex(const uns8 *pkt) {
+	return rxTable.indexOf(pkt);
 }
 
 /*	Prints packet in index INDEX in buffer QUEUE in a readable manner, or return -1 if empty	*/
 int CoapProtocol::printPacket(int queue, int index) {
-	if (queue) {
-		ptr_packetStatus = &rxPacketStatus[index];
-		ptr_queue = &rxBuffer[index];
-	} else {
-		ptr_packetStatus = &txPacketStatus[index];
-		ptr_queue = &txBuffer[index];
-	}
-	if (!bitRead(ptr_packetStatus[index], 7))
+	CoapTransactionTable &table = queueTable(queue);
+	if (!table.isFilled(index))
 		return -1;
-	ptr_queue[index].readPacket();
+	table[index].packet.readPacket();
 	return 1;	
 }
 
@@ -247,307 +357,1083 @@ void CoapProtocol::setHandlers(packetReturn_callback packetAvailable,
 	_responseTimeout = responseTimeout;
 }
 
+/*	HANDLER is called with CTX and a decoded view of the packet, instead of
+	the packetReturn_callback, for EVENT (COAP_EVENT_...)	*/
+void CoapProtocol::setViewHandler(uns8 event, packetView_callback handler, void *ctx) {
+	if (event >= COAP_EVENTS)
+		return;
+	viewHandlers[event] = handler;
+	viewContexts[event] = ctx;
+}
+
+/*	Keeps the packet VIEW looks at where it is once the callback has
+	returned. The protocol is done with it as usual, but its queue slot
+	isn't reused until releasePacket(), so a retained packet takes up room
+	in the queue. Returns 1, or -1 if the packet isn't in a queue (a cached
+	response)	*/
+int CoapProtocol::retainPacket(const coap_packet_view *view) {
+	if (view->index < 0)
+		return -1;
+	CoapTransactionTable &table = queueTable(view->queue);
+	if (!table.isFilled(view->index) || (table[view->index].packet.getPacket() != view->data))
+		return -1;
+	table.retain(view->index);
+	return 1;
+}
+
+/*	Lets go of a packet retainPacket() kept. Call it once	*/
+void CoapProtocol::releasePacket(const coap_packet_view *view) {
+	if (view->index >= 0)
+		queueTable(view->queue).unretain(view->index);
+}
+
 
 ////////////////////////////////////////////////////
 ////				 Callbacks					////
 ////////////////////////////////////////////////////
 
 void CoapProtocol::txSuccessHandler(uns8* pkt, int pktLen) {
-	if (_txSuccess != NULL) {
+	if (viewHandlers[COAP_EVENT_SUCCESS] != NULL) {
+		viewEvent(COAP_EVENT_SUCCESS, RX, pkt, pktLen);
+	}
+	else if (_txSuccess != NULL) {
 		_txSuccess(pkt, pktLen);
 	}
 }
 
+/*	Offers a response to each extension in turn. Returns 1 if one took it	*/
+int CoapProtocol::extensionResponse(int rxIndex, int txIndex) {
+	for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+		if (ext->onResponse(rxIndex, txIndex))
+			return 1;
+	}
+	return 0;
+}
+
+int CoapProtocol::extensionRequest(int rxIndex) {
+	for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+		if (ext->onRequest(rxIndex))
+			return 1;
+	}
+	return 0;
+}
+
+int CoapProtocol::extensionReset(int rxIndex, int txIndex) {
+	for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+		if (ext->onReset(rxIndex, txIndex))
+			return 1;
+	}
+	return 0;
+}
+
+int CoapProtocol::extensionTxFailure(int txIndex) {
+	for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+		if (ext->onTxFailure(txIndex))
+			return 1;
+	}
+	return 0;
+}
+
 void CoapProtocol::txFailureHandler(uns8* pkt, int pktLen) {
-	if (_txSuccess != NULL) {
+	if (viewHandlers[COAP_EVENT_FAILURE] != NULL) {
+		viewEvent(COAP_EVENT_FAILURE, TX, pkt, pktLen);
+	}
+	else if (_txFailure != NULL) {
 		_txFailure(pkt, pktLen);
 	}
 }
 
 void CoapProtocol::availablePacketHandler(uns8* pkt, int pktLen) {
-	if (_txSuccess != NULL) {
+	if (viewHandlers[COAP_EVENT_AVAILABLE] != NULL) {
+		viewEvent(COAP_EVENT_AVAILABLE, RX, pkt, pktLen);
+	}
+	else if (_packetAvailable != NULL) {
 		_packetAvailable(pkt, pktLen);
 	}
 }
 
 void CoapProtocol::responseTimeoutHandler(uns8* pkt, int pktLen) {
-	if (_txSuccess != NULL) {
+	if (viewHandlers[COAP_EVENT_TIMEOUT] != NULL) {
+		viewEvent(COAP_EVENT_TIMEOUT, RX, pkt, pktLen);
+	}
+	else if (_responseTimeout != NULL) {
 		_responseTimeout(pkt, pktLen);
 	}
 }
 
+/*	Fills VIEW in from P, which is already decoded	*/
+static void fill_view(coap_packet_view &view, CoapPacket &p) {
+	view.packet = &p;
+	view.data = p.getPacket();
+	view.length = p.getPacketLength();
+	view.type = p.getMessageType();
+	view.code = p.getResponseCode();
+	view.id = p.getID();
+	view.token = p.getTokenPtr();
+	view.tokenLength = p.getTokenLength();
+	view.payload = p.getPayloadPtr();
+	view.payloadLength = p.getPayloadLength();
+}
+
+/*	Calls the view handler for EVENT with PKT as it sits, already decoded,
+	in QUEUE. The slot is found through indexOf(), and the view is filled
+	in from the slot's packet	*/
+void CoapProtocol::viewEvent(uns8 event, int queue, uns8 *pkt, int pktLen) {
+	CoapTransactionTable &table = queueTable(queue);
+	int index = table.indexOf(pkt);
+	if (index < 0) {
+		viewCopyEvent(event, queue, pkt, pktLen);
+		return;
+	}
+	
+	coap_packet_view view;
+	fill_view(view, table[index].packet);
+	view.peer = table[index].peer;
+	view.event = event;
+	view.queue = queue;
+	view.index = index;
+	viewHandlers[event](viewContexts[event], &view);
+}
+
+/*	The same for a packet that isn't queued (a response served from the
+	cache). It is decoded into a packet of its own, and can't be retained	*/
+void CoapProtocol::viewCopyEvent(uns8 event, int queue, uns8 *pkt, int pktLen) {
+	coap_packet_view view;
+	CoapPacket copy;
+	
+	copy.copyPacket(pkt, pktLen);
+	fill_view(view, copy);
+	view.peer.addr = 0;
+	view.peer.port = 0;
+	view.event = event;
+	view.queue = queue;
+	view.index = -1;
+	viewHandlers[event](viewContexts[event], &view);
+}
+
 
 ////////////////////////////////////////////////////
 ////			Buffer Functions				////
 ////////////////////////////////////////////////////
 
-/*	EMPTY -> go to next packet
-//	PROCESSED? -> remove from queue, go to next packet
+/*	New packets are dispatched as they are received (see dispatchPacket()).
+//	After that an rx packet is only looked at again when its deadline passes:
+//	PROCESSED? -> remove from queue
+//	CON -> late response deadline passed
+//		responseTimeout(&packet), send empty ACK, remove from queue
+//	NON/RST -> NON_LIFETIME passed without being processed, remove from queue*/
+
+void CoapProtocol::process_rx_queue() {
+	int due[COAP_BATCH_SIZE];
+	int count;
+	
+	receivePackets();
+	
+	uns32 now = millis();
+	while ((count = rxTable.expired(now, due, COAP_BATCH_SIZE)) > 0) {
+		for (int n = 0; n < count; n++) {
+			int i = due[n];
+			if (!rxTable.isFilled(i))
+				continue;
+			coap_transaction &rx = rxTable[i];
+			
+			//Response time has expired
+			if (bitRead(rx.status, FLAG_IS_CON) && !bitRead(rx.status, FLAG_PROCESSED)) {
+				metrics.count(COAP_METRIC_LATE_RESPONSES);
+				//Empty ACK, so the response has to come separately
+				if (sendEmpty(TYPE_ACK, rx.packet.getID(), rx.peer) < 0)
+					metrics.count(COAP_METRIC_SEND_ERRORS);
+				responseTimeoutHandler(rx.packet.getPacket(), rx.packet.getPacketLength());
+			}
+			else if ((rx.packet.getMessageType() == TYPE_NON) && !bitRead(rx.status, FLAG_PROCESSED)) {
+				metrics.count(COAP_METRIC_DROP_EXPIRED);
+			}
+			rxTable.release(i);
+		}
+	}
+	metrics.occupancy(RX, rxTable.size());
+}
+
+/*	Called once for every packet that makes it into the rx queue
 //	ACK? -> find matching CON in tx
 //				match found -> txSuccess(ID), remove both from queues
 //				match not found -> remove from buffer
-//	CON -> check time
-//		time "expired?" -> responseTimeout(&packet), send empty ACK, remove from queue
-//		time not "expired" -> packetReceived(&packet)	
+//	CON -> start late response deadline, packetReceived(&packet)
 //	RST/NON -> packetReceived(&packet)	
 //	3 callback functions - txSuccess(ID), responseTimeout(&packet), packetAvailable(&packet)*/
 
-void CoapProtocol::process_rx_queue() {
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		//If packet index is empty, skip 
-		if (!bitRead(rxPacketStatus[i], FLAG_FILLED))
-			continue;
-		
-		//If packet is processed, remove from buffer go to next one
-		else if (bitRead(rxPacketStatus[i], FLAG_PROCESSED)) {
-			rxPacketStatus[i] = 0;
-			rxTimeLog[i] = 0;
-			continue;
-		}
+void CoapProtocol::dispatchPacket(int index) {
+	coap_transaction &rx = rxTable[index];
+	
+	//If packet is an ACK, find matching CON in TX
+	if (bitRead(rx.status, FLAG_ACK_RCVD)) {
+		int match = txTable.findById(rx.peer, rx.packet.getID());
 		
-		//If packet is an ACK, find matching CON in TX
-		if (bitRead(rxPacketStatus[i], FLAG_ACK_RCVD)) {
-			int cursor = 0;
-			//Look for matching CON in TX
-			while ((cursor < MAX_QUEUE_SIZE) && bitRead(txPacketStatus[cursor], FLAG_FILLED)) {
-				 if (rxBuffer[i].getID() == txBuffer[cursor].getID())
-					 break;
-				 else
-					cursor++;
+		//Matching CON has been found. Callback, then remove. A request
+		//already ACKed is waiting for its separate response
+		if ((match >= 0) && bitRead(txTable[match].status, FLAG_IS_CON) && !bitRead(txTable[match].status, FLAG_ACK_RCVD)) {
+			coap_transaction &tx = txTable[match];
+			//Only a CON sent once gives an unambiguous round trip time. One
+			//sent two or three times gives a weak one, timed from the first
+			int sent = numTimesTransmitted(tx.status);
+			if (sent <= 3) {
+				int p = peerTable.get(tx.peer);
+				if (p >= 0)
+					peerTable.rttSample(p, rx.time - tx.time, sent > 1, config.ackTimeout, rx.time);
 			}
-			//This means matching CON was not found in tx. Remove
-			if (cursor == MAX_QUEUE_SIZE) {
-				rxPacketStatus[i] = 0x00;
-				rxTimeLog[i] = 0;
+			if (sent == 1)
+				metrics.record(COAP_HISTOGRAM_RTT, rx.time - tx.time);
+			if (extensionResponse(index, match)) {
+				releaseTX(match);
 			}
-			//Matching CON has been found. Callback, then remove
-			else {
-				txSuccessHandler(rxBuffer[i].getPacket(), rxBuffer[i].getPacketLength());
-				rxPacketStatus[i] = 0x00;
-				rxTimeLog[i] = 0;
-				txPacketStatus[cursor] = 0;
-				txTimeLog[cursor] = 0;
-			}
-		}
-		
-		//Packet is CON -> check its time
-		else if (bitRead(rxPacketStatus[i], FLAG_IS_CON)) {
-			//Response time has expired
-			if (responseTimeExpired(RX, i)) {
-				int x = findSpace(TX);
-				//If there's space in TX, send empty ACK and remove this one
-				if (x < MAX_QUEUE_SIZE) {
-					addHeader(x, TYPE_ACK, rxBuffer[i].getResponseCode(), rxBuffer[i].getID());
-					sendPacket(x);
-					rxPacketStatus[i] = 0;
-					rxTimeLog[i] = 0;
-					txPacketStatus[x] = 0;
-					txTimeLog[x] = 0;
-				}
-				responseTimeoutHandler(rxBuffer[i].getPacket(), rxBuffer[i].getPacketLength());
+			//Empty ACK to a request: the response follows on its own
+			else if ((rx.packet.getResponseCode() == 0) && isRequest(tx.packet)) {
+				awaitResponse(match);
 			}
 			else {
-				availablePacketHandler(rxBuffer[i].getPacket(), rxBuffer[i].getPacketLength());
+				txSuccessHandler(rx.packet.getPacket(), rx.packet.getPacketLength());
+				releaseTX(match);
 			}
 		}
-		
-		//Packet is NON or RST
-		else {
-			//Insert packetAvailable(&packet) callback
-			availablePacketHandler(rxBuffer[i].getPacket(), rxBuffer[i].getPacketLength());
+		else if (match < 0) {
+			metrics.count(COAP_METRIC_DROP_UNMATCHED);
 		}
+		//Either way the ACK is done with
+		rxTable.release(index);
+		return;
 	}
+	
+	//The peer rejected one of our messages, which ends the exchange
+	//(RFC 7252 section 4.2): it is not retransmitted or waited for any more
+	if (rx.packet.getMessageType() == TYPE_RST) {
+		int match = txTable.findById(rx.peer, rx.packet.getID());
+		metrics.count(COAP_METRIC_RESETS);
+		if (extensionReset(index, match)) {
+			if (match >= 0)
+				releaseTX(match);
+			rxTable.release(index);
+			return;
+		}
+		if (match >= 0) {
+			coap_transaction &tx = txTable[match];
+			metrics.count(COAP_METRIC_TX_FAILURES);
+			if (!extensionTxFailure(match))
+				txFailureHandler(tx.packet.getPacket(), tx.packet.getPacketLength());
+			releaseTX(match);
+			rxTable.release(index);
+			return;
+		}
+	}
+	
+	//Request an extension answers itself
+	if (((rx.packet.getResponseCode() >> 5) == 0) && (rx.packet.getResponseCode() != 0) && extensionRequest(index)) {
+		if (!bitRead(rx.status, FLAG_PROCESSED))
+			metrics.record(COAP_HISTOGRAM_RX_QUEUE, millis() - rx.time);
+		rxTable.release(index);
+		return;
+	}
+	
+	//Separate response to a request an extension made, or to one of ours,
+	//found by its token
+	if ((rx.packet.getResponseCode() >> 5) >= 2) {
+		int match = -1;
+		bool handled = extensionResponse(index, -1);
+		if (!handled) {
+			match = txTable.findByToken(rx.peer, rx.packet.getTokenPtr(), rx.packet.getTokenLength());
+			handled = (match >= 0) && awaitingResponse(match);
+		}
+		if (handled) {
+			if (bitRead(rx.status, FLAG_IS_CON) && (sendEmpty(TYPE_ACK, rx.packet.getID(), rx.peer) < 0))
+				metrics.count(COAP_METRIC_SEND_ERRORS);
+			if (match >= 0) {
+				txSuccessHandler(rx.packet.getPacket(), rx.packet.getPacketLength());
+				releaseTX(match);
+			}
+			rxTable.release(index);
+			return;
+		}
+	}
+	
+	if (bitRead(rx.status, FLAG_IS_CON))
+		rxTable.schedule(index, rx.time + config.ackTimeout);
+	else
+		rxTable.schedule(index, rx.time + nonLifetime);
+	
+	availablePacketHandler(rx.packet.getPacket(), rx.packet.getPacketLength());
+	
+	//Handled straight away - no need to wait for the next pass
+	if (bitRead(rx.status, FLAG_PROCESSED))
+		rxTable.release(index);
 }
 
-/*	EMPTY -> go to next packet
-//	NOT SENT? -> send, go to next packet
-//	SENT & NON/RST? -> remove from queue
-//	SENT & ACK -> remove from queue
-//	SENT & CON -> check time
-//			majorTimeout? -> txFailed(&packet), remove from queue
-//			responseTimeout? -> re-send
-//			no time has expired yet -> next packet;
-//	1 callback function - txFailed(&packet)*/
+/*	Only packets whose deadline has passed are looked at:
+//	NOT SENT? -> send
+//	SENT & CON -> retransmit timeout passed
+//			retransmitted maxRetransmit times? -> txFailed(&packet), remove from queue
+//			otherwise -> re-send, back-off doubles
+//	NON/RST/ACK packets are removed as soon as they have been sent
+//	1 callback function - txFailed(&packet)
+//	Everything due for (re)transmission is collected and handed to the
+//	transport in batches of up to COAP_BATCH_SIZE datagrams*/
 
 void CoapProtocol::process_tx_queue() {
-	for (int i = 0; i < MAX_QUEUE_SIZE; i++) {
-		//Packet index empty - next packet
-		if (!bitRead(txPacketStatus[i], FLAG_FILLED)) {
-			continue;
+	int due[COAP_BATCH_SIZE];
+	int count;
+	int queued;
+	
+	//Extensions may have more to send than fits in the queue (notifications
+	//to many observers). Keep going while sending frees up room for them
+	do {
+		uns32 now = millis();
+		queued = 0;
+		for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+			queued += ext->poll(now);
 		}
-		
-		//Packet not sent yet - send
-		else if ((txPacketStatus[i] & COUNT_TRANSMISSIONS) == 0) {
-			sendPacket(i);
+		while ((count = txTable.expired(now, due, COAP_BATCH_SIZE)) > 0) {
+			sendDue(due, count);
 		}
-		//Packet sent before - NON/RST/ACK type -> remove from queue
-		if ((txBuffer[i].getMessageType() == TYPE_NON) || 
-			(txBuffer[i].getMessageType() == TYPE_RST) ||
-			(txBuffer[i].getMessageType() == TYPE_ACK)) {
-			txPacketStatus[i] = 0;
-			txTimeLog[i] = 0;
+	} while (queued > 0);
+	metrics.occupancy(TX, txTable.size());
+}
+
+/*	Milliseconds until the earliest rx or tx deadline or extension deadline,
+	0 if one has passed, -1 if there is none. An event loop that waits this
+	long, or until getFd() is readable, misses nothing process_rx_queue()
+	and process_tx_queue() would have done in between	*/
+int CoapProtocol::nextTimeout() {
+	uns32 earliest = 0;
+	uns32 deadline;
+	bool found = false;
+	
+	if (rxTable.nextDeadline(&deadline)) {
+		earliest = deadline;
+		found = true;
+	}
+	if (txTable.nextDeadline(&deadline) && (!found || ((int32_t)(deadline - earliest) < 0))) {
+		earliest = deadline;
+		found = true;
+	}
+	for (CoapExtension *ext = extensions; ext != NULL; ext = ext->nextExtension) {
+		if (ext->nextDeadline(&deadline) && (!found || ((int32_t)(deadline - earliest) < 0))) {
+			earliest = deadline;
+			found = true;
 		}
+	}
+	if (!found)
+		return -1;
+	
+	int32_t wait = (int32_t)(earliest - millis());
+	return (wait > 0) ? wait : 0;
+}
+
+int CoapProtocol::getFd() {
+	return transport->getFd();
+}
+
+/*	False while the rx queue is full, when waiting on getFd() would only
+	wake straight away for datagrams that can't be taken yet	*/
+bool CoapProtocol::canReceive() {
+	return rxTable.available() > 0;
+}
+
+/*	Looks at the COUNT tx packets at DUE whose deadline has passed: sends or
+	retransmits them in one batch, or gives up on them	*/
+void CoapProtocol::sendDue(const int *due, int count) {
+	int batch[COAP_BATCH_SIZE];
+	int batched = 0;
+	
+	for (int n = 0; n < count; n++) {
+		int i = due[n];
+		if (!txTable.isFilled(i))
+			continue;
+		coap_transaction &tx = txTable[i];
+		int sent = numTimesTransmitted(tx.status);
 		
-		//Packet sent before - CON -> check time
+		//Request ACKed empty whose separate response never came
+		if (bitRead(tx.status, FLAG_ACK_RCVD)) {
+			metrics.count(COAP_METRIC_TX_FAILURES);
+			if (!extensionTxFailure(i))
+				txFailureHandler(tx.packet.getPacket(), tx.packet.getPacketLength());
+			releaseTX(i);
+		}
+		//Packet not sent yet, or a CON whose ACK is late
+		else if ((sent == 0) || (bitRead(tx.status, FLAG_IS_CON) && (sent <= config.maxRetransmit))) {
+			batch[batched++] = i;
+		}
+		//CON that was never acknowledged
+		else if (bitRead(tx.status, FLAG_IS_CON)) {
+			metrics.count(COAP_METRIC_TX_FAILURES);
+			if (!extensionTxFailure(i))
+				txFailureHandler(tx.packet.getPacket(), tx.packet.getPacketLength());
+			releaseTX(i);
+		}
+		//Sent NON/RST/ACK
 		else {
-			//Check major timeout
-			if (timeExpired(TX, i)) {
-				txFailureHandler(txBuffer[i].getPacket(), txBuffer[i].getPacketLength());
-				txPacketStatus[i] = 0;
-				txTimeLog[i] = 0;
-			}
-			
-			//Major timeout not expired. Check response timeout
-			else if (responseTimeExpired(TX, i)) {
-				sendPacket(i);
+			releaseTX(i);
+		}
+	}
+	flushTX(batch, batched);
+}
+
+/*	Sends the tx packets at INDEXES with as few transport calls as possible.
+	Sent CONs wait for their next retransmission, anything else is done with.
+	Packets the transport did not accept are retried on the next tick	*/
+void CoapProtocol::flushTX(const int *indexes, int count) {
+	coap_datagram dgrams[COAP_BATCH_SIZE];
+	int batch[COAP_BATCH_SIZE];
+	int batched = 0;
+	
+	if (count == 0)
+		return;
+	for (int i = 0; i < count; i++) {
+		coap_transaction &tx = txTable[indexes[i]];
+		//Packets with payload references aren't in one buffer, so they go
+		//on their own for the transport to gather
+		if (tx.segmentCount > 0) {
+			if (transmit(tx) < 0) {
+				metrics.count(COAP_METRIC_SEND_ERRORS);
+				txTable.schedule(indexes[i], millis() + COAP_TIMER_TICK_MS);
 			}
-			
-			//Packet sent more than 5x already, remove
-			else if ((txPacketStatus[i] & COUNT_TRANSMISSIONS) == 5) {
-				txFailureHandler(txBuffer[i].getPacket(), txBuffer[i].getPacketLength());
+			else {
+				txSent(indexes[i], millis());
 			}
-			//Neither timeouts have expired - do nothing
+			continue;
 		}
+		batch[batched] = indexes[i];
+		dgrams[batched].data = tx.packet.getPacket();
+		dgrams[batched].length = tx.packet.getPacketLength();
+		dgrams[batched].capacity = MAX_SIZE;
+		dgrams[batched].peer = tx.peer;
+		batched++;
+	}
+	if (batched == 0)
+		return;
+	
+	int sent = transport->sendBatch(dgrams, batched);
+	if (sent < 0)
+		sent = 0;
+	uns32 now = millis();
+	if (sent < batched)
+		metrics.count(COAP_METRIC_SEND_ERRORS, batched - sent);
+	for (int i = 0; i < sent; i++) {
+		txSent(batch[i], now);
+	}
+	for (int i = sent; i < batched; i++) {
+		txTable.schedule(batch[i], now + COAP_TIMER_TICK_MS);
+	}
+}
+
+/*	Tx slot INDEX has just been sent: a CON waits for its next
+	retransmission, anything else is done with	*/
+void CoapProtocol::txSent(int index, uns32 now) {
+	coap_transaction &tx = txTable[index];
+	packetSent(tx, now);
+	
+	if (bitRead(tx.status, FLAG_IS_CON)) {
+		txTable.index(index);	//ACKs can be matched from now on
+		txTable.schedule(index, now + retransmitTimeout(tx));
+	}
+	else {
+		releaseTX(index);
 	}
 }
 
 /* 
 Clears packet in buffer[queue], at slot [index] 
-If index = 4, entire buffer is cleared. This is also default if no index is passed*/
+If index = -1, entire buffer is cleared. This is also default if no index is passed*/
 void CoapProtocol::clearQueue(int queue, int index) {
-	if (queue) {
-		ptr_packetStatus = &rxPacketStatus[0];
-		timePtr = &rxTimeLog[0];
-	} else {
-		ptr_packetStatus = &txPacketStatus[0];
-		timePtr = &txTimeLog[0];
-	}
-	
-	if (index == 4) {
-		ptr_packetStatus[0] = 0;
-		ptr_packetStatus[1] = 0;
-		ptr_packetStatus[2] = 0;
-		ptr_packetStatus[3] = 0;
-		
-		timePtr[0] = 0;
-		timePtr[1] = 0;
-		timePtr[2] = 0;
-		timePtr[3] = 0;
+	if (queue == RX) {
+		if (index < 0)
+			rxTable.clear();
+		else
+			rxTable.release(index);
 	}
 	else {
-		ptr_packetStatus[index] = 0;
-		timePtr[index] = 0;
+		//One at a time, so CONs in flight are accounted for
+		if (index < 0) {
+			int i;
+			while ((i = txTable.first()) >= 0)
+				releaseTX(i);
+		}
+		else if (txTable.isFilled(index)) {
+			releaseTX(index);
+		}
 	}
 }
 
-/*	Add packet to txQueue. Returns -1 if full	*/
+/*	Add packet to txQueue, to be sent to the destination set by
+	setDestination(). Returns -1 if full	*/
 
 int CoapProtocol::addToTX(uns8 *packet, int len) {
-	int index = findSpace(TX);
-	if (index == MAX_QUEUE_SIZE)
+	return addToTX(destination, packet, len);
+}
+
+/*	Add packet to txQueue, to be sent to TO. Returns -1 if full	*/
+int CoapProtocol::addToTX(const coap_endpoint &to, uns8 *packet, int len) {
+	int index = reserveTX(to);
+	if (index < 0)
+		return -1;
+	if ((len > 0) && (txTable[index].packet.copyPacket(packet, len) == 0)) {
+		metrics.count(COAP_METRIC_DROP_NO_MEMORY);
+		clearQueue(TX, index);
+		return -1;
+	}
+	return commitTX(index);
+}
+
+/*	Queues a packet to TO stamped from TMPL, with the next message ID for TO.
+	Returns -1 if txQueue is full or the packet doesn't fit	*/
+int CoapProtocol::addToTX(const coap_endpoint &to, CoapPacketTemplate &tmpl, const uns8 *token, uns8 tokenLength,
+						  const uns8 *payload, uns16 payloadLength) {
+	int index = reserveTX(to);
+	if (index < 0)
 		return -1;
-	txBuffer[index].begin();
-	txBuffer[index].copyPacket(packet, len);
+	if (!tmpl.stamp(txTable[index].packet, nextMessageId(to), token, tokenLength, payload, payloadLength)) {
+		clearQueue(TX, index);
+		return -1;
+	}
+	return commitTX(index);
+}
+
+/*	Takes a tx slot for a packet to TO, to be built in place through
+	getCoapPacket(TX, index) and queued with commitTX(). Saves copying the
+	packet in. Returns the index, or -1 if txQueue is full	*/
+int CoapProtocol::reserveTX(const coap_endpoint &to) {
+	int index = txTable.allocate();
+	if (index < 0) {
+		metrics.count(COAP_METRIC_DROP_TX_FULL);
+		return -1;
+	}
+	metrics.occupancy(TX, txTable.size());
+	txTable[index].packet.begin();
+	txTable[index].peer = to;
+	return index;
+}
+
+/*	Queues the packet built in tx slot INDEX	*/
+int CoapProtocol::commitTX(int index) {
+	coap_transaction &tx = txTable[index];
 	
 	//Set FILLED flag
-	bitSet(txPacketStatus[index], FLAG_FILLED);	
-	txBuffer[index].parsePacket();
+	bitSet(tx.status, FLAG_FILLED);	
 
 	//Set CON flag if it's a CON packet
-	if (txBuffer[index].getMessageType() == TYPE_CON) {
-		bitSet(txPacketStatus[index], FLAG_IS_CON);
+	if (tx.packet.getMessageType() == TYPE_CON) {
+		bitSet(tx.status, FLAG_IS_CON);
+	}
+	
+	//Due straight away. Until it is sent its time is when it was queued
+	tx.time = millis();
+	txTable.schedule(index, tx.time);
+	return 1;
+}
+
+
+/*	Add packet to txQueue, to be sent to whoever sent REQUEST, a packet handed
+	to availablePacketHandler() that is still in the rx queue.
+	Returns -1 if REQUEST isn't in the rx queue or txQueue is full	*/
+int CoapProtocol::replyTo(const uns8 *request, uns8 *packet, int len) {
+	int index = rxTable.indexOf(request);
+	if (index < 0)
+		return -1;
+	return addToTX(rxTable[index].peer, packet, len);
+}
+
+/*	Starts the response to REQUEST, a packet handed to availablePacketHandler()
+	that is still in the rx queue, in a tx slot: a piggybacked ACK with the
+	request's message ID if it is a CON, otherwise a NON, with code CODE and
+	the request's token. Options and payload can then be added to
+	getCoapPacket(TX, index) before sendReply(). Returns the tx index, or -1
+	if REQUEST isn't in the rx queue or txQueue is full	*/
+int CoapProtocol::startReply(const uns8 *request, uns8 code) {
+	int rx = rxTable.indexOf(request);
+	if (rx < 0)
+		return -1;
+	CoapPacket &req = rxTable[rx].packet;
+	int index = reserveTX(rxTable[rx].peer);
+	if (index < 0)
+		return -1;
+	
+	CoapPacket &rsp = txTable[index].packet;
+	if (req.getMessageType() == TYPE_CON)
+		rsp.addHeader(TYPE_ACK, code, req.getID());
+	else
+		rsp.addHeader(TYPE_NON, code, nextMessageId(rxTable[rx].peer));
+	rsp.addTokens(req.getTokenLength(), req.getTokenPtr());
+	return index;
+}
+
+/*	Sends the response in tx slot INDEX started by startReply() straight
+	away, without waiting for process_tx_queue(), and marks REQUEST as
+	processed so it gets no empty ACK. Returns 1 if it was sent, or 0 if the
+	transport wouldn't take it and it was left queued to be sent again	*/
+int CoapProtocol::sendReply(const uns8 *request, int index) {
+	int rx = rxTable.indexOf(request);
+	if (rx >= 0)
+		markProcessed(rx);
+	
+	coap_transaction &tx = txTable[index];
+	bitSet(tx.status, FLAG_FILLED);
+	if (tx.packet.getMessageType() == TYPE_CON)
+		bitSet(tx.status, FLAG_IS_CON);
+	uns32 now = millis();
+	tx.time = now;
+	if (transmit(tx) < 0) {
+		metrics.count(COAP_METRIC_SEND_ERRORS);
+		txTable.schedule(index, now);
+		return 0;
 	}
+	txSent(index, now);
+	return 1;
+}
+
+/*	From inside availablePacketHandler(): REQUEST will be answered later, by
+	a separate response. A CON is ACKed straight away so the client stops
+	retransmitting it, and the request leaves the rx queue; LATER keeps what
+	startDeferredReply() needs. Returns 1, or -1 if REQUEST isn't in the rx
+	queue	*/
+int CoapProtocol::deferReply(const uns8 *request, coap_deferred *later) {
+	int rx = rxTable.indexOf(request);
+	if (rx < 0)
+		return -1;
+	CoapPacket &req = rxTable[rx].packet;
+	later->peer = rxTable[rx].peer;
+	later->type = req.getMessageType();
+	later->tokenLength = req.getTokenLength();
+	memcpy(later->token, req.getTokenPtr(), later->tokenLength);
 	
+	if ((later->type == TYPE_CON) && (sendEmpty(TYPE_ACK, req.getID(), later->peer) < 0))
+		metrics.count(COAP_METRIC_SEND_ERRORS);
+	markProcessed(rx);
 	return 1;
 }
 
+/*	Starts the separate response to the request deferReply() kept in LATER,
+	in a tx slot: a CON if the request was one, otherwise a NON, with a new
+	message ID, code CODE and the request's token. Options and payload can
+	then be added to getCoapPacket(TX, index) before commitTX(). Returns the
+	tx index, or -1 if txQueue is full	*/
+int CoapProtocol::startDeferredReply(const coap_deferred &later, uns8 code) {
+	int index = reserveTX(later.peer);
+	if (index < 0)
+		return -1;
+	CoapPacket &rsp = txTable[index].packet;
+	rsp.addHeader((later.type == TYPE_CON) ? TYPE_CON : TYPE_NON, code, nextMessageId(later.peer));
+	rsp.addTokens(later.tokenLength, (uns8*)later.token);
+	return index;
+}
+
 
 //////////////////////
 //	UDP Functions	//
 //////////////////////
 
 int CoapProtocol::sendPacket(int index) {
-		WiFiUDP::beginPacket(ipAddr, portRemote);
-		WiFiUDP::write(txBuffer[index].getPacket(), txBuffer[index].getPacketLength());
-		WiFiUDP::endPacket();
-		txTimeLog[index] = millis();	//Log time sent
-		txPacketStatus[index]++;
-		return index;
-}
-
-int CoapProtocol::parseUDPPacket() {
-	return WiFiUDP::parsePacket();
+	coap_transaction &tx = txTable[index];
+	if (transmit(tx) < 0)
+		return -1;
+	uns32 now = millis();
+	packetSent(tx, now);
+	txTable.index(index);
+	
+	//CONs wait for their ACK, anything else is removed on the next pass
+	if (bitRead(tx.status, FLAG_IS_CON))
+		txTable.schedule(index, now + retransmitTimeout(tx));
+	else
+		txTable.schedule(index, now);
+	return index;
 }
 
-/*	Receives incoming packet.
-	places it in the buffer, parses it, and sets the appropriate flags.
-	Returns the index of the packet or -1 if packet dropped.
-	*/
-int CoapProtocol::receivePacket() {
-	//Find space in rx queue
-	int index = findSpace(RX);	
-	if (index == MAX_QUEUE_SIZE) {
-		return -1;
+/*	Decodes the packet that has just been written into rx slot INDEX and sets
+	its flags. Malformed packets are dropped (a CON gets a RST, as RFC 7252
+	4.2 asks), and so are duplicates (a CON gets the ACK or RST it was
+	answered with before, see 4.5). A datagram the transport had to cut
+	short is dropped without an answer. Returns 1 if the packet was queued,
+	0 if it was dropped	*/
+int CoapProtocol::packetArrived(int index, int len, const coap_endpoint &from) {
+	coap_transaction &rx = rxTable[index];
+	
+	//Too big for the buffer, so only the start of it is there
+	if (len > MAX_SIZE) {
+		metrics.count(COAP_METRIC_DROP_TRUNCATED);
+		rxTable.release(index);
+		return 0;
 	}
-	rxBuffer[index].begin();
-	int len = WiFiUDP::read(rxBuffer[index].getPacket(), MAX_SIZE);
 	
-	//Set the packet's index manually, since this doesn't use copyPacket()
-	rxBuffer[index].setIndex(len);
+	//Set the packet's index manually, since this doesn't use copyPacket().
+	//It keeps its MAX_SIZE buffer until the slot is freed: moving it to a
+	//smaller block would copy every datagram a second time
+	rx.packet.setIndex(len);
+	metrics.received(len, rxTable.size());
+	
+	//Set the pointers to the parts of the packet
+	uns8 result = rx.packet.parsePacket();
+	if (result != PARSE_OK) {
+		metrics.count(COAP_METRIC_DROP_MALFORMED);
+		if ((result > PARSE_BAD_VERSION) && (rx.packet.getMessageType() == TYPE_CON))
+			sendEmpty(TYPE_RST, rx.packet.getID(), from);
+		rxTable.release(index);
+		return 0;
+	}
 	
 	//Log time
-	rxTimeLog[index] = millis();
+	rx.time = millis();
+	rx.peer = from;
+	
+#if COAP_WITH_DEDUP
+	//Seen this CON/NON before? Answer it again the same way and drop it
+	uns8 type = rx.packet.getMessageType();
+	if ((type == TYPE_CON) || (type == TYPE_NON)) {
+		int seen = dedup.check(from, rx.packet.getID(), rx.time);
+		if (seen >= 0) {
+			metrics.count(COAP_METRIC_DEDUP_HITS);
+			int respLen;
+			const uns8 *resp = dedup.getResponse(seen, &respLen);
+			if ((resp != NULL) && (type == TYPE_CON))
+				transport->send(resp, respLen, from);
+			rxTable.release(index);
+			return 0;
+		}
+	}
+#endif
 	
 	//Set FILLED flag
-	bitSet(rxPacketStatus[index], FLAG_FILLED);
+	bitSet(rx.status, FLAG_FILLED);
 	
 	//Increase rx count for this packet
-	rxPacketStatus[index]++;	
+	rx.status++;	
 	
 	//Set the CON/ACK flags in packetStatus and queueStatus
-	if (rxBuffer[index].getMessageType() == TYPE_CON) {
-		bitSet(rxPacketStatus[index], FLAG_IS_CON);
+	if (rx.packet.getMessageType() == TYPE_CON) {
+		bitSet(rx.status, FLAG_IS_CON);
 	} 
-	else if (rxBuffer[index].getMessageType() == TYPE_ACK) {
-		bitSet(rxPacketStatus[index], FLAG_ACK_RCVD);
+	else if (rx.packet.getMessageType() == TYPE_ACK) {
+		bitSet(rx.status, FLAG_ACK_RCVD);
 	}
-	
-	//Set the pointers to the parts of the packet
-	rxBuffer[index].parsePacket();
+	rxTable.index(index);
 	return 1;
 }
 
+/*	Bookkeeping for a packet TX has just sent: its time first sent and count
+	of transmissions are logged (until then its time is when it was queued).
+	An ACK or RST is remembered
+	as the answer to its message, so a retransmission of that message can be
+	answered from the dedup cache. A CON sent for the first time counts as in
+	flight to its peer until releaseTX(), and gets its retransmission timeout	*/
+void CoapProtocol::packetSent(coap_transaction &tx, uns32 now) {
+	if (numTimesTransmitted(tx.status) == 0) {
+		metrics.record(COAP_HISTOGRAM_TX_QUEUE, now - tx.time);
+		tx.time = now;
+	}
+	tx.status++;
+	int len = txLength(tx);
+	metrics.sent(len, numTimesTransmitted(tx.status));
+	
+	uns8 type = tx.packet.getMessageType();
+	if ((type == TYPE_ACK) || (type == TYPE_RST)) {
+#if COAP_WITH_DEDUP
+		//The dedup cache keeps a copy, so payload references are gathered
+		//into one if the whole message fits. If not, the length alone tells
+		//the cache it can't answer for this message
+		const uns8 *msg = tx.packet.getPacket();
+		uns8 copy[COAP_DEDUP_RESPONSE_SIZE];
+		if ((tx.segmentCount > 0) && (len <= COAP_DEDUP_RESPONSE_SIZE)) {
+			coap_iovec iov[COAP_MAX_SEGMENTS + 2];
+			int count = gather(tx, iov);
+			int pos = 0;
+			for (int i = 0; i < count; i++) {
+				memcpy(copy + pos, iov[i].data, iov[i].length);
+				pos += iov[i].length;
+			}
+			msg = copy;
+		}
+		dedup.storeResponse(tx.peer, tx.packet.getID(), msg, len, now);
+#endif
+	}
+	else if ((type == TYPE_CON) && (numTimesTransmitted(tx.status) == 1)) {
+		int p = peerTable.get(tx.peer);
+		if (p >= 0)
+			peerTable[p].inFlight++;
+		tx.timeout = initialTimeout(p, now);
+	}
+}
+
+/*	Hands TX to the transport: in one piece, or as the packet followed by
+	its payload references	*/
+int CoapProtocol::transmit(coap_transaction &tx) {
+	if (tx.segmentCount == 0)
+		return transport->send(tx.packet.getPacket(), tx.packet.getPacketLength(), tx.peer);
+	
+	coap_iovec iov[COAP_MAX_SEGMENTS + 2];
+	int count = gather(tx, iov);
+	return transport->sendv(iov, count, tx.peer);
+}
+
+/*	Fills IOV with the pieces of TX in the order they go on the wire: the
+	packet, a payload marker if the packet has no payload of its own, then
+	the payload references. Returns the number of pieces	*/
+int CoapProtocol::gather(coap_transaction &tx, coap_iovec *iov) {
+	static const uns8 mark = PAYLOAD_MARK;
+	int count = 0;
+	
+	iov[count].data = tx.packet.getPacket();
+	iov[count++].length = tx.packet.getPacketLength();
+	if ((tx.segmentCount > 0) && (tx.packet.getPayloadLength() == 0)) {
+		iov[count].data = &mark;
+		iov[count++].length = 1;
+	}
+	for (int i = 0; i < tx.segmentCount; i++) {
+		iov[count++] = tx.segments[i];
+	}
+	return count;
+}
+
+/*	Bytes TX takes on the wire, payload references included	*/
+int CoapProtocol::txLength(coap_transaction &tx) {
+	int len = tx.packet.getPacketLength();
+	if (tx.segmentCount == 0)
+		return len;
+	if (tx.packet.getPayloadLength() == 0)
+		len++;
+	for (int i = 0; i < tx.segmentCount; i++) {
+		len += tx.segments[i].length;
+	}
+	return len;
+}
+
+/*	First wait for the ACK of a CON to peer PEER (-1 if it has no entry):
+	ACK_TIMEOUT, or in CoCoA mode the peer's estimate, made up to
+	ACK_RANDOM_FACTOR longer at random so that CONs sent together aren't
+	retransmitted together	*/
+uns32 CoapProtocol::initialTimeout(int peer, uns32 now) {
+	uns32 rto = config.ackTimeout;
+	if ((config.rtoMode == COAP_RTO_COCOA) && (peer >= 0))
+		rto = peerTable.rto(peer, config.ackTimeout, now);
+	
+	//xorshift32
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return rto + (randomState % ((rto / 2) + 1));
+}
+
+/*	How long TX waits after its latest transmission. RFC 7252 doubles the
+	first wait each time; CoCoA's variable back-off triples a short one
+	(under 1 s) and takes a long one (over 3 s) only 1.5 times, never
+	waiting more than COAP_MAX_RTO	*/
+uns32 CoapProtocol::retransmitTimeout(coap_transaction &tx) {
+	int sent = numTimesTransmitted(tx.status);
+	uns32 wait = tx.timeout;
+	
+	if (config.rtoMode != COAP_RTO_COCOA)
+		return wait << (sent - 1);
+	for (int i = 1; i < sent; i++) {
+		if (tx.timeout < 1000)
+			wait *= 3;
+		else if (tx.timeout > 3000)
+			wait = wait * 3 / 2;
+		else
+			wait *= 2;
+		if (wait > COAP_MAX_RTO)
+			wait = COAP_MAX_RTO;
+	}
+	return wait;
+}
+
+/*	Gives tx slot INDEX back, taking a CON that was sent off its peer's
+	in flight count	*/
+void CoapProtocol::releaseTX(int index) {
+	coap_transaction &tx = txTable[index];
+	if (bitRead(tx.status, FLAG_IS_CON) && (numTimesTransmitted(tx.status) > 0) && !bitRead(tx.status, FLAG_ACK_RCVD)) {
+		int p = peerTable.find(tx.peer);
+		if ((p >= 0) && (peerTable[p].inFlight > 0))
+			peerTable[p].inFlight--;
+	}
+	txTable.release(index);
+}
+
+/*	True if PKT is a request rather than a response or empty message	*/
+bool CoapProtocol::isRequest(CoapPacket &pkt) {
+	return ((pkt.getResponseCode() >> 5) == 0) && (pkt.getResponseCode() != 0);
+}
+
+/*	The request in tx slot INDEX got an empty ACK. It stops being
+	retransmitted and no longer counts as in flight, but stays indexed by
+	its token until its separate response comes, or NON_LIFETIME passes and
+	it fails	*/
+void CoapProtocol::awaitResponse(int index) {
+	coap_transaction &tx = txTable[index];
+	int p = peerTable.find(tx.peer);
+	if ((p >= 0) && (peerTable[p].inFlight > 0))
+		peerTable[p].inFlight--;
+	bitSet(tx.status, FLAG_ACK_RCVD);
+	txTable.schedule(index, millis() + nonLifetime);
+}
+
+/*	True if tx slot INDEX is a request that has been sent and not answered.
+	A separate response may overtake the empty ACK, so this doesn't wait
+	for one	*/
+bool CoapProtocol::awaitingResponse(int index) {
+	coap_transaction &tx = txTable[index];
+	return bitRead(tx.status, FLAG_IS_CON) && (numTimesTransmitted(tx.status) > 0) && isRequest(tx.packet);
+}
+
+/*	Sends an empty message of TYPE (an ACK or RST) for message ID straight
+	away, without using the tx queue	*/
+int CoapProtocol::sendEmpty(uns8 type, uns16 id, const coap_endpoint &to) {
+	uns8 msg[4];
+	msg[0] = (COAP_VERSION << 6) | (type << 4);
+	msg[1] = 0;
+	msg[2] = id >> 8;
+	msg[3] = id & 0xFF;
+#if COAP_WITH_DEDUP
+	//A retransmission of the message an ACK answers gets it again
+	if (type == TYPE_ACK)
+		dedup.storeResponse(to, id, msg, 4, millis());
+#endif
+	int result = transport->send(msg, 4, to);
+	if (result >= 0)
+		metrics.sent(4, 1);
+	return result;
+}
+
+/*	Receives one incoming packet.
+	places it in the buffer, parses it, and sets the appropriate flags.
+	Returns the index of the packet or -1 if packet dropped.
+	*/
+int CoapProtocol::receivePacket() {
+	coap_endpoint from;
+	
+	//Find space in rx queue
+	int index = rxTable.allocate();	
+	if (index < 0) {
+		return -1;
+	}
+	if (rxTable.available() == 0)
+		metrics.count(COAP_METRIC_RX_QUEUE_FULL);
+	rxTable[index].packet.begin();
+	uns8 *buf = rxTable[index].packet.reservePacket(MAX_SIZE);
+	int len = (buf != NULL) ? transport->receive(buf, MAX_SIZE, &from) : -1;
+	if (len <= 0) {
+		rxTable.release(index);
+		return -1;
+	}
+	if (!packetArrived(index, len, from))
+		return -1;
+	dispatchPacket(index);
+	return index;
+}
+
+/*	Drains the transport into free rx slots, COAP_BATCH_SIZE datagrams per
+	transport call, until it runs dry or the queue is full.
+	Returns the number of packets received	*/
+int CoapProtocol::receivePackets() {
+	coap_datagram	dgrams[COAP_BATCH_SIZE];
+	int				slots[COAP_BATCH_SIZE];
+	int				total = 0;
+	
+	while (1) {
+		//Point the transport at as many free slots as it can fill in one call.
+		//They are only taken off the free list once something arrives in them.
+		//Each gets a MAX_SIZE buffer; slots left empty keep theirs for next time
+		int count = rxTable.peekFree(slots, COAP_BATCH_SIZE);
+		for (int i = 0; i < count; i++) {
+			dgrams[i].data = rxTable[slots[i]].packet.reservePacket(MAX_SIZE);
+			if (dgrams[i].data == NULL) {
+				count = i;
+				break;
+			}
+			dgrams[i].capacity = MAX_SIZE;
+			dgrams[i].length = 0;
+		}
+		if (count == 0)
+			break;
+		
+		int n = transport->receiveBatch(dgrams, count);
+		if (n < 0)
+			n = 0;
+		for (int i = 0; i < n; i++) {
+			rxTable.allocate();		//Hands out slots in peekFree() order
+		}
+		if ((n > 0) && (rxTable.available() == 0))
+			metrics.count(COAP_METRIC_RX_QUEUE_FULL);
+		for (int i = 0; i < n; i++) {
+			if (packetArrived(slots[i], dgrams[i].length, dgrams[i].peer)) {
+				dispatchPacket(slots[i]);
+				total++;
+			}
+		}
+		if (n < count)
+			break;
+	}
+	return total;
+}
+
 
 //////////////////////////////////////////////
 ///			Replying Functions			   ///
 //////////////////////////////////////////////
 
 int CoapProtocol::addPayload(int index, int len, const char *pay) {
-	return txBuffer[index].addPayload(len, pay);
+	return txTable[index].packet.addPayload(len, pay);
+}
+
+int CoapProtocol::addPayload(int index, int len, const uns8 *pay) {
+	return txTable[index].packet.addPayload(len, pay);
+}
+
+/*	Adds LEN bytes at DATA to the end of the payload of tx slot INDEX
+	without copying them; they are read each time the packet is sent, so
+	they must stay as they are until the slot is released (see
+	setPayloadDone()). Options and any inline payload have to be added
+	first. Returns 1, or 0 if the slot has COAP_MAX_SEGMENTS references
+	already or the packet would be bigger than MAX_SIZE	*/
+int CoapProtocol::addPayloadRef(int index, const uns8 *data, int len) {
+	coap_transaction &tx = txTable[index];
+	if (len <= 0)
+		return 1;
+	if (tx.segmentCount == COAP_MAX_SEGMENTS)
+		return 0;
+	int total = txLength(tx) + len;
+	if ((tx.segmentCount == 0) && (tx.packet.getPayloadLength() == 0))
+		total++;
+	if (total > MAX_SIZE)
+		return 0;
+	tx.segments[tx.segmentCount].data = data;
+	tx.segments[tx.segmentCount].length = len;
+	tx.segmentCount++;
+	return 1;
+}
+
+/*	DONE is called with CTX when tx slot INDEX is released, sent or not,
+	and the memory its payload references point at can be reused	*/
+void CoapProtocol::setPayloadDone(int index, coap_payload_done done, void *ctx) {
+	txTable[index].payloadDone = done;
+	txTable[index].payloadCtx = ctx;
 }
 
 int CoapProtocol::addTokens(int index, int numTokens, uns8 *tokens) {
-	return txBuffer[index].addTokens(numTokens, tokens);
+	return txTable[index].packet.addTokens(numTokens, tokens);
 }
 
 int CoapProtocol::addHeader(int index, uns8 type, uns8 code, uns16 id) {
-	txBuffer[index].begin();
-	return txBuffer[index].addHeader(type, code, id);
+	txTable[index].packet.begin();
+	return txTable[index].packet.addHeader(type, code, id);
 }
 
 /*	
-Create simple response packet. 
+Create simple response packet to rx packet INDEX. 
 Returns -1 if txBuffer is full, otherwise it returns index
 */
 int CoapProtocol::emptyACK(int index) {
-	int x = findSpace(TX);	//Find first empty space in tx queue
-	if (x == MAX_QUEUE_SIZE)
+	int x = txTable.allocate();	//Take an empty space in tx queue
+	if (x < 0)
 		return -1;
-	txBuffer[x].begin();
-	txBuffer[x].addHeader(TYPE_ACK, rxBuffer[index].getResponseCode(), rxBuffer[index].getID());
-	bitSet(txPacketStatus[x], FLAG_FILLED);
+	txTable[x].packet.begin();
+	txTable[x].packet.addHeader(TYPE_ACK, 0, rxTable[index].packet.getID());
+	txTable[x].peer = rxTable[index].peer;
+	bitSet(txTable[x].status, FLAG_FILLED);
+	txTable[x].time = millis();
+	txTable.schedule(x, txTable[x].time);
 	return x;
 }
-
-
-
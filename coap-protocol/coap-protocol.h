@@ -31,18 +31,28 @@ THE POSSIBILITY OF SUCH DAMAGE.
 // Written originally by Embedded Adventures
 
 #ifndef __COAP_PROTOCOL_h
-#define __COAP-PROTOCOL_h
+#define __COAP_PROTOCOL_h
 
-#include "ESP8266WiFi.h"
-#include "WiFiUdp.h"
 #include "coap-packet.h"
+#include "coap-template.h"
+#include "coap-transport.h"
+#include "coap-transactions.h"
+#include "coap-dedup.h"
+#include "coap-peers.h"
+#include "coap-metrics.h"
+#ifdef ARDUINO
+#include "coap-transport-wifi.h"
+#elif defined(__linux__)
+#include "coap-transport-posix.h"
+#endif
 
-#define		uns32				unsigned long
-#define		MAX_QUEUE_SIZE		4
-#define		ACK_TIMEOUT			2
+//MAX_QUEUE_SIZE, ACK_TIMEOUT, MAX_RETRANSMIT and MAX_LATENCY are in coap-config.h
 #define		ACK_RANDOM_FACTOR	1.5
-#define		MAX_RETRANSMIT		4
-#define		MAJOR_TIMEOUT		(ACK_TIMEOUT * (pow(2, MAX_RETRANSMIT) - 1) * ACK_RANDOM_FACTOR)
+
+//Derived times, in whole seconds (ACK_RANDOM_FACTOR is applied as * 3 / 2)
+#define		MAJOR_TIMEOUT		(ACK_TIMEOUT * ((1 << MAX_RETRANSMIT) - 1) * 3 / 2)
+#define		EXCHANGE_LIFETIME	(MAJOR_TIMEOUT + (2 * MAX_LATENCY) + ACK_TIMEOUT)
+#define		NON_LIFETIME		(MAJOR_TIMEOUT + MAX_LATENCY)
 
 /*STATUS BYTE
 	7		6		5 		4		3		2		1		0
@@ -60,28 +70,119 @@ THE POSSIBILITY OF SUCH DAMAGE.
 
 typedef void (*packetReturn_callback)(uns8* packet, int packetLength);
 
-class CoapProtocol : public WiFiUDP {
+//What a packetView_callback is called for, see setViewHandler()
+#define		COAP_EVENT_AVAILABLE	0		//A packet for the application arrived
+#define		COAP_EVENT_SUCCESS		1		//A response to one of our CONs
+#define		COAP_EVENT_FAILURE		2		//One of our CONs was never answered
+#define		COAP_EVENT_TIMEOUT		3		//A CON wasn't processed in time
+#define		COAP_EVENTS				4
+
+/*	A packet handed to a packetView_callback, already decoded, in the queue
+	slot it arrived or was sent from. Valid until the callback returns, or
+	until releasePacket() if the callback retained it. Read only: PACKET is
+	there for the options, through findOption() and friends	*/
+typedef struct {
+	CoapPacket		*packet;
+	const uns8		*data;			//The whole packet, as for packetReturn_callback
+	int				length;
+	coap_endpoint	peer;
+	uns8			type;
+	uns8			code;
+	uns16			id;
+	const uns8		*token;
+	uns8			tokenLength;
+	const uns8		*payload;
+	uns16			payloadLength;
+	uns8			event;			//COAP_EVENT_...
+	uns8			queue;			//RX or TX
+	int				index;
+}	coap_packet_view;
+
+typedef void (*packetView_callback)(void *ctx, const coap_packet_view *view);
+
+//A request to be answered later by a separate response, see deferReply()
+typedef struct {
+	coap_endpoint	peer;
+	uns8			type;			//The request's, CON or NON
+	uns8			tokenLength;
+	uns8			token[8];
+}	coap_deferred;
+
+/*	Settings for one CoapProtocol, given to begin(), so a program can run
+	several of different sizes. Start from COAP_CONFIG_DEFAULT:
+		coap_config config = COAP_CONFIG_DEFAULT;
+		config.queueSize = 64;	*/
+typedef struct {
+	uns16	localPort;
+	int		queueSize;			//Slots in each of the rx and tx queues
+	uns32	ackTimeout;			//ms before a CON is first sent again
+	uns8	maxRetransmit;		//Up to MAX_RETRANSMIT
+	uns32	dedupBudget;		//Bytes for duplicate detection, 0 for none
+	int		maxPeers;
+	uns8	rtoMode;			//COAP_RTO_COCOA or COAP_RTO_RFC7252
+}	coap_config;
+
+#define		COAP_CONFIG_DEFAULT		{COAP_DEFAULT_PORT, MAX_QUEUE_SIZE, ACK_TIMEOUT * 1000UL, MAX_RETRANSMIT, \
+									 COAP_DEDUP_BUDGET, COAP_MAX_PEERS, COAP_RTO_MODE}
+
+/*	Something layered on top of CoapProtocol (block-wise transfers, observe,
+	...) that wants to see packets before the application does. Each hook
+	returns 1 if it has dealt with the packet, which then doesn't reach the
+	callbacks	*/
+class CoapExtension {
+public:
+	CoapExtension	*nextExtension;
+	
+	CoapExtension() : nextExtension(NULL) {}
+	virtual ~CoapExtension() {}
+	
+	//A request arrived in rx slot RXINDEX. Return 1 only once it is answered
+	virtual int		onRequest(int /*rxIndex*/) { return 0; }
+	//A response arrived in rx slot RXINDEX. TXINDEX is the CON it ACKs,
+	//or -1 for a separate response (matched by token)
+	virtual int		onResponse(int /*rxIndex*/, int /*txIndex*/) { return 0; }
+	//The CON in tx slot TXINDEX was never ACKed
+	virtual int		onTxFailure(int /*txIndex*/) { return 0; }
+	//A RST arrived in rx slot RXINDEX. TXINDEX is the CON it rejects, or -1
+	virtual int		onReset(int /*rxIndex*/, int /*txIndex*/) { return 0; }
+	//Called from process_tx_queue() before anything is sent. Returns how many
+	//packets it queued; it is called again after those are sent if that's > 0
+	virtual int		poll(uns32 /*now*/) { return 0; }
+	//Sets DEADLINE to when poll() next has timed work, and returns 1, or
+	//returns 0 if it only does something after packets come and go
+	virtual int		nextDeadline(uns32* /*deadline*/) { return 0; }
+};
+
+class CoapProtocol {
 	
 private:
-	const int		thisPort = 5683;
-	int				portRemote;
-	const char*		ipAddr;
+	coap_config		config;
+	coap_endpoint	destination;
 	bool 			received;
+	
+	//Network backend. defaultTransport is used unless begin() is given another
+	CoapTransport*	transport;
+#ifdef ARDUINO
+	CoapWiFiTransport	defaultTransport;
+#elif defined(__linux__)
+	CoapPosixTransport	defaultTransport;
+#endif
 
-	//Used for functions that can manipulate either rx or tx variables
-	CoapPacket*		ptr_queue;
-	uns8*			ptr_packetStatus;
-	uns32*			timePtr;
+	//RX & TX queues. Packets, status bytes and time logs live in the tables
+	CoapTransactionTable	rxTable;
+	CoapTransactionTable	txTable;
+	CoapTransactionTable&	queueTable(int queue);
+	
+#if COAP_WITH_DEDUP
+	//Recently seen (peer, message ID)s and what they were answered with
+	CoapDedupCache	dedup;
+#endif
 	
-	//RX variables
-	CoapPacket		rxBuffer[MAX_QUEUE_SIZE];
-	uns8			rxPacketStatus[MAX_QUEUE_SIZE];	
-	uns32			rxTimeLog[MAX_QUEUE_SIZE];
+	//Message IDs, round trip times and CONs in flight, per peer
+	CoapPeerTable	peerTable;
 	
-	//TX variables
-	CoapPacket		txBuffer[MAX_QUEUE_SIZE];
-	uns8			txPacketStatus[MAX_QUEUE_SIZE];
-	uns32			txTimeLog[MAX_QUEUE_SIZE];
+	//Counters, histograms and queue gauges
+	CoapMetrics		metrics;
 	
 	//Status checking
 	inline int		numTimesTransmitted(uns8& stat);
@@ -89,18 +190,48 @@ private:
 	//Status and Overhead Query functions
 	int		numEmptySpaces(int queue);	//1 = rx, 0 = tx
 	int		numFilledSpaces(int queue); //1 = rx, 0 = tx
-	int		findSpace(int queue);		//Returns MAX_QUEUE_SIZE if no space
 	uns32	timeSent(int index);
 	uns32	timeReceived(int index);
-	int		timeExpired(int queue, int index);
-	int		responseTimeExpired(int queue, int index);
 	uns8	getPacketStatus(int queue, int index);
+	void	sendDue(const int *due, int count);
+	void	flushTX(const int *indexes, int count);
+	int		packetArrived(int index, int len, const coap_endpoint &from);
+	void	dispatchPacket(int index);
+	void	packetSent(coap_transaction &tx, uns32 now);
+	void	txSent(int index, uns32 now);
+	int		transmit(coap_transaction &tx);
+	int		gather(coap_transaction &tx, coap_iovec *iov);
+	int		txLength(coap_transaction &tx);
+	void	markProcessed(int index);
+	void	releaseTX(int index);
+	bool	isRequest(CoapPacket &pkt);
+	void	awaitResponse(int index);
+	bool	awaitingResponse(int index);
+	
+	//How long a CON waits for its ACK after its first and latest
+	//transmissions, and how long a NON waits to be processed
+	uns32	initialTimeout(int peer, uns32 now);
+	uns32	retransmitTimeout(coap_transaction &tx);
+	uns32	randomState;
+	uns32	nonLifetime;
+	int		sendEmpty(uns8 type, uns16 id, const coap_endpoint &to);
+	
+	//Extensions, in the order they were added
+	CoapExtension	*extensions;
+	int		extensionRequest(int rxIndex);
+	int		extensionResponse(int rxIndex, int txIndex);
+	int		extensionTxFailure(int txIndex);
+	int		extensionReset(int rxIndex, int txIndex);
 	
 	//Callback functions
 	packetReturn_callback	_txSuccess;
 	packetReturn_callback 	_txFailure;
 	packetReturn_callback 	_packetAvailable;
 	packetReturn_callback 	_responseTimeout;
+	packetView_callback		viewHandlers[COAP_EVENTS];
+	void					*viewContexts[COAP_EVENTS];
+	void	viewEvent(uns8 event, int queue, uns8 *pkt, int pktLen);
+	void	viewCopyEvent(uns8 event, int queue, uns8 *pkt, int pktLen);
 	
 public:
 	CoapProtocol();
@@ -115,6 +246,13 @@ public:
 							packetReturn_callback txSuccess,
 							packetReturn_callback txFailure,
 							packetReturn_callback responseTimeout);
+	//Decoded packets in place, with a context pointer. Takes over from the
+	//packetReturn_callback for EVENT while set (NULL gives it back)
+	void	setViewHandler(uns8 event, packetView_callback handler, void *ctx);
+	//From inside a packetView_callback: keep the packet, and its queue
+	//slot, after the callback returns, until releasePacket()
+	int		retainPacket(const coap_packet_view *view);
+	void	releasePacket(const coap_packet_view *view);
 	
 	//Callback function handlers
 	virtual void	txSuccessHandler(uns8* pkt, int pktLen);
@@ -124,28 +262,73 @@ public:
 	
 	//Other stuff
 	int		begin();
+	int		begin(CoapTransport *backend);
+	int		begin(CoapTransport *backend, int queueSize);
+	int		begin(CoapTransport *backend, const coap_config &settings);
+	const coap_config&	getConfig();
+	CoapTransport*	getTransport();
+	CoapDedupCache*	getDedupCache();
+	CoapPeerTable*	getPeers();
+	void	addExtension(CoapExtension *ext);
+	uns32	getMemoryUsage();
+	void	printMemoryReport();
+	//Copy of the metrics, safe from any thread. Returns 0 if they aren't built
+	int		getMetrics(coap_metrics *snapshot);
+	void	clearMetrics();
+	void	printMetrics();
+#ifdef ARDUINO
 	void	setDestination(IPAddress ip, int portNum);
+#endif
 	void	setDestination(const char* ip, int portNum);	
+	uns16	nextMessageId(const coap_endpoint &peer);
 	
 	//Packet functions
 	uns8*	getPacket(int queue, int index);
 	int		getPacketLength(int queue, int index);
 	int		printPacket(int queue, int index);
+	coap_endpoint	getPeer(int queue, int index);
+	CoapPacket&		getCoapPacket(int queue, int index);
+	int		getSender(const uns8 *pkt, coap_endpoint *from);
+	int		getRxIndex(const uns8 *pkt);
 		
 	//RX & TX Buffer functions
 	void	packetProcessed(uns16 id);
-	void	clearQueue(int queue, int index = MAX_QUEUE_SIZE);
+	void	packetProcessed(const coap_endpoint &peer, uns16 id);
+	void	clearQueue(int queue, int index = -1);
 	void	process_rx_queue();	
 	void	process_tx_queue();	
+	//For event loops: ms until either of the above has timed work (0 if
+	//now, -1 if none), the transport's fd, and whether there is room to
+	//take more from it
+	int		nextTimeout();
+	int		getFd();
+	bool	canReceive();
 	int		addToTX(uns8 *packet, int len);
+	int		addToTX(const coap_endpoint &to, uns8 *packet, int len);
+	int		addToTX(const coap_endpoint &to, CoapPacketTemplate &tmpl, const uns8 *token, uns8 tokenLength,
+					const uns8 *payload, uns16 payloadLength);
+	int		replyTo(const uns8 *request, uns8 *packet, int len);
+	//Piggybacked responses from inside availablePacketHandler(), built in
+	//place and sent without a pass through the tx queue
+	int		startReply(const uns8 *request, uns8 code);
+	int		sendReply(const uns8 *request, int index);
+	//Separate responses, for requests that take a while to answer
+	int		deferReply(const uns8 *request, coap_deferred *later);
+	int		startDeferredReply(const coap_deferred &later, uns8 code);
+	int		reserveTX(const coap_endpoint &to);
+	int		commitTX(int index);
 	
 	//UDP Functions
-	int		parseUDPPacket();
 	int		receivePacket();
+	int		receivePackets();
 	int		sendPacket(int index);
 	
 	//Replying Functions
 	int		addPayload(int index, int len, const char *pay);
+	int		addPayload(int index, int len, const uns8 *pay);
+	//Payload sent from the application's memory, without a copy
+	int		addPayloadRef(int index, const uns8 *data, int len);
+	void	setPayloadDone(int index, coap_payload_done done, void *ctx);
 	int		addTokens(int index, int numTokens, uns8 *tokens);
 	int		addHeader(int index, uns8 type, uns8 code, uns16 id);
 	int		emptyACK(int index);
@@ -0,0 +1,600 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP forward proxy, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-proxy.h"
+
+#define		SCHEME_LENGTH	7		//"coap://"
+
+/*	Value of hex digit C, or -1	*/
+inline int hex_value(uns8 c) {
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*	Percent-decodes the LEN bytes at S in place. Returns the new length	*/
+static uns16 percent_decode(uns8 *s, uns16 len) {
+	uns16 out = 0;
+	for (uns16 i = 0; i < len; i++) {
+		int hi, lo;
+		if ((s[i] == '%') && (i + 2 < len) &&
+			((hi = hex_value(s[i + 1])) >= 0) && ((lo = hex_value(s[i + 2])) >= 0)) {
+			s[out++] = (hi << 4) | lo;
+			i += 2;
+		}
+		else {
+			s[out++] = s[i];
+		}
+	}
+	return out;
+}
+
+/*	Case-insensitive compare of LEN bytes at S with lower case TEXT	*/
+static bool matches_lower(const uns8 *s, uns16 len, const char *text) {
+	for (uns16 i = 0; i < len; i++) {
+		uns8 c = s[i];
+		if ((c >= 'A') && (c <= 'Z'))
+			c += 'a' - 'A';
+		if ((text[i] == 0) || (c != (uns8)text[i]))
+			return false;
+	}
+	return text[len] == 0;
+}
+
+/*	A host made only of digits and dots needs no Uri-Host upstream	*/
+static bool is_ip_literal(const uns8 *host, uns16 len) {
+	for (uns16 i = 0; i < len; i++) {
+		if (((host[i] < '0') || (host[i] > '9')) && (host[i] != '.'))
+			return false;
+	}
+	return true;
+}
+
+CoapProxy::CoapProxy() {
+	coap = NULL;
+	cache = NULL;
+	waiters = NULL;
+	freeWaiter = -1;
+	forwardedCount = 0;
+	coalescedCount = 0;
+	cachedCount = 0;
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		exchanges[x].state = PROXY_FREE;
+		exchanges[x].generation = 0;
+		buckets[x] = -1;
+	}
+}
+
+CoapProxy::~CoapProxy() {
+	end();
+}
+
+int CoapProxy::begin(CoapProtocol *protocol) {
+	return begin(protocol, NULL, COAP_PROXY_WAITERS);
+}
+
+int CoapProxy::begin(CoapProtocol *protocol, CoapResponseCache *responseCache) {
+	return begin(protocol, responseCache, COAP_PROXY_WAITERS);
+}
+
+/*	Hooks into PROTOCOL, keeping responses in RESPONSECACHE (NULL for none),
+	with room for MAXWAITERS downstream requests. Call once, after PROTOCOL's
+	begin() and RESPONSECACHE's. Returns 0 if out of memory	*/
+int CoapProxy::begin(CoapProtocol *protocol, CoapResponseCache *responseCache, int maxWaiters) {
+	end();
+	waiters = new (std::nothrow) coap_proxy_waiter[maxWaiters];
+	if (waiters == NULL)
+		return 0;
+	for (int w = 0; w < maxWaiters; w++) {
+		waiters[w].next = (w + 1 < maxWaiters) ? w + 1 : -1;
+	}
+	freeWaiter = (maxWaiters > 0) ? 0 : -1;
+	
+	coap = protocol;
+	cache = responseCache;
+	coap->addExtension(this);
+	return 1;
+}
+
+void CoapProxy::end() {
+	delete[] waiters;
+	waiters = NULL;
+	freeWaiter = -1;
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		exchanges[x].state = PROXY_FREE;
+		buckets[x] = -1;
+	}
+}
+
+int CoapProxy::pending() {
+	int n = 0;
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		if (exchanges[x].state != PROXY_FREE)
+			n++;
+	}
+	return n;
+}
+
+uns32 CoapProxy::forwarded() {
+	return forwardedCount;
+}
+
+uns32 CoapProxy::coalesced() {
+	return coalescedCount;
+}
+
+uns32 CoapProxy::cached() {
+	return cachedCount;
+}
+
+
+////////////////////////////////////////////////////
+////				Upstream Requests			////
+////////////////////////////////////////////////////
+
+/*	Finds where REQ is to be sent, from its Proxy-Uri, or its Proxy-Scheme
+	and Uri-Host/Uri-Port. Returns 0 with the response code in ERROR if it
+	can't be	*/
+int CoapProxy::target(CoapPacket &req, coap_endpoint *to, uns8 *error) {
+	const uns8 *host;
+	uns16 hostLength;
+	uns32 port = COAP_DEFAULT_PORT;
+	int opt = req.findOption(OPT_PROXY_URI);
+	
+	if (opt >= 0) {
+		const uns8 *uri = req.getOptionValue(opt);
+		uns16 len = req.getOptionLength(opt);
+		uns16 pos = SCHEME_LENGTH;
+		if ((len < SCHEME_LENGTH) || !matches_lower(uri, SCHEME_LENGTH, "coap://")) {
+			*error = CODE_PROXY_NSUPPORT;
+			return 0;
+		}
+		host = &uri[pos];
+		while ((pos < len) && (uri[pos] != ':') && (uri[pos] != '/') && (uri[pos] != '?'))
+			pos++;
+		hostLength = &uri[pos] - host;
+		if ((pos < len) && (uri[pos] == ':')) {
+			port = 0;
+			while ((++pos < len) && (uri[pos] >= '0') && (uri[pos] <= '9'))
+				port = (port * 10) + (uri[pos] - '0');
+		}
+	}
+	else {
+		opt = req.findOption(OPT_PROXY_SCH);
+		if (!matches_lower(req.getOptionValue(opt), req.getOptionLength(opt), "coap")) {
+			*error = CODE_PROXY_NSUPPORT;
+			return 0;
+		}
+		opt = req.findOption(OPT_URI_HOST);
+		if (opt < 0) {
+			*error = CODE_BAD_REQUEST;
+			return 0;
+		}
+		host = req.getOptionValue(opt);
+		hostLength = req.getOptionLength(opt);
+		req.getUintOption(OPT_URI_PORT, &port);
+	}
+	
+	char name[COAP_PROXY_HOST_SIZE];
+	if ((hostLength == 0) || (hostLength >= COAP_PROXY_HOST_SIZE) || (port == 0) || (port > 0xFFFF)) {
+		*error = CODE_BAD_REQUEST;
+		return 0;
+	}
+	memcpy(name, host, hostLength);
+	name[hostLength] = 0;
+	if (!coap->getTransport()->resolve(name, port, to)) {
+		*error = CODE_BAD_GATE;
+		return 0;
+	}
+	return 1;
+}
+
+/*	Adds REQ's options to UP. A Proxy-Uri becomes Uri-Host (unless it names
+	an IP address), Uri-Path and Uri-Query options, decoded in place in REQ
+	and copied into UP. Observe is not forwarded. Returns 0 if they don't fit	*/
+int CoapProxy::upstreamOptions(CoapPacket &req, CoapPacket &up) {
+	int proxyUri = req.findOption(OPT_PROXY_URI);
+	
+	for (int i = 0; i < req.numOptions(); i++) {
+		uns16 num = req.getOptionNumber(i);
+		if ((num == OPT_PROXY_URI) || (num == OPT_PROXY_SCH) || (num == OPT_URI_PORT) || (num == OPT_OBSERVE))
+			continue;
+		if ((proxyUri >= 0) && ((num == OPT_URI_HOST) || (num == OPT_URI_PATH) || (num == OPT_URI_QUERY)))
+			continue;
+		if ((num == OPT_URI_HOST) && is_ip_literal(req.getOptionValue(i), req.getOptionLength(i)))
+			continue;
+		if (!up.addOption(num, req.getOptionLength(i), (const char*)req.getOptionValue(i)))
+			return 0;
+	}
+	if (proxyUri < 0)
+		return 1;
+	
+	uns8 *uri = req.getOptionValue(proxyUri);
+	uns16 len = req.getOptionLength(proxyUri);
+	uns16 pos = SCHEME_LENGTH;
+	uns16 start = pos;
+	while ((pos < len) && (uri[pos] != ':') && (uri[pos] != '/') && (uri[pos] != '?'))
+		pos++;
+	if (!is_ip_literal(&uri[start], pos - start) &&
+		!up.addOption(OPT_URI_HOST, pos - start, (const char*)&uri[start]))
+		return 0;
+	while ((pos < len) && (uri[pos] != '/') && (uri[pos] != '?'))
+		pos++;
+	
+	//"/a/b" is two Uri-Paths, "" and "/" are none (RFC 7252 6.4)
+	if ((pos < len) && (uri[pos] == '/'))
+		pos++;
+	if ((pos < len) && (uri[pos] != '?')) {
+		while (1) {
+			start = pos;
+			while ((pos < len) && (uri[pos] != '/') && (uri[pos] != '?'))
+				pos++;
+			if (!up.addOption(OPT_URI_PATH, percent_decode(&uri[start], pos - start), (const char*)&uri[start]))
+				return 0;
+			if ((pos == len) || (uri[pos] == '?'))
+				break;
+			pos++;
+		}
+	}
+	if ((pos < len) && (uri[pos] == '?')) {
+		while (pos < len) {
+			start = ++pos;
+			while ((pos < len) && (uri[pos] != '&'))
+				pos++;
+			if (!up.addOption(OPT_URI_QUERY, percent_decode(&uri[start], pos - start), (const char*)&uri[start]))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+
+////////////////////////////////////////////////////
+////				Exchanges					////
+////////////////////////////////////////////////////
+
+uns32 CoapProxy::hash(const uns8 *key, uns16 len) {
+	uns32 h = 2166136261UL;
+	for (uns16 i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 16777619UL;
+	}
+	h ^= h >> 15;
+	return h;
+}
+
+/*	A GET already upstream with the same cache key, or -1	*/
+int CoapProxy::findExchange(const uns8 *key, uns16 len, uns32 h) {
+	int x = buckets[h % COAP_PROXY_EXCHANGES];
+	while (x >= 0) {
+		coap_proxy_exchange &ex = exchanges[x];
+		if ((ex.hash == h) && (ex.keyLength == len) && (memcmp(ex.key, key, len) == 0))
+			return x;
+		x = ex.hashNext;
+	}
+	return -1;
+}
+
+int CoapProxy::newExchange() {
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		if (exchanges[x].state == PROXY_FREE)
+			return x;
+	}
+	return -1;
+}
+
+/*	Stops exchange X from being joined by new requests	*/
+void CoapProxy::unlinkExchange(int x) {
+	int *link = &buckets[exchanges[x].hash % COAP_PROXY_EXCHANGES];
+	while (*link >= 0) {
+		if (*link == x) {
+			*link = exchanges[x].hashNext;
+			return;
+		}
+		link = &exchanges[*link].hashNext;
+	}
+}
+
+/*	The exchange PKT (an upstream request or its response, from or to PEER)
+	belongs to, found from its token. OURS says whether the token is one of
+	the proxy's, even if its exchange is over	*/
+int CoapProxy::exchangeOf(CoapPacket &pkt, const coap_endpoint &peer, bool *ours) {
+	const uns8 *token = pkt.getTokenPtr();
+	*ours = (pkt.getTokenLength() == PROXY_TOKEN_LENGTH) && (token[2] == PROXY_TOKEN_TAG) &&
+			(token[0] < COAP_PROXY_EXCHANGES);
+	if (!*ours)
+		return -1;
+	coap_proxy_exchange &ex = exchanges[token[0]];
+	if ((ex.state != PROXY_WAITING) || (ex.generation != token[1]) || !coap_endpoint_equal(ex.upstream, peer))
+		return -1;
+	return token[0];
+}
+
+int CoapProxy::addWaiter(int x, CoapPacket &req, const coap_endpoint &peer) {
+	int w = freeWaiter;
+	if (w < 0)
+		return -1;
+	coap_proxy_waiter &wt = waiters[w];
+	freeWaiter = wt.next;
+	wt.peer = peer;
+	wt.tokenLength = req.getTokenLength();
+	memcpy(wt.token, req.getTokenPtr(), wt.tokenLength);
+	wt.confirmable = req.getMessageType() == TYPE_CON;
+	wt.next = exchanges[x].waiters;
+	exchanges[x].waiters = w;
+	return w;
+}
+
+
+////////////////////////////////////////////////////
+////				Downstream Responses		////
+////////////////////////////////////////////////////
+
+/*	Queues a response made of a header, TOKEN, and BODY: the options and
+	payload of another response, copied as they are	*/
+int CoapProxy::sendResponse(const coap_endpoint &peer, uns8 type, uns16 id, const uns8 *token, uns8 tokenLength,
+							uns8 code, const uns8 *body, uns16 bodyLength) {
+	if (4 + tokenLength + bodyLength > MAX_SIZE) {
+		code = CODE_BAD_GATE;
+		bodyLength = 0;
+	}
+	int t = coap->reserveTX(peer);
+	if (t < 0)
+		return -1;
+	CoapPacket &pkt = coap->getCoapPacket(TX, t);
+	uns8 *buf = pkt.reservePacket(4 + tokenLength + bodyLength);
+	if (buf == NULL) {
+		coap->clearQueue(TX, t);
+		return -1;
+	}
+	buf[0] = (COAP_VERSION << 6) | (type << 4) | tokenLength;
+	buf[1] = code;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	memcpy(&buf[4], token, tokenLength);
+	memcpy(&buf[4 + tokenLength], body, bodyLength);
+	pkt.setIndex(4 + tokenLength + bodyLength);
+	pkt.parseHeader();
+	return coap->commitTX(t);
+}
+
+/*	Answers the request in RXINDEX straight away, piggybacked if it's a CON	*/
+int CoapProxy::reply(int rxIndex, uns8 code, const uns8 *body, uns16 bodyLength) {
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	bool con = req.getMessageType() == TYPE_CON;
+	return sendResponse(peer, con ? TYPE_ACK : TYPE_NON, con ? req.getID() : coap->nextMessageId(peer),
+						req.getTokenPtr(), req.getTokenLength(), code, body, bodyLength);
+}
+
+/*	Sends the response to everyone waiting on exchange X. Waiters the tx
+	queue has no room for are answered from poll(). Returns how many
+	responses were queued	*/
+int CoapProxy::answer(int x, uns8 code, const uns8 *body, uns16 bodyLength) {
+	coap_proxy_exchange &ex = exchanges[x];
+	int queued = 0;
+	unlinkExchange(x);
+	
+	while (ex.waiters >= 0) {
+		int w = ex.waiters;
+		coap_proxy_waiter &wt = waiters[w];
+		if (sendResponse(wt.peer, wt.confirmable ? TYPE_CON : TYPE_NON, coap->nextMessageId(wt.peer),
+						 wt.token, wt.tokenLength, code, body, bodyLength) < 0) {
+			ex.state = PROXY_DRAINING;
+			ex.code = code;
+			return queued;
+		}
+		ex.waiters = wt.next;
+		wt.next = freeWaiter;
+		freeWaiter = w;
+		queued++;
+	}
+	ex.state = PROXY_FREE;
+	return queued;
+}
+
+/*	Answers the waiters exchange X had no room for, from the cache if it
+	still has the response, or with 5.03 Service Unavailable if a body has
+	been lost	*/
+int CoapProxy::drain(int x) {
+	coap_proxy_exchange &ex = exchanges[x];
+	const uns8 *body = NULL;
+	uns16 bodyLength = 0;
+	uns8 code = ex.code;
+	
+	if ((code >> 5) == 2) {
+		int e = (cache != NULL) ? cache->lookup(ex.key, ex.keyLength) : -1;
+		if (e >= 0)
+			body = cache->getBody(e, &bodyLength, &code);
+		else
+			code = CODE_SVC_UNAVAIL;
+	}
+	return answer(x, code, body, bodyLength);
+}
+
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+/*	Requests with a Proxy-Uri or Proxy-Scheme are answered from the cache,
+	join an identical GET already upstream, or are sent upstream. Anything
+	else is left to the rest of the chain	*/
+int CoapProxy::onRequest(int rxIndex) {
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	if ((waiters == NULL) || ((req.findOption(OPT_PROXY_URI) < 0) && (req.findOption(OPT_PROXY_SCH) < 0)))
+		return 0;
+	
+	coap_endpoint peer = coap->getPeer(RX, rxIndex);
+	coap_endpoint to;
+	uns8 method = req.getResponseCode();
+	uns8 error;
+	if (!target(req, &to, &error))
+		return reply(rxIndex, error, NULL, 0) > 0;
+	int x = newExchange();
+	if (x < 0)
+		return reply(rxIndex, CODE_SVC_UNAVAIL, NULL, 0) > 0;
+	
+	//Build the upstream request in the tx queue, to find its cache key
+	int t = coap->reserveTX(to);
+	if (t < 0)
+		return 0;
+	coap_proxy_exchange &ex = exchanges[x];
+	uns8 token[PROXY_TOKEN_LENGTH] = {(uns8)x, (uns8)(ex.generation + 1), PROXY_TOKEN_TAG};
+	CoapPacket &up = coap->getCoapPacket(TX, t);
+	up.addHeader(TYPE_CON, method, coap->nextMessageId(to));
+	up.addTokens(PROXY_TOKEN_LENGTH, token);
+	if (!upstreamOptions(req, up) || !up.addPayload(req.getPayloadLength(), req.getPayloadPtr())) {
+		coap->clearQueue(TX, t);
+		return reply(rxIndex, CODE_BAD_OPTION, NULL, 0) > 0;
+	}
+	up.size();
+	
+	ex.keyLength = CoapResponseCache::buildKey(up, to, method, ex.key);
+	ex.hash = hash(ex.key, ex.keyLength);
+	bool safe = (method == COAP_GET) && (ex.keyLength > 0);
+	if (safe) {
+		int same = findExchange(ex.key, ex.keyLength, ex.hash);
+		if (same >= 0) {
+			coap->clearQueue(TX, t);
+			if (addWaiter(same, req, peer) < 0)
+				return reply(rxIndex, CODE_SVC_UNAVAIL, NULL, 0) > 0;
+			if (req.getMessageType() == TYPE_CON)
+				coap->emptyACK(rxIndex);
+			coalescedCount++;
+			return 1;
+		}
+		int e = (cache != NULL) ? cache->lookup(ex.key, ex.keyLength) : -1;
+		if (e >= 0) {
+			uns16 bodyLength;
+			uns8 code;
+			const uns8 *body = cache->getBody(e, &bodyLength, &code);
+			coap->clearQueue(TX, t);
+			cachedCount++;
+			return reply(rxIndex, code, body, bodyLength) > 0;
+		}
+	}
+	
+	ex.waiters = -1;
+	if (addWaiter(x, req, peer) < 0) {
+		coap->clearQueue(TX, t);
+		return reply(rxIndex, CODE_SVC_UNAVAIL, NULL, 0) > 0;
+	}
+	ex.state = PROXY_WAITING;
+	ex.generation++;
+	ex.method = method;
+	ex.upstream = to;
+	ex.started = millis();
+	ex.hashNext = -1;
+	if (safe) {
+		int *bucket = &buckets[ex.hash % COAP_PROXY_EXCHANGES];
+		ex.hashNext = *bucket;
+		*bucket = x;
+	}
+	coap->commitTX(t);
+	forwardedCount++;
+	
+	if (req.getMessageType() == TYPE_CON)
+		coap->emptyACK(rxIndex);
+	return 1;
+}
+
+/*	Upstream responses are cached and copied out to every waiter	*/
+int CoapProxy::onResponse(int rxIndex, int txIndex) {
+	CoapPacket &rsp = coap->getCoapPacket(RX, rxIndex);
+	bool ours;
+	//An empty ACK has no token, so go by the request it ACKs
+	int x = (txIndex >= 0) ? exchangeOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours)
+						   : exchangeOf(rsp, coap->getPeer(RX, rxIndex), &ours);
+	if (x < 0)
+		return ours;	//Late answer to an exchange that is over
+	if (rsp.getResponseCode() == 0)
+		return 1;		//Separate response to follow
+	
+	if ((cache != NULL) && (exchanges[x].method == COAP_GET))
+		cache->keep(exchanges[x].key, exchanges[x].keyLength, rsp);
+	uns16 tokenEnd = 4 + rsp.getTokenLength();
+	answer(x, rsp.getResponseCode(), rsp.getPacket() + tokenEnd, rsp.getPacketLength() - tokenEnd);
+	return 1;
+}
+
+int CoapProxy::onTxFailure(int txIndex) {
+	bool ours;
+	int x = exchangeOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours);
+	if (x >= 0)
+		answer(x, CODE_GATE_TIMEOUT, NULL, 0);
+	return ours;
+}
+
+int CoapProxy::onReset(int rxIndex, int txIndex) {
+	if (txIndex < 0)
+		return 0;
+	bool ours;
+	int x = exchangeOf(coap->getCoapPacket(TX, txIndex), coap->getPeer(TX, txIndex), &ours);
+	if (x >= 0)
+		answer(x, CODE_BAD_GATE, NULL, 0);
+	return ours;
+}
+
+/*	Gives up on upstream servers that ACKed but never answered, and answers
+	waiters the tx queue had no room for	*/
+int CoapProxy::poll(uns32 now) {
+	int queued = 0;
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		coap_proxy_exchange &ex = exchanges[x];
+		if ((ex.state == PROXY_WAITING) && ((now - ex.started) >= COAP_PROXY_TIMEOUT))
+			queued += answer(x, CODE_GATE_TIMEOUT, NULL, 0);
+		else if (ex.state == PROXY_DRAINING)
+			queued += drain(x);
+	}
+	return queued;
+}
+
+/*	When the oldest exchange still waiting on its origin times out	*/
+int CoapProxy::nextDeadline(uns32 *deadline) {
+	bool found = false;
+	for (int x = 0; x < COAP_PROXY_EXCHANGES; x++) {
+		coap_proxy_exchange &ex = exchanges[x];
+		if (ex.state != PROXY_WAITING)
+			continue;
+		uns32 timeout = ex.started + COAP_PROXY_TIMEOUT;
+		if (!found || ((int32_t)(timeout - *deadline) < 0)) {
+			*deadline = timeout;
+			found = true;
+		}
+	}
+	return found;
+}
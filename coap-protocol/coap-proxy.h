@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP forward proxy, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_PROXY_h
+#define __COAP_PROXY_h
+
+#include "coap-protocol.h"
+#include "coap-cache.h"
+
+//Upstream requests in flight
+#ifndef COAP_PROXY_EXCHANGES
+#ifdef ARDUINO
+#define		COAP_PROXY_EXCHANGES	2
+#else
+#define		COAP_PROXY_EXCHANGES	64
+#endif
+#endif
+//Downstream requests waiting for an upstream response
+#ifndef COAP_PROXY_WAITERS
+#ifdef ARDUINO
+#define		COAP_PROXY_WAITERS		4
+#else
+#define		COAP_PROXY_WAITERS		1024
+#endif
+#endif
+//Longest host name in a Proxy-Uri or Uri-Host
+#ifndef COAP_PROXY_HOST_SIZE
+#define		COAP_PROXY_HOST_SIZE	64
+#endif
+//An upstream exchange is given up on after this long, ms
+#ifndef COAP_PROXY_TIMEOUT
+#define		COAP_PROXY_TIMEOUT		(MAJOR_TIMEOUT * 1000UL + MAX_LATENCY * 1000UL)
+#endif
+
+#define		PROXY_TOKEN_LENGTH		3		//Exchange, generation, PROXY_TOKEN_TAG
+#define		PROXY_TOKEN_TAG			0xC5
+
+#define		PROXY_FREE				0
+#define		PROXY_WAITING			1		//Upstream request sent
+#define		PROXY_DRAINING			2		//Answered, but the tx queue filled up before every waiter was
+
+//A downstream request, waiting on an exchange
+typedef struct {
+	coap_endpoint	peer;
+	uns8			token[MAX_TOKENSIZE];
+	uns8			tokenLength;
+	bool			confirmable;	//Was a CON, already ACKed empty
+	int				next;			//Exchange's list, or free list
+}	coap_proxy_waiter;
+
+//One upstream request and everyone waiting for its response
+typedef struct {
+	coap_endpoint	upstream;
+	uns32			hash;
+	uns32			started;
+	uns16			keyLength;
+	uns8			state;
+	uns8			generation;		//Changes each time the exchange is reused
+	uns8			method;
+	uns8			code;			//Sent to waiters left over when DRAINING
+	int				waiters;
+	int				hashNext;
+	uns8			key[COAP_CACHE_KEY_SIZE];
+}	coap_proxy_exchange;
+
+/*	RFC 7252 5.7 CoAP-to-CoAP forward proxy. Requests with a Proxy-Uri, or a
+	Proxy-Scheme of coap with Uri-Host, are sent on upstream as CONs through
+	the tx queue, with a token of the proxy's own that leads straight back
+	to the exchange. Identical GETs arriving while one is already upstream
+	join it instead of being sent again, and the response is copied out to
+	every client waiting on it, header and token swapped, without being
+	re-encoded. With a CoapResponseCache, 2.05 responses are kept for their
+	Max-Age and GETs they answer never go upstream.
+	CON requests that can't be answered straight away are ACKed empty and
+	answered with a separate CON. Upstream failures are answered 5.02 Bad
+	Gateway (RST, unknown host) or 5.04 Gateway Timeout, and schemes other
+	than coap 5.05 Proxying Not Supported	*/
+class CoapProxy : public CoapExtension {
+private:
+	CoapProtocol		*coap;
+	CoapResponseCache	*cache;
+	coap_proxy_exchange	exchanges[COAP_PROXY_EXCHANGES];
+	int					buckets[COAP_PROXY_EXCHANGES];
+	coap_proxy_waiter	*waiters;
+	int					freeWaiter;
+	uns32				forwardedCount;
+	uns32				coalescedCount;
+	uns32				cachedCount;
+	
+	uns32	hash(const uns8 *key, uns16 len);
+	int		target(CoapPacket &req, coap_endpoint *to, uns8 *error);
+	int		upstreamOptions(CoapPacket &req, CoapPacket &up);
+	int		findExchange(const uns8 *key, uns16 len, uns32 h);
+	int		newExchange();
+	void	unlinkExchange(int x);
+	int		exchangeOf(CoapPacket &pkt, const coap_endpoint &peer, bool *ours);
+	int		addWaiter(int x, CoapPacket &req, const coap_endpoint &peer);
+	int		sendResponse(const coap_endpoint &peer, uns8 type, uns16 id, const uns8 *token, uns8 tokenLength,
+						uns8 code, const uns8 *body, uns16 bodyLength);
+	int		reply(int rxIndex, uns8 code, const uns8 *body, uns16 bodyLength);
+	int		answer(int x, uns8 code, const uns8 *body, uns16 bodyLength);
+	int		drain(int x);
+	
+public:
+	CoapProxy();
+	~CoapProxy();
+	
+	int		begin(CoapProtocol *protocol);
+	int		begin(CoapProtocol *protocol, CoapResponseCache *responseCache);
+	int		begin(CoapProtocol *protocol, CoapResponseCache *responseCache, int maxWaiters);
+	void	end();
+	
+	int		pending();
+	uns32	forwarded();
+	uns32	coalesced();
+	uns32	cached();
+	
+	//CoapExtension hooks
+	int		onRequest(int rxIndex);
+	int		onResponse(int rxIndex, int txIndex);
+	int		onTxFailure(int txIndex);
+	int		onReset(int rxIndex, int txIndex);
+	int		poll(uns32 now);
+	int		nextDeadline(uns32 *deadline);
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP resource router, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-router.h"
+
+#define		ROOT		0
+
+CoapRouter::CoapRouter() {
+	coap = NULL;
+	nodes = NULL;
+	buckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	numNodes = 0;
+	notFound = 0;
+	notAllowed = 0;
+}
+
+CoapRouter::~CoapRouter() {
+	end();
+}
+
+int CoapRouter::begin(CoapProtocol *protocol) {
+	return begin(protocol, COAP_MAX_ROUTES);
+}
+
+/*	Hooks into PROTOCOL with room for MAXROUTES path segments. Call once, after
+	PROTOCOL's begin(), and after any extension that should see requests
+	first (CoapObserve). Returns 0 if out of memory	*/
+int CoapRouter::begin(CoapProtocol *protocol, int maxRoutes) {
+	end();
+	if (maxRoutes < 1)
+		return 0;
+	
+	int bucketCount = 1;
+	while (bucketCount < maxRoutes)
+		bucketCount <<= 1;
+	nodes = new (std::nothrow) coap_route_node[maxRoutes];
+	buckets = new (std::nothrow) int[bucketCount];
+	if ((nodes == NULL) || (buckets == NULL)) {
+		end();
+		return 0;
+	}
+	capacity = maxRoutes;
+	bucketMask = bucketCount - 1;
+	for (int i = 0; i < bucketCount; i++) {
+		buckets[i] = -1;
+	}
+	
+	//The root has no segment and is never in the hash table
+	coap_route_node &root = nodes[ROOT];
+	root.segment = "";
+	root.segmentLength = 0;
+	root.parent = -1;
+	root.hashNext = -1;
+	for (int m = 0; m < COAP_ROUTE_METHODS; m++) {
+		root.handlers[m] = NULL;
+		root.ctx[m] = NULL;
+	}
+	numNodes = 1;
+	
+	coap = protocol;
+	coap->addExtension(this);
+	return 1;
+}
+
+void CoapRouter::end() {
+	delete[] nodes;
+	delete[] buckets;
+	nodes = NULL;
+	buckets = NULL;
+	capacity = 0;
+	numNodes = 0;
+}
+
+
+////////////////////////////////////////////////////
+////				Trie						////
+////////////////////////////////////////////////////
+
+uns32 CoapRouter::hash(int parent, const uns8 *segment, uns16 len) {
+	uns32 h = 2166136261UL ^ (uns32)parent;
+	for (uns16 i = 0; i < len; i++) {
+		h = (h ^ segment[i]) * 16777619UL;
+	}
+	h ^= h >> 15;
+	return h;
+}
+
+int CoapRouter::findChild(int parent, const uns8 *segment, uns16 len) {
+	int i = buckets[hash(parent, segment, len) & bucketMask];
+	while (i >= 0) {
+		coap_route_node &n = nodes[i];
+		if ((n.parent == parent) && (n.segmentLength == len) &&
+			(memcmp(n.segment, segment, len) == 0))
+			return i;
+		i = n.hashNext;
+	}
+	return -1;
+}
+
+int CoapRouter::addChild(int parent, const char *segment, uns16 len) {
+	if (numNodes == capacity)
+		return -1;
+	int i = numNodes++;
+	coap_route_node &n = nodes[i];
+	n.segment = segment;
+	n.segmentLength = len;
+	n.parent = parent;
+	for (int m = 0; m < COAP_ROUTE_METHODS; m++) {
+		n.handlers[m] = NULL;
+		n.ctx[m] = NULL;
+	}
+	
+	int *bucket = &buckets[hash(parent, (const uns8*)segment, len) & bucketMask];
+	n.hashNext = *bucket;
+	*bucket = i;
+	return i;
+}
+
+bool CoapRouter::hasHandlers(int node) {
+	for (int m = 0; m < COAP_ROUTE_METHODS; m++) {
+		if (nodes[node].handlers[m] != NULL)
+			return true;
+	}
+	return false;
+}
+
+/*	Adds the segments of PATH that aren't in the trie yet. Adding the same
+	path and method again replaces the handler	*/
+int CoapRouter::addRoute(const char *path, uns8 method, coap_route_handler handler, void *ctx) {
+	if ((capacity == 0) || (method < COAP_GET) || (method > COAP_ROUTE_METHODS))
+		return -1;
+	
+	int node = ROOT;
+	while (1) {
+		while (*path == '/')
+			path++;
+		if (*path == 0)
+			break;
+		
+		uns16 len = 0;
+		while ((path[len] != 0) && (path[len] != '/'))
+			len++;
+		int child = findChild(node, (const uns8*)path, len);
+		if (child < 0)
+			child = addChild(node, path, len);
+		if (child < 0)
+			return -1;
+		node = child;
+		path += len;
+	}
+	
+	nodes[node].handlers[method - 1] = handler;
+	nodes[node].ctx[method - 1] = ctx;
+	return node;
+}
+
+/*	One hash lookup per Uri-Path option, comparing against the option bytes
+	where they are in the packet	*/
+int CoapRouter::match(CoapPacket &req) {
+	if (capacity == 0)
+		return -1;
+	int node = ROOT;
+	for (int opt = req.findOption(OPT_URI_PATH); opt >= 0; opt = req.nextOption(opt)) {
+		node = findChild(node, req.getOptionValue(opt), req.getOptionLength(opt));
+		if (node < 0)
+			return -1;
+	}
+	return node;
+}
+
+int CoapRouter::routes() {
+	return numNodes;
+}
+
+uns32 CoapRouter::notFoundCount() {
+	return notFound;
+}
+
+uns32 CoapRouter::notAllowedCount() {
+	return notAllowed;
+}
+
+
+////////////////////////////////////////////////////
+////				Responses					////
+////////////////////////////////////////////////////
+
+/*	Takes a tx slot for the response to the request in RXINDEX and builds it
+	up to the payload. Returns the slot, or -1 if the tx queue is full	*/
+int CoapRouter::startResponse(int rxIndex, uns8 code, int contentFormat) {
+	int x = coap->startReply(coap->getPacket(RX, rxIndex), code);
+	if (x < 0)
+		return -1;
+	if (contentFormat >= 0)
+		coap->getCoapPacket(TX, x).addUintOption(OPT_CONTENT_FORMAT, contentFormat);
+	return x;
+}
+
+/*	Finishes the response in tx slot X to the request in RXINDEX and sends
+	it straight away. A response the transport didn't take stays queued	*/
+int CoapRouter::finishResponse(int rxIndex, int x) {
+	coap->sendReply(coap->getPacket(RX, rxIndex), x);
+	return 1;
+}
+
+int CoapRouter::respond(int rxIndex, uns8 code, int contentFormat, const uns8 *payload, int len) {
+	int x = startResponse(rxIndex, code, contentFormat);
+	if (x < 0)
+		return -1;
+	if (len > 0)
+		coap->getCoapPacket(TX, x).addPayload(len, payload);
+	return finishResponse(rxIndex, x);
+}
+
+int CoapRouter::reply(const uns8 *request, uns8 code, int contentFormat, const uns8 *payload, int len) {
+	int rxIndex = coap->getRxIndex(request);
+	if (rxIndex < 0)
+		return -1;
+	return respond(rxIndex, code, contentFormat, payload, len);
+}
+
+
+#if COAP_WITH_METRICS
+/*	Serves the metrics of the router's protocol on PATH, as the text
+	CoapMetrics::format() writes, so nodes can be scraped remotely.
+	Returns the resource's node, or -1 if there's no room	*/
+int CoapRouter::addMetricsRoute(const char *path) {
+	return addRoute(path, COAP_GET, metricsHandler, this);
+}
+
+/*	Formats a snapshot of the metrics straight into the response's payload	*/
+int CoapRouter::metricsHandler(void *ctx, const uns8 *request, int requestLength) {
+	CoapRouter *router = (CoapRouter*)ctx;
+	int rxIndex = router->coap->getRxIndex(request);
+	if (rxIndex < 0)
+		return 0;
+	int x = router->startResponse(rxIndex, CODE_CONTENT, 0);
+	if (x < 0)
+		return 0;
+	
+	CoapPacket &rsp = router->coap->getCoapPacket(TX, x);
+	int room = MAX_SIZE - rsp.size() - 1;
+	char *text = (char*)rsp.reservePayload(room);
+	if (text != NULL) {
+		coap_metrics snapshot;
+		router->coap->getMetrics(&snapshot);
+		rsp.setPayloadLength(CoapMetrics::format(snapshot, text, room));
+		rsp.shrink();
+	}
+	return router->finishResponse(rxIndex, x);
+}
+#endif
+
+
+////////////////////////////////////////////////////
+////				Protocol Hooks				////
+////////////////////////////////////////////////////
+
+/*	Finds the handler for the request in RXINDEX, or answers 4.04/4.05 itself.
+	If the tx queue is full the request goes on to the application, rather
+	than being dropped with no answer the dedup cache could repeat	*/
+int CoapRouter::onRequest(int rxIndex) {
+	CoapPacket &req = coap->getCoapPacket(RX, rxIndex);
+	uns8 method = req.getResponseCode();
+	int node = match(req);
+	
+	if ((node < 0) || !hasHandlers(node)) {
+		notFound++;
+		return respond(rxIndex, CODE_NOT_FOUND, -1, NULL, 0) > 0;
+	}
+	if ((method > COAP_ROUTE_METHODS) || (nodes[node].handlers[method - 1] == NULL)) {
+		notAllowed++;
+		return respond(rxIndex, CODE_NOT_ALLOWED, -1, NULL, 0) > 0;
+	}
+	return nodes[node].handlers[method - 1](nodes[node].ctx[method - 1],
+											req.getPacket(), req.getPacketLength());
+}
@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP resource router, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_ROUTER_h
+#define __COAP_ROUTER_h
+
+#include "coap-protocol.h"
+
+//Trie nodes, one per distinct path segment ("a/b" and "a/c" take 3)
+#ifndef COAP_MAX_ROUTES
+#ifdef ARDUINO
+#define		COAP_MAX_ROUTES			16
+#else
+#define		COAP_MAX_ROUTES			4096
+#endif
+#endif
+//GET, POST, PUT and DELETE
+#define		COAP_ROUTE_METHODS		4
+
+//Handles REQUEST, a packet in the rx queue, usually with CoapRouter::reply()
+//or CoapBlockwise::serveBlock2(). Returns 1 if it answered, or 0 to hand
+//REQUEST on to availablePacketHandler()
+typedef int (*coap_route_handler)(void *ctx, const uns8 *request, int requestLength);
+
+//One path segment. Its children are found through the router's hash table
+typedef struct {
+	const char			*segment;		//Points into the path given to addRoute()
+	uns16				segmentLength;
+	int					parent;
+	int					hashNext;
+	coap_route_handler	handlers[COAP_ROUTE_METHODS];
+	void				*ctx[COAP_ROUTE_METHODS];
+}	coap_route_node;
+
+/*	Sends requests to a handler per resource and method. Paths are kept as a
+	trie of Uri-Path segments, and each (parent, segment) pair is looked up in
+	one hash table, so a request is matched with one lookup per Uri-Path
+	option, straight from the option bytes in the rx queue. Requests for
+	paths with no handlers get 4.04 Not Found, and requests with a method the
+	resource has no handler for get 4.05 Method Not Allowed	*/
+class CoapRouter : public CoapExtension {
+private:
+	CoapProtocol		*coap;
+	coap_route_node		*nodes;
+	int					*buckets;
+	int					capacity;
+	int					bucketMask;
+	int					numNodes;
+	uns32				notFound;
+	uns32				notAllowed;
+	
+	uns32	hash(int parent, const uns8 *segment, uns16 len);
+	int		findChild(int parent, const uns8 *segment, uns16 len);
+	int		addChild(int parent, const char *segment, uns16 len);
+	bool	hasHandlers(int node);
+	int		startResponse(int rxIndex, uns8 code, int contentFormat);
+	int		finishResponse(int rxIndex, int x);
+	int		respond(int rxIndex, uns8 code, int contentFormat, const uns8 *payload, int len);
+#if COAP_WITH_METRICS
+	static int	metricsHandler(void *ctx, const uns8 *request, int requestLength);
+#endif
+	
+public:
+	CoapRouter();
+	~CoapRouter();
+	
+	int		begin(CoapProtocol *protocol);
+	int		begin(CoapProtocol *protocol, int maxRoutes);
+	void	end();
+	
+	//Handles METHOD requests on PATH ("a/b/c", "" for the root) with HANDLER.
+	//PATH must stay valid. Returns the resource's node, or -1 if there's no room
+	int		addRoute(const char *path, uns8 method, coap_route_handler handler, void *ctx);
+	//Node the Uri-Path options of REQ lead to, or -1
+	int		match(CoapPacket &req);
+	//Answers REQUEST (piggybacked on the ACK of a CON). CONTENTFORMAT < 0
+	//leaves the option out. Returns 1, or -1 if the tx queue is full
+	int		reply(const uns8 *request, uns8 code, int contentFormat, const uns8 *payload, int len);
+#if COAP_WITH_METRICS
+	//GETs on PATH are answered with the protocol's metrics as text (see
+	//CoapMetrics::format()). Returns the resource's node, or -1
+	int		addMetricsRoute(const char *path);
+#endif
+	
+	int		routes();
+	uns32	notFoundCount();
+	uns32	notAllowedCount();
+	
+	//CoapExtension hooks
+	int		onRequest(int rxIndex);
+};
+
+#endif
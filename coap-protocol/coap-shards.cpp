@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP sharded multi-core server (Linux host builds)
+// Written originally by Embedded Adventures
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <new>
+#include <sched.h>
+#include <unistd.h>
+#include "coap-shards.h"
+
+static thread_local CoapProtocol	*currentProtocol = NULL;
+static thread_local int				currentIndex = -1;
+
+CoapShardedServer::CoapShardedServer() {
+	shards = NULL;
+	numShards = 0;
+	setup = NULL;
+	setupCtx = NULL;
+	pinning = true;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&changed, NULL);
+}
+
+CoapShardedServer::~CoapShardedServer() {
+	end();
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+void CoapShardedServer::setPinning(bool enable) {
+	pinning = enable;
+}
+
+int CoapShardedServer::begin(int workers, const coap_config &settings, coap_shard_setup shardSetup, void *ctx) {
+	end();
+	if ((workers < 1) || (workers > COAP_MAX_SHARDS))
+		return 0;
+	shards = new (std::nothrow) coap_shard[workers];
+	if (shards == NULL)
+		return 0;
+	config = settings;
+	setup = shardSetup;
+	setupCtx = ctx;
+	
+	int started = 0;
+	for (; started < workers; started++) {
+		coap_shard &s = shards[started];
+		s.server = this;
+		s.shard = started;
+		s.state = COAP_SHARD_STARTING;
+		s.loop = NULL;
+		if (pthread_create(&s.thread, NULL, worker, &s) != 0)
+			break;
+	}
+	numShards = started;
+	
+	//Wait for every worker to bind and set up, or fail to
+	bool ok = (started == workers);
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < numShards; i++) {
+		while (shards[i].state == COAP_SHARD_STARTING)
+			pthread_cond_wait(&changed, &lock);
+		if (shards[i].state == COAP_SHARD_FAILED)
+			ok = false;
+	}
+	pthread_mutex_unlock(&lock);
+	
+	if (!ok) {
+		end();
+		return 0;
+	}
+	return 1;
+}
+
+void CoapShardedServer::end() {
+	if (shards == NULL)
+		return;
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < numShards; i++) {
+		if (shards[i].loop != NULL)
+			shards[i].loop->stop();
+	}
+	pthread_mutex_unlock(&lock);
+	for (int i = 0; i < numShards; i++) {
+		pthread_join(shards[i].thread, NULL);
+	}
+	delete[] shards;
+	shards = NULL;
+	numShards = 0;
+}
+
+int CoapShardedServer::workers() {
+	return numShards;
+}
+
+CoapProtocol* CoapShardedServer::current() {
+	return currentProtocol;
+}
+
+int CoapShardedServer::currentShard() {
+	return currentIndex;
+}
+
+void* CoapShardedServer::worker(void *arg) {
+	coap_shard *s = (coap_shard*)arg;
+	s->server->run(*s);
+	return NULL;
+}
+
+void CoapShardedServer::setState(coap_shard &s, int state, CoapEventLoop *loop) {
+	pthread_mutex_lock(&lock);
+	s.state = state;
+	s.loop = loop;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+/*	A worker's whole life. It is pinned first, so the socket, queues and
+	pool slabs are all allocated from memory local to its core	*/
+void CoapShardedServer::run(coap_shard &s) {
+	if (pinning) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET((cores > 0) ? (s.shard % cores) : 0, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	
+	CoapPosixTransport transport;
+	CoapProtocol protocol;
+	CoapEventLoop loop;
+	transport.setReusePort(true);
+	if (!protocol.begin(&transport, config) || !loop.begin() || !loop.add(&protocol) ||
+		((setup != NULL) && !setup(setupCtx, &protocol, s.shard))) {
+		setState(s, COAP_SHARD_FAILED, NULL);
+		return;
+	}
+	currentProtocol = &protocol;
+	currentIndex = s.shard;
+	setState(s, COAP_SHARD_RUNNING, &loop);
+	
+	loop.run();
+	
+	setState(s, COAP_SHARD_RUNNING, NULL);
+	currentProtocol = NULL;
+	currentIndex = -1;
+}
+
+#endif
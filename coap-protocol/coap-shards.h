@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP sharded multi-core server (Linux host builds)
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_SHARDS_h
+#define __COAP_SHARDS_h
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <pthread.h>
+#include "coap-protocol.h"
+#include "coap-transport-posix.h"
+#include "coap-eventloop.h"
+
+#ifndef COAP_MAX_SHARDS
+#define		COAP_MAX_SHARDS			64
+#endif
+
+//Runs on each worker's own thread once its CoapProtocol has begun, before
+//anything is received, to set handlers and add extensions. It is called for
+//all shards at once, so it must only touch CTX in ways that are safe across
+//threads. Returns 1, or 0 to fail begin()
+typedef int (*coap_shard_setup)(void *ctx, CoapProtocol *protocol, int shard);
+
+class CoapShardedServer;
+
+//One worker
+typedef struct {
+	CoapShardedServer	*server;
+	pthread_t			thread;
+	int					shard;
+	int					state;			//COAP_SHARD_xxx
+	CoapEventLoop		*loop;			//On the worker's stack while it runs
+}	coap_shard;
+
+#define		COAP_SHARD_STARTING		0
+#define		COAP_SHARD_RUNNING		1
+#define		COAP_SHARD_FAILED		2
+
+/*	Serves one port from several threads. Each worker binds its own socket to
+	the port with SO_REUSEPORT, so the kernel hashes every peer to one of
+	them, and runs its own CoapProtocol (queues, dedup cache, peers, timers,
+	packet pool) built on its own thread, pinned to a core, driven by its own
+	CoapEventLoop. Nothing is shared
+	between workers and nothing is locked while they run. Everything a
+	handler needs must be made per shard in the setup callback: a resource
+	that is observed, for instance, is only known to the shard its observers
+	were hashed to	*/
+class CoapShardedServer {
+private:
+	coap_shard			*shards;
+	int					numShards;
+	coap_config			config;
+	coap_shard_setup	setup;
+	void				*setupCtx;
+	bool				pinning;
+	pthread_mutex_t		lock;
+	pthread_cond_t		changed;
+	
+	static void*	worker(void *arg);
+	void	run(coap_shard &s);
+	void	setState(coap_shard &s, int state, CoapEventLoop *loop);
+	
+public:
+	CoapShardedServer();
+	~CoapShardedServer();
+	
+	//Pin worker N to core N modulo the cores online (the default), before
+	//it allocates anything. Set before begin()
+	void	setPinning(bool enable);
+	//Starts WORKERS threads serving SETTINGS.localPort, calling SETUP with
+	//CTX on each. Returns 1 once all are running, or 0 if one could not
+	//start, with none left running
+	int		begin(int workers, const coap_config &settings, coap_shard_setup setup, void *ctx);
+	//Stops and joins the workers
+	void	end();
+	int		workers();
+	
+	//The CoapProtocol of the worker calling, for packetReturn_callback
+	//handlers, or NULL outside a worker
+	static CoapProtocol*	current();
+	static int	currentShard();
+};
+
+#endif
+
+#endif
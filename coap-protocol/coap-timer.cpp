@@ -0,0 +1,307 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP timer wheel, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-timer.h"
+
+#define		NOT_SCHEDULED		-1
+#define		WHEEL_MASK			(slots - 1)
+//Ticks and turns count modulo these so millis() wrapping round is harmless
+#define		TICK_MASK			(0xFFFFFFFFUL >> COAP_TIMER_TICK_SHIFT)
+#define		TURN_MASK			(TICK_MASK >> bits)
+
+/*	Wrap safe "A is at or before B" for millis() values	*/
+inline bool time_reached(uns32 a, uns32 b) {
+	return (int32_t)(a - b) <= 0;
+}
+
+inline uns32 tick_of(uns32 time) {
+	return time >> COAP_TIMER_TICK_SHIFT;
+}
+
+inline uns32 tick_diff(uns32 a, uns32 b) {
+	return (a - b) & TICK_MASK;
+}
+
+CoapTimerWheel::CoapTimerWheel() {
+	bucketHead = NULL;
+	entryNext = NULL;
+	entryPrev = NULL;
+	entryBucket = NULL;
+	entryDeadline = NULL;
+	ids = 0;
+	bits = 0;
+	slots = 0;
+	scheduled = 0;
+	currentTick = 0;
+	cascadedTurn = 0;
+}
+
+CoapTimerWheel::~CoapTimerWheel() {
+	end();
+}
+
+/*	Makes room for ids 0 to IDCOUNT - 1, with the wheel starting at the
+	current millis(). Each wheel gets about as many buckets as there are ids,
+	from 1 << COAP_TIMER_MIN_BITS up to 1 << COAP_TIMER_BITS, since more
+	buckets than deadlines would mostly stay empty. Returns 0 if out of
+	memory	*/
+int CoapTimerWheel::begin(int idCount) {
+	end();
+	bits = COAP_TIMER_MIN_BITS;
+	while ((bits < COAP_TIMER_BITS) && ((1 << bits) < idCount))
+		bits++;
+	slots = 1 << bits;
+	bucketHead = new (std::nothrow) int[2 * slots];
+	entryNext = new (std::nothrow) int[idCount];
+	entryPrev = new (std::nothrow) int[idCount];
+	entryBucket = new (std::nothrow) int[idCount];
+	entryDeadline = new (std::nothrow) uns32[idCount];
+	if ((bucketHead == NULL) || (entryNext == NULL) || (entryPrev == NULL) || (entryBucket == NULL) || (entryDeadline == NULL)) {
+		end();
+		return 0;
+	}
+	ids = idCount;
+	clear();
+	return 1;
+}
+
+void CoapTimerWheel::end() {
+	delete[] bucketHead;
+	delete[] entryNext;
+	delete[] entryPrev;
+	delete[] entryBucket;
+	delete[] entryDeadline;
+	bucketHead = NULL;
+	entryNext = NULL;
+	entryPrev = NULL;
+	entryBucket = NULL;
+	entryDeadline = NULL;
+	ids = 0;
+	scheduled = 0;
+}
+
+void CoapTimerWheel::clear() {
+	if (bucketHead == NULL)
+		return;
+	for (int i = 0; i < 2 * slots; i++) {
+		bucketHead[i] = -1;
+	}
+	for (int i = 0; i < ids; i++) {
+		entryBucket[i] = NOT_SCHEDULED;
+	}
+	scheduled = 0;
+	currentTick = tick_of(millis());
+	cascadedTurn = currentTick >> bits;
+}
+
+/*	Puts ID in the inner bucket of its tick if that is within one turn,
+	otherwise in the outer bucket of its turn. Anything already due goes
+	in the bucket expire() looks at next	*/
+void CoapTimerWheel::link(int id) {
+	uns32 tick = tick_of(entryDeadline[id]);
+	int bucket;
+	
+	if (time_reached(entryDeadline[id], currentTick << COAP_TIMER_TICK_SHIFT))
+		tick = currentTick;
+	if (tick_diff(tick, currentTick) < (uns32)slots)
+		bucket = tick & WHEEL_MASK;
+	else
+		bucket = slots + ((tick >> bits) & WHEEL_MASK);
+	
+	entryBucket[id] = bucket;
+	entryPrev[id] = -1;
+	entryNext[id] = bucketHead[bucket];
+	if (bucketHead[bucket] >= 0)
+		entryPrev[bucketHead[bucket]] = id;
+	bucketHead[bucket] = id;
+	scheduled++;
+}
+
+void CoapTimerWheel::unlink(int id) {
+	if (entryPrev[id] >= 0)
+		entryNext[entryPrev[id]] = entryNext[id];
+	else
+		bucketHead[entryBucket[id]] = entryNext[id];
+	if (entryNext[id] >= 0)
+		entryPrev[entryNext[id]] = entryPrev[id];
+	
+	entryBucket[id] = NOT_SCHEDULED;
+	scheduled--;
+}
+
+/*	Moves everything waiting in the outer bucket for TURN back through link(),
+	which drops the ones due this turn into the inner wheel	*/
+void CoapTimerWheel::cascade(uns32 turn) {
+	int bucket = slots + (turn & WHEEL_MASK);
+	int id = bucketHead[bucket];
+	
+	bucketHead[bucket] = -1;
+	while (id >= 0) {
+		int next = entryNext[id];
+		scheduled--;
+		link(id);
+		id = next;
+	}
+}
+
+/*	Sets (or moves) the deadline of ID	*/
+void CoapTimerWheel::schedule(int id, uns32 deadline) {
+	if (isScheduled(id))
+		unlink(id);
+	entryDeadline[id] = deadline;
+	link(id);
+}
+
+void CoapTimerWheel::cancel(int id) {
+	if (isScheduled(id))
+		unlink(id);
+}
+
+bool CoapTimerWheel::isScheduled(int id) {
+	return entryBucket[id] != NOT_SCHEDULED;
+}
+
+uns32 CoapTimerWheel::deadline(int id) {
+	return entryDeadline[id];
+}
+
+int CoapTimerWheel::size() {
+	return scheduled;
+}
+
+uns32 CoapTimerWheel::getMemoryUsage() {
+	if (bucketHead == NULL)
+		return 0;
+	return 2 * slots * sizeof(int) + ids * (3 * sizeof(int) + sizeof(uns32));
+}
+
+/*	Walks the inner buckets from the last tick seen up to NOW, pulling each
+	turn down from the outer wheel as it starts. If more than MAX ids are due,
+	the rest are picked up by the next call. A NOW from before the tick the
+	wheel is on has nothing due	*/
+int CoapTimerWheel::expire(uns32 now, int *expired, int max) {
+	uns32 nowTick = tick_of(now);
+	int found = 0;
+	
+	if (!time_reached(currentTick << COAP_TIMER_TICK_SHIFT, now))
+		return 0;
+	if (scheduled == 0) {
+		currentTick = nowTick;
+		cascadedTurn = nowTick >> bits;
+		return 0;
+	}
+	
+	//Never walk more than one full turn of the inner wheel, or cascade more
+	//than one full turn of the outer one
+	if (tick_diff(nowTick, currentTick) >= (uns32)slots)
+		currentTick = (nowTick - (slots - 1)) & TICK_MASK;
+	uns32 turn = currentTick >> bits;
+	if (((turn - cascadedTurn) & TURN_MASK) > (uns32)slots)
+		cascadedTurn = (turn - slots) & TURN_MASK;
+	
+	while (1) {
+		while (cascadedTurn != (currentTick >> bits)) {
+			cascadedTurn = (cascadedTurn + 1) & TURN_MASK;
+			cascade(cascadedTurn);
+		}
+		int id = bucketHead[currentTick & WHEEL_MASK];
+		while ((id >= 0) && (found < max)) {
+			int next = entryNext[id];
+			if (time_reached(entryDeadline[id], now)) {
+				unlink(id);
+				expired[found++] = id;
+			}
+			id = next;
+		}
+		if ((found == max) || (currentTick == nowTick))
+			break;
+		currentTick = (currentTick + 1) & TICK_MASK;
+	}
+	return found;
+}
+
+/*	Earliest deadline in the first inner bucket with anything in it from the
+	current tick on, and in the first outer bucket after the current turn
+	with anything for its own turn; nothing in a later bucket can be due
+	sooner. Outer buckets also hold deadlines whole wheel turns further out,
+	the earliest of which is the answer if nothing else is scheduled	*/
+int CoapTimerWheel::next(uns32 *deadline) {
+	bool found = false;
+	uns32 earliest = 0;
+	
+	if (scheduled == 0)
+		return 0;
+	
+	for (int k = 0; k < slots; k++) {
+		int id = bucketHead[(currentTick + k) & WHEEL_MASK];
+		if (id < 0)
+			continue;
+		for (; id >= 0; id = entryNext[id]) {
+			if (!found || time_reached(entryDeadline[id], earliest)) {
+				earliest = entryDeadline[id];
+				found = true;
+			}
+		}
+		break;
+	}
+	
+	bool foundOuter = false;
+	bool foundLater = false;
+	uns32 outer = 0;
+	uns32 later = 0;
+	for (int k = 1; (k <= slots) && !foundOuter; k++) {
+		uns32 turn = ((currentTick >> bits) + k) & TURN_MASK;
+		for (int id = bucketHead[slots + (turn & WHEEL_MASK)]; id >= 0; id = entryNext[id]) {
+			uns32 d = entryDeadline[id];
+			if ((tick_of(d) >> bits) == turn) {
+				if (!foundOuter || time_reached(d, outer))
+					outer = d;
+				foundOuter = true;
+			}
+			else if (!foundLater || time_reached(d, later)) {
+				later = d;
+				foundLater = true;
+			}
+		}
+	}
+	if (!foundOuter && foundLater) {
+		outer = later;
+		foundOuter = true;
+	}
+	if (foundOuter && (!found || time_reached(outer, earliest))) {
+		earliest = outer;
+		found = true;
+	}
+	*deadline = earliest;
+	return found;
+}
@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP timer wheel, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_TIMER_h
+#define __COAP_TIMER_h
+
+#include "coap-packet.h"
+
+//Resolution of the wheels is 1 << COAP_TIMER_TICK_SHIFT ms
+#ifndef COAP_TIMER_TICK_SHIFT
+#define		COAP_TIMER_TICK_SHIFT	3
+#endif
+//Each wheel has up to 1 << COAP_TIMER_BITS buckets. begin() gives a wheel
+//for fewer ids fewer buckets, but never under 1 << COAP_TIMER_MIN_BITS
+#ifndef COAP_TIMER_BITS
+#ifdef ARDUINO
+#define		COAP_TIMER_BITS			6
+#else
+#define		COAP_TIMER_BITS			10
+#endif
+#endif
+#ifndef COAP_TIMER_MIN_BITS
+#define		COAP_TIMER_MIN_BITS		4
+#endif
+
+#define		COAP_TIMER_TICK_MS		(1UL << COAP_TIMER_TICK_SHIFT)
+
+/*	Two level hierarchical timer wheel. Each id (a transaction slot) can have
+	one deadline. The inner wheel has one bucket per tick and covers one turn
+	of SLOTS ticks; deadlines further out wait in the outer wheel,
+	one bucket per turn, and are moved down when their turn comes round.
+	expire() only visits the inner buckets whose tick has passed since the
+	last call, and every entry it finds there is due, so checking wheels with
+	nothing due costs close to nothing however many ids are scheduled.	*/
+class CoapTimerWheel {
+private:
+	int		*bucketHead;		//Inner wheel, then outer wheel
+	int		*entryNext;
+	int		*entryPrev;
+	int		*entryBucket;
+	uns32	*entryDeadline;
+	int		ids;
+	int		bits;				//Each wheel has SLOTS = 1 << BITS buckets
+	int		slots;
+	int		scheduled;
+	uns32	currentTick;
+	uns32	cascadedTurn;
+	
+	void	link(int id);
+	void	unlink(int id);
+	void	cascade(uns32 turn);
+	
+public:
+	CoapTimerWheel();
+	~CoapTimerWheel();
+	
+	int		begin(int idCount);
+	void	end();
+	void	clear();
+	
+	void	schedule(int id, uns32 deadline);
+	void	cancel(int id);
+	bool	isScheduled(int id);
+	uns32	deadline(int id);
+	int		size();
+	uns32	getMemoryUsage();
+	
+	//Removes up to MAX ids whose deadline is at or before NOW, returns how many
+	int		expire(uns32 now, int *expired, int max);
+	//Sets DEADLINE to the earliest deadline (never later). 0 if none
+	int		next(uns32 *deadline);
+};
+
+#endif
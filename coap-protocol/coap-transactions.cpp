@@ -0,0 +1,396 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transaction table, Arduino library
+// Written originally by Embedded Adventures
+
+#include <new>
+#include "coap-transactions.h"
+
+CoapTransactionTable::CoapTransactionTable() {
+	slots = NULL;
+	idBuckets = NULL;
+	tokenBuckets = NULL;
+	capacity = 0;
+	bucketMask = 0;
+	freeHead = -1;
+	usedHead = -1;
+	used = 0;
+}
+
+CoapTransactionTable::~CoapTransactionTable() {
+	end();
+}
+
+/*	Allocates SLOTCOUNT slots and the hash buckets (the next power of 2 up).
+	Returns 1 on success, 0 if out of memory	*/
+int CoapTransactionTable::begin(int slotCount) {
+	end();
+	
+	int buckets = 1;
+	while (buckets < slotCount)
+		buckets <<= 1;
+	
+	slots = new (std::nothrow) coap_transaction[slotCount];
+	idBuckets = new (std::nothrow) int[buckets];
+	tokenBuckets = new (std::nothrow) int[buckets];
+	if ((slots == NULL) || (idBuckets == NULL) || (tokenBuckets == NULL) || !timers.begin(slotCount)) {
+		end();
+		return 0;
+	}
+	capacity = slotCount;
+	bucketMask = buckets - 1;
+	clear();
+	return 1;
+}
+
+void CoapTransactionTable::end() {
+	delete[] slots;
+	delete[] idBuckets;
+	delete[] tokenBuckets;
+	slots = NULL;
+	idBuckets = NULL;
+	tokenBuckets = NULL;
+	timers.end();
+	capacity = 0;
+	freeHead = -1;
+	usedHead = -1;
+	used = 0;
+}
+
+/*	Empties the table	*/
+void CoapTransactionTable::clear() {
+	for (int i = 0; i <= bucketMask; i++) {
+		idBuckets[i] = -1;
+		tokenBuckets[i] = -1;
+	}
+	for (int i = 0; i < capacity; i++) {
+		slots[i].status = 0;
+		slots[i].time = 0;
+		slots[i].timeout = 0;
+		slots[i].segmentCount = 0;
+		slots[i].payloadDone = NULL;
+		slots[i].filled = false;
+		slots[i].indexed = false;
+		slots[i].retained = false;
+		slots[i].next = (i + 1 < capacity) ? i + 1 : -1;
+		slots[i].packet.release();
+		slots[i].packet.setTag(i);
+	}
+	freeHead = (capacity > 0) ? 0 : -1;
+	usedHead = -1;
+	used = 0;
+	timers.clear();
+}
+
+
+////////////////////////////////////////////////////
+////				Hashing						////
+////////////////////////////////////////////////////
+
+uns32 CoapTransactionTable::idHash(const coap_endpoint &peer, uns16 id) {
+	uns32 h = (peer.addr * 2654435761UL) ^ (((uns32)peer.port << 16) | id);
+	h ^= h >> 15;
+	h *= 2246822519UL;
+	h ^= h >> 13;
+	return h;
+}
+
+uns32 CoapTransactionTable::tokenHash(const coap_endpoint &peer, const uns8 *token, uns8 len) {
+	uns32 h = 2166136261UL ^ peer.addr;
+	for (uns8 i = 0; i < len; i++) {
+		h = (h ^ token[i]) * 16777619UL;
+	}
+	h = (h ^ peer.port) * 16777619UL;
+	h ^= h >> 15;
+	return h;
+}
+
+/*	Removes INDEX from the chain starting at *BUCKET. Chains are doubly
+	linked, so this doesn't depend on how long they are: many requests in
+	flight to one peer with the same (or no) token all share one	*/
+void CoapTransactionTable::unlinkBucket(int *bucket, int index, bool byToken) {
+	coap_transaction &t = slots[index];
+	int prev = byToken ? t.tokenPrev : t.idPrev;
+	int next = byToken ? t.tokenNext : t.idNext;
+	
+	if (prev < 0)
+		*bucket = next;
+	else if (byToken)
+		slots[prev].tokenNext = next;
+	else
+		slots[prev].idNext = next;
+	if (next >= 0) {
+		if (byToken)
+			slots[next].tokenPrev = prev;
+		else
+			slots[next].idPrev = prev;
+	}
+}
+
+
+////////////////////////////////////////////////////
+////			Slot Allocation					////
+////////////////////////////////////////////////////
+
+/*	Takes a slot off the free list. Returns its index, or -1 if full	*/
+int CoapTransactionTable::allocate() {
+	int index = freeHead;
+	if (index < 0)
+		return -1;
+	
+	coap_transaction &t = slots[index];
+	freeHead = t.next;
+	
+	t.filled = true;
+	t.indexed = false;
+	t.retained = false;
+	t.status = 0;
+	t.time = 0;
+	t.timeout = 0;
+	t.segmentCount = 0;
+	t.payloadDone = NULL;
+	t.prev = -1;
+	t.next = usedHead;
+	if (usedHead >= 0)
+		slots[usedHead].prev = index;
+	usedHead = index;
+	used++;
+	return index;
+}
+
+/*	Returns the slots the next MAX allocate() calls will hand out, without
+	allocating them. Lets a receiver fill slots before committing to them	*/
+int CoapTransactionTable::peekFree(int *indexes, int max) {
+	int n = 0;
+	for (int i = freeHead; (i >= 0) && (n < max); i = slots[i].next) {
+		indexes[n++] = i;
+	}
+	return n;
+}
+
+/*	Gives slot INDEX back to the free list. A retained slot is only taken
+	off the filled list, and keeps its packet until unretain()	*/
+void CoapTransactionTable::release(int index) {
+	coap_transaction &t = slots[index];
+	if (!t.filled)
+		return;
+	unindex(index);
+	timers.cancel(index);
+	
+	if (t.prev >= 0)
+		slots[t.prev].next = t.next;
+	else
+		usedHead = t.next;
+	if (t.next >= 0)
+		slots[t.next].prev = t.prev;
+	
+	t.filled = false;
+	if (!t.retained)
+		recycle(index);
+}
+
+/*	Puts released slot INDEX on the free list, telling whoever owns the
+	memory its payload references point at that it is done with	*/
+void CoapTransactionTable::recycle(int index) {
+	coap_transaction &t = slots[index];
+	if (t.payloadDone != NULL)
+		t.payloadDone(t.payloadCtx);
+	t.segmentCount = 0;
+	t.payloadDone = NULL;
+	t.status = 0;
+	t.time = 0;
+	t.timeout = 0;
+	t.packet.release();
+	t.next = freeHead;
+	freeHead = index;
+	used--;
+}
+
+/*	Keeps filled slot INDEX, and the packet in it, from being reused until
+	unretain(). It still counts as taken	*/
+void CoapTransactionTable::retain(int index) {
+	if (isFilled(index))
+		slots[index].retained = true;
+}
+
+/*	Lets go of slot INDEX. If it was released while retained it is free
+	from now on	*/
+void CoapTransactionTable::unretain(int index) {
+	if ((index < 0) || (index >= capacity) || !slots[index].retained)
+		return;
+	slots[index].retained = false;
+	if (!slots[index].filled)
+		recycle(index);
+}
+
+
+////////////////////////////////////////////////////
+////				Lookup						////
+////////////////////////////////////////////////////
+
+/*	Makes slot INDEX findable by its peer, message ID and token. Must be
+	called again (after unindex()) if any of those change	*/
+void CoapTransactionTable::index(int index) {
+	coap_transaction &t = slots[index];
+	if (t.indexed)
+		return;
+	
+	int *bucket = &idBuckets[idHash(t.peer, t.packet.getID()) & bucketMask];
+	t.idPrev = -1;
+	t.idNext = *bucket;
+	if (*bucket >= 0)
+		slots[*bucket].idPrev = index;
+	*bucket = index;
+	
+	bucket = &tokenBuckets[tokenHash(t.peer, t.packet.getTokenPtr(), t.packet.getTokenLength()) & bucketMask];
+	t.tokenPrev = -1;
+	t.tokenNext = *bucket;
+	if (*bucket >= 0)
+		slots[*bucket].tokenPrev = index;
+	*bucket = index;
+	
+	t.indexed = true;
+}
+
+void CoapTransactionTable::unindex(int index) {
+	coap_transaction &t = slots[index];
+	if (!t.indexed)
+		return;
+	
+	unlinkBucket(&idBuckets[idHash(t.peer, t.packet.getID()) & bucketMask], index, false);
+	unlinkBucket(&tokenBuckets[tokenHash(t.peer, t.packet.getTokenPtr(), t.packet.getTokenLength()) & bucketMask], index, true);
+	t.indexed = false;
+}
+
+/*	Returns the slot holding message ID from PEER, or -1	*/
+int CoapTransactionTable::findById(const coap_endpoint &peer, uns16 id) {
+	int i = idBuckets[idHash(peer, id) & bucketMask];
+	while (i >= 0) {
+		if ((slots[i].packet.getID() == id) && coap_endpoint_equal(slots[i].peer, peer))
+			return i;
+		i = slots[i].idNext;
+	}
+	return -1;
+}
+
+/*	Returns the slot holding token TOKEN exchanged with PEER, or -1	*/
+int CoapTransactionTable::findByToken(const coap_endpoint &peer, const uns8 *token, uns8 len) {
+	int i = tokenBuckets[tokenHash(peer, token, len) & bucketMask];
+	while (i >= 0) {
+		coap_transaction &t = slots[i];
+		if ((t.packet.getTokenLength() == len) && coap_endpoint_equal(t.peer, peer) &&
+			((len == 0) || (memcmp(t.packet.getTokenPtr(), token, len) == 0)))
+			return i;
+		i = t.tokenNext;
+	}
+	return -1;
+}
+
+/*	Returns the filled slot whose packet buffer starts at PKT, or -1. This is
+	what lets a callback, which is only given the packet, find its slot.
+	Every slot's packet is tagged with its index, which the pool keeps in
+	front of the buffer, so PKT leads straight to its slot. A packet from
+	anywhere else (another table, or the application's own) has a tag that
+	doesn't lead back to PKT	*/
+int CoapTransactionTable::indexOf(const uns8 *pkt) {
+	if (pkt == NULL)
+		return -1;
+	uns32 index = CoapPacket::tagOf(pkt);
+	if ((index < (uns32)capacity) && slots[index].filled && (slots[index].packet.getPacket() == pkt))
+		return index;
+	return -1;
+}
+
+
+////////////////////////////////////////////////////
+////				Deadlines					////
+////////////////////////////////////////////////////
+
+void CoapTransactionTable::schedule(int index, uns32 deadline) {
+	timers.schedule(index, deadline);
+}
+
+void CoapTransactionTable::cancelTimer(int index) {
+	timers.cancel(index);
+}
+
+bool CoapTransactionTable::isScheduled(int index) {
+	return timers.isScheduled(index);
+}
+
+/*	Fills INDEXES with up to MAX slots whose deadline has passed and returns
+	how many. Their deadlines are cleared	*/
+int CoapTransactionTable::expired(uns32 now, int *indexes, int max) {
+	return timers.expire(now, indexes, max);
+}
+
+/*	Sets DEADLINE to the earliest one, returns 0 if no slot has one	*/
+int CoapTransactionTable::nextDeadline(uns32 *deadline) {
+	return timers.next(deadline);
+}
+
+
+////////////////////////////////////////////////////
+////				Iteration					////
+////////////////////////////////////////////////////
+
+int CoapTransactionTable::first() {
+	return usedHead;
+}
+
+int CoapTransactionTable::next(int index) {
+	return slots[index].next;
+}
+
+int CoapTransactionTable::size() {
+	return used;
+}
+
+int CoapTransactionTable::available() {
+	return capacity - used;
+}
+
+int CoapTransactionTable::getCapacity() {
+	return capacity;
+}
+
+uns32 CoapTransactionTable::getMemoryUsage() {
+	if (capacity == 0)
+		return 0;
+	return capacity * sizeof(coap_transaction) + 2 * (bucketMask + 1) * sizeof(int) + timers.getMemoryUsage();
+}
+
+bool CoapTransactionTable::isFilled(int index) {
+	return (index >= 0) && (index < capacity) && slots[index].filled;
+}
+
+coap_transaction& CoapTransactionTable::operator[](int index) {
+	return slots[index];
+}
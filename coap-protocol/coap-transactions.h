@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transaction table, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_TRANSACTIONS_h
+#define __COAP_TRANSACTIONS_h
+
+#include "coap-packet.h"
+#include "coap-transport.h"
+#include "coap-timer.h"
+
+//Payload references one tx slot can carry, see CoapProtocol::addPayloadRef()
+#ifndef COAP_MAX_SEGMENTS
+#ifdef ARDUINO
+#define		COAP_MAX_SEGMENTS	2
+#else
+#define		COAP_MAX_SEGMENTS	4
+#endif
+#endif
+
+//Called once a slot no longer needs the memory its payload references point at
+typedef void (*coap_payload_done)(void *ctx);
+
+//One rx or tx exchange
+typedef struct {
+	CoapPacket		packet;
+	coap_endpoint	peer;
+	uns8			status;			//See STATUS BYTE in coap-protocol.h
+	uns32			time;			//Time first sent/received
+	uns32			timeout;		//Wait for an ACK after the first transmission, ms
+	coap_iovec		segments[COAP_MAX_SEGMENTS];	//Payload sent after the packet, owned by the application
+	uns8			segmentCount;
+	coap_payload_done	payloadDone;
+	void			*payloadCtx;
+	bool			filled;			//Allocated
+	bool			indexed;		//Reachable through findById()/findByToken()
+	bool			retained;		//Kept off the free list until unretain()
+	int				idNext;			//Next slot in the same message ID bucket
+	int				idPrev;
+	int				tokenNext;		//Next slot in the same token bucket
+	int				tokenPrev;
+	int				prev;			//Filled list links. Free slots use next only
+	int				next;
+}	coap_transaction;
+
+/*	Fixed capacity table of transactions. Free slots are handed out from a
+	free list, filled slots are kept on a list that process_*_queue() walks,
+	and indexed slots can be found by (peer, message ID) or (peer, token)
+	through two chained hash tables. Each slot can also have one deadline on
+	a timer wheel. Everything is O(1) on average	*/
+class CoapTransactionTable {
+private:
+	coap_transaction	*slots;
+	int					*idBuckets;
+	int					*tokenBuckets;
+	int					capacity;
+	int					bucketMask;
+	int					freeHead;
+	int					usedHead;
+	int					used;
+	CoapTimerWheel		timers;
+	
+	uns32	idHash(const coap_endpoint &peer, uns16 id);
+	uns32	tokenHash(const coap_endpoint &peer, const uns8 *token, uns8 len);
+	void	unlinkBucket(int *bucket, int index, bool byToken);
+	void	recycle(int index);
+	
+public:
+	CoapTransactionTable();
+	~CoapTransactionTable();
+	
+	int		begin(int slotCount);
+	void	end();
+	
+	//Slot allocation
+	int		allocate();
+	int		peekFree(int *indexes, int max);
+	void	release(int index);
+	void	clear();
+	//A retained slot keeps its packet after release(), until unretain()
+	void	retain(int index);
+	void	unretain(int index);
+	
+	//Deadlines. Releasing a slot cancels its deadline
+	void	schedule(int index, uns32 deadline);
+	void	cancelTimer(int index);
+	bool	isScheduled(int index);
+	int		expired(uns32 now, int *indexes, int max);
+	int		nextDeadline(uns32 *deadline);
+	
+	//Lookup. Slots are only found once index() has been called on them
+	void	index(int index);
+	void	unindex(int index);
+	int		findById(const coap_endpoint &peer, uns16 id);
+	int		findByToken(const coap_endpoint &peer, const uns8 *token, uns8 len);
+	int		indexOf(const uns8 *pkt);
+	
+	//Walk the filled slots: for (i = first(); i >= 0; i = next(i))
+	int		first();
+	int		next(int index);
+	
+	int		size();
+	int		available();
+	int		getCapacity();
+	//Bytes taken from the heap by begin(). Packet buffers come from coapBufferPool
+	uns32	getMemoryUsage();
+	bool	isFilled(int index);
+	coap_transaction&	operator[](int index);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transport over POSIX UDP sockets (Linux host builds)
+// Written originally by Embedded Adventures
+
+#ifdef __linux__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "coap-transport-posix.h"
+
+//Most pieces sendv() passes to the kernel without copying them first
+#define		MAX_IOV		16
+
+static void toSockaddr(const coap_endpoint &ep, struct sockaddr_in *sa) {
+	memset(sa, 0, sizeof(*sa));
+	sa->sin_family = AF_INET;
+	sa->sin_addr.s_addr = htonl(ep.addr);
+	sa->sin_port = htons(ep.port);
+}
+
+static void fromSockaddr(const struct sockaddr_in *sa, coap_endpoint *ep) {
+	ep->addr = ntohl(sa->sin_addr.s_addr);
+	ep->port = ntohs(sa->sin_port);
+}
+
+CoapPosixTransport::CoapPosixTransport() {
+	sock = -1;
+	batching = true;
+	reusePort = false;
+}
+
+CoapPosixTransport::~CoapPosixTransport() {
+	stop();
+}
+
+/*	Opens and binds the socket. Returns 1 on success, 0 on failure	*/
+int CoapPosixTransport::begin(uns16 localPort) {
+	stop();
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return 0;
+	
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(localPort);
+	
+	int one = 1;
+	if (reusePort && (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)) {
+		stop();
+		return 0;
+	}
+	if ((bind(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0) ||
+		(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0)) {
+		stop();
+		return 0;
+	}
+	return 1;
+}
+
+void CoapPosixTransport::stop() {
+	if (sock >= 0)
+		close(sock);
+	sock = -1;
+}
+
+void CoapPosixTransport::setBatching(bool enable) {
+	batching = enable;
+}
+
+void CoapPosixTransport::setReusePort(bool enable) {
+	reusePort = enable;
+}
+
+int CoapPosixTransport::getFd() {
+	return sock;
+}
+
+int CoapPosixTransport::receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+	struct sockaddr_in sa;
+	socklen_t saLen = sizeof(sa);
+	
+	//MSG_TRUNC makes it return the full length of a datagram that didn't fit
+	int len = recvfrom(sock, buf, maxLen, MSG_TRUNC, (struct sockaddr*)&sa, &saLen);
+	if (len < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+	fromSockaddr(&sa, from);
+	return len;
+}
+
+int CoapPosixTransport::send(const uns8 *buf, int len, const coap_endpoint &to) {
+	struct sockaddr_in sa;
+	toSockaddr(to, &sa);
+	
+	if (sendto(sock, buf, len, 0, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+		return -1;
+	return len;
+}
+
+/*	One sendmsg() with the pieces as its iovec, so nothing is copied	*/
+int CoapPosixTransport::sendv(const coap_iovec *iov, int count, const coap_endpoint &to) {
+	struct iovec		iovs[MAX_IOV];
+	struct sockaddr_in	sa;
+	struct msghdr		msg;
+	
+	if (count > MAX_IOV)
+		return CoapTransport::sendv(iov, count, to);
+	int len = 0;
+	for (int i = 0; i < count; i++) {
+		iovs[i].iov_base = (void*)iov[i].data;
+		iovs[i].iov_len = iov[i].length;
+		len += iov[i].length;
+	}
+	toSockaddr(to, &sa);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &sa;
+	msg.msg_namelen = sizeof(sa);
+	msg.msg_iov = iovs;
+	msg.msg_iovlen = count;
+	
+	if (sendmsg(sock, &msg, 0) < 0)
+		return -1;
+	return len;
+}
+
+int CoapPosixTransport::receiveBatch(coap_datagram *dgrams, int count) {
+	if (!batching)
+		return CoapTransport::receiveBatch(dgrams, count);
+	
+	struct mmsghdr		msgs[COAP_BATCH_SIZE];
+	struct iovec		iovs[COAP_BATCH_SIZE];
+	struct sockaddr_in	addrs[COAP_BATCH_SIZE];
+	
+	if (count > COAP_BATCH_SIZE)
+		count = COAP_BATCH_SIZE;
+	
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (int i = 0; i < count; i++) {
+		iovs[i].iov_base = dgrams[i].data;
+		iovs[i].iov_len = dgrams[i].capacity;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+	}
+	
+	int n = recvmmsg(sock, msgs, count, MSG_DONTWAIT | MSG_TRUNC, NULL);
+	if (n < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+	
+	for (int i = 0; i < n; i++) {
+		dgrams[i].length = msgs[i].msg_len;
+		if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) && (dgrams[i].length <= dgrams[i].capacity))
+			dgrams[i].length = dgrams[i].capacity + 1;
+		fromSockaddr(&addrs[i], &dgrams[i].peer);
+	}
+	return n;
+}
+
+int CoapPosixTransport::sendBatch(const coap_datagram *dgrams, int count) {
+	if (!batching)
+		return CoapTransport::sendBatch(dgrams, count);
+	
+	struct mmsghdr		msgs[COAP_BATCH_SIZE];
+	struct iovec		iovs[COAP_BATCH_SIZE];
+	struct sockaddr_in	addrs[COAP_BATCH_SIZE];
+	int					sent = 0;
+	
+	while (sent < count) {
+		int n = count - sent;
+		if (n > COAP_BATCH_SIZE)
+			n = COAP_BATCH_SIZE;
+		
+		memset(msgs, 0, sizeof(msgs[0]) * n);
+		for (int i = 0; i < n; i++) {
+			const coap_datagram &d = dgrams[sent + i];
+			iovs[i].iov_base = d.data;
+			iovs[i].iov_len = d.length;
+			toSockaddr(d.peer, &addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		}
+		
+		int r = sendmmsg(sock, msgs, n, 0);
+		if (r <= 0)
+			return (sent > 0) ? sent : -1;
+		sent += r;
+		if (r < n)
+			break;
+	}
+	return sent;
+}
+
+#endif
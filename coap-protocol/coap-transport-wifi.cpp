@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transport over the ESP8266 WiFiUDP class, Arduino library
+// Written originally by Embedded Adventures
+
+#ifdef ARDUINO
+
+#include "coap-transport-wifi.h"
+
+int CoapWiFiTransport::begin(uns16 localPort) {
+	return WiFiUDP::begin(localPort);
+}
+
+void CoapWiFiTransport::stop() {
+	WiFiUDP::stop();
+}
+
+/*	Accepts dotted quads as well as host names	*/
+int CoapWiFiTransport::resolve(const char *host, uns16 port, coap_endpoint *ep) {
+	if (coap_endpoint_parse(host, port, ep))
+		return 1;
+	
+	IPAddress ip;
+	if (!WiFi.hostByName(host, ip))
+		return 0;
+	ep->addr = ((uns32)ip[0] << 24) | ((uns32)ip[1] << 16) | ((uns32)ip[2] << 8) | ip[3];
+	ep->port = port;
+	return 1;
+}
+
+int CoapWiFiTransport::receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+	int len = WiFiUDP::parsePacket();
+	if (len <= 0)
+		return 0;
+	
+	IPAddress ip = WiFiUDP::remoteIP();
+	from->addr = ((uns32)ip[0] << 24) | ((uns32)ip[1] << 16) | ((uns32)ip[2] << 8) | ip[3];
+	from->port = WiFiUDP::remotePort();
+	int got = WiFiUDP::read(buf, maxLen);
+	return (len > maxLen) ? len : got;		//Cut short; the rest goes with the next parsePacket()
+}
+
+int CoapWiFiTransport::send(const uns8 *buf, int len, const coap_endpoint &to) {
+	IPAddress ip(to.addr >> 24, (to.addr >> 16) & 0xFF, (to.addr >> 8) & 0xFF, to.addr & 0xFF);
+	if (!WiFiUDP::beginPacket(ip, to.port))
+		return -1;
+	WiFiUDP::write(buf, len);
+	if (!WiFiUDP::endPacket())
+		return -1;
+	return len;
+}
+
+/*	WiFiUDP gathers what is written between beginPacket() and endPacket()
+	into its own buffer, so each piece is copied just once, into that	*/
+int CoapWiFiTransport::sendv(const coap_iovec *iov, int count, const coap_endpoint &to) {
+	IPAddress ip(to.addr >> 24, (to.addr >> 16) & 0xFF, (to.addr >> 8) & 0xFF, to.addr & 0xFF);
+	if (!WiFiUDP::beginPacket(ip, to.port))
+		return -1;
+	int len = 0;
+	for (int i = 0; i < count; i++) {
+		WiFiUDP::write(iov[i].data, iov[i].length);
+		len += iov[i].length;
+	}
+	if (!WiFiUDP::endPacket())
+		return -1;
+	return len;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transport over the ESP8266 WiFiUDP class, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_TRANSPORT_WIFI_h
+#define __COAP_TRANSPORT_WIFI_h
+
+#ifdef ARDUINO
+
+#include "ESP8266WiFi.h"
+#include "WiFiUdp.h"
+#include "coap-transport.h"
+
+class CoapWiFiTransport : public CoapTransport, public WiFiUDP {
+public:
+	int		begin(uns16 localPort);
+	void	stop();
+	int		resolve(const char *host, uns16 port, coap_endpoint *ep);
+	int		receive(uns8 *buf, int maxLen, coap_endpoint *from);
+	int		send(const uns8 *buf, int len, const coap_endpoint &to);
+	int		sendv(const coap_iovec *iov, int count, const coap_endpoint &to);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transport layer, Arduino library
+// Written originally by Embedded Adventures
+
+#include "coap-transport.h"
+#include "coap-pool.h"
+
+/*	Parses a dotted quad "a.b.c.d". Returns 1 on success, 0 if malformed	*/
+int coap_endpoint_parse(const char *ip, uns16 port, coap_endpoint *ep) {
+	uns32 addr = 0;
+	int octets = 0;
+	
+	while (octets < 4) {
+		int value = 0;
+		int digits = 0;
+		while ((*ip >= '0') && (*ip <= '9') && (digits < 3)) {
+			value = (value * 10) + (*ip++ - '0');
+			digits++;
+		}
+		if ((digits == 0) || (value > 255))
+			return 0;
+		addr = (addr << 8) | value;
+		octets++;
+		
+		if (octets < 4) {
+			if (*ip++ != '.')
+				return 0;
+		}
+	}
+	if (*ip)
+		return 0;
+	
+	ep->addr = addr;
+	ep->port = port;
+	return 1;
+}
+
+bool coap_endpoint_equal(const coap_endpoint &a, const coap_endpoint &b) {
+	return (a.addr == b.addr) && (a.port == b.port);
+}
+
+
+////////////////////////////////////////////////////
+////			Default Implementations			////
+////////////////////////////////////////////////////
+
+int CoapTransport::resolve(const char *host, uns16 port, coap_endpoint *ep) {
+	return coap_endpoint_parse(host, port, ep);
+}
+
+int CoapTransport::receiveBatch(coap_datagram *dgrams, int count) {
+	int n = 0;
+	while (n < count) {
+		int len = receive(dgrams[n].data, dgrams[n].capacity, &dgrams[n].peer);
+		if (len <= 0)
+			break;
+		dgrams[n++].length = len;
+	}
+	return n;
+}
+
+int CoapTransport::sendBatch(const coap_datagram *dgrams, int count) {
+	int n = 0;
+	while (n < count) {
+		if (send(dgrams[n].data, dgrams[n].length, dgrams[n].peer) < 0)
+			break;
+		n++;
+	}
+	return n;
+}
+
+/*	Copies the pieces into one block from the buffer pool	*/
+int CoapTransport::sendv(const coap_iovec *iov, int count, const coap_endpoint &to) {
+	int len = 0;
+	for (int i = 0; i < count; i++) {
+		len += iov[i].length;
+	}
+	if (len > 0xFFFF)
+		return -1;
+	
+	uns16 capacity;
+	uns8 *buf = coapBufferPool.allocate(len, &capacity);
+	if (buf == NULL)
+		return -1;
+	int at = 0;
+	for (int i = 0; i < count; i++) {
+		memcpy(buf + at, iov[i].data, iov[i].length);
+		at += iov[i].length;
+	}
+	int result = send(buf, len, to);
+	coapBufferPool.release(buf, capacity);
+	return result;
+}
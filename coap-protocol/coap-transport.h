@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP transport layer, Arduino library
+// Written originally by Embedded Adventures
+
+#ifndef __COAP_TRANSPORT_h
+#define __COAP_TRANSPORT_h
+
+#include "coap-packet.h"
+
+#define		COAP_DEFAULT_PORT	5683
+
+//Largest number of datagrams moved by one receiveBatch()/sendBatch() call
+#ifndef COAP_BATCH_SIZE
+#ifdef ARDUINO
+#define		COAP_BATCH_SIZE		1
+#else
+#define		COAP_BATCH_SIZE		32
+#endif
+#endif
+
+//IPv4 address (host byte order, first octet in the top byte) and UDP port
+typedef struct {
+	uns32	addr;
+	uns16	port;
+}	coap_endpoint;
+
+//One datagram for the batched calls. DATA points at CAPACITY bytes of storage.
+//A LENGTH over CAPACITY means the datagram didn't fit and was cut short
+typedef struct {
+	uns8			*data;
+	int				length;
+	int				capacity;
+	coap_endpoint	peer;
+}	coap_datagram;
+
+//One piece of a datagram given to sendv()
+typedef struct {
+	const uns8	*data;
+	int			length;
+}	coap_iovec;
+
+int		coap_endpoint_parse(const char *ip, uns16 port, coap_endpoint *ep);
+bool	coap_endpoint_equal(const coap_endpoint &a, const coap_endpoint &b);
+
+/*	A CoapTransport moves datagrams between CoapProtocol and the network.
+	Backends only have to implement the single datagram calls; the batched
+	calls fall back to looping over them unless the backend can do better. */
+class CoapTransport {
+public:
+	virtual ~CoapTransport() {}
+	
+	virtual int		begin(uns16 localPort) = 0;
+	virtual void	stop() {}
+	
+	//Resolve a host/ip string. Returns 1 on success, 0 on failure
+	virtual int		resolve(const char *host, uns16 port, coap_endpoint *ep);
+	
+	//Returns the datagram length, 0 if nothing is waiting, -1 on error.
+	//A datagram longer than MAXLEN is cut short, and a length over MAXLEN
+	//returned so the caller can tell and drop it
+	virtual int		receive(uns8 *buf, int maxLen, coap_endpoint *from) = 0;
+	//Returns LEN if sent, -1 on error
+	virtual int		send(const uns8 *buf, int len, const coap_endpoint &to) = 0;
+	//Sends the COUNT pieces at IOV as one datagram. Returns its length if
+	//sent, -1 on error. Falls back to copying them into one buffer for send()
+	virtual int		sendv(const coap_iovec *iov, int count, const coap_endpoint &to);
+	
+	//Both return the number of datagrams moved, or -1 on error
+	virtual int		receiveBatch(coap_datagram *dgrams, int count);
+	virtual int		sendBatch(const coap_datagram *dgrams, int count);
+	
+	//File descriptor that turns readable when a datagram arrives, for event
+	//loops to wait on, or -1 if there isn't one
+	virtual int		getFd() { return -1; }
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP block-wise transfer benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Moves a 1 MB body over UDP loopback with Block2 (download) and Block1
+//(upload), for a few window sizes, and prints the throughput.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol blockwise-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o blockwise-bench
+
+#include "coap-blockwise.h"
+#include <stdlib.h>
+
+#define		BODY_SIZE		(1024UL * 1024UL)
+#define		CLIENT_PORT		5684
+
+static uns8				body[BODY_SIZE];
+static uns8				received[BODY_SIZE];
+static CoapProtocol		server, client;
+static CoapBlockwise	serverBlocks, clientBlocks;
+static int				finalCode;
+
+int readBody(void *ctx, uns32 offset, uns8 *buf, int len) {
+	memcpy(buf, body + offset, len);
+	return len;
+}
+
+int storeBody(void *ctx, uns32 offset, const uns8 *data, int len) {
+	if (offset + len > BODY_SIZE)
+		return -1;
+	memcpy(received + offset, data, len);
+	return len;
+}
+
+void transferDone(void *ctx, int transfer, uns8 code) {
+	finalCode = code;
+}
+
+//GETs are served from BODY, PUTs are stored in RECEIVED
+void serverPacket(uns8 *pkt, int pktLen) {
+	CoapPacket &req = server.getCoapPacket(RX, server.getRxIndex(pkt));
+	if (req.getResponseCode() == COAP_GET)
+		serverBlocks.serveBlock2(pkt, CODE_CONTENT, BODY_SIZE, readBody, NULL);
+	else
+		serverBlocks.acceptBlock1(pkt, storeBody, NULL, CODE_CHANGED);
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+/*	Runs one transfer to completion, returns the time it took in ms	*/
+double run(bool upload, uns8 window) {
+	coap_endpoint to;
+	coap_endpoint_parse("127.0.0.1", COAP_DEFAULT_PORT, &to);
+	
+	memset(received, 0, BODY_SIZE);
+	finalCode = -1;
+	clientBlocks.setWindow(window);
+	
+	uns32 start = micros();
+	if (upload)
+		clientBlocks.upload(to, COAP_PUT, "bench", BODY_SIZE, readBody, transferDone, NULL);
+	else
+		clientBlocks.download(to, "bench", storeBody, transferDone, NULL);
+	while (finalCode < 0) {
+		client.process_tx_queue();
+		server.process_rx_queue();
+		server.process_tx_queue();
+		client.process_rx_queue();
+	}
+	double ms = (micros() - start) / 1000.0;
+	
+	if ((memcmp(body, received, BODY_SIZE) != 0) || ((finalCode >> 5) != 2))
+		coap_printf("  transfer failed (code %d.%02d)\n", finalCode >> 5, finalCode & 0x1F);
+	return ms;
+}
+
+int main() {
+	static CoapPosixTransport clientTransport;
+	static const uns8 windows[] = {1, 2, 4, 8};
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = 32;
+	
+	for (uns32 i = 0; i < BODY_SIZE; i++) {
+		body[i] = rand();
+	}
+	coap_config clientConfig = config;
+	clientConfig.localPort = CLIENT_PORT;		//The server has COAP_DEFAULT_PORT
+	if (!server.begin(server.getTransport(), config) || !client.begin(&clientTransport, clientConfig)) {
+		coap_printf("can't open ports %d and %d\n", COAP_DEFAULT_PORT, CLIENT_PORT);
+		return 1;
+	}
+	server.setHandlers(serverPacket, ignore, ignore, ignore);
+	client.setHandlers(ignore, ignore, ignore, ignore);
+	serverBlocks.begin(&server);
+	clientBlocks.begin(&client);
+	
+	coap_printf("1 MB over loopback, %d byte blocks\n", 16 << COAP_BLOCK_SZX);
+	for (uns8 i = 0; i < sizeof(windows); i++) {
+		double down = run(false, windows[i]);
+		double up = run(true, windows[i]);
+		coap_printf("window %d: download %8.1f ms %7.1f MB/s   upload %8.1f ms %7.1f MB/s\n",
+			windows[i], down, 1000.0 / down, up, 1000.0 / up);
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP coroutine client benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Starts 10000 coroutines on one thread, each awaiting CON GETs one after the
+//other through CoapClient, so 10000 requests are outstanding at once, and
+//answers them with a CoapRouter on a second CoapProtocol joined to the first
+//by an in-memory transport. Prints the time per request and how many heap
+//allocations were made: the coroutine frames come from coapBufferPool, so
+//once it has grown to hold them all a run makes none.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -std=c++20 -O2 -I../../coap-packet -I../../coap-protocol client-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o client-bench
+
+#include "coap-client.h"
+#include "coap-router.h"
+#include "coap-pool.h"
+#include <stdlib.h>
+
+#define		TASKS			10000
+#define		ROUNDS			20
+#define		RING_SIZE		32768
+#define		RING_BYTES		32
+
+static unsigned long	allocations;
+
+void* operator new(size_t size) {
+	allocations++;
+	void *p = malloc(size);
+	if (p == NULL)
+		abort();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	allocations++;
+	return malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+	free(p);
+}
+
+//Fixed ring of datagrams each way, so the transport itself never allocates
+typedef struct {
+	uns8			data[RING_BYTES];
+	int				length;
+	coap_endpoint	from;
+}	ring_datagram;
+
+typedef struct {
+	ring_datagram	slots[RING_SIZE];
+	uns32			head;
+	uns32			tail;
+}	datagram_ring;
+
+static datagram_ring	rings[2];
+
+class RingTransport : public CoapTransport {
+public:
+	int				me;
+	coap_endpoint	self;
+	
+	RingTransport(int id) {
+		me = id;
+		self.addr = 0x7F000001UL;
+		self.port = 1000 + id;
+	}
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		datagram_ring &r = rings[me];
+		if (r.head == r.tail)
+			return 0;
+		ring_datagram &d = r.slots[r.tail++ % RING_SIZE];
+		memcpy(buf, d.data, d.length);
+		*from = d.from;
+		return d.length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		datagram_ring &r = rings[to.port - 1000];
+		if ((r.head - r.tail == RING_SIZE) || (len > RING_BYTES))
+			return -1;
+		ring_datagram &d = r.slots[r.head++ % RING_SIZE];
+		memcpy(d.data, buf, len);
+		d.length = len;
+		d.from = self;
+		return len;
+	}
+};
+
+static RingTransport	serverTransport(0);
+static RingTransport	clientTransport(1);
+static CoapProtocol		server;
+static CoapProtocol		client;
+static CoapRouter		router;
+static CoapClient		requests;
+static uns32			finished;
+static uns32			answered;
+
+int answer(void *ctx, const uns8 *request, int requestLength) {
+	return router.reply(request, CODE_CONTENT, 0, (const uns8*)"21.5", 4);
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+CoapTask poller(int rounds) {
+	for (int n = 0; n < rounds; n++) {
+		coap_response rsp = co_await requests.request(serverTransport.self, COAP_GET, "sensors/temp");
+		answered += (rsp.status == COAP_REQUEST_OK);
+	}
+	finished++;
+}
+
+/*	TASKS coroutines of ROUNDS requests each. Returns ns per request	*/
+double run(int rounds, int *peak) {
+	finished = 0;
+	answered = 0;
+	*peak = 0;
+	uns32 start = micros();
+	for (int t = 0; t < TASKS; t++) {
+		if (!poller(rounds).started) {
+			coap_printf("no room for coroutine %d\n", t);
+			exit(1);
+		}
+	}
+	while (finished < TASKS) {
+		if (requests.pending() > *peak)
+			*peak = requests.pending();
+		client.process_tx_queue();
+		server.process_rx_queue();
+		server.process_tx_queue();
+		client.process_rx_queue();
+	}
+	uns32 us = micros() - start;
+	if (answered != (uns32)(TASKS * rounds)) {
+		coap_printf("%lu of %lu answered\n", (unsigned long)answered, (unsigned long)(TASKS * rounds));
+		exit(1);
+	}
+	return us * 1000.0 / (TASKS * rounds);
+}
+
+int main() {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = TASKS + 64;
+	config.localPort = 0;
+	if (!server.begin(&serverTransport, config) || !client.begin(&clientTransport, config) ||
+		!router.begin(&server, 4) || !requests.begin(&client, TASKS)) {
+		coap_printf("out of memory\n");
+		return 1;
+	}
+	server.setHandlers(ignore, ignore, ignore, ignore);
+	client.setHandlers(ignore, ignore, ignore, ignore);
+	router.addRoute("sensors/temp", COAP_GET, answer, &router);
+	
+	int peak;
+	unsigned long before = allocations;
+	double ns = run(1, &peak);
+	coap_printf("first run:  %d coroutines, %d requests outstanding at most, %.0f ns/request, %lu heap allocations\n",
+		TASKS, peak, ns, allocations - before);
+	
+	before = allocations;
+	ns = run(ROUNDS, &peak);
+	coap_printf("second run: %d coroutines x %d requests, %d outstanding at most, %.0f ns/request, %lu heap allocations\n",
+		TASKS, ROUNDS, peak, ns, allocations - before);
+	coapBufferPool.printReport();
+	return 0;
+}
@@ -0,0 +1,577 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP encode, decode and protocol loop benchmark suite, Linux host
+// Written originally by Embedded Adventures
+
+//Times the paths every packet goes through, each over the same fixed mix of
+//messages, and prints ns per operation and packets per second:
+//	encode				header, token, options and payload with the CoapPacket builder
+//	encode, N options	the same for one GET with 3 to 6 options given out of
+//						order, apart from the mix, so the option encoder is timed alone
+//	decode				copyPacket() and a walk over every option
+//	rx ACK matching		process_rx_queue() matching piggybacked ACKs to CONs in flight,
+//						from 4 up to 100000 of them, which should cost the same
+//	tx idle scan		process_tx_queue() with CONs in flight and none due
+//	tx retransmit		process_tx_queue() sending every CON in flight again
+//	request/response	CON requests answered piggybacked by a second CoapProtocol,
+//						over an in-memory transport
+//	loopback			the same over CoapPosixTransport sockets on 127.0.0.1,
+//						with recvmmsg()/sendmmsg() batching on and off, best of
+//						LOOPBACK_ROUNDS runs each after one to warm up
+//The mix ("requests", "responses" or "mixed", the default) is drawn from the
+//same seed every run, so builds of two commits can be run with the same mix
+//and their numbers compared line by line. The protocol cases send each
+//message as a CON request, keeping its options and payload.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol coap-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o coap-bench
+//	./coap-bench [requests|responses|mixed]
+
+#include "coap-protocol.h"
+#include <stdio.h>
+#include <string.h>
+
+#define		MIX_LENGTH			1024		//Messages in a mix, repeated as needed
+#define		CODEC_ROUNDS		2000		//Passes over the mix to encode and decode
+#define		OPTION_ENCODES		2000000UL	//Packets encoded for each option count
+#define		ACK_MATCHES			512000UL	//ACKs matched for each number in flight
+#define		ID_SPAN				32768		//Message IDs a flight uses per peer
+#define		SCANS				1000000UL
+#define		RETRANSMIT_FLIGHT	1024
+#define		RETRANSMIT_ROUNDS	50
+#define		WINDOW				32			//Requests outstanding end to end
+#define		EXCHANGES			500000UL
+#define		LOOPBACK_EXCHANGES	100000UL
+#define		LOOPBACK_ROUNDS		3			//Timed runs of each batching mode
+#define		LOOPBACK_PORT		56830		//The client is on the next port up
+#define		DATAGRAM_BYTES		640
+#define		RING_SIZE			4096
+
+//One kind of message in a mix. -1 leaves an option out
+typedef struct {
+	const char	*name;
+	uns8		type;
+	uns8		code;
+	uns8		tokenLength;
+	const char	*path;
+	int			contentFormat;
+	int			observe;
+	int			block2;
+	uns16		payloadLength;
+	uns8		weight[3];		//In the requests, responses and mixed mixes
+}	bench_kind;
+
+static const bench_kind kinds[] = {
+	{"GET",              TYPE_CON, COAP_GET,     4, "sensors/temp",          -1,  -1,   -1,   0, {6, 0, 3}},
+	{"POST report",      TYPE_CON, COAP_POST,    4, "sensors/temp",           0,  -1,   -1,   8, {3, 0, 2}},
+	{"PUT config",       TYPE_CON, COAP_PUT,     8, "config/node/interval",  50,  -1,   -1,  64, {1, 0, 1}},
+	{"2.05 piggybacked", TYPE_ACK, CODE_CONTENT, 4, NULL,                     0,  -1,   -1,  16, {0, 6, 2}},
+	{"notification",     TYPE_NON, CODE_CONTENT, 8, NULL,                    50, 1000,  -1,  32, {0, 3, 1}},
+	{"block",            TYPE_CON, CODE_CONTENT, 2, NULL,                    42,  -1, 0x1E, 512, {0, 1, 1}},
+};
+
+#define		KINDS		(sizeof(kinds) / sizeof(kinds[0]))
+
+static const char *mixNames[3] = {"requests", "responses", "mixed"};
+
+//The mix, as kinds and as encoded packets
+static uns8		sequence[MIX_LENGTH];
+static uns8		encoded[MIX_LENGTH][DATAGRAM_BYTES];
+static uns16	encodedLength[MIX_LENGTH];
+static uns8		payload[512];
+static volatile uns32	sink;
+
+typedef struct {
+	uns8			data[DATAGRAM_BYTES];
+	int				length;
+	coap_endpoint	from;
+}	bench_datagram;
+
+/*	Datagrams sent to a BenchTransport with a peer are queued for it, in a
+	fixed ring so the transport never allocates. Without one they are only
+	counted	*/
+class BenchTransport : public CoapTransport {
+public:
+	BenchTransport	*peer;
+	coap_endpoint	self;
+	bench_datagram	ring[RING_SIZE];
+	uns32			head;
+	uns32			tail;
+	uns32			sent;
+	
+	BenchTransport(uns16 port) {
+		peer = NULL;
+		self.addr = 0x7F000001UL;
+		self.port = port;
+		head = 0;
+		tail = 0;
+		sent = 0;
+	}
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	//Queues a datagram to be received from FROM
+	int inject(const uns8 *buf, int len, const coap_endpoint &from) {
+		if ((head - tail == RING_SIZE) || (len > DATAGRAM_BYTES))
+			return -1;
+		bench_datagram &d = ring[head++ % RING_SIZE];
+		memcpy(d.data, buf, len);
+		d.length = len;
+		d.from = from;
+		return len;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if (head == tail)
+			return 0;
+		bench_datagram &d = ring[tail++ % RING_SIZE];
+		memcpy(buf, d.data, d.length);
+		*from = d.from;
+		return d.length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		if ((peer != NULL) && (peer->inject(buf, len, self) < 0))
+			return -1;
+		sent++;
+		return len;
+	}
+};
+
+static BenchTransport	serverTransport(1000);
+static BenchTransport	clientTransport(1001);
+static CoapProtocol		server;
+static CoapProtocol		client;
+static uns32			acked;
+
+/*	Same draws every run, whatever the platform's rand() does	*/
+static uns32 lcg = 12345;
+uns32 next_random() {
+	lcg = lcg * 1103515245UL + 12345UL;
+	return (lcg >> 16) & 0x7FFF;
+}
+
+void build_mix(int mix) {
+	int total = 0;
+	for (unsigned k = 0; k < KINDS; k++) {
+		total += kinds[k].weight[mix];
+	}
+	for (int i = 0; i < MIX_LENGTH; i++) {
+		int pick = next_random() % total;
+		unsigned k = 0;
+		while (pick >= kinds[k].weight[mix]) {
+			pick -= kinds[k].weight[mix];
+			k++;
+		}
+		sequence[i] = k;
+	}
+	for (unsigned i = 0; i < sizeof(payload); i++) {
+		payload[i] = 'a' + (i % 26);
+	}
+}
+
+/*	The builder calls an application makes for message I of the mix	*/
+void encode(CoapPacket &pkt, int i, uns16 id) {
+	const bench_kind &k = kinds[sequence[i]];
+	uns8 token[8] = {0xC0, 0xFF, 0xEE, 0x00, 0x12, 0x34, 0x56, (uns8)i};
+	
+	pkt.begin();
+	pkt.addHeader(k.type, k.code, id);
+	pkt.addTokens(k.tokenLength, token);
+	if (k.observe >= 0)
+		pkt.addUintOption(OPT_OBSERVE, k.observe + i);
+	if (k.path != NULL)
+		pkt.addUriPath(k.path);
+	if (k.contentFormat >= 0)
+		pkt.addUintOption(OPT_CONTENT_FORMAT, k.contentFormat);
+	if (k.block2 >= 0)
+		pkt.addUintOption(OPT_BLOCK2, k.block2);
+	if (k.payloadLength > 0)
+		pkt.addPayload(k.payloadLength, payload);
+	pkt.size();
+}
+
+/*	Message I of the mix as a CON request with message ID ID, into BUF	*/
+int as_request(int i, uns16 id, uns8 *buf) {
+	int len = encodedLength[i];
+	memcpy(buf, encoded[i], len);
+	buf[0] = (buf[0] & 0xCF) | (TYPE_CON << 4);
+	if ((buf[1] >> 5) != 0)
+		buf[1] = COAP_POST;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	return len;
+}
+
+/*	A piggybacked 2.05 with message ID ID answering message I of the mix
+	sent as a request, into BUF. An empty ACK would only tell the client a
+	separate response is on its way	*/
+int piggybacked_ack(int i, uns16 id, uns8 *buf) {
+	i %= MIX_LENGTH;
+	uns8 tokenLength = encoded[i][0] & 0x0F;
+	buf[0] = (COAP_VERSION << 6) | (TYPE_ACK << 4) | tokenLength;
+	buf[1] = CODE_CONTENT;
+	buf[2] = id >> 8;
+	buf[3] = id & 0xFF;
+	memcpy(&buf[4], &encoded[i][4], tokenLength);
+	return 4 + tokenLength;
+}
+
+void print_result(const char *name, double ns, int packetsPerOp) {
+	if (packetsPerOp > 0)
+		coap_printf("%-36s %10.1f %12.0f\n", name, ns, packetsPerOp * 1e9 / ns);
+	else
+		coap_printf("%-36s %10.1f %12s\n", name, ns, "-");
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+void count_ack(uns8 *pkt, int pktLen) {
+	acked++;
+}
+
+/*	The server answers every request with a piggybacked 2.05, built in place	*/
+void answer(uns8 *pkt, int pktLen) {
+	int rx = server.getRxIndex(pkt);
+	if (rx < 0)
+		return;
+	CoapPacket &req = server.getCoapPacket(RX, rx);
+	coap_endpoint peer = server.getPeer(RX, rx);
+	int x = server.reserveTX(peer);
+	if (x >= 0) {
+		server.addHeader(x, TYPE_ACK, CODE_CONTENT, req.getID());
+		server.addTokens(x, req.getTokenLength(), req.getTokenPtr());
+		server.addPayload(x, 4, (const uns8*)"21.5");
+		server.commitTX(x);
+	}
+	server.packetProcessed(peer, req.getID());
+}
+
+double bench_encode() {
+	static CoapPacket pkt;
+	uns32 start = micros();
+	for (int r = 0; r < CODEC_ROUNDS; r++) {
+		for (int i = 0; i < MIX_LENGTH; i++) {
+			encode(pkt, i, i);
+			sink += pkt.packetPtr()[3];
+		}
+	}
+	return (micros() - start) * 1000.0 / ((double)CODEC_ROUNDS * MIX_LENGTH);
+}
+
+/*	Times encoding a GET with the first OPTIONS (3 to 6) of a fixed set,
+	added out of option number order as an application might	*/
+double bench_encode_options(int options) {
+	static CoapPacket pkt;
+	uns8 token[4] = {0xC0, 0xFF, 0xEE, 0x00};
+	uns32 start = micros();
+	for (uns32 n = 0; n < OPTION_ENCODES; n++) {
+		pkt.begin();
+		pkt.addHeader(TYPE_CON, COAP_GET, n);
+		pkt.addTokens(sizeof(token), token);
+		pkt.addUintOption(OPT_ACCEPT, 50);
+		pkt.addOption(OPT_URI_PATH, 7, "sensors");
+		pkt.addUintOption(OPT_OBSERVE, 0);
+		if (options > 3)
+			pkt.addOption(OPT_URI_PATH, 4, "temp");
+		if (options > 4)
+			pkt.addOption(OPT_URI_QUERY, 6, "unit=c");
+		if (options > 5)
+			pkt.addOption(OPT_URI_HOST, 9, "node.home");
+		sink += pkt.packetPtr()[pkt.size() - 1];
+	}
+	return (micros() - start) * 1000.0 / OPTION_ENCODES;
+}
+
+double bench_decode() {
+	static CoapPacket pkt;
+	uns32 start = micros();
+	for (int r = 0; r < CODEC_ROUNDS; r++) {
+		for (int i = 0; i < MIX_LENGTH; i++) {
+			pkt.copyPacket(encoded[i], encodedLength[i]);
+			for (int o = 0; o < pkt.numOptions(); o++) {
+				sink += pkt.getOptionNumber(o) + pkt.getOptionLength(o);
+			}
+			sink += pkt.getPayloadLength();
+		}
+	}
+	return (micros() - start) * 1000.0 / ((double)CODEC_ROUNDS * MIX_LENGTH);
+}
+
+/*	Where CON N of a flight goes. A flight bigger than ID_SPAN is spread
+	over more than one peer, so no two CONs in it share a message ID	*/
+coap_endpoint flight_peer(int n) {
+	coap_endpoint peer = serverTransport.self;
+	peer.port += n / ID_SPAN;
+	return peer;
+}
+
+/*	Fills PROTOCOL's tx queue with COUNT CONs from the mix and sends them	*/
+void send_flight(CoapProtocol &protocol, int count, uns16 firstId, int *next) {
+	uns8 buf[DATAGRAM_BYTES];
+	for (int n = 0; n < count; n++) {
+		int len = as_request(*next, firstId + (n % ID_SPAN), buf);
+		*next = (*next + 1) % MIX_LENGTH;
+		protocol.addToTX(flight_peer(n), buf, len);
+	}
+	protocol.process_tx_queue();
+}
+
+/*	Times matching piggybacked ACKs to IN_FLIGHT CONs, and
+	process_tx_queue() with those CONs waiting and nothing due. The ACKs
+	are received RING_SIZE at a time	*/
+int bench_ack(int inFlight, double *ackNs, double *scanNs) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = inFlight;
+	if (!client.begin(&clientTransport, config))
+		return 0;
+	client.setHandlers(ignore, count_ack, ignore, ignore);
+	clientTransport.peer = NULL;
+	
+	uns32 rounds = ACK_MATCHES / inFlight;
+	uns32 ackTime = 0;
+	uns32 scanTime = 0;
+	uns32 scans = 0;
+	int next = 0;
+	uns16 id = 0;
+	acked = 0;
+	for (uns32 r = 0; r < rounds; r++) {
+		int first = next;
+		send_flight(client, inFlight, id, &next);
+		
+		uns32 start = micros();
+		for (uns32 s = 0; s < SCANS / rounds; s++) {
+			client.process_tx_queue();
+		}
+		scanTime += micros() - start;
+		scans += SCANS / rounds;
+		
+		//ACKs come back in a different order from the CONs
+		for (int n = 0; n < inFlight; ) {
+			for (int queued = 0; (queued < RING_SIZE) && (n < inFlight); queued++, n++) {
+				int k = (int)(((uns32)n * 97) % inFlight);
+				uns8 ack[4 + 8];
+				int len = piggybacked_ack(first + k, id + (k % ID_SPAN), ack);
+				clientTransport.inject(ack, len, flight_peer(k));
+			}
+			start = micros();
+			client.process_rx_queue();
+			ackTime += micros() - start;
+		}
+		id += (inFlight < ID_SPAN) ? inFlight : ID_SPAN;
+	}
+	if (acked != rounds * inFlight) {
+		coap_printf("%lu of %lu CONs ACKed\n", (unsigned long)acked, (unsigned long)rounds * inFlight);
+		return 0;
+	}
+	*ackNs = ackTime * 1000.0 / ((double)rounds * inFlight);
+	*scanNs = (scans > 0) ? scanTime * 1000.0 / scans : 0;
+	return 1;
+}
+
+/*	Times process_tx_queue() retransmitting RETRANSMIT_FLIGHT CONs at once	*/
+int bench_retransmit(double *ns) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = RETRANSMIT_FLIGHT;
+	config.ackTimeout = 1;
+	if (!client.begin(&clientTransport, config))
+		return 0;
+	client.setHandlers(ignore, ignore, ignore, ignore);
+	clientTransport.peer = NULL;
+	
+	uns32 time = 0;
+	int next = 0;
+	uns16 id = 0;
+	for (int r = 0; r < RETRANSMIT_ROUNDS; r++) {
+		send_flight(client, RETRANSMIT_FLIGHT, id, &next);
+		//Every one of them is due a tick after the last was sent
+		uns32 sentAt = millis();
+		while ((int32_t)(millis() - (sentAt + config.ackTimeout + COAP_TIMER_TICK_MS)) < 0)
+			;
+		uns32 sent = clientTransport.sent;
+		uns32 start = micros();
+		client.process_tx_queue();
+		time += micros() - start;
+		if (clientTransport.sent - sent != RETRANSMIT_FLIGHT) {
+			coap_printf("%lu of %d CONs retransmitted\n", (unsigned long)(clientTransport.sent - sent), RETRANSMIT_FLIGHT);
+			return 0;
+		}
+		client.clearQueue(TX);
+		id += RETRANSMIT_FLIGHT;
+	}
+	*ns = time * 1000.0 / ((double)RETRANSMIT_ROUNDS * RETRANSMIT_FLIGHT);
+	return 1;
+}
+
+/*	Sends COUNT CON requests to TO, WINDOW at a time, each answered by the
+	server, and returns the time taken in microseconds	*/
+uns32 run_exchanges(const coap_endpoint &to, uns32 count) {
+	uns8 buf[DATAGRAM_BYTES];
+	uns32 requested = 0;
+	int next = 0;
+	acked = 0;
+	uns32 start = micros();
+	while (acked < count) {
+		while ((requested - acked < WINDOW) && (requested < count)) {
+			int len = as_request(next, client.nextMessageId(to), buf);
+			next = (next + 1) % MIX_LENGTH;
+			if (client.addToTX(to, buf, len) < 0)
+				break;
+			requested++;
+		}
+		client.process_tx_queue();
+		server.process_rx_queue();
+		server.process_tx_queue();
+		client.process_rx_queue();
+	}
+	return micros() - start;
+}
+
+/*	Times EXCHANGES CON requests, WINDOW at a time, answered by the server	*/
+int bench_exchange(double *ns) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = 2 * WINDOW;
+	config.localPort = 0;
+	if (!server.begin(&serverTransport, config) || !client.begin(&clientTransport, config))
+		return 0;
+	server.setHandlers(answer, ignore, ignore, ignore);
+	client.setHandlers(ignore, count_ack, ignore, ignore);
+	clientTransport.peer = &serverTransport;
+	serverTransport.peer = &clientTransport;
+	
+	*ns = run_exchanges(serverTransport.self, EXCHANGES) * 1000.0 / EXCHANGES;
+	return 1;
+}
+
+/*	Times LOOPBACK_EXCHANGES CON requests over UDP sockets on 127.0.0.1,
+	with the sockets' batching set to BATCHING	*/
+int bench_loopback(bool batching, double *ns) {
+	static CoapPosixTransport serverSocket;
+	static CoapPosixTransport clientSocket;
+	coap_config config = COAP_CONFIG_DEFAULT;
+	coap_endpoint to;
+	
+	config.queueSize = 2 * WINDOW;
+	serverSocket.setBatching(batching);
+	clientSocket.setBatching(batching);
+	config.localPort = LOOPBACK_PORT;
+	if (!server.begin(&serverSocket, config))
+		return 0;
+	config.localPort = LOOPBACK_PORT + 1;
+	if (!client.begin(&clientSocket, config))
+		return 0;
+	server.setHandlers(answer, ignore, ignore, ignore);
+	client.setHandlers(ignore, count_ack, ignore, ignore);
+	coap_endpoint_parse("127.0.0.1", LOOPBACK_PORT, &to);
+	
+	*ns = run_exchanges(to, LOOPBACK_EXCHANGES) * 1000.0 / LOOPBACK_EXCHANGES;
+	serverSocket.stop();
+	clientSocket.stop();
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	int mix = 2;
+	if (argc > 1) {
+		for (mix = 0; (mix < 3) && (strcmp(argv[1], mixNames[mix]) != 0); mix++)
+			;
+		if (mix == 3) {
+			coap_printf("usage: %s [requests|responses|mixed]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	build_mix(mix);
+	static CoapPacket pkt;
+	uns32 bytes = 0;
+	for (int i = 0; i < MIX_LENGTH; i++) {
+		encode(pkt, i, i);
+		encodedLength[i] = pkt.size();
+		memcpy(encoded[i], pkt.packetPtr(), encodedLength[i]);
+		bytes += encodedLength[i];
+	}
+	coap_printf("mix \"%s\": %d messages, %lu bytes on average\n", mixNames[mix], MIX_LENGTH,
+				(unsigned long)(bytes / MIX_LENGTH));
+	for (unsigned k = 0; k < KINDS; k++) {
+		int count = 0;
+		for (int i = 0; i < MIX_LENGTH; i++) {
+			count += sequence[i] == k;
+		}
+		if (count > 0)
+			coap_printf("  %-18s %4d\n", kinds[k].name, count);
+	}
+	coap_printf("\n%-36s %10s %12s\n", "case", "ns/op", "packets/s");
+	
+	char name[64];
+	double ns;
+	print_result("encode", bench_encode(), 1);
+	for (int options = 3; options <= 6; options++) {
+		snprintf(name, sizeof(name), "encode, %d options", options);
+		print_result(name, bench_encode_options(options), 1);
+	}
+	print_result("decode", bench_decode(), 1);
+	static const int flights[] = {4, 64, 256, 1000, 10000, 100000};
+	double scans[sizeof(flights) / sizeof(flights[0])];
+	for (unsigned f = 0; f < sizeof(flights) / sizeof(flights[0]); f++) {
+		if (!bench_ack(flights[f], &ns, &scans[f]))
+			return 1;
+		snprintf(name, sizeof(name), "rx ACK matching, %d in flight", flights[f]);
+		print_result(name, ns, 1);
+	}
+	for (unsigned f = 0; f < sizeof(flights) / sizeof(flights[0]); f++) {
+		snprintf(name, sizeof(name), "tx idle scan, %d in flight", flights[f]);
+		print_result(name, scans[f], 0);
+	}
+	if (!bench_retransmit(&ns))
+		return 1;
+	snprintf(name, sizeof(name), "tx retransmit, %d due", RETRANSMIT_FLIGHT);
+	print_result(name, ns, 1);
+	if (!bench_exchange(&ns))
+		return 1;
+	snprintf(name, sizeof(name), "request/response, %d in flight", WINDOW);
+	print_result(name, ns, 2);
+	//Loopback runs get faster as the host warms up, which used to count
+	//against whichever mode went first. So the first run is thrown away,
+	//the modes take turns, and each keeps its best run
+	double best[2] = {0, 0};
+	for (int r = 0; r <= 2 * LOOPBACK_ROUNDS; r++) {
+		int batching = r & 1;
+		if (!bench_loopback(batching, &ns)) {
+			coap_printf("no loopback sockets on ports %d and %d\n", LOOPBACK_PORT, LOOPBACK_PORT + 1);
+			return 1;
+		}
+		if ((r > 0) && ((best[batching] == 0) || (ns < best[batching])))
+			best[batching] = ns;
+	}
+	for (int batching = 1; batching >= 0; batching--) {
+		snprintf(name, sizeof(name), "loopback, %d in flight, batching %s", WINDOW, batching ? "on" : "off");
+		print_result(name, best[batching], 2);
+	}
+	return (sink == 0xFFFFFFFF) ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP event loop benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Runs a server thread three ways: process_rx_queue()/process_tx_queue() in
+//a tight loop, the same with a 1 ms sleep each time round, and driven by
+//CoapEventLoop. For each it prints the CPU the server thread burns over
+//a second with no traffic, then the median and 99th percentile round trip
+//of CON GETs sent one at a time, a few ms apart, over loopback.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol eventloop-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o eventloop-bench -lpthread
+
+#include "coap-eventloop.h"
+#include "coap-router.h"
+#include "coap-template.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define		BENCH_PORT		56850
+#define		IDLE_MS			1000
+#define		REQUESTS		2000
+#define		GAP_US			2000
+
+#define		MODE_BUSY		0
+#define		MODE_SLEEP		1
+#define		MODE_EVENTS		2
+
+static const char	*modeNames[] = {"busy polling", "polling, 1 ms sleep", "CoapEventLoop"};
+
+typedef struct {
+	int				mode;
+	int				stop;
+	int				ready;
+	CoapEventLoop	*loop;
+}	bench_server;
+
+static uns32	rtt[REQUESTS];
+
+int answer(void *ctx, const uns8 *request, int requestLength) {
+	return ((CoapRouter*)ctx)->reply(request, CODE_CONTENT, 0, (const uns8*)"21.5", 4);
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+void* serve(void *arg) {
+	bench_server *s = (bench_server*)arg;
+	CoapPosixTransport transport;
+	CoapProtocol protocol;
+	CoapRouter router;
+	CoapEventLoop loop;
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.localPort = BENCH_PORT;
+	if (!protocol.begin(&transport, config) || !router.begin(&protocol, 4) || !loop.begin() || !loop.add(&protocol)) {
+		__atomic_store_n(&s->ready, -1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	protocol.setHandlers(ignore, ignore, ignore, ignore);
+	router.addRoute("sensors/temp", COAP_GET, answer, &router);
+	s->loop = &loop;
+	__atomic_store_n(&s->ready, 1, __ATOMIC_RELEASE);
+	
+	if (s->mode == MODE_EVENTS) {
+		loop.run();
+		return NULL;
+	}
+	while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+		protocol.process_rx_queue();
+		protocol.process_tx_queue();
+		if (s->mode == MODE_SLEEP)
+			usleep(1000);
+	}
+	return NULL;
+}
+
+/*	CPU time of THREAD so far, in ms	*/
+double cpuMs(pthread_t thread) {
+	clockid_t clock;
+	struct timespec ts;
+	pthread_getcpuclockid(thread, &clock);
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int compare(const void *a, const void *b) {
+	uns32 x = *(const uns32*)a;
+	uns32 y = *(const uns32*)b;
+	return (x > y) - (x < y);
+}
+
+int measure(int mode) {
+	bench_server s;
+	pthread_t thread;
+	s.mode = mode;
+	s.stop = 0;
+	s.ready = 0;
+	s.loop = NULL;
+	pthread_create(&thread, NULL, serve, &s);
+	while (__atomic_load_n(&s.ready, __ATOMIC_ACQUIRE) == 0)
+		usleep(1000);
+	if (s.ready < 0) {
+		coap_printf("could not start a server on port %d\n", BENCH_PORT);
+		pthread_join(thread, NULL);
+		return 0;
+	}
+	
+	//Idle
+	double cpu = cpuMs(thread);
+	usleep(IDLE_MS * 1000);
+	double idle = (cpuMs(thread) - cpu) * 100.0 / IDLE_MS;
+	
+	//One request at a time
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in server;
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server.sin_port = htons(BENCH_PORT);
+	connect(sock, (struct sockaddr*)&server, sizeof(server));
+	
+	CoapPacket pkt;
+	CoapPacketTemplate request;
+	pkt.addHeader(TYPE_CON, COAP_GET, 0);
+	pkt.addUriPath("sensors/temp");
+	request.begin(pkt);
+	
+	uns8 buf[MAX_SIZE];
+	int answered = 0;
+	for (uns16 id = 0; id < REQUESTS; id++) {
+		uns16 len = request.stamp(buf, sizeof(buf), id, (uns8*)&id, 2, NULL, 0);
+		uns32 start = micros();
+		send(sock, buf, len, 0);
+		
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		rtt[answered] = 0;
+		while (poll(&pfd, 1, 100) > 0) {
+			if ((recv(sock, buf, sizeof(buf), 0) >= 4) && (((buf[2] << 8) | buf[3]) == id)) {
+				rtt[answered++] = micros() - start;
+				break;
+			}
+		}
+		usleep(GAP_US);
+	}
+	close(sock);
+	
+	__atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+	if (mode == MODE_EVENTS)
+		s.loop->stop();
+	pthread_join(thread, NULL);
+	
+	qsort(rtt, answered, sizeof(rtt[0]), compare);
+	coap_printf("%-20s  %7.1f%%  %8u us  %8u us  %d/%d\n", modeNames[mode], idle,
+		answered ? rtt[answered / 2] : 0, answered ? rtt[(answered * 99) / 100] : 0, answered, REQUESTS);
+	return 1;
+}
+
+int main() {
+	coap_printf("%-20s  %8s  %11s  %11s  %s\n", "server", "idle CPU", "median RTT", "p99 RTT", "answered");
+	for (int mode = MODE_BUSY; mode <= MODE_EVENTS; mode++) {
+		if (!measure(mode))
+			return 1;
+	}
+	return 0;
+}
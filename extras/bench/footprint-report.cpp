@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP memory footprint report, Linux host
+// Written originally by Embedded Adventures
+
+//Prints the RAM a CoapProtocol takes with a few coap_configs, from a small
+//node to a gateway. Then what the rx and tx queues cost for a few queue
+//sizes, with every slot holding a packet of a given size: the slot tables,
+//the pool blocks the packets are in, and what the same queues cost when
+//each slot carried a MAX_SIZE buffer inline. Then the full report for the
+//default configuration; the pool keeps the slabs the runs before it took.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol footprint-report.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o footprint-report
+//
+//Add the coap-config.h settings to compare builds, for instance
+//-DCOAP_WITH_DEDUP=0 -DCOAP_WITH_OBSERVE=0 -DCOAP_WITH_BLOCKWISE=0, and
+//-Os -ffunction-sections -Wl,--gc-sections to see the code size with size.
+
+#include "coap-protocol.h"
+#include "coap-pool.h"
+
+//Hands out NON GETs of LENGTH bytes, each with a new message ID, and sends
+//nothing anywhere, so both queues can be filled up
+class FillTransport : public CoapTransport {
+public:
+	int		length;
+	uns16	id;
+	
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if (length > maxLen)
+			return 0;
+		memset(buf, 0, length);
+		buf[0] = (COAP_VERSION << 6) | (TYPE_NON << 4);
+		buf[1] = COAP_GET;
+		buf[2] = id >> 8;
+		buf[3] = id & 0xFF;
+		if (length > 4)
+			buf[4] = PAYLOAD_MARK;
+		id++;
+		coap_endpoint_parse("127.0.0.1", COAP_DEFAULT_PORT, from);
+		return length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		return len;
+	}
+};
+
+uns32 dedupBytes(CoapProtocol &coap) {
+#if COAP_WITH_DEDUP
+	return coap.getDedupCache()->getMemoryUsage();
+#else
+	return 0;
+#endif
+}
+
+/*	Prints the RAM one CoapProtocol takes with SETTINGS, with empty queues	*/
+void reportConfig(const char *name, const coap_config &settings) {
+	static FillTransport transport;
+	CoapProtocol coap;
+	if (!coap.begin(&transport, settings)) {
+		coap_printf("%-8s out of memory\n", name);
+		return;
+	}
+	coap_printf("%-8s %6d %6d %8lu %8u %10lu %10lu\n", name, settings.queueSize, settings.maxPeers,
+				(unsigned long)dedupBytes(coap), (unsigned)sizeof(CoapProtocol),
+				(unsigned long)(coap.getMemoryUsage() - coapBufferPool.getMemoryUsage()),
+				(unsigned long)(sizeof(CoapProtocol) + coap.getMemoryUsage() - coapBufferPool.getMemoryUsage()));
+}
+
+/*	Fills both queues of a QUEUESIZE protocol with packets of PACKETSIZE
+	bytes and prints what they take	*/
+void report(int queueSize, int packetSize) {
+	static FillTransport transport;
+	static uns8 packet[MAX_SIZE];
+	CoapProtocol coap;
+	if (!coap.begin(&transport, queueSize)) {
+		coap_printf("%5d %6d   out of memory\n", queueSize, packetSize);
+		return;
+	}
+	
+	coap_endpoint to;
+	coap_endpoint_parse("127.0.0.1", COAP_DEFAULT_PORT, &to);
+	transport.length = packetSize;
+	coap.receivePackets();
+	memset(packet, 0, packetSize);
+	packet[0] = (COAP_VERSION << 6) | (TYPE_NON << 4);
+	packet[1] = COAP_GET;
+	packet[4] = PAYLOAD_MARK;
+	for (int i = 0; i < queueSize; i++) {
+		coap.addToTX(to, packet, packetSize);
+	}
+	
+	//The queues themselves, without the dedup cache and peer table
+	uns32 queues = coap.getMemoryUsage() - coapBufferPool.getMemoryUsage() - dedupBytes(coap) -
+					coap.getPeers()->getMemoryUsage();
+	uns32 packets = coapBufferPool.bytesInUse();
+	uns32 inlined = queues + 2 * queueSize * (MAX_SIZE - sizeof(uns8*) - sizeof(uns16));
+	coap_printf("%5d %6d %10lu %10lu %10lu %10lu\n", queueSize, packetSize, (unsigned long)queues,
+				(unsigned long)packets, (unsigned long)(queues + packets), (unsigned long)inlined);
+}
+
+int main() {
+	static const int queueSizes[] = {4, 16, 64, 256};
+	static const int packetSizes[] = {24, 100, 500, MAX_SIZE};
+	
+	coap_config node = COAP_CONFIG_DEFAULT;
+	node.queueSize = 2;
+	node.maxPeers = 2;
+	node.dedupBudget = 1024;
+	coap_config gateway = COAP_CONFIG_DEFAULT;
+	gateway.queueSize = 4096;
+	gateway.maxPeers = 16384;
+	gateway.dedupBudget = 4UL * 1024 * 1024;
+	coap_config defaults = COAP_CONFIG_DEFAULT;
+	
+	coap_printf("config    queue  peers    dedup   object       heap      total (bytes, empty queues)\n");
+	reportConfig("node", node);
+	reportConfig("default", defaults);
+	reportConfig("gateway", gateway);
+	coap_printf("\n");
+	
+	coap_printf("queue packet     queues    packets     pooled     inline (bytes)\n");
+	for (unsigned q = 0; q < sizeof(queueSizes) / sizeof(int); q++) {
+		for (unsigned p = 0; p < sizeof(packetSizes) / sizeof(int); p++) {
+			report(queueSizes[q], packetSizes[p]);
+		}
+	}
+	
+	coap_printf("\nMAX_QUEUE_SIZE, 100 byte packets, after the runs above:\n");
+	CoapProtocol coap;
+	FillTransport transport;
+	transport.length = 100;
+	transport.id = 0;
+	coap.begin(&transport, MAX_QUEUE_SIZE);
+	coap.receivePackets();
+	coap.printMemoryReport();
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP telemetry ingest benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Feeds NON POSTs with a READING_BYTES payload, WINDOW at a time, to a
+//server whose handler finds the Uri-Path and adds up the payload, three
+//ways, and prints packets per second (the best of ROUNDS runs) and packet
+//bytes the handler copied per packet:
+//	copyPacket()		the packetReturn_callback way, the packet copied into the
+//						handler's own CoapPacket and decoded again
+//	view				a packetView_callback, reading the packet where it is
+//	view, retained		the same, but each window is retained and only read
+//						and released once process_rx_queue() has returned
+//Every packet is marked processed from the handler, so it leaves the rx
+//queue straight away (or, retained, once it is released)
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol ingest-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o ingest-bench
+
+#include "coap-protocol.h"
+#include <stdio.h>
+#include <string.h>
+
+#define		WINDOW				32			//Packets received per process_rx_queue()
+#define		PACKETS				500000UL
+#define		ROUNDS				3
+#define		READING_BYTES		256
+#define		DATAGRAM_BYTES		320
+
+#define		FLOW_COPY			0
+#define		FLOW_VIEW			1
+#define		FLOW_RETAIN			2
+#define		FLOWS				3
+
+static const char *flowNames[FLOWS] = {"copyPacket()", "view", "view, retained"};
+
+/*	Hands out the same datagram, with a new message ID each time, COUNT
+	times	*/
+class IngestTransport : public CoapTransport {
+public:
+	uns8			datagram[DATAGRAM_BYTES];
+	int				length;
+	uns16			nextId;
+	uns32			count;
+	coap_endpoint	sensor;
+	
+	IngestTransport() {
+		length = 0;
+		nextId = 0;
+		count = 0;
+		sensor.addr = 0x0A000002UL;
+		sensor.port = 5683;
+	}
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if ((count == 0) || (length > maxLen))
+			return 0;
+		count--;
+		memcpy(buf, datagram, length);
+		buf[2] = nextId >> 8;
+		buf[3] = nextId & 0xFF;
+		nextId++;
+		*from = sensor;
+		return length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		return len;
+	}
+};
+
+static IngestTransport		transport;
+static CoapProtocol			server;
+static int					flow;
+static uns32				handled;
+static uns32				copied;			//Packet bytes the handler copied
+static uns32				checksum;
+static coap_packet_view		retained[WINDOW];
+static int					numRetained;
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+/*	What every flow does with a reading	*/
+void ingest(CoapPacket &pkt, const uns8 *payload, uns16 length) {
+	int opt = pkt.findOption(OPT_URI_PATH);
+	if (opt >= 0)
+		checksum += pkt.getOptionLength(opt);
+	for (uns16 i = 0; i < length; i++) {
+		checksum += payload[i];
+	}
+	handled++;
+}
+
+void ingest_copy(uns8 *pkt, int pktLen) {
+	static CoapPacket reading;
+	reading.copyPacket(pkt, pktLen);
+	reading.parsePacket();
+	ingest(reading, reading.getPayloadPtr(), reading.getPayloadLength());
+	copied += pktLen;
+	server.packetProcessed(transport.sensor, reading.getID());
+}
+
+void ingest_view(void *ctx, const coap_packet_view *view) {
+	if ((flow == FLOW_RETAIN) && (server.retainPacket(view) > 0))
+		retained[numRetained++] = *view;
+	else
+		ingest(*view->packet, view->payload, view->payloadLength);
+	server.packetProcessed(view->peer, view->id);
+}
+
+/*	Times PACKETS readings ingested the FLOW way	*/
+int bench_flow(double *packetsPerSecond, double *bytes) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = 2 * WINDOW;
+	config.localPort = 0;
+	config.dedupBudget = 0;
+	if (!server.begin(&transport, config))
+		return 0;
+	server.setHandlers((flow == FLOW_COPY) ? ingest_copy : ignore, ignore, ignore, ignore);
+	server.setViewHandler(COAP_EVENT_AVAILABLE, (flow == FLOW_COPY) ? NULL : ingest_view, NULL);
+	
+	handled = 0;
+	copied = 0;
+	uns32 start = micros();
+	while (handled < PACKETS) {
+		transport.count = WINDOW;
+		numRetained = 0;
+		server.process_rx_queue();
+		for (int i = 0; i < numRetained; i++) {
+			coap_packet_view &view = retained[i];
+			ingest(*view.packet, view.payload, view.payloadLength);
+			server.releasePacket(&view);
+		}
+	}
+	uns32 elapsed = micros() - start;
+	*packetsPerSecond = handled * 1e6 / elapsed;
+	*bytes = (double)copied / handled;
+	return 1;
+}
+
+int main() {
+	static CoapPacket reading;
+	uns8 payload[READING_BYTES];
+	for (int i = 0; i < READING_BYTES; i++) {
+		payload[i] = i;
+	}
+	reading.addHeader(TYPE_NON, COAP_POST, 0);
+	reading.addUriPath("telemetry/batch");
+	reading.addPayload(READING_BYTES, payload);
+	memcpy(transport.datagram, reading.packetPtr(), reading.size());
+	transport.length = reading.size();
+	
+	coap_printf("%lu NON POSTs of %d bytes, %d per pass\n\n", (unsigned long)PACKETS, transport.length, WINDOW);
+	coap_printf("%-16s %12s %13s\n", "handler", "packets/s", "bytes copied");
+	//Runs get faster as the host warms up, so the first round is thrown
+	//away and the handlers take turns in every round, rather than one
+	//handler's runs all going first
+	double rates[FLOWS] = {0};
+	double bytes[FLOWS];
+	for (int r = 0; r <= ROUNDS; r++) {
+		for (flow = 0; flow < FLOWS; flow++) {
+			double rate;
+			if (!bench_flow(&rate, &bytes[flow]))
+				return 1;
+			if ((r > 0) && (rate > rates[flow]))
+				rates[flow] = rate;
+		}
+	}
+	for (flow = 0; flow < FLOWS; flow++) {
+		coap_printf("%-16s %12.0f %13.1f\n", flowNames[flow], rates[flow], bytes[flow]);
+	}
+	return 0;
+}
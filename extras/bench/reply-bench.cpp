@@ -0,0 +1,235 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP piggybacked response benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Answers CON GETs, WINDOW at a time, with a RESPONSE_BYTES payload from
+//availablePacketHandler() three ways and prints requests per second (the
+//best of ROUNDS runs), datagrams the server sent and packet bytes the
+//handler copied per request, and how many responses were already sent by
+//the time process_rx_queue() returned rather than on the next
+//process_tx_queue():
+//	copy and replyTo()		the request copied into the handler's own CoapPacket,
+//							the response built in another and copied into the tx queue
+//	reserveTX()/commitTX()	the response built in place, sent by process_tx_queue()
+//	startReply()/sendReply()	the response built in place and sent straight away
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol reply-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o reply-bench
+
+#include "coap-protocol.h"
+#include <stdio.h>
+#include <string.h>
+
+#define		WINDOW				32			//Requests outstanding at once
+#define		EXCHANGES			200000UL
+#define		ROUNDS				3
+#define		RESPONSE_BYTES		64
+#define		DATAGRAM_BYTES		160
+#define		RING_SIZE			256
+
+#define		FLOW_COPY			0
+#define		FLOW_IN_PLACE		1
+#define		FLOW_REPLY			2
+#define		FLOWS				3
+
+static const char *flowNames[FLOWS] = {"copy and replyTo()", "reserveTX()/commitTX()", "startReply()/sendReply()"};
+
+typedef struct {
+	uns8			data[DATAGRAM_BYTES];
+	int				length;
+	coap_endpoint	from;
+}	bench_datagram;
+
+/*	Datagrams sent to a BenchTransport are queued for its peer, in a fixed
+	ring so the transport never allocates	*/
+class BenchTransport : public CoapTransport {
+public:
+	BenchTransport	*peer;
+	coap_endpoint	self;
+	bench_datagram	ring[RING_SIZE];
+	uns32			head;
+	uns32			tail;
+	uns32			sent;
+	
+	BenchTransport(uns16 port) {
+		peer = NULL;
+		self.addr = 0x7F000001UL;
+		self.port = port;
+		head = 0;
+		tail = 0;
+		sent = 0;
+	}
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int inject(const uns8 *buf, int len, const coap_endpoint &from) {
+		if ((head - tail == RING_SIZE) || (len > DATAGRAM_BYTES))
+			return -1;
+		bench_datagram &d = ring[head++ % RING_SIZE];
+		memcpy(d.data, buf, len);
+		d.length = len;
+		d.from = from;
+		return len;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if (head == tail)
+			return 0;
+		bench_datagram &d = ring[tail++ % RING_SIZE];
+		memcpy(buf, d.data, d.length);
+		*from = d.from;
+		return d.length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		if (peer->inject(buf, len, self) < 0)
+			return -1;
+		sent++;
+		return len;
+	}
+};
+
+static BenchTransport	serverTransport(1000);
+static BenchTransport	clientTransport(1001);
+static CoapProtocol		server;
+static CoapProtocol		client;
+static int				flow;
+static uns32			acked;
+static uns32			copied;			//Packet bytes the handler copied
+static uns8				payload[RESPONSE_BYTES];
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+void count_ack(uns8 *pkt, int pktLen) {
+	acked++;
+}
+
+/*	The server's handler: a piggybacked 2.05 with a short payload	*/
+void answer(uns8 *pkt, int pktLen) {
+	static CoapPacket req;
+	static CoapPacket rsp;
+	
+	if (flow == FLOW_COPY) {
+		req.copyPacket(pkt, pktLen);
+		req.parsePacket();
+		rsp.begin();
+		rsp.addHeader(TYPE_ACK, CODE_CONTENT, req.getID());
+		rsp.addTokens(req.getTokenLength(), req.getTokenPtr());
+		rsp.addPayload(RESPONSE_BYTES, payload);
+		server.replyTo(pkt, rsp.packetPtr(), rsp.size());
+		server.packetProcessed(req.getID());
+		copied += pktLen + rsp.size();
+	}
+	else if (flow == FLOW_IN_PLACE) {
+		int rx = server.getRxIndex(pkt);
+		CoapPacket &request = server.getCoapPacket(RX, rx);
+		coap_endpoint peer = server.getPeer(RX, rx);
+		int x = server.reserveTX(peer);
+		if (x >= 0) {
+			server.addHeader(x, TYPE_ACK, CODE_CONTENT, request.getID());
+			server.addTokens(x, request.getTokenLength(), request.getTokenPtr());
+			server.addPayload(x, RESPONSE_BYTES, payload);
+			server.commitTX(x);
+		}
+		server.packetProcessed(peer, request.getID());
+	}
+	else {
+		int x = server.startReply(pkt, CODE_CONTENT);
+		if (x >= 0) {
+			server.getCoapPacket(TX, x).addPayload(RESPONSE_BYTES, payload);
+			server.sendReply(pkt, x);
+		}
+	}
+}
+
+/*	Times EXCHANGES requests answered the FLOW way	*/
+int bench_flow(double *requestsPerSecond, double *datagrams, double *bytes, double *early) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = 2 * WINDOW;
+	config.localPort = 0;
+	if (!server.begin(&serverTransport, config) || !client.begin(&clientTransport, config))
+		return 0;
+	server.setHandlers(answer, ignore, ignore, ignore);
+	client.setHandlers(ignore, count_ack, ignore, ignore);
+	clientTransport.peer = &serverTransport;
+	serverTransport.peer = &clientTransport;
+	serverTransport.sent = 0;
+	
+	static CoapPacket pkt;
+	uns8 token[4] = {0xC0, 0xFF, 0xEE, 0x00};
+	uns32 requested = 0;
+	uns32 sentEarly = 0;
+	acked = 0;
+	copied = 0;
+	uns32 start = micros();
+	while (acked < EXCHANGES) {
+		while ((requested - acked < WINDOW) && (requested < EXCHANGES)) {
+			pkt.begin();
+			pkt.addHeader(TYPE_CON, COAP_GET, client.nextMessageId(serverTransport.self));
+			token[3] = requested;
+			pkt.addTokens(sizeof(token), token);
+			pkt.addUriPath("sensors/temp");
+			if (client.addToTX(serverTransport.self, pkt.packetPtr(), pkt.size()) < 0)
+				break;
+			requested++;
+		}
+		client.process_tx_queue();
+		uns32 sent = serverTransport.sent;
+		server.process_rx_queue();
+		sentEarly += serverTransport.sent - sent;
+		server.process_tx_queue();
+		client.process_rx_queue();
+	}
+	uns32 elapsed = micros() - start;
+	*requestsPerSecond = EXCHANGES * 1e6 / elapsed;
+	*datagrams = (double)serverTransport.sent / EXCHANGES;
+	*bytes = (double)copied / EXCHANGES;
+	*early = sentEarly * 100.0 / serverTransport.sent;
+	return 1;
+}
+
+int main() {
+	memset(payload, 'x', sizeof(payload));
+	coap_printf("%lu CON GETs, %d outstanding\n\n", (unsigned long)EXCHANGES, WINDOW);
+	coap_printf("%-26s %12s %10s %13s %11s\n", "handler", "requests/s", "datagrams", "bytes copied", "sent early");
+	for (flow = 0; flow < FLOWS; flow++) {
+		double rate = 0;
+		double datagrams, bytes, early;
+		for (int r = 0; r < ROUNDS; r++) {
+			double roundRate;
+			if (!bench_flow(&roundRate, &datagrams, &bytes, &early))
+				return 1;
+			if (roundRate > rate)
+				rate = roundRate;
+		}
+		coap_printf("%-26s %12.0f %10.2f %13.1f %10.0f%%\n", flowNames[flow], rate, datagrams, bytes, early);
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP resource router benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Registers 1000 resources and times matching requests to them with
+//CoapRouter, against the chain of matchUriPath() calls an application
+//would otherwise run in availablePacketHandler(), and then full dispatch
+//through CoapProtocol, 4.04s included, with an in-memory transport.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol router-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o router-bench
+
+#include "coap-router.h"
+#include <stdio.h>
+
+#define		AREAS			10
+#define		DEVICES			50
+#define		RESOURCES		(AREAS * DEVICES * 2)
+#define		MATCH_ROUNDS	200
+#define		REQUESTS		200000UL
+
+//Hands out queued requests and counts what is sent back
+class MemoryTransport : public CoapTransport {
+public:
+	CoapPacket	*requests;
+	uns32		next;
+	uns32		last;
+	uns32		sent;
+	
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if (next == last)
+			return 0;
+		CoapPacket &req = requests[next % (RESOURCES + 1)];
+		//A peer per request, so message IDs never repeat within a peer
+		from->addr = 0x0A000000UL + next;
+		from->port = COAP_DEFAULT_PORT;
+		next++;
+		memcpy(buf, req.getPacket(), req.getPacketLength());
+		return req.getPacketLength();
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		sent++;
+		return len;
+	}
+};
+
+static char				paths[RESOURCES][32];
+static CoapPacket		requests[RESOURCES + 1];
+static MemoryTransport	transport;
+static CoapProtocol		server;
+static CoapRouter		router;
+static volatile uns32	matched;
+
+int answer(void *ctx, const uns8 *request, int requestLength) {
+	return router.reply(request, CODE_CONTENT, 0, (const uns8*)"21.5", 4);
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+int main() {
+	for (int a = 0; a < AREAS; a++) {
+		for (int d = 0; d < DEVICES; d++) {
+			int r = (a * DEVICES + d) * 2;
+			snprintf(paths[r], sizeof(paths[r]), "area%d/device%d/temperature", a, d);
+			snprintf(paths[r + 1], sizeof(paths[r + 1]), "area%d/device%d/humidity", a, d);
+		}
+	}
+	for (int r = 0; r <= RESOURCES; r++) {
+		requests[r].begin();
+		requests[r].addHeader(TYPE_CON, COAP_GET, 1);
+		requests[r].addUriPath((r < RESOURCES) ? paths[r] : "area0/device0/pressure");
+		requests[r].size();
+		requests[r].parsePacket();
+	}
+	
+	transport.requests = requests;
+	if (!server.begin(&transport, 64) || !router.begin(&server, 4 * RESOURCES)) {
+		coap_printf("out of memory\n");
+		return 1;
+	}
+	server.setHandlers(ignore, ignore, ignore, ignore);
+	for (int r = 0; r < RESOURCES; r++) {
+		router.addRoute(paths[r], COAP_GET, answer, NULL);
+	}
+	coap_printf("%d resources, %d trie nodes\n", RESOURCES, router.routes());
+	
+	//Trie lookups
+	uns32 start = micros();
+	for (int n = 0; n < MATCH_ROUNDS; n++) {
+		for (int r = 0; r < RESOURCES; r++) {
+			matched += router.match(requests[r]) >= 0;
+		}
+	}
+	double trie = (micros() - start) * 1000.0 / (MATCH_ROUNDS * RESOURCES);
+	
+	//What an application does without the router: compare every path in turn
+	start = micros();
+	for (int n = 0; n < MATCH_ROUNDS / 10; n++) {
+		for (int r = 0; r < RESOURCES; r++) {
+			for (int p = 0; p < RESOURCES; p++) {
+				if (requests[r].matchUriPath(paths[p])) {
+					matched++;
+					break;
+				}
+			}
+		}
+	}
+	double chain = (micros() - start) * 1000.0 / (MATCH_ROUNDS / 10 * RESOURCES);
+	coap_printf("match:    trie %8.1f ns/request   matchUriPath chain %8.1f ns/request\n", trie, chain);
+	
+	//Whole receive, dispatch and reply path, one in RESOURCES + 1 a 4.04
+	start = micros();
+	while (transport.next < REQUESTS) {
+		transport.last = transport.next + 32;
+		server.process_rx_queue();
+		server.process_tx_queue();
+	}
+	double us = micros() - start;
+	coap_printf("dispatch: %8.1f ns/request %10.0f requests/s (%lu replies, %lu 4.04)\n",
+		us * 1000.0 / REQUESTS, REQUESTS / (us / 1e6),
+		(unsigned long)transport.sent, (unsigned long)router.notFoundCount());
+	return 0;
+}
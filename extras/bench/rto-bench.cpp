@@ -0,0 +1,265 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP retransmission timeout benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Sends CON GETs, WINDOW at a time, to a second CoapProtocol over an
+//emulated link that delays and drops datagrams, once with the RFC 7252
+//timeouts and once with CoCoA's, for each of a few kinds of link. Prints
+//how many requests were answered per second and how long they took, so
+//the cost of waiting ACK_TIMEOUT on a link with a much shorter round trip
+//(and of guessing too short on a long one) can be seen. The link drops at
+//random but from the same seed every run.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol rto-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o rto-bench
+//	./rto-bench [requests per run]
+
+#include "coap-protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define		REQUESTS			400			//Per run, unless given on the command line
+#define		MAX_REQUESTS		100000
+#define		WINDOW				16			//Requests outstanding at once
+#define		DATAGRAM_BYTES		64
+#define		RING_SIZE			256
+
+//One kind of link. Each direction delays every datagram by DELAY plus up to
+//JITTER ms and drops LOSS percent of them
+typedef struct {
+	const char	*name;
+	uns32		delay;
+	uns32		jitter;
+	uns32		loss;
+}	link_profile;
+
+static const link_profile profiles[] = {
+	{"LAN, 1 ms",                1,   1,  0},
+	{"LAN, 1 ms, 5% loss",       1,   1,  5},
+	{"WAN, 25 ms, 10% loss",    25,  10, 10},
+	{"satellite, 300 ms, 2% loss", 300, 50,  2},
+};
+
+#define		PROFILES	(sizeof(profiles) / sizeof(profiles[0]))
+
+static const char *modeNames[2] = {"RFC 7252", "CoCoA"};
+
+typedef struct {
+	uns8			data[DATAGRAM_BYTES];
+	int				length;
+	coap_endpoint	from;
+	uns32			deliverAt;
+}	link_datagram;
+
+static const link_profile	*profile;
+
+/*	Same draws every run, whatever the platform's rand() does	*/
+static uns32 lcg;
+uns32 next_random() {
+	lcg = lcg * 1103515245UL + 12345UL;
+	return (lcg >> 16) & 0x7FFF;
+}
+
+/*	Datagrams sent to a LinkTransport's peer are dropped or queued for it
+	until the link's delay has passed. They arrive in the order sent	*/
+class LinkTransport : public CoapTransport {
+public:
+	LinkTransport	*peer;
+	coap_endpoint	self;
+	link_datagram	ring[RING_SIZE];
+	uns32			head;
+	uns32			tail;
+	uns32			sent;
+	
+	LinkTransport(uns16 port) {
+		peer = NULL;
+		self.addr = 0x7F000001UL;
+		self.port = port;
+		reset();
+	}
+	void reset() {
+		head = 0;
+		tail = 0;
+		sent = 0;
+	}
+	int begin(uns16 localPort) {
+		return 1;
+	}
+	int deliver(const uns8 *buf, int len, const coap_endpoint &from) {
+		if ((head - tail == RING_SIZE) || (len > DATAGRAM_BYTES))
+			return -1;
+		uns32 at = millis() + profile->delay + (profile->jitter > 0 ? next_random() % (profile->jitter + 1) : 0);
+		if ((head != tail) && ((int32_t)(at - ring[(head - 1) % RING_SIZE].deliverAt) < 0))
+			at = ring[(head - 1) % RING_SIZE].deliverAt;
+		link_datagram &d = ring[head++ % RING_SIZE];
+		memcpy(d.data, buf, len);
+		d.length = len;
+		d.from = from;
+		d.deliverAt = at;
+		return len;
+	}
+	int receive(uns8 *buf, int maxLen, coap_endpoint *from) {
+		if ((head == tail) || ((int32_t)(millis() - ring[tail % RING_SIZE].deliverAt) < 0))
+			return 0;
+		link_datagram &d = ring[tail++ % RING_SIZE];
+		memcpy(buf, d.data, d.length);
+		*from = d.from;
+		return d.length;
+	}
+	int send(const uns8 *buf, int len, const coap_endpoint &to) {
+		sent++;
+		if ((next_random() % 100) < profile->loss)
+			return len;
+		if (peer->deliver(buf, len, self) < 0)
+			return -1;
+		return len;
+	}
+};
+
+static LinkTransport	serverTransport(1000);
+static LinkTransport	clientTransport(1001);
+static CoapProtocol		server;
+static CoapProtocol		client;
+static uns32			startedAt[65536];	//By message ID
+static uns32			latency[MAX_REQUESTS];
+static uns32			answered;
+static uns32			failed;
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+void answered_request(uns8 *pkt, int pktLen) {
+	uns16 id = (pkt[2] << 8) | pkt[3];
+	latency[answered++] = millis() - startedAt[id];
+}
+
+void failed_request(uns8 *pkt, int pktLen) {
+	failed++;
+}
+
+/*	The server answers every request with a piggybacked 2.05, built in place	*/
+void answer(uns8 *pkt, int pktLen) {
+	int rx = server.getRxIndex(pkt);
+	if (rx < 0)
+		return;
+	CoapPacket &req = server.getCoapPacket(RX, rx);
+	coap_endpoint peer = server.getPeer(RX, rx);
+	int x = server.reserveTX(peer);
+	if (x >= 0) {
+		server.addHeader(x, TYPE_ACK, CODE_CONTENT, req.getID());
+		server.addTokens(x, req.getTokenLength(), req.getTokenPtr());
+		server.addPayload(x, 4, (const uns8*)"21.5");
+		server.commitTX(x);
+	}
+	server.packetProcessed(peer, req.getID());
+}
+
+int compare_uns32(const void *a, const void *b) {
+	uns32 x = *(const uns32*)a;
+	uns32 y = *(const uns32*)b;
+	return (x > y) - (x < y);
+}
+
+/*	Runs REQUESTS requests over the link in PROFILE with retransmission
+	timeouts worked out the MODE way, and prints a line of results	*/
+int run(const link_profile &link, uns8 mode, uns32 requests) {
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.queueSize = 2 * WINDOW;
+	config.localPort = 0;
+	config.rtoMode = mode;
+	if (!server.begin(&serverTransport, config) || !client.begin(&clientTransport, config))
+		return 0;
+	server.setHandlers(answer, ignore, ignore, ignore);
+	client.setHandlers(ignore, answered_request, failed_request, ignore);
+	clientTransport.peer = &serverTransport;
+	serverTransport.peer = &clientTransport;
+	clientTransport.reset();
+	serverTransport.reset();
+	profile = &link;
+	lcg = 12345;
+	answered = 0;
+	failed = 0;
+	
+	static CoapPacket pkt;
+	uns8 token[2] = {0x7E, 0x57};
+	uns32 issued = 0;
+	uns32 start = millis();
+	while (answered + failed < requests) {
+		while ((issued - answered - failed < WINDOW) && (issued < requests)) {
+			uns16 id = client.nextMessageId(serverTransport.self);
+			pkt.begin();
+			pkt.addHeader(TYPE_CON, COAP_GET, id);
+			pkt.addTokens(sizeof(token), token);
+			pkt.addUriPath("temp");
+			if (client.addToTX(serverTransport.self, pkt.packetPtr(), pkt.size()) < 0)
+				break;
+			startedAt[id] = millis();
+			issued++;
+		}
+		client.process_tx_queue();
+		server.process_rx_queue();
+		server.process_tx_queue();
+		client.process_rx_queue();
+		usleep(200);
+	}
+	uns32 elapsed = millis() - start;
+	
+	qsort(latency, answered, sizeof(latency[0]), compare_uns32);
+	uns32 p50 = (answered > 0) ? latency[answered / 2] : 0;
+	uns32 p99 = (answered > 0) ? latency[(answered * 99) / 100] : 0;
+	uns32 worst = (answered > 0) ? latency[answered - 1] : 0;
+	coap_printf("%-28s %-9s %6lu %6lu %6lu %9.1f %7lu %7lu %7lu\n", link.name, modeNames[mode],
+				(unsigned long)answered, (unsigned long)failed, (unsigned long)(clientTransport.sent - issued),
+				answered * 1000.0 / (elapsed > 0 ? elapsed : 1),
+				(unsigned long)p50, (unsigned long)p99, (unsigned long)worst);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	uns32 requests = REQUESTS;
+	if (argc > 1)
+		requests = atol(argv[1]);
+	if ((requests == 0) || (requests > MAX_REQUESTS)) {
+		coap_printf("usage: %s [requests per run, up to %d]\n", argv[0], MAX_REQUESTS);
+		return 1;
+	}
+	
+	coap_printf("%lu CON GETs per run, %d outstanding, ACK_TIMEOUT %d s\n\n", (unsigned long)requests, WINDOW, ACK_TIMEOUT);
+	coap_printf("%-28s %-9s %6s %6s %6s %9s %7s %7s %7s\n", "link", "timeouts", "done", "failed", "retx",
+				"req/s", "p50 ms", "p99 ms", "max ms");
+	for (unsigned p = 0; p < PROFILES; p++) {
+		if (!run(profiles[p], COAP_RTO_RFC7252, requests) || !run(profiles[p], COAP_RTO_COCOA, requests))
+			return 1;
+	}
+	return 0;
+}
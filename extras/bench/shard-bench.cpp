@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP sharded server scaling benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Runs a CoapShardedServer with 1 to N workers on a loopback port and
+//drives it with CON GETs from client threads, each keeping WINDOW requests
+//in flight on SOCKETS source ports, and prints the responses per second for
+//each worker count. N defaults to the cores online. Clients share the cores
+//with the workers, so on a small machine the curve flattens early.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol shard-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o shard-bench -lpthread
+//
+//and run it as shard-bench [workers [seconds]]
+
+#include "coap-shards.h"
+#include "coap-router.h"
+#include "coap-template.h"
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define		BENCH_PORT		56830
+#define		SOCKETS			8
+#define		WINDOW			8
+
+static CoapRouter		routers[COAP_MAX_SHARDS];
+static int				stopClients;
+
+int answer(void *ctx, const uns8 *request, int requestLength) {
+	return ((CoapRouter*)ctx)->reply(request, CODE_CONTENT, 0, (const uns8*)"21.5", 4);
+}
+
+void ignore(uns8 *pkt, int pktLen) {}
+
+/*	Runs on every worker: a router with one resource	*/
+int setupShard(void *ctx, CoapProtocol *protocol, int shard) {
+	CoapRouter &router = routers[shard];
+	protocol->setHandlers(ignore, ignore, ignore, ignore);
+	if (!router.begin(protocol, 4))
+		return 0;
+	return router.addRoute("sensors/temp", COAP_GET, answer, &router) >= 0;
+}
+
+typedef struct {
+	pthread_t	thread;
+	uns32		responses;
+}	bench_client;
+
+/*	Sends a new request for every response, and refills the windows when
+	nothing has come back for a while	*/
+void* runClient(void *arg) {
+	bench_client *c = (bench_client*)arg;
+	int socks[SOCKETS];
+	struct sockaddr_in server;
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server.sin_port = htons(BENCH_PORT);
+	
+	CoapPacket pkt;
+	CoapPacketTemplate request;
+	pkt.addHeader(TYPE_CON, COAP_GET, 0);
+	pkt.addUriPath("sensors/temp");
+	if (!request.begin(pkt))
+		return NULL;
+	
+	struct pollfd pfds[SOCKETS];
+	for (int s = 0; s < SOCKETS; s++) {
+		socks[s] = socket(AF_INET, SOCK_DGRAM, 0);
+		connect(socks[s], (struct sockaddr*)&server, sizeof(server));
+		pfds[s].fd = socks[s];
+		pfds[s].events = POLLIN;
+	}
+	
+	uns8 buf[MAX_SIZE];
+	uns16 id = 0;
+	bool refill = true;
+	while (!__atomic_load_n(&stopClients, __ATOMIC_RELAXED)) {
+		for (int s = 0; s < SOCKETS; s++) {
+			for (int w = 0; refill && (w < WINDOW); w++) {
+				uns16 len = request.stamp(buf, sizeof(buf), id, (uns8*)&id, 2, NULL, 0);
+				id++;
+				send(socks[s], buf, len, 0);
+			}
+		}
+		
+		int ready = poll(pfds, SOCKETS, 20);
+		refill = (ready == 0);
+		for (int s = 0; (ready > 0) && (s < SOCKETS); s++) {
+			if (!(pfds[s].revents & POLLIN))
+				continue;
+			while (recv(socks[s], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+				c->responses++;
+				uns16 len = request.stamp(buf, sizeof(buf), id, (uns8*)&id, 2, NULL, 0);
+				id++;
+				send(socks[s], buf, len, 0);
+			}
+		}
+	}
+	
+	for (int s = 0; s < SOCKETS; s++) {
+		close(socks[s]);
+	}
+	return NULL;
+}
+
+/*	Responses per second from a server with WORKERS shards	*/
+double measure(int workers, int clients, int seconds) {
+	CoapShardedServer server;
+	coap_config config = COAP_CONFIG_DEFAULT;
+	config.localPort = BENCH_PORT;
+	//Room for every request in flight, however the kernel spreads them
+	config.queueSize = clients * SOCKETS * WINDOW;
+	if (!server.begin(workers, config, setupShard, NULL)) {
+		coap_printf("could not start %d workers on port %d\n", workers, BENCH_PORT);
+		return -1;
+	}
+	
+	bench_client *c = new bench_client[clients];
+	__atomic_store_n(&stopClients, 0, __ATOMIC_RELAXED);
+	for (int i = 0; i < clients; i++) {
+		c[i].responses = 0;
+		pthread_create(&c[i].thread, NULL, runClient, &c[i]);
+	}
+	uns32 start = micros();
+	sleep(seconds);
+	__atomic_store_n(&stopClients, 1, __ATOMIC_RELAXED);
+	
+	uns32 responses = 0;
+	for (int i = 0; i < clients; i++) {
+		pthread_join(c[i].thread, NULL);
+		responses += c[i].responses;
+	}
+	double elapsed = (micros() - start) / 1e6;
+	delete[] c;
+	server.end();
+	return responses / elapsed;
+}
+
+int main(int argc, char **argv) {
+	int maxWorkers = (argc > 1) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = (argc > 2) ? atoi(argv[2]) : 2;
+	if (maxWorkers < 1)
+		maxWorkers = 1;
+	if (maxWorkers > COAP_MAX_SHARDS)
+		maxWorkers = COAP_MAX_SHARDS;
+	int clients = (maxWorkers < 2) ? 2 : maxWorkers;
+	
+	coap_printf("%d client threads, %d sockets each, %d requests in flight per socket\n",
+		clients, SOCKETS, WINDOW);
+	coap_printf("workers  responses/s  speedup\n");
+	double base = 0;
+	for (int w = 1; w <= maxWorkers; w++) {
+		double rate = measure(w, clients, seconds);
+		if (rate < 0)
+			return 1;
+		if (w == 1)
+			base = rate;
+		coap_printf("%7d  %11.0f  %6.2fx\n", w, rate, rate / base);
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP packet template benchmark, Linux host
+// Written originally by Embedded Adventures
+
+//Builds the same sensor report, a CON POST to sensors/temp with
+//Content-Format and Accept, a 4 byte token and an 8 byte payload, with
+//the CoapPacket builder and then with a CoapPacketTemplate, and prints the
+//time per packet. The packets are checked to be byte for byte the same.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol template-bench.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o template-bench
+
+#include "coap-template.h"
+
+#define		ROUNDS		2000000UL
+
+static uns8		token[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+static uns8		payload[8] = {'2', '1', '.', '5', ' ', 'd', 'e', 'g'};
+static uns32	sink;
+
+/*	The builder calls an application makes for every report	*/
+void build(CoapPacket &pkt, uns16 id) {
+	pkt.begin();
+	pkt.addHeader(TYPE_CON, COAP_POST, id);
+	pkt.addTokens(sizeof(token), token);
+	pkt.addUriPath("sensors/temp");
+	pkt.addUintOption(OPT_CONTENT_FORMAT, 0);
+	pkt.addUintOption(OPT_ACCEPT, 0);
+	pkt.addPayload(sizeof(payload), payload);
+}
+
+int main() {
+	static CoapPacket pkt;
+	static CoapPacketTemplate report;
+	static uns8 buf[MAX_SIZE];
+	
+	build(pkt, 0);
+	if (!report.begin(pkt)) {
+		coap_printf("out of memory\n");
+		return 1;
+	}
+	
+	//Same bytes either way
+	build(pkt, 0x1234);
+	uns16 len = report.stamp(buf, sizeof(buf), 0x1234, token, sizeof(token), payload, sizeof(payload));
+	if ((len != pkt.size()) || (memcmp(buf, pkt.packetPtr(), len) != 0)) {
+		coap_printf("template and builder packets differ\n");
+		return 1;
+	}
+	
+	uns32 start = micros();
+	for (uns32 i = 0; i < ROUNDS; i++) {
+		build(pkt, i);
+		sink += pkt.packetPtr()[3];
+	}
+	double builder = (micros() - start) * 1000.0 / ROUNDS;
+	
+	start = micros();
+	for (uns32 i = 0; i < ROUNDS; i++) {
+		report.stamp(pkt, i, token, sizeof(token), payload, sizeof(payload));
+		sink += pkt.packetPtr()[3];
+	}
+	double intoPacket = (micros() - start) * 1000.0 / ROUNDS;
+	
+	start = micros();
+	for (uns32 i = 0; i < ROUNDS; i++) {
+		report.stamp(buf, sizeof(buf), i, token, sizeof(token), payload, sizeof(payload));
+		sink += buf[3];
+	}
+	double intoBuffer = (micros() - start) * 1000.0 / ROUNDS;
+	
+	coap_printf("%u byte packet, %u bytes of it options\n", len, len - 4 - (unsigned)sizeof(token) - 1 - (unsigned)sizeof(payload));
+	coap_printf("builder:                %6.1f ns/packet\n", builder);
+	coap_printf("template into packet:   %6.1f ns/packet\n", intoPacket);
+	coap_printf("template into buffer:   %6.1f ns/packet\n", intoBuffer);
+	return (sink == 0xFFFFFFFF) ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2016, Embedded Adventures
+All rights reserved.
+Contact us at source [at] embeddedadventures.com
+www.embeddedadventures.com
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+- Redistributions of source code must retain the above copyright notice,
+  this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+- Neither the name of Embedded Adventures nor the names of its contributors
+  may be used to endorse or promote products derived from this software
+  without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// CoAP timer wheel test, Linux host
+// Written originally by Embedded Adventures
+
+//Checks that CoapTimerWheel::next() gives the earliest deadline and that
+//expire() hands every id out once it is due and not before, whatever
+//order the deadlines were scheduled in and however far out they are,
+//including ones scheduled before the first expire(). Time is stepped
+//forward from the millis() the wheel was started at. Prints the first
+//thing that goes wrong and exits with 1, or exits with 0.
+//Host only, not part of the Arduino library. Build from this folder with:
+//
+//	g++ -O2 -I../../coap-packet -I../../coap-protocol timer-test.cpp
+//		../../coap-packet/*.cpp ../../coap-protocol/*.cpp -o timer-test
+//	./timer-test
+
+#include "coap-timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define		IDS				2000		//The most ids a wheel is tested with
+#define		FEW_IDS			12			//Few enough for the smallest wheel
+#define		SPAN			300000UL	//Deadlines up to this many ms out
+#define		STEP			37			//ms the clock moves each round
+#define		BATCH			16
+
+static int failures = 0;
+
+static void fail(const char *what, uns32 got, uns32 want) {
+	printf("FAIL: %s: got %lu, expected %lu\n", what, (unsigned long)got, (unsigned long)want);
+	failures++;
+}
+
+/*	Earliest deadline scheduled, the slow way	*/
+static int earliest(CoapTimerWheel &wheel, int ids, uns32 *deadline) {
+	int found = 0;
+	for (int id = 0; id < ids; id++) {
+		if (wheel.isScheduled(id) && (!found || ((int32_t)(wheel.deadline(id) - *deadline) < 0))) {
+			*deadline = wheel.deadline(id);
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/*	A NON's lifetime scheduled before the first expire(), then an ACK
+	timeout after it. The ACK timeout is the one next() has to give	*/
+static void far_then_near() {
+	CoapTimerWheel wheel;
+	uns32 deadline = 0;
+	
+	wheel.begin(2);
+	uns32 now = millis();
+	wheel.schedule(0, now + 145000);
+	int expired[BATCH];
+	wheel.expire(now, expired, BATCH);
+	wheel.schedule(1, now + 7000);
+	if (!wheel.next(&deadline) || (deadline != now + 7000))
+		fail("far deadline scheduled before expire() hid a near one", deadline - now, 7000);
+}
+
+/*	Deadlines for IDS ids all over the wheels, some already due, some
+	scheduled before the first expire() and some moved or cancelled as the
+	clock goes on. Wheels for fewer ids have fewer buckets, so deadlines
+	the same distance out go round the outer wheel more times	*/
+static void random_deadlines(int ids) {
+	CoapTimerWheel wheel;
+	uns32 start = millis();
+	uns32 now = start;
+	int expired[BATCH];
+	
+	wheel.begin(ids);
+	srand(7);
+	for (int id = 0; id < ids / 2; id++) {
+		wheel.schedule(id, now - 100 + (uns32)(rand() % SPAN));
+	}
+	
+	while ((uns32)(now - start) < 2 * SPAN) {
+		//Reschedule, cancel or add a few
+		for (int k = 0; k < 4; k++) {
+			int id = rand() % ids;
+			if (rand() % 5 == 0)
+				wheel.cancel(id);
+			else
+				wheel.schedule(id, now + (uns32)(rand() % SPAN));
+		}
+		
+		uns32 want = 0, got = 0;
+		int wantFound = earliest(wheel, ids, &want);
+		int gotFound = wheel.next(&got);
+		if (gotFound != wantFound)
+			fail("next() found", gotFound, wantFound);
+		else if (wantFound && (got != want))
+			fail("next() deadline, ms after start", got - start, want - start);
+		
+		int n;
+		while ((n = wheel.expire(now, expired, BATCH)) > 0) {
+			for (int i = 0; i < n; i++) {
+				if ((int32_t)(wheel.deadline(expired[i]) - now) > 0)
+					fail("expired early, ms after start", now - start, wheel.deadline(expired[i]) - start);
+				if (wheel.isScheduled(expired[i]))
+					fail("still scheduled once expired, id", expired[i], expired[i]);
+			}
+		}
+		for (int id = 0; id < ids; id++) {
+			if (wheel.isScheduled(id) && ((int32_t)(wheel.deadline(id) - now) <= 0))
+				fail("due but not expired, ms after start", wheel.deadline(id) - start, now - start);
+		}
+		if (failures > 10)
+			return;
+		now += STEP;
+	}
+}
+
+int main() {
+	far_then_near();
+	random_deadlines(IDS);
+	random_deadlines(FEW_IDS);
+	if (failures > 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("timer wheel: ok\n");
+	return 0;
+}